@@ -0,0 +1,106 @@
+/*
+ * Host benchmarks
+ * Built by the [env:bench] PlatformIO environment (platform = native), run with
+ * `pio run -e bench -t exec`. Each suite prints one line per case; the run exits
+ * non-zero if any suite fails its tolerance. Timings passed to bench_record()
+ * can be written out and checked against a baseline, see bench_main.cpp.
+ */
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Cycle counter: TSC on x86, nanoseconds elsewhere
+static inline uint64_t bench_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Wall clock in nanoseconds
+static inline uint64_t bench_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Keeps the optimizer from discarding a result
+template <typename T>
+static inline void bench_keep(const T& value)
+{
+  __asm__ __volatile__("" : : "g"(&value) : "memory");
+}
+
+// Mean time per call over n_calls calls of f(i), and the slowest single call
+struct bench_timing {
+  double f_mean_ns;
+  double f_worst_ns;
+};
+
+template <typename F>
+static bench_timing bench_time(int32_t n_calls, F f)
+{
+  bench_timing s_timing = { 0.0, 0.0 };
+  uint64_t ul_start, ul_call, ul_overhead = ~0ull;
+  int32_t i;
+  for (i = 0; i < 64; i++) { // cost of reading the clock
+    ul_start = bench_ns();
+    ul_call = bench_ns() - ul_start;
+    ul_overhead = ul_call < ul_overhead ? ul_call : ul_overhead;
+  }
+  ul_start = bench_ns();
+  for (i = 0; i < n_calls; i++)
+    f(i);
+  s_timing.f_mean_ns = (double)(bench_ns() - ul_start) / n_calls;
+  for (i = 0; i < n_calls; i++) {
+    ul_start = bench_ns();
+    f(i);
+    ul_call = bench_ns() - ul_start;
+    ul_call = ul_call > ul_overhead ? ul_call - ul_overhead : 0;
+    if (ul_call > s_timing.f_worst_ns)
+      s_timing.f_worst_ns = (double)ul_call;
+  }
+  return s_timing;
+}
+
+// Adds one row to the machine readable results (--out, --baseline)
+void bench_record(const char* s_suite, const char* s_case, int32_t n_size, const bench_timing& s_timing);
+
+// Shared by the kernel suites, see bench_kernels.cpp
+void bench_ppg_window(uint32_t* pun_ir, uint32_t* pun_red, int32_t n_size, float f_fs, uint32_t un_seed);
+int32_t bench_recorded_windows(int32_t n_size, std::vector<uint32_t>& aun_ir, std::vector<uint32_t>& aun_red);
+void bench_kernel_report(const char* s_kernel, const char* s_source, int32_t n_size, const bench_timing& s_timing);
+bool bench_kernels_maxim();
+size_t bench_stack_peak(void (*f)(void*), void* p_context); // see bench_lowram.cpp
+
+// Suites return false if a result is outside its tolerance
+bool bench_autocorrelation();
+bool bench_fixed();
+bool bench_config();
+bool bench_channels();
+bool bench_driver();
+bool bench_kernels();
+bool bench_synth();
+bool bench_capture();
+bool bench_lowram();
+bool bench_peaks();
+bool bench_cascade();
+bool bench_agc();
+bool bench_temp();
+bool bench_telemetry();
+bool bench_ingest();
+bool bench_uplink();
+bool bench_profile();
+bool bench_duty();
+bool bench_batch();
+bool bench_spo2();
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,156 @@
+/*
+ * Closed-loop LED current and ADC range control (max30102_agc)
+ * The MAX30102 simulator with a synthetic finger: ppg_synth pulses whose light
+ * scales with the LED current and the finger's transmission, plus noise that
+ * does not (ambient light, dark current), so lowering the LED current costs
+ * SNR. Driver, RF stream and controller run as in main.cpp. Each finger runs
+ * with the fixed settings of maxim_max30102_init() and with the controller:
+ * valid estimates, HR error, windows touching full scale and the average LED
+ * current over the second half, where the controller has settled.
+ * - the controller must never touch full scale once settled, keep 80 % of
+ *   the estimates valid within 3 bpm, and use less LED current than the fixed
+ *   settings on the reference finger; without a finger it must park the LEDs
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <max30102.h>
+#include <max30102_agc.h>
+#include <max30102_sim.h>
+#include <ppg_synth.h>
+#include <math.h>
+#include <stdio.h>
+
+#define BENCH_AGC_SECONDS 600
+#define BENCH_AGC_NOISE_NA 0.5f // rms per conversion, independent of the LEDs
+
+struct bench_agc_finger {
+  ppg_synth_state s_synth;
+  float f_transmission; // light returned relative to the reference finger
+  uint32_t un_rng;
+  uint32_t un_red, un_ir;
+};
+
+static float bench_agc_gauss(bench_agc_finger* ps_finger)
+{
+  float f_sum = 0.0f;
+  for (int i = 0; i < 4; i++) {
+    ps_finger->un_rng ^= ps_finger->un_rng << 13;
+    ps_finger->un_rng ^= ps_finger->un_rng >> 17;
+    ps_finger->un_rng ^= ps_finger->un_rng << 5;
+    f_sum += (int32_t)ps_finger->un_rng * (1.0f / 2147483648.0f);
+  }
+  return 0.8660254f * f_sum;
+}
+
+// The generator's counts are what the reference finger gives at 4096 nA and 12 mA
+static float bench_agc_photocurrent(void* p_context, uint8_t uch_led, float f_led_ma, uint64_t ul_time_us)
+{
+  bench_agc_finger* ps_finger = (bench_agc_finger*)p_context;
+  (void)ul_time_us;
+  if (uch_led == MAX30102_SIM_LED_RED)
+    ppg_synth_next(&ps_finger->s_synth, &ps_finger->un_red, &ps_finger->un_ir);
+  return (uch_led == MAX30102_SIM_LED_RED ? ps_finger->un_red : ps_finger->un_ir) * (4096.0f / 262144.0f) * (f_led_ma / 12.0f)
+      * ps_finger->f_transmission + BENCH_AGC_NOISE_NA * bench_agc_gauss(ps_finger);
+}
+
+struct bench_agc_result {
+  int32_t n_estimates, n_valid, n_saturated, n_changes;
+  float f_hr_err, f_led_ua;
+};
+
+static bool bench_agc_run(float f_transmission, bool b_agc, bench_agc_result* ps_result)
+{
+  static bench_agc_finger s_finger;
+  static rf_stream_state s_stream;
+  ppg_synth_config s_cfg;
+  max30102_sim s_sim;
+  max30102_hal s_hal;
+  max30102_agc s_agc;
+  max30102_agc_config s_agc_cfg;
+  uint32_t aun_red[MAX30102_FIFO_DEPTH], aun_ir[MAX30102_FIFO_DEPTH], un_saturated = 0;
+  float f_spo2, f_ratio, f_correl;
+  double f_led_ua_sum = 0.0;
+  int32_t n_hr, n_updates = 0;
+  int8_t ch_spo2_valid, ch_hr_valid;
+  uint8_t uch_num, i;
+  bool b_changed, b_settled;
+
+  *ps_result = {};
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.f_fs = 100.0f; // conversion rate, the sensor averages 4
+  s_cfg.f_noise = 0.0f; // the finger adds its own
+  ppg_synth_init(&s_finger.s_synth, &s_cfg);
+  s_finger.f_transmission = f_transmission;
+  s_finger.un_rng = 0x12345678u;
+  max30102_sim_init(&s_sim, bench_agc_photocurrent, &s_finger);
+  max30102_sim_hal(&s_sim, &s_hal);
+  maxim_max30102_set_hal(&s_hal);
+  max30102_agc_default_config(&s_agc_cfg);
+  s_agc_cfg.f_min_correl = min_pearson_correlation;
+  s_agc_cfg.f_min_ratio = min_autocorrelation_ratio;
+  if (!maxim_max30102_init() || !max30102_agc_init(&s_agc, &s_agc_cfg))
+    return false;
+  rf_stream_init(&s_stream, FS);
+  while (s_sim.ul_now_us < (uint64_t)BENCH_AGC_SECONDS * 1000000) {
+    max30102_sim_advance_us(&s_sim, 1000);
+    if (!max30102_sim_int_asserted(&s_sim))
+      continue;
+    if (!maxim_max30102_read_fifo_burst(aun_red, aun_ir, MAX30102_FIFO_DEPTH, &uch_num))
+      return false;
+    b_settled = s_sim.ul_now_us >= (uint64_t)BENCH_AGC_SECONDS * 1000000 / 2;
+    for (i = 0; i < uch_num; i++) {
+      max30102_agc_sample(&s_agc, aun_red[i], aun_ir[i]);
+      if (aun_red[i] >= 262143 - 16 || aun_ir[i] >= 262143 - 16)
+        un_saturated++;
+      if (!rf_stream_push(&s_stream, aun_ir[i], aun_red[i], &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl))
+        continue;
+      if (b_settled) {
+        ps_result->n_estimates++;
+        if (ch_hr_valid) {
+          ps_result->n_valid++;
+          ps_result->f_hr_err += fabsf(n_hr - s_cfg.f_hr_bpm);
+        }
+        if (un_saturated != 0)
+          ps_result->n_saturated++;
+        f_led_ua_sum += max30102_agc_average_led_ua(&s_agc);
+        n_updates++;
+      }
+      un_saturated = 0;
+      if (!b_agc)
+        continue;
+      if (!max30102_agc_update(&s_agc, ch_hr_valid, f_ratio, f_correl, &b_changed))
+        return false;
+      if (b_changed) {
+        rf_stream_init(&s_stream, FS);
+        if (b_settled)
+          ps_result->n_changes++;
+      }
+    }
+  }
+  ps_result->f_hr_err = ps_result->n_valid ? ps_result->f_hr_err / ps_result->n_valid : 0.0f;
+  ps_result->f_led_ua = n_updates ? (float)(f_led_ua_sum / n_updates) : 0.0f;
+  printf("agc\t%-5s\tfinger %4.2f\tLED %5.1f/%5.1f mA, %5.0f nA, %3d us\tvalid %3d%% err %5.2f bpm\tfull scale %3d windows\t%4d changes\tLEDs %6.0f uA avg\n",
+      b_agc ? "agc" : "fixed", f_transmission, max30102_agc_led_ma(s_agc.uch_led_red), max30102_agc_led_ma(s_agc.uch_led_ir),
+      max30102_agc_range_na(&s_agc), max30102_agc_pulse_us(&s_agc), ps_result->n_estimates ? 100 * ps_result->n_valid / ps_result->n_estimates : 0,
+      ps_result->f_hr_err, (int)ps_result->n_saturated, (int)ps_result->n_changes, ps_result->f_led_ua);
+  return true;
+}
+
+bool bench_agc()
+{
+  static const float af_transmission[] = { 1.0f, 3.0f, 0.25f, 0.0f }; // reference, thin (saturates at 12 mA), thick, no finger
+  bench_agc_result s_fixed, s_agc;
+  bool b_pass = true;
+  for (float f_transmission : af_transmission) {
+    if (!bench_agc_run(f_transmission, false, &s_fixed) || !bench_agc_run(f_transmission, true, &s_agc))
+      return false;
+    if (f_transmission == 0.0f) { // LEDs parked below the fixed current
+      b_pass &= s_agc.f_led_ua < s_fixed.f_led_ua;
+      continue;
+    }
+    b_pass &= s_agc.n_saturated == 0 && s_agc.n_valid >= s_agc.n_estimates * 8 / 10 && s_agc.f_hr_err <= 3.0f;
+    if (f_transmission == 1.0f)
+      b_pass &= s_agc.f_led_ua < s_fixed.f_led_ua;
+  }
+  return b_pass;
+}
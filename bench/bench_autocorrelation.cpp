@@ -0,0 +1,81 @@
+/*
+ * Periodicity search: lag-by-lag walk vs. FFT all-lags autocorrelation
+ * Reports cycles per window for the part of rf_heart_rate_and_oxygen_saturation()
+ * that follows detrending, on clean, noisy and aperiodic IR windows.
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <math.h>
+#include <stdio.h>
+
+#define BENCH_WINDOWS 2000
+
+static uint32_t un_bench_seed = 12345;
+
+static float bench_noise() // uniform in [-1, 1)
+{
+  un_bench_seed = un_bench_seed * 1664525u + 1013904223u;
+  return (int32_t)un_bench_seed / 2147483648.0f;
+}
+
+static void bench_make_window(float* pn_x, float f_bpm, float f_noise, float f_signal)
+{
+  float f_mean = 0.0, f_beta;
+  int32_t k;
+  for (k = 0; k < BUFFER_SIZE; ++k) {
+    float t = (float)k / FS;
+    pn_x[k] = f_signal * (sinf(2 * M_PI * f_bpm / 60 * t) + 0.3f * sinf(4 * M_PI * f_bpm / 60 * t + 1.0f)) + f_noise * bench_noise();
+    f_mean += pn_x[k];
+  }
+  f_mean /= BUFFER_SIZE;
+  for (k = 0; k < BUFFER_SIZE; ++k)
+    pn_x[k] -= f_mean;
+  f_beta = rf_linear_regression_beta(pn_x, mean_X, sum_X2);
+  for (k = 0; k < BUFFER_SIZE; ++k)
+    pn_x[k] -= f_beta * (k - mean_X);
+}
+
+static bool bench_case(const char* s_name, float f_noise, float f_signal)
+{
+  static float aan_x[BENCH_WINDOWS][BUFFER_SIZE];
+  float an_aut[BUFFER_SIZE];
+  float af_sumsq[BENCH_WINDOWS], f_ratio;
+  int32_t i, n_walk, n_fft, n_agree = 0;
+  uint64_t ul_start, ul_walk = 0, ul_fft = 0;
+
+  for (i = 0; i < BENCH_WINDOWS; ++i) {
+    bench_make_window(aan_x[i], 50 + (i % 100), f_noise, f_signal);
+    rf_rms(aan_x[i], BUFFER_SIZE, &af_sumsq[i]);
+  }
+  for (i = 0; i < BENCH_WINDOWS; ++i) {
+    ul_start = bench_cycles();
+    n_walk = LOWEST_PERIOD;
+    rf_initialize_periodicity_search(aan_x[i], BUFFER_SIZE, &n_walk, HIGHEST_PERIOD, min_autocorrelation_ratio, af_sumsq[i]);
+    if (n_walk != 0)
+      rf_signal_periodicity(aan_x[i], BUFFER_SIZE, &n_walk, LOWEST_PERIOD, HIGHEST_PERIOD, min_autocorrelation_ratio, af_sumsq[i], &f_ratio);
+    ul_walk += bench_cycles() - ul_start;
+
+    ul_start = bench_cycles();
+    n_fft = LOWEST_PERIOD;
+    rf_autocorrelation_all(aan_x[i], BUFFER_SIZE, an_aut, BUFFER_SIZE - 1);
+    rf_initialize_periodicity_search_table(an_aut, BUFFER_SIZE - 1, &n_fft, HIGHEST_PERIOD, min_autocorrelation_ratio, af_sumsq[i]);
+    if (n_fft != 0)
+      rf_signal_periodicity_table(an_aut, BUFFER_SIZE - 1, &n_fft, LOWEST_PERIOD, HIGHEST_PERIOD, min_autocorrelation_ratio, af_sumsq[i], &f_ratio);
+    ul_fft += bench_cycles() - ul_start;
+
+    bench_keep(f_ratio);
+    if (n_walk == n_fft)
+      n_agree++;
+  }
+  printf("autocorrelation\t%-10s\twalk %8.0f cycles/window\tfft %8.0f cycles/window\tsame periodicity %d/%d\n", s_name,
+      (double)ul_walk / BENCH_WINDOWS, (double)ul_fft / BENCH_WINDOWS, n_agree, BENCH_WINDOWS);
+  return n_agree == BENCH_WINDOWS;
+}
+
+bool bench_autocorrelation()
+{
+  bool b_pass = bench_case("clean", 0.0f, 1000.0f);
+  b_pass &= bench_case("noisy", 600.0f, 1000.0f);
+  b_pass &= bench_case("aperiodic", 1000.0f, 0.0f);
+  return b_pass;
+}
@@ -0,0 +1,232 @@
+/*
+ * Batched RF estimator (lib/rf_batch) against the scalar one
+ * 64 ppg_synth streams of different heart rate, SpO2, noise and motion, every
+ * seventh without red light, cut into sliding windows one hop apart. Each
+ * stream runs through rf_heart_rate_and_oxygen_saturation_r() with its own
+ * channel, and through rf_batch_heart_rate_and_oxygen_saturation() 8 and 16
+ * streams per call with each instruction set the CPU has.
+ * - kernels: every batch kernel against the scalar one on random lanes,
+ *   lags past the window included
+ * - estimates: every result and channel state must match the scalar run bit
+ *   for bit
+ * - timing: windows/s on one core, best of three passes
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <ppg_synth.h>
+#include <rf_batch.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_BATCH_STREAMS 64
+#define BENCH_BATCH_WINDOWS 40
+#define BENCH_BATCH_HOP FS
+#define BENCH_BATCH_SAMPLES (BUFFER_SIZE + (BENCH_BATCH_WINDOWS - 1) * BENCH_BATCH_HOP)
+#define BENCH_BATCH_PASSES 3
+
+struct bench_batch_stream {
+  uint32_t aun_ir[BENCH_BATCH_SAMPLES];
+  uint32_t aun_red[BENCH_BATCH_SAMPLES];
+  bool b_red;
+};
+
+static bench_batch_stream as_streams[BENCH_BATCH_STREAMS];
+static rf_batch_result as_scalar[BENCH_BATCH_STREAMS][BENCH_BATCH_WINDOWS];
+static rf_batch_result as_batch[BENCH_BATCH_STREAMS][BENCH_BATCH_WINDOWS];
+static rf_channel_state as_channels[BENCH_BATCH_STREAMS];
+static rf_channel_state as_scalar_end[BENCH_BATCH_STREAMS];
+static rf_batch_scratch s_scratch;
+
+static void bench_batch_synth()
+{
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  for (uint32_t s = 0; s < BENCH_BATCH_STREAMS; s++) {
+    ppg_synth_default_config(&s_cfg);
+    s_cfg.un_seed = s + 1;
+    s_cfg.f_hr_bpm = 45.0f + (float)((s * 2654435761u) >> 16) * 125.0f / 65536.0f;
+    s_cfg.f_spo2 = 85.0f + (float)(s % 16);
+    s_cfg.f_noise = 10.0f + 40.0f * (s % 5);
+    s_cfg.f_ir_perfusion = s % 11 == 3 ? 0.002f : 0.02f;
+    s_cfg.f_motion_per_s = s % 4 == 1 ? 0.3f : 0.0f;
+    ppg_synth_init(&s_synth, &s_cfg);
+    ppg_synth_fill(&s_synth, as_streams[s].aun_red, as_streams[s].aun_ir, BENCH_BATCH_SAMPLES);
+    as_streams[s].b_red = s % 7 != 6;
+  }
+}
+
+static void bench_batch_scalar()
+{
+  for (int32_t s = 0; s < BENCH_BATCH_STREAMS; s++) {
+    bench_batch_stream* ps_stream = &as_streams[s];
+    rf_channel_init(&as_channels[s]);
+    for (int32_t w = 0; w < BENCH_BATCH_WINDOWS; w++) {
+      rf_batch_result* ps_result = &as_scalar[s][w];
+      ps_result->f_ratio = 0.0f; // left alone when the walk does not run
+      rf_heart_rate_and_oxygen_saturation_r(&as_channels[s], ps_stream->aun_ir + w * BENCH_BATCH_HOP, BUFFER_SIZE,
+          ps_stream->b_red ? ps_stream->aun_red + w * BENCH_BATCH_HOP : NULL, &ps_result->f_spo2, &ps_result->ch_spo2_valid,
+          &ps_result->n_heart_rate, &ps_result->ch_hr_valid, &ps_result->f_ratio, &ps_result->f_correl);
+    }
+  }
+}
+
+// Window by window, n_lanes streams per call as the ingest workers would group them
+static void bench_batch_run(int32_t n_lanes)
+{
+  rf_channel_state* aps_channels[RF_BATCH_LANES];
+  const uint32_t *apun_ir[RF_BATCH_LANES], *apun_red[RF_BATCH_LANES];
+  rf_batch_result as_results[RF_BATCH_LANES];
+  int32_t s, l, n;
+
+  for (s = 0; s < BENCH_BATCH_STREAMS; s++)
+    rf_channel_init(&as_channels[s]);
+  for (int32_t w = 0; w < BENCH_BATCH_WINDOWS; w++)
+    for (s = 0; s < BENCH_BATCH_STREAMS; s += n) {
+      n = BENCH_BATCH_STREAMS - s < n_lanes ? BENCH_BATCH_STREAMS - s : n_lanes;
+      for (l = 0; l < n; l++) {
+        aps_channels[l] = &as_channels[s + l];
+        apun_ir[l] = as_streams[s + l].aun_ir + w * BENCH_BATCH_HOP;
+        apun_red[l] = as_streams[s + l].b_red ? as_streams[s + l].aun_red + w * BENCH_BATCH_HOP : NULL;
+      }
+      rf_batch_heart_rate_and_oxygen_saturation(&s_scratch, aps_channels, apun_ir, apun_red, n, as_results);
+      for (l = 0; l < n; l++)
+        as_batch[s + l][w] = as_results[l];
+    }
+}
+
+static bool bench_batch_same(const rf_batch_result& a, const rf_batch_result& b)
+{
+  return memcmp(&a.f_spo2, &b.f_spo2, sizeof(float)) == 0 && a.ch_spo2_valid == b.ch_spo2_valid && a.n_heart_rate == b.n_heart_rate
+      && a.ch_hr_valid == b.ch_hr_valid && memcmp(&a.f_ratio, &b.f_ratio, sizeof(float)) == 0
+      && memcmp(&a.f_correl, &b.f_correl, sizeof(float)) == 0;
+}
+
+static uint32_t bench_batch_mismatches()
+{
+  uint32_t un_bad = 0;
+  for (int32_t s = 0; s < BENCH_BATCH_STREAMS; s++) {
+    for (int32_t w = 0; w < BENCH_BATCH_WINDOWS; w++)
+      un_bad += !bench_batch_same(as_scalar[s][w], as_batch[s][w]);
+    un_bad += as_channels[s].n_last_peak_interval != as_scalar_end[s].n_last_peak_interval
+        || as_channels[s].un_windows != as_scalar_end[s].un_windows || as_channels[s].un_valid_windows != as_scalar_end[s].un_valid_windows;
+  }
+  return un_bad;
+}
+
+static bool bench_batch_float_same(float a, float b)
+{
+  return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+// Every kernel on random lanes against algorithmRF.cpp
+static uint32_t bench_batch_kernels()
+{
+  alignas(32) static float af_x[BUFFER_SIZE][RF_BATCH_LANES], af_y[BUFFER_SIZE][RF_BATCH_LANES];
+  float af_lane_x[BUFFER_SIZE], af_lane_y[BUFFER_SIZE];
+  float af_out[RF_BATCH_LANES], af_out2[RF_BATCH_LANES], f_sumsq;
+  uint32_t un_rng = 12345, un_bad = 0, un_lanes;
+  int32_t k, l, n_lag;
+
+  for (int32_t n_round = 0; n_round < 64; n_round++) {
+    for (k = 0; k < BUFFER_SIZE; k++)
+      for (l = 0; l < RF_BATCH_LANES; l++) {
+        un_rng = un_rng * 1664525u + 1013904223u;
+        af_x[k][l] = (float)(int32_t)(un_rng >> 14) - 131072.0f;
+        un_rng = un_rng * 1664525u + 1013904223u;
+        af_y[k][l] = (float)(int32_t)(un_rng >> 14) - 131072.0f;
+      }
+    un_rng = un_rng * 1664525u + 1013904223u;
+    un_lanes = n_round == 0 ? 0xFFFF : (un_rng >> 8) & 0xFFFF;
+    n_lag = (int32_t)((un_rng >> 24) % (BUFFER_SIZE + 4));
+    rf_batch_linear_regression_beta(af_x, BUFFER_SIZE, mean_X, sum_X2, un_lanes, af_out);
+    for (l = 0; l < RF_BATCH_LANES; l++) {
+      if (!(un_lanes >> l & 1))
+        continue;
+      for (k = 0; k < BUFFER_SIZE; k++) {
+        af_lane_x[k] = af_x[k][l];
+        af_lane_y[k] = af_y[k][l];
+      }
+      un_bad += !bench_batch_float_same(af_out[l], rf_linear_regression_beta(af_lane_x, mean_X, sum_X2));
+    }
+    rf_batch_autocorrelation(af_x, BUFFER_SIZE, n_lag, un_lanes, af_out);
+    for (l = 0; l < RF_BATCH_LANES; l++) {
+      if (!(un_lanes >> l & 1))
+        continue;
+      for (k = 0; k < BUFFER_SIZE; k++)
+        af_lane_x[k] = af_x[k][l];
+      un_bad += !bench_batch_float_same(af_out[l], rf_autocorrelation(af_lane_x, BUFFER_SIZE, n_lag));
+    }
+    rf_batch_rms(af_x, BUFFER_SIZE, un_lanes, af_out, af_out2);
+    for (l = 0; l < RF_BATCH_LANES; l++) {
+      if (!(un_lanes >> l & 1))
+        continue;
+      for (k = 0; k < BUFFER_SIZE; k++)
+        af_lane_x[k] = af_x[k][l];
+      un_bad += !bench_batch_float_same(af_out[l], rf_rms(af_lane_x, BUFFER_SIZE, &f_sumsq)) || !bench_batch_float_same(af_out2[l], f_sumsq);
+    }
+    rf_batch_Pcorrelation(af_x, af_y, BUFFER_SIZE, un_lanes, af_out);
+    for (l = 0; l < RF_BATCH_LANES; l++) {
+      if (!(un_lanes >> l & 1))
+        continue;
+      for (k = 0; k < BUFFER_SIZE; k++) {
+        af_lane_x[k] = af_x[k][l];
+        af_lane_y[k] = af_y[k][l];
+      }
+      un_bad += !bench_batch_float_same(af_out[l], rf_Pcorrelation(af_lane_x, af_lane_y, BUFFER_SIZE));
+    }
+  }
+  return un_bad;
+}
+
+template <typename F>
+static double bench_batch_windows_per_s(F f)
+{
+  uint64_t ul_start, ul_best = ~0ull;
+  for (int32_t i = 0; i < BENCH_BATCH_PASSES; i++) {
+    ul_start = bench_ns();
+    f();
+    if (bench_ns() - ul_start < ul_best)
+      ul_best = bench_ns() - ul_start;
+  }
+  return (double)BENCH_BATCH_STREAMS * BENCH_BATCH_WINDOWS * 1e9 / (double)ul_best;
+}
+
+bool bench_batch()
+{
+  static const rf_batch_isa ae_isas[] = { RF_BATCH_PORTABLE, RF_BATCH_SSE2, RF_BATCH_AVX2 };
+  static const int32_t an_lanes[] = { 8, 16 };
+  const rf_batch_isa e_default = rf_batch_get_isa();
+  double f_scalar, f_batch;
+  uint32_t un_bad, un_valid = 0;
+  bool b_pass = true;
+
+  bench_batch_synth();
+  bench_batch_scalar();
+  memcpy(as_scalar_end, as_channels, sizeof(as_channels));
+  for (int32_t s = 0; s < BENCH_BATCH_STREAMS; s++)
+    for (int32_t w = 0; w < BENCH_BATCH_WINDOWS; w++)
+      un_valid += as_scalar[s][w].ch_hr_valid != 0;
+  f_scalar = bench_batch_windows_per_s(bench_batch_scalar);
+  printf("batch\tscalar\t%d streams x %d windows, %u%% HR valid\t%10.0f windows/s\n", BENCH_BATCH_STREAMS, BENCH_BATCH_WINDOWS,
+      (unsigned)(100 * un_valid / (BENCH_BATCH_STREAMS * BENCH_BATCH_WINDOWS)), f_scalar);
+
+  for (rf_batch_isa e_isa : ae_isas) {
+    if (!rf_batch_set_isa(e_isa)) {
+      printf("batch\t%s\tnot supported by this CPU\n", rf_batch_isa_name(e_isa));
+      continue;
+    }
+    un_bad = bench_batch_kernels();
+    printf("batch\t%s\tkernels\t%u mismatches\n", rf_batch_isa_name(e_isa), (unsigned)un_bad);
+    b_pass &= un_bad == 0;
+    for (int32_t n_lanes : an_lanes) {
+      bench_batch_run(n_lanes);
+      un_bad = bench_batch_mismatches();
+      f_batch = bench_batch_windows_per_s([n_lanes] { bench_batch_run(n_lanes); });
+      printf("batch\t%s\t%2d lanes\t%u mismatches\t%10.0f windows/s\t%5.2fx scalar\n", rf_batch_isa_name(e_isa), (int)n_lanes, (unsigned)un_bad,
+          f_batch, f_batch / f_scalar);
+      b_pass &= un_bad == 0;
+    }
+  }
+  rf_batch_set_isa(e_default);
+  return b_pass;
+}
@@ -0,0 +1,137 @@
+/*
+ * Raw capture format
+ * - size: a day of synthetic samples at 25 Hz written through capture_writer,
+ *   bytes per sample on the wire and a sample-exact round trip
+ * - damage: a flipped byte and a cut chunk are skipped, counted, and everything
+ *   around them is still read
+ * - replay: decode plus the RF estimator over the whole day, speed-up over real time
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <capture.h>
+#include <ppg_synth.h>
+#include <stdio.h>
+#include <vector>
+
+#define BENCH_CAPTURE_HOURS 24
+
+static bool bench_capture_to_vector(void* p_context, const uint8_t* puch_data, size_t un_len)
+{
+  std::vector<uint8_t>* p_bytes = (std::vector<uint8_t>*)p_context;
+  p_bytes->insert(p_bytes->end(), puch_data, puch_data + un_len);
+  return true;
+}
+
+// The maxim_max30102_init() configuration: 100 sps averaged by 4, 411 us, 4096 nA, 7 mA
+static void bench_capture_config(capture_config* ps_config)
+{
+  static const uint8_t auch_regs_08_0d[6] = { 0x4F, 0x03, 0x27, 0x00, 0x24, 0x24 };
+  capture_config_from_regs(ps_config, auch_regs_08_0d, 0x00, 0x00);
+}
+
+static bool bench_capture_size(std::vector<uint8_t>& auch_bytes, std::vector<uint32_t>& aun_red, std::vector<uint32_t>& aun_ir)
+{
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  capture_config s_config;
+  static capture_writer s_writer;
+  capture_reader s_reader;
+  static capture_record s_record;
+  const uint32_t un_total = BENCH_CAPTURE_HOURS * 3600 * 25;
+  uint32_t i, un_read = 0, un_mismatch = 0;
+  uint64_t ul_start, ul_ns;
+
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.f_motion_per_s = 0.05f;
+  ppg_synth_init(&s_synth, &s_cfg);
+  aun_red.resize(un_total);
+  aun_ir.resize(un_total);
+  ppg_synth_fill(&s_synth, aun_red.data(), aun_ir.data(), un_total);
+
+  bench_capture_config(&s_config);
+  capture_writer_init(&s_writer, bench_capture_to_vector, &auch_bytes);
+  ul_start = bench_ns();
+  capture_write_config(&s_writer, &s_config);
+  for (i = 0; i < un_total; i++)
+    capture_write_sample(&s_writer, aun_red[i], aun_ir[i], i * 40);
+  capture_flush(&s_writer);
+  ul_ns = bench_ns() - ul_start;
+
+  capture_reader_init(&s_reader, auch_bytes.data(), auch_bytes.size());
+  while (capture_read(&s_reader, &s_record)) {
+    if (s_record.uch_type != CAPTURE_CHUNK_DATA)
+      continue;
+    for (i = 0; i < s_record.uw_count; i++, un_read++)
+      if (s_record.un_index + i != un_read || s_record.aun_red[i] != aun_red[un_read] || s_record.aun_ir[i] != aun_ir[un_read])
+        un_mismatch++;
+  }
+  printf("capture\tsize\t%d h at 25 Hz\t%.1f MB\t%.2f bytes/sample\twrite %.1f ns/sample\tround trip %u/%u samples, %u mismatches\n",
+      BENCH_CAPTURE_HOURS, auch_bytes.size() / 1e6, (double)auch_bytes.size() / un_total, (double)ul_ns / un_total, un_read, un_total,
+      un_mismatch);
+  return un_read == un_total && un_mismatch == 0 && s_reader.un_crc_errors == 0 && s_reader.un_skipped_bytes == 0
+      && auch_bytes.size() < un_total * 5;
+}
+
+static bool bench_capture_damage(const std::vector<uint8_t>& auch_clean)
+{
+  const size_t un_chunk = CAPTURE_HEADER_BYTES + CAPTURE_MAX_PAYLOAD + CAPTURE_CRC_BYTES;
+  const size_t un_first = CAPTURE_HEADER_BYTES + 5 + CAPTURE_CONFIG_REGS + CAPTURE_CRC_BYTES;
+  std::vector<uint8_t> auch_bytes(auch_clean.begin(), auch_clean.begin() + un_first + 1000 * un_chunk);
+  capture_reader s_reader;
+  static capture_record s_record;
+  uint32_t un_samples = 0;
+
+  auch_bytes[un_first + 10 * un_chunk + 40] ^= 0x10; // bit error in chunk 10
+  auch_bytes.erase(auch_bytes.begin() + un_first + 20 * un_chunk + 100, auch_bytes.begin() + un_first + 21 * un_chunk + 100); // lost bytes
+  capture_reader_init(&s_reader, auch_bytes.data(), auch_bytes.size());
+  while (capture_read(&s_reader, &s_record))
+    if (s_record.uch_type == CAPTURE_CHUNK_DATA)
+      un_samples += s_record.uw_count;
+  printf("capture\tdamage\t1 bit error, %u bytes cut\t%u samples of %u read, %u missing, %u CRC errors, %u bytes skipped\n",
+      (unsigned)un_chunk, un_samples, 1000 * CAPTURE_CHUNK_SAMPLES, s_reader.un_missing_samples, s_reader.un_crc_errors,
+      s_reader.un_skipped_bytes);
+  // the damaged chunk and the two the cut runs through are lost, nothing else
+  return un_samples == 997 * CAPTURE_CHUNK_SAMPLES && s_reader.un_missing_samples == 3 * CAPTURE_CHUNK_SAMPLES
+      && s_reader.un_crc_errors > 0;
+}
+
+static bool bench_capture_replay(const std::vector<uint8_t>& auch_bytes)
+{
+  capture_reader s_reader;
+  static capture_record s_record;
+  static rf_stream_state s_stream;
+  float f_spo2, f_ratio, f_correl;
+  int32_t n_hr;
+  int8_t ch_spo2_valid, ch_hr_valid;
+  uint32_t i, un_samples = 0, un_estimates = 0, un_valid = 0;
+  uint64_t ul_start, ul_ns;
+
+  ul_start = bench_ns();
+  rf_stream_init(&s_stream, FS);
+  capture_reader_init(&s_reader, auch_bytes.data(), auch_bytes.size());
+  while (capture_read(&s_reader, &s_record)) {
+    if (s_record.uch_type != CAPTURE_CHUNK_DATA)
+      continue;
+    for (i = 0; i < s_record.uw_count; i++) {
+      if (!rf_stream_push(&s_stream, s_record.aun_ir[i], s_record.aun_red[i], &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl))
+        continue;
+      un_estimates++;
+      un_valid += ch_hr_valid != 0;
+    }
+    un_samples += s_record.uw_count;
+  }
+  ul_ns = bench_ns() - ul_start;
+  printf("capture\treplay\t%d h through the RF estimator in %.2f s\t%.0fx real time\t%u estimates, HR valid %u%%\n", BENCH_CAPTURE_HOURS,
+      ul_ns / 1e9, un_samples / 25.0 / (ul_ns / 1e9), un_estimates, un_estimates ? 100 * un_valid / un_estimates : 0);
+  return un_samples / 25.0 / (ul_ns / 1e9) >= 1000.0; // a day well within two minutes
+}
+
+bool bench_capture()
+{
+  std::vector<uint8_t> auch_bytes;
+  std::vector<uint32_t> aun_red, aun_ir;
+  bool b_pass = bench_capture_size(auch_bytes, aun_red, aun_ir);
+  b_pass &= bench_capture_damage(auch_bytes);
+  b_pass &= bench_capture_replay(auch_bytes);
+  return b_pass;
+}
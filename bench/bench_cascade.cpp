@@ -0,0 +1,160 @@
+/*
+ * Estimator interface and cascade (lib/estimator)
+ * - sweep: Maxim, RF and the cascade on the same synthetic windows over heart
+ *   rate, noise and motion; error against ground truth, escalation rate and
+ *   cycles per window as estimator_cycles_per_window() publishes them
+ * - the cascade must be as accurate as RF on clean signals: HR within 3 bpm or
+ *   one lag step, SpO2 within 1 %, and cost fewer cycles per window than RF;
+ *   cycles per window are the least of BENCH_CASCADE_PASSES passes, one pass
+ *   swings too much on a shared host
+ * - hr-only: every estimator without red (NULL): SpO2 never valid, heart rate
+ *   as accurate as above
+ */
+#include "bench.h"
+#include <estimator.h>
+#include <ppg_synth.h>
+#include <math.h>
+#include <stdio.h>
+
+#define BENCH_CASCADE_WINDOWS 400
+#define BENCH_CASCADE_PASSES 5
+
+struct bench_cascade_stats {
+  int32_t n_hr_valid, n_spo2_valid;
+  float f_hr_err, f_spo2_err;
+};
+
+static bool bench_cascade_case(float f_hr, float f_dicrotic, float f_noise, float f_motion_per_s, bool b_check)
+{
+  static const estimator_kind ae_kinds[] = { ESTIMATOR_MAXIM, ESTIMATOR_RF, ESTIMATOR_CASCADE };
+  static uint32_t aun_red[BENCH_CASCADE_WINDOWS][BUFFER_SIZE], aun_ir[BENCH_CASCADE_WINDOWS][BUFFER_SIZE];
+  static estimator_state s_estimator;
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  estimator_result s_result;
+  bench_cascade_stats s_stats;
+  float f_hr_tolerance = f_hr * f_hr / FS60 > 3.0f ? f_hr * f_hr / FS60 : 3.0f;
+  float f_cycles, f_escalation_rate, f_rf_cycles = 0.0f;
+  char s_case[32];
+  bool b_pass = true;
+  int32_t w, n_pass;
+
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.un_seed = (uint32_t)(f_hr * 100 + f_noise + f_motion_per_s * 1000);
+  s_cfg.f_dicrotic = f_dicrotic;
+  s_cfg.f_fs = FS;
+  s_cfg.f_hr_bpm = f_hr;
+  s_cfg.f_noise = f_noise;
+  s_cfg.f_motion_per_s = f_motion_per_s;
+  ppg_synth_init(&s_synth, &s_cfg);
+  for (w = 0; w < BENCH_CASCADE_WINDOWS; w++)
+    ppg_synth_fill(&s_synth, aun_red[w], aun_ir[w], BUFFER_SIZE);
+
+  for (estimator_kind e_kind : ae_kinds) {
+    s_stats = {};
+    estimator_init(&s_estimator, e_kind);
+    for (w = 0; w < BENCH_CASCADE_WINDOWS; w++) {
+      estimator_run(&s_estimator, aun_ir[w], aun_red[w], &s_result);
+      if (s_result.ch_hr_valid) {
+        s_stats.n_hr_valid++;
+        s_stats.f_hr_err += fabsf(s_result.n_heart_rate - f_hr);
+      }
+      if (s_result.ch_spo2_valid) {
+        s_stats.n_spo2_valid++;
+        s_stats.f_spo2_err += fabsf(s_result.f_spo2 - s_cfg.f_spo2);
+      }
+    }
+    s_stats.f_hr_err = s_stats.n_hr_valid ? s_stats.f_hr_err / s_stats.n_hr_valid : 0.0f;
+    s_stats.f_spo2_err = s_stats.n_spo2_valid ? s_stats.f_spo2_err / s_stats.n_spo2_valid : 0.0f;
+    f_escalation_rate = estimator_escalation_rate(&s_estimator);
+    f_cycles = estimator_cycles_per_window(&s_estimator);
+    for (n_pass = 1; n_pass < BENCH_CASCADE_PASSES; n_pass++) {
+      estimator_init(&s_estimator, e_kind);
+      for (w = 0; w < BENCH_CASCADE_WINDOWS; w++)
+        estimator_run(&s_estimator, aun_ir[w], aun_red[w], &s_result);
+      if (estimator_cycles_per_window(&s_estimator) < f_cycles)
+        f_cycles = estimator_cycles_per_window(&s_estimator);
+    }
+    printf("cascade\t%-8s\tHR %3.0f notch %.2f noise %4.0f motion %4.2f/s\tHR valid %3d%% err %6.2f bpm\tSpO2 valid %3d%% err %5.2f %%\tescalated %5.1f%%\t%7.0f cycles/window\n",
+        estimator_name(e_kind), f_hr, f_dicrotic, f_noise, f_motion_per_s, (int)(100 * s_stats.n_hr_valid / BENCH_CASCADE_WINDOWS), s_stats.f_hr_err,
+        (int)(100 * s_stats.n_spo2_valid / BENCH_CASCADE_WINDOWS), s_stats.f_spo2_err, 100.0f * f_escalation_rate, f_cycles);
+    if (e_kind == ESTIMATOR_RF)
+      f_rf_cycles = f_cycles;
+    if (b_check && e_kind == ESTIMATOR_CASCADE)
+      b_pass = s_stats.n_hr_valid >= BENCH_CASCADE_WINDOWS * 8 / 10 && s_stats.f_hr_err <= f_hr_tolerance && s_stats.f_spo2_err <= 1.0f
+          && f_cycles < f_rf_cycles;
+  }
+
+  if (f_noise == 30.0f && f_motion_per_s == 0.0f && f_hr == 75.0f) {
+    for (estimator_kind e_kind : ae_kinds) {
+      estimator_init(&s_estimator, e_kind);
+      snprintf(s_case, sizeof(s_case), "%s_notch%02d", estimator_name(e_kind), (int)(f_dicrotic * 100 + 0.5f));
+      bench_record("cascade", s_case, BUFFER_SIZE, bench_time(BENCH_CASCADE_WINDOWS * 4, [&](int32_t i) {
+        estimator_run(&s_estimator, aun_ir[i % BENCH_CASCADE_WINDOWS], aun_red[i % BENCH_CASCADE_WINDOWS], &s_result);
+        bench_keep(s_result);
+      }));
+    }
+  }
+  return b_pass;
+}
+
+static bool bench_cascade_hr_only(float f_hr)
+{
+  static const estimator_kind ae_kinds[] = { ESTIMATOR_MAXIM, ESTIMATOR_RF, ESTIMATOR_RF_FIXED, ESTIMATOR_CASCADE };
+  static uint32_t aun_red[BENCH_CASCADE_WINDOWS][BUFFER_SIZE], aun_ir[BENCH_CASCADE_WINDOWS][BUFFER_SIZE];
+  static estimator_state s_estimator;
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  estimator_result s_result;
+  float f_hr_tolerance = f_hr * f_hr / FS60 > 3.0f ? f_hr * f_hr / FS60 : 3.0f, f_hr_err;
+  int32_t w, n_hr_valid, n_spo2_valid;
+  bool b_pass = true;
+
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.un_seed = (uint32_t)(f_hr * 100) + 1;
+  s_cfg.f_dicrotic = 0.1f;
+  s_cfg.f_fs = FS;
+  s_cfg.f_hr_bpm = f_hr;
+  s_cfg.f_noise = 30.0f;
+  ppg_synth_init(&s_synth, &s_cfg);
+  for (w = 0; w < BENCH_CASCADE_WINDOWS; w++)
+    ppg_synth_fill(&s_synth, aun_red[w], aun_ir[w], BUFFER_SIZE);
+
+  for (estimator_kind e_kind : ae_kinds) {
+    n_hr_valid = n_spo2_valid = 0;
+    f_hr_err = 0.0f;
+    estimator_init(&s_estimator, e_kind);
+    for (w = 0; w < BENCH_CASCADE_WINDOWS; w++) {
+      estimator_run(&s_estimator, aun_ir[w], NULL, &s_result);
+      n_spo2_valid += s_result.ch_spo2_valid;
+      if (s_result.ch_hr_valid) {
+        n_hr_valid++;
+        f_hr_err += fabsf(s_result.n_heart_rate - f_hr);
+      }
+    }
+    f_hr_err = n_hr_valid ? f_hr_err / n_hr_valid : 0.0f;
+    printf("cascade\t%-8s\tHR %3.0f hr-only\tHR valid %3d%% err %6.2f bpm\tSpO2 valid %d\tescalated %5.1f%%\t%7.0f cycles/window\n", estimator_name(e_kind),
+        f_hr, (int)(100 * n_hr_valid / BENCH_CASCADE_WINDOWS), f_hr_err, (int)n_spo2_valid, 100.0f * estimator_escalation_rate(&s_estimator),
+        estimator_cycles_per_window(&s_estimator));
+    b_pass &= n_spo2_valid == 0;
+    if (e_kind != ESTIMATOR_MAXIM)
+      b_pass &= n_hr_valid >= BENCH_CASCADE_WINDOWS * 8 / 10 && f_hr_err <= f_hr_tolerance;
+  }
+  return b_pass;
+}
+
+bool bench_cascade()
+{
+  static const float af_hr[] = { 50, 75, 100, 140 };
+  static const float af_dicrotic[] = { 0.1f, 0.35f }; // weak notch: Maxim holds; default pulse: Maxim counts the notch
+  bool b_pass = true;
+  for (float f_dicrotic : af_dicrotic)
+    for (float f_hr : af_hr)
+      b_pass &= bench_cascade_case(f_hr, f_dicrotic, 30.0f, 0.0f, true);
+  for (float f_hr : af_hr) {
+    bench_cascade_case(f_hr, 0.1f, 300.0f, 0.0f, false);
+    bench_cascade_case(f_hr, 0.1f, 30.0f, 0.2f, false);
+  }
+  b_pass &= bench_cascade_hr_only(75.0f);
+  return b_pass;
+}
@@ -0,0 +1,84 @@
+/*
+ * Many channels on a thread pool
+ * Processes recorded-style streams with one rf_channel_state each, once
+ * sequentially and once spread over all hardware threads, and checks that
+ * every window produced the same result both ways.
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#define BENCH_CHANNELS 256
+#define BENCH_CHANNEL_WINDOWS 50
+
+struct bench_channel_result {
+  float f_spo2, f_ratio, f_correl;
+  int32_t n_hr;
+  int8_t ch_spo2_valid, ch_hr_valid;
+};
+
+static void bench_channel_window(int32_t n_channel, int32_t n_window, uint32_t* pun_ir, uint32_t* pun_red)
+{
+  float f_bpm = 50 + (n_channel * 37) % 110;
+  for (int32_t k = 0; k < BUFFER_SIZE; ++k) {
+    float t = (float)(n_window * BUFFER_SIZE + k) / FS;
+    float f_pulse = sinf(2 * M_PI * f_bpm / 60 * t) + 0.3f * sinf(4 * M_PI * f_bpm / 60 * t);
+    uint32_t un_noise = (uint32_t)(n_channel * 7919 + n_window * 104729 + k * 31) % 97;
+    pun_ir[k] = 110000 + n_channel * 100 + (uint32_t)(1000 * f_pulse) + un_noise;
+    pun_red[k] = 85000 + (uint32_t)((400 + n_channel % 300) * f_pulse) + un_noise;
+  }
+}
+
+static void bench_channel_run(int32_t n_channel, bench_channel_result* ps_results)
+{
+  rf_channel_state s_state;
+  uint32_t aun_ir[BUFFER_SIZE], aun_red[BUFFER_SIZE];
+  rf_channel_init(&s_state);
+  for (int32_t w = 0; w < BENCH_CHANNEL_WINDOWS; ++w) {
+    bench_channel_result* ps = &ps_results[n_channel * BENCH_CHANNEL_WINDOWS + w];
+    bench_channel_window(n_channel, w, aun_ir, aun_red);
+    rf_heart_rate_and_oxygen_saturation_r(&s_state, aun_ir, BUFFER_SIZE, aun_red, &ps->f_spo2, &ps->ch_spo2_valid, &ps->n_hr, &ps->ch_hr_valid,
+        &ps->f_ratio, &ps->f_correl);
+  }
+}
+
+bool bench_channels()
+{
+  std::vector<bench_channel_result> as_sequential(BENCH_CHANNELS * BENCH_CHANNEL_WINDOWS), as_parallel(as_sequential.size());
+  std::vector<std::thread> a_workers;
+  std::atomic<int32_t> n_next(0);
+  uint32_t un_threads = std::thread::hardware_concurrency();
+  if (un_threads == 0)
+    un_threads = 1;
+
+  auto t_start = std::chrono::steady_clock::now();
+  for (int32_t c = 0; c < BENCH_CHANNELS; ++c)
+    bench_channel_run(c, as_sequential.data());
+  double d_sequential = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+
+  t_start = std::chrono::steady_clock::now();
+  for (uint32_t t = 0; t < un_threads; ++t)
+    a_workers.emplace_back([&]() {
+      for (int32_t c = n_next++; c < BENCH_CHANNELS; c = n_next++)
+        bench_channel_run(c, as_parallel.data());
+    });
+  for (std::thread& worker : a_workers)
+    worker.join();
+  double d_parallel = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+
+  bool b_same = true;
+  for (size_t i = 0; i < as_sequential.size(); ++i) {
+    const bench_channel_result &s_a = as_sequential[i], &s_b = as_parallel[i];
+    if (s_a.n_hr != s_b.n_hr || s_a.f_spo2 != s_b.f_spo2 || s_a.f_ratio != s_b.f_ratio || s_a.f_correl != s_b.f_correl
+        || s_a.ch_hr_valid != s_b.ch_hr_valid || s_a.ch_spo2_valid != s_b.ch_spo2_valid)
+      b_same = false;
+  }
+  double d_windows = (double)BENCH_CHANNELS * BENCH_CHANNEL_WINDOWS;
+  printf("channels\t%d streams\t1 thread %.0f windows/s\t%u threads %.0f windows/s\tresults %s\n", BENCH_CHANNELS, d_windows / d_sequential,
+      un_threads, d_windows / d_parallel, b_same ? "identical" : "DIFFER");
+  return b_same;
+}
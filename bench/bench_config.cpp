@@ -0,0 +1,52 @@
+/*
+ * Sampling configurations side by side
+ * Instantiates rf_heart_rate_and_oxygen_saturation_cfg<> for 25, 50 and 100 Hz in
+ * one binary and reports cycles per window and the detected heart rate.
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_CONFIG_WINDOWS 500
+#define BENCH_CONFIG_BPM 72
+
+template <class CFG>
+static bool bench_config_case(const char* s_name)
+{
+  static uint32_t aun_ir[CFG::buffer_size], aun_red[CFG::buffer_size];
+  static rf_channel_state_t<CFG> s_channel;
+  int32_t n_hr = 0, i, k, n_hr_min = 1000, n_hr_max = 0;
+  int8_t ch_spo2_valid, ch_hr_valid;
+  float f_spo2, f_ratio, f_correl;
+  uint64_t ul_start, ul_cycles = 0;
+
+  rf_channel_init_cfg(&s_channel);
+  for (i = 0; i < BENCH_CONFIG_WINDOWS; ++i) {
+    for (k = 0; k < CFG::buffer_size; ++k) {
+      float t = (float)(i * CFG::buffer_size + k) / CFG::fs;
+      float f_pulse = sinf(2 * M_PI * BENCH_CONFIG_BPM / 60 * t);
+      aun_ir[k] = 120000 + 1200 * f_pulse + rand() % 100;
+      aun_red[k] = 90000 + 600 * f_pulse + rand() % 100;
+    }
+    ul_start = bench_cycles();
+    rf_heart_rate_and_oxygen_saturation_cfg(&s_channel, aun_ir, aun_red, &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+    ul_cycles += bench_cycles() - ul_start;
+    if (ch_hr_valid) {
+      n_hr_min = n_hr < n_hr_min ? n_hr : n_hr_min;
+      n_hr_max = n_hr > n_hr_max ? n_hr : n_hr_max;
+    }
+  }
+  printf("config\t%-8s\tN=%4d\t%8.0f cycles/window\tHR %d..%d bpm (true %d)\n", s_name, (int)CFG::buffer_size,
+      (double)ul_cycles / BENCH_CONFIG_WINDOWS, (int)n_hr_min, (int)n_hr_max, BENCH_CONFIG_BPM);
+  return n_hr_min >= BENCH_CONFIG_BPM - 3 && n_hr_max <= BENCH_CONFIG_BPM + 3;
+}
+
+bool bench_config()
+{
+  bool b_pass = bench_config_case<rf_default_config>("25 Hz");
+  b_pass &= bench_config_case<rf_config<50, 4> >("50 Hz");
+  b_pass &= bench_config_case<rf_config<100, 4> >("100 Hz");
+  return b_pass;
+}
@@ -0,0 +1,353 @@
+/*
+ * MAX30102 driver against the register level simulator
+ * Reports I2C traffic per sample, sample latency (conversion -> last byte read)
+ * and FIFO overflow for the burst read (A_FULL interrupt), the original
+ * one-sample-per-PPG_RDY read and a burst read serviced too late.
+ * - burst-full: each interrupt serviced FIFO_A_FULL samples late, with the
+ *   FIFO exactly full (equal pointers, OVF_COUNTER 0); nothing may be lost
+ * - ring-wrap: the same into a 64 sample ring as lib/acquisition drains it,
+ *   every read crossing the ring end; nothing may be lost
+ * I2C runs at 400 kHz with the ESP8266 Wire buffer (128 bytes per read).
+ * - modes: heart rate, SpO2 and multi-LED slot orders decoded into red/IR,
+ *   I2C bytes per sample of each, a switch at runtime without a reset, and
+ *   an IR-only sensor feeding the RF stream heart rate only
+ * - init: simulated time and bus traffic of maxim_max30102_configure(), and
+ *   the status it returns for a missing part, a late supply, a wrong part ID,
+ *   a reset that never completes and a write that does not stick
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <max30102.h>
+#include <max30102_sim.h>
+#include <ppg_synth.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_SECONDS 60
+#define BENCH_WIRE_BUFFER 128
+
+// Slow ramp: every FIFO sample is larger than the one before, so reordered,
+// repeated or skipped samples show up in the readout
+static float bench_ramp_source(void* p_context, uint8_t uch_led, float f_led_ma, uint64_t ul_time_us)
+{
+  (void)p_context;
+  (void)f_led_ma;
+  float f_na = 500.0f + 10.0f * (float)(ul_time_us / 1e6);
+  return uch_led == MAX30102_SIM_LED_IR ? f_na : 0.5f * f_na;
+}
+
+#define BENCH_RING_SIZE 64
+
+enum bench_read_mode { BENCH_BURST, BENCH_SINGLE, BENCH_RING };
+
+// un_service_ms: poll at that period instead of on INT; b_until_full: answer INT once the FIFO is full
+static bool bench_case(const char* s_name, bench_read_mode e_mode, uint32_t un_service_ms, bool b_until_full = false)
+{
+  max30102_sim s_sim;
+  max30102_hal s_hal;
+  uint32_t aun_red[BENCH_RING_SIZE], aun_ir[BENCH_RING_SIZE];
+  uint32_t un_last_ir = 0, un_out_of_order = 0, un_read = 0, un_ms, un_wait = 0;
+  uint16_t uw_head = BENCH_RING_SIZE - 2, uw_index; // 2 slots to the ring end, 32 - 2 > FIFO_A_FULL left behind if the read stopped there
+  uint8_t uch_num, uch_late = 0, i;
+  const max30102_sim_stats& s_stats = s_sim.s_stats;
+
+  max30102_sim_init(&s_sim, bench_ramp_source, NULL);
+  max30102_sim_hal(&s_sim, &s_hal);
+  s_hal.uw_max_read = BENCH_WIRE_BUFFER;
+  maxim_max30102_set_hal(&s_hal);
+  if (!maxim_max30102_init())
+    return false;
+  if (e_mode == BENCH_SINGLE)
+    maxim_max30102_write_reg(REG_INTR_ENABLE_1, 0b0'1'0'00000); // new sample interrupt, as the original sketch
+  // start from an empty FIFO with clean counters
+  maxim_max30102_write_reg(REG_FIFO_WRITE_POINTER, 0);
+  maxim_max30102_write_reg(REG_OVERFLOW_COUNTER, 0);
+  maxim_max30102_write_reg(REG_FIFO_READ_POINTER, 0);
+  maxim_max30102_read_reg(REG_INTR_STATUS_1, &uch_num);
+  if (b_until_full)
+    maxim_max30102_read_reg(REG_FIFO_CONFIG, &uch_late);
+  uch_late &= 0x0F; // FIFO_A_FULL: samples still free when INT fires
+  s_sim.s_stats = max30102_sim_stats();
+
+  for (un_ms = 0; un_ms < BENCH_SECONDS * 1000; un_ms++) {
+    max30102_sim_advance_us(&s_sim, 1000);
+    if (un_service_ms != 0 ? ++un_wait < un_service_ms : !max30102_sim_int_asserted(&s_sim))
+      continue;
+    un_wait = 0;
+    if (uch_late != 0) // half a period after the last free slot filled
+      max30102_sim_advance_us(&s_sim, (uch_late * 2 + 1) * (uint64_t)max30102_sim_sample_period_us(&s_sim) / 2);
+    if (e_mode == BENCH_RING) {
+      if (!maxim_max30102_read_fifo_ring(aun_red, aun_ir, BENCH_RING_SIZE, uw_head, MAX30102_FIFO_DEPTH, &uch_num))
+        return false;
+    } else if (e_mode == BENCH_BURST) {
+      uw_head = 0;
+      if (!maxim_max30102_read_fifo_burst(aun_red, aun_ir, MAX30102_FIFO_DEPTH, &uch_num))
+        return false;
+    } else {
+      uw_head = 0;
+      maxim_max30102_read_fifo(aun_red, aun_ir);
+      uch_num = 1;
+    }
+    for (i = 0; i < uch_num; i++, un_read++) {
+      uw_index = (uw_head + i) & (BENCH_RING_SIZE - 1);
+      if (aun_ir[uw_index] <= un_last_ir)
+        un_out_of_order++;
+      un_last_ir = aun_ir[uw_index];
+    }
+    uw_head += uch_num;
+  }
+
+  uint32_t un_samples = s_stats.un_samples_read ? s_stats.un_samples_read : 1;
+  printf("driver\t%-10s\t%5.1f bytes/sample\t%5.2f transactions/sample\tlatency mean %6.1f ms max %6.1f ms\t"
+         "bus %4.2f%%\toverflow %u/%u samples\n",
+      s_name, (double)s_stats.un_bytes / un_samples, (double)s_stats.un_transactions / un_samples,
+      s_stats.ul_latency_sum_us / 1000.0 / un_samples, s_stats.un_latency_max_us / 1000.0,
+      100.0 * s_stats.un_bytes * 9 / MAX30102_SIM_I2C_HZ / BENCH_SECONDS, s_stats.un_samples_dropped, s_stats.un_samples_generated);
+  // every sample the driver returned was read from the FIFO exactly once, in order
+  return un_read == s_stats.un_samples_read && un_out_of_order == 0 && s_stats.un_fifo_underflows == 0
+      && (!b_until_full || s_stats.un_samples_dropped == 0);
+}
+
+static bool bench_mode_converts(uint8_t uch_mode, const uint8_t* puch_slots, uint8_t uch_slot)
+{
+  uint8_t i;
+  if (uch_mode != MAX30102_MODE_MULTI_LED)
+    return uch_slot == MAX30102_SLOT_RED || uch_mode == MAX30102_MODE_SPO2;
+  for (i = 0; i < MAX30102_MAX_SLOTS && puch_slots[i] != MAX30102_SLOT_NONE; i++)
+    if (puch_slots[i] == uch_slot)
+      return true;
+  return false;
+}
+
+// Starts in SpO2 mode and switches to uch_mode halfway through if b_switch. Every
+// converted channel must ramp up sample after sample, red at half the IR level
+// whatever the slot order; channels the mode does not convert must read 0.
+static bool bench_mode_case(const char* s_name, uint8_t uch_mode, const uint8_t* puch_slots, bool b_switch, double* pd_bytes_per_sample)
+{
+  max30102_sim s_sim;
+  max30102_hal s_hal;
+  uint32_t aun_red[MAX30102_FIFO_DEPTH], aun_ir[MAX30102_FIFO_DEPTH];
+  uint32_t un_last_red = 0, un_last_ir = 0, un_bad = 0, un_read = 0, un_ms;
+  uint8_t uch_active = b_switch ? MAX30102_MODE_SPO2 : uch_mode, uch_num, i;
+  bool b_red, b_ir;
+  const max30102_sim_stats& s_stats = s_sim.s_stats;
+
+  max30102_sim_init(&s_sim, bench_ramp_source, NULL);
+  max30102_sim_hal(&s_sim, &s_hal);
+  s_hal.uw_max_read = BENCH_WIRE_BUFFER;
+  maxim_max30102_set_hal(&s_hal);
+  if (!maxim_max30102_init() || !maxim_max30102_set_mode(uch_active, puch_slots)) // also empties the FIFO
+    return false;
+  s_sim.s_stats = max30102_sim_stats();
+  b_red = bench_mode_converts(uch_active, puch_slots, MAX30102_SLOT_RED);
+  b_ir = bench_mode_converts(uch_active, puch_slots, MAX30102_SLOT_IR);
+
+  for (un_ms = 0; un_ms < BENCH_SECONDS * 1000; un_ms++) {
+    max30102_sim_advance_us(&s_sim, 1000);
+    if (b_switch && un_ms == BENCH_SECONDS * 1000 / 2) {
+      if (!maxim_max30102_set_mode(uch_mode, puch_slots) || maxim_max30102_bytes_per_sample() != max30102_sim_bytes_per_sample(&s_sim))
+        return false;
+      b_red = bench_mode_converts(uch_mode, puch_slots, MAX30102_SLOT_RED);
+      b_ir = bench_mode_converts(uch_mode, puch_slots, MAX30102_SLOT_IR);
+      un_last_red = un_last_ir = 0;
+    }
+    if (!max30102_sim_int_asserted(&s_sim))
+      continue;
+    if (!maxim_max30102_read_fifo_burst(aun_red, aun_ir, MAX30102_FIFO_DEPTH, &uch_num))
+      return false;
+    for (i = 0; i < uch_num; i++, un_read++) {
+      if (b_red ? aun_red[i] <= un_last_red : aun_red[i] != 0)
+        un_bad++;
+      if (b_ir ? aun_ir[i] <= un_last_ir : aun_ir[i] != 0)
+        un_bad++;
+      if (b_red && b_ir && (aun_red[i] < aun_ir[i] * 4 / 10 || aun_red[i] > aun_ir[i] * 6 / 10))
+        un_bad++;
+      un_last_red = aun_red[i];
+      un_last_ir = aun_ir[i];
+    }
+  }
+
+  uint32_t un_samples = s_stats.un_samples_read ? s_stats.un_samples_read : 1;
+  *pd_bytes_per_sample = (double)s_stats.un_bytes / un_samples;
+  printf("driver\t%-10s\t%5.1f bytes/sample\t%5.2f transactions/sample\tbus %4.2f%%\tdecoded %u samples, %u wrong\n", s_name,
+      *pd_bytes_per_sample, (double)s_stats.un_transactions / un_samples, 100.0 * s_stats.un_bytes * 9 / MAX30102_SIM_I2C_HZ / BENCH_SECONDS,
+      un_read, un_bad);
+  return un_read == s_stats.un_samples_read && un_bad == 0 && s_stats.un_fifo_underflows == 0 && s_stats.un_samples_dropped == 0;
+}
+
+struct bench_hr_finger {
+  ppg_synth_state s_synth;
+  uint32_t un_red, un_ir;
+};
+
+static float bench_hr_source(void* p_context, uint8_t uch_led, float f_led_ma, uint64_t ul_time_us)
+{
+  bench_hr_finger* ps_finger = (bench_hr_finger*)p_context;
+  (void)uch_led; // IR is the only slot
+  (void)f_led_ma;
+  (void)ul_time_us;
+  ppg_synth_next(&ps_finger->s_synth, &ps_finger->un_red, &ps_finger->un_ir); // one slot per conversion
+  return ps_finger->un_ir * (4096.0f / 262144.0f);
+}
+
+// IR in a single multi-LED slot straight into the RF stream: red reads 0, so the
+// stream estimates the heart rate alone
+static bool bench_hr_only_stream()
+{
+  static bench_hr_finger s_finger;
+  static rf_stream_state s_stream;
+  static const uint8_t auch_slots[MAX30102_MAX_SLOTS] = { MAX30102_SLOT_IR, MAX30102_SLOT_NONE };
+  ppg_synth_config s_cfg;
+  max30102_sim s_sim;
+  max30102_hal s_hal;
+  uint32_t aun_red[MAX30102_FIFO_DEPTH], aun_ir[MAX30102_FIFO_DEPTH];
+  int32_t n_hr, n_estimates = 0, n_valid = 0, n_spo2_valid = 0;
+  int8_t ch_spo2_valid, ch_hr_valid;
+  float f_spo2, f_ratio, f_correl, f_hr_err = 0.0f;
+  uint8_t uch_num, i;
+
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.f_fs = 100.0f; // conversion rate, the sensor averages 4
+  ppg_synth_init(&s_finger.s_synth, &s_cfg);
+  max30102_sim_init(&s_sim, bench_hr_source, &s_finger);
+  max30102_sim_hal(&s_sim, &s_hal);
+  maxim_max30102_set_hal(&s_hal);
+  if (!maxim_max30102_init() || !maxim_max30102_set_mode(MAX30102_MODE_MULTI_LED, auch_slots))
+    return false;
+  rf_stream_init(&s_stream, FS);
+  while (s_sim.ul_now_us < (uint64_t)BENCH_SECONDS * 1000000) {
+    max30102_sim_advance_us(&s_sim, 1000);
+    if (!max30102_sim_int_asserted(&s_sim))
+      continue;
+    if (!maxim_max30102_read_fifo_burst(aun_red, aun_ir, MAX30102_FIFO_DEPTH, &uch_num))
+      return false;
+    for (i = 0; i < uch_num; i++) {
+      if (!rf_stream_push(&s_stream, aun_ir[i], aun_red[i], &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl))
+        continue;
+      n_estimates++;
+      n_spo2_valid += ch_spo2_valid;
+      if (ch_hr_valid) {
+        n_valid++;
+        f_hr_err += fabsf(n_hr - s_cfg.f_hr_bpm);
+      }
+    }
+  }
+  f_hr_err = n_valid ? f_hr_err / n_valid : 0.0f;
+  printf("driver\t%-10s\tHR valid %3d%% err %5.2f bpm\tSpO2 valid %d\n", "ir-stream", n_estimates ? (int)(100 * n_valid / n_estimates) : 0,
+      f_hr_err, (int)n_spo2_valid);
+  return n_valid >= n_estimates * 8 / 10 && f_hr_err <= 3.0f && n_spo2_valid == 0;
+}
+
+enum bench_fault { BENCH_FAULT_NONE, BENCH_FAULT_ABSENT, BENCH_FAULT_LATE_POWER, BENCH_FAULT_PART_ID, BENCH_FAULT_STUCK_RESET, BENCH_FAULT_WRITE };
+
+// Sits between the driver and the simulator and breaks it as e_fault says
+struct bench_fault_bus {
+  max30102_sim* ps_sim;
+  max30102_hal s_sim_hal;
+  bench_fault e_fault;
+};
+
+static bool bench_fault_write(void* p_context, uint8_t uch_addr, const uint8_t* puch_data, uint8_t uch_len)
+{
+  bench_fault_bus* ps_bus = (bench_fault_bus*)p_context;
+  uint8_t auch_data[16];
+  if (ps_bus->e_fault == BENCH_FAULT_ABSENT || (ps_bus->e_fault == BENCH_FAULT_LATE_POWER && ps_bus->ps_sim->ul_now_us < 5000))
+    return false;
+  if (ps_bus->e_fault == BENCH_FAULT_WRITE && uch_addr <= REG_LED1_PULSE_AMPLITUDE && uch_addr + uch_len > REG_LED1_PULSE_AMPLITUDE
+      && uch_len <= sizeof(auch_data)) {
+    memcpy(auch_data, puch_data, uch_len);
+    auch_data[REG_LED1_PULSE_AMPLITUDE - uch_addr] ^= 0x01; // one bit flipped on the wire
+    puch_data = auch_data;
+  }
+  return ps_bus->s_sim_hal.write(ps_bus->s_sim_hal.p_context, uch_addr, puch_data, uch_len);
+}
+
+static bool bench_fault_read(void* p_context, uint8_t uch_addr, uint8_t* puch_data, uint16_t uw_len)
+{
+  bench_fault_bus* ps_bus = (bench_fault_bus*)p_context;
+  if (ps_bus->e_fault == BENCH_FAULT_ABSENT || (ps_bus->e_fault == BENCH_FAULT_LATE_POWER && ps_bus->ps_sim->ul_now_us < 5000))
+    return false;
+  if (!ps_bus->s_sim_hal.read(ps_bus->s_sim_hal.p_context, uch_addr, puch_data, uw_len))
+    return false;
+  if (ps_bus->e_fault == BENCH_FAULT_PART_ID && uch_addr + uw_len > REG_PART_ID)
+    puch_data[REG_PART_ID - uch_addr] = 0x11; // a MAX30100
+  if (ps_bus->e_fault == BENCH_FAULT_STUCK_RESET && uch_addr <= REG_MODE_CONFIG && uch_addr + uw_len > REG_MODE_CONFIG)
+    puch_data[REG_MODE_CONFIG - uch_addr] |= 0x40;
+  return true;
+}
+
+static void bench_fault_delay_ms(void* p_context, uint32_t un_ms)
+{
+  bench_fault_bus* ps_bus = (bench_fault_bus*)p_context;
+  ps_bus->s_sim_hal.delay_ms(ps_bus->s_sim_hal.p_context, un_ms);
+}
+
+static uint32_t bench_fault_millis(void* p_context)
+{
+  bench_fault_bus* ps_bus = (bench_fault_bus*)p_context;
+  return ps_bus->s_sim_hal.millis(ps_bus->s_sim_hal.p_context);
+}
+
+// maxim_max30102_configure() from power-up; true if it returns e_expected, within 10 ms when it succeeds
+static bool bench_init_case(const char* s_name, bench_fault e_fault, max30102_status e_expected)
+{
+  max30102_sim s_sim;
+  max30102_hal s_hal;
+  bench_fault_bus s_bus;
+  max30102_status e_status;
+
+  max30102_sim_init(&s_sim, bench_ramp_source, NULL);
+  max30102_sim_hal(&s_sim, &s_bus.s_sim_hal);
+  s_bus.ps_sim = &s_sim;
+  s_bus.e_fault = e_fault;
+  s_hal = s_bus.s_sim_hal;
+  s_hal.p_context = &s_bus;
+  s_hal.begin = NULL;
+  s_hal.write = bench_fault_write;
+  s_hal.read = bench_fault_read;
+  s_hal.delay_ms = bench_fault_delay_ms;
+  s_hal.millis = bench_fault_millis;
+  s_hal.int_asserted = NULL;
+  maxim_max30102_set_hal(&s_hal);
+  e_status = maxim_max30102_configure();
+  printf("driver\tinit-%-10s\t%6.2f ms simulated\t%3u transactions, %4u bytes\t%s\n", s_name, s_sim.ul_now_us / 1000.0,
+      (unsigned)s_sim.s_stats.un_transactions, (unsigned)s_sim.s_stats.un_bytes, maxim_max30102_status_name(e_status));
+  return e_status == e_expected && (e_status != MAX30102_OK || s_sim.ul_now_us < 10000);
+}
+
+bool bench_driver()
+{
+  static const uint8_t auch_red_ir[MAX30102_MAX_SLOTS] = { MAX30102_SLOT_RED, MAX30102_SLOT_IR };
+  static const uint8_t auch_ir_red[MAX30102_MAX_SLOTS] = { MAX30102_SLOT_IR, MAX30102_SLOT_RED };
+  static const uint8_t auch_ir[MAX30102_MAX_SLOTS] = { MAX30102_SLOT_IR };
+  static const uint8_t auch_ir_ir[MAX30102_MAX_SLOTS] = { MAX30102_SLOT_IR, MAX30102_SLOT_IR };
+  static const uint8_t auch_none[MAX30102_MAX_SLOTS] = { MAX30102_SLOT_NONE };
+  double d_spo2, d_hr, d_other;
+  bool b_pass = bench_case("burst", BENCH_BURST, 0);
+  b_pass &= bench_case("single", BENCH_SINGLE, 0);
+  b_pass &= bench_case("burst-1.5s", BENCH_BURST, 1500); // polled at ACQ_POLL_TIMEOUT_MS, FIFO overflows
+  b_pass &= bench_case("burst-full", BENCH_BURST, 0, true); // 32 samples, wr == rd
+  b_pass &= bench_case("ring-wrap", BENCH_RING, 0, true);
+
+  b_pass &= bench_mode_case("spo2", MAX30102_MODE_SPO2, NULL, false, &d_spo2);
+  b_pass &= bench_mode_case("hr", MAX30102_MODE_HR, NULL, false, &d_hr);
+  b_pass &= bench_mode_case("multi-rdir", MAX30102_MODE_MULTI_LED, auch_red_ir, false, &d_other);
+  b_pass &= bench_mode_case("multi-irrd", MAX30102_MODE_MULTI_LED, auch_ir_red, false, &d_other);
+  b_pass &= bench_mode_case("multi-ir", MAX30102_MODE_MULTI_LED, auch_ir, false, &d_other);
+  b_pass &= bench_mode_case("spo2->hr", MAX30102_MODE_HR, NULL, true, &d_other);
+  b_pass &= bench_mode_case("spo2->ir", MAX30102_MODE_MULTI_LED, auch_ir, true, &d_other);
+  b_pass &= d_hr <= 0.6 * d_spo2; // half the FIFO bytes, plus the same per-burst overhead
+  // an LED twice or no slot at all cannot be decoded into red/IR
+  b_pass &= !maxim_max30102_set_mode(MAX30102_MODE_MULTI_LED, auch_ir_ir) && !maxim_max30102_set_mode(MAX30102_MODE_MULTI_LED, auch_none)
+      && !maxim_max30102_set_mode(MAX30102_MODE_MULTI_LED, NULL) && !maxim_max30102_set_mode(0x05, NULL);
+  b_pass &= bench_hr_only_stream();
+
+  b_pass &= bench_init_case("ok", BENCH_FAULT_NONE, MAX30102_OK); // was a 1 s delay and 13 single register transfers
+  b_pass &= bench_init_case("late-power", BENCH_FAULT_LATE_POWER, MAX30102_OK);
+  b_pass &= bench_init_case("absent", BENCH_FAULT_ABSENT, MAX30102_ERR_BUS);
+  b_pass &= bench_init_case("part-id", BENCH_FAULT_PART_ID, MAX30102_ERR_PART_ID);
+  b_pass &= bench_init_case("stuck-reset", BENCH_FAULT_STUCK_RESET, MAX30102_ERR_RESET_TIMEOUT);
+  b_pass &= bench_init_case("bad-write", BENCH_FAULT_WRITE, MAX30102_ERR_VERIFY);
+  return b_pass;
+}
@@ -0,0 +1,154 @@
+/*
+ * Duty-cycled acquisition (lib/duty) against the simulated sensor clock
+ * The MCU is modelled as the firmware built with -DDUTY_CYCLE runs it: asleep
+ * until INT (or the 1.5 s poll timer), a light sleep exit, a burst drain, the
+ * work on the drained samples, duty_done() and back to sleep. The work is a
+ * fixed cost per sample plus one estimate per 25 samples, as rf_stream_push()
+ * produces one per FS samples. Two minutes per case at 25 to 400 sps.
+ * - adaptive: the threshold from duty_done(); must never drop a sample, from
+ *   the first wake on
+ * - fixed 2: the init table's FIFO_A_FULL throughout (drops above 100 sps)
+ * - fixed 15: the earliest interrupt the FIFO offers, safe but twice the wakeups
+ * Reports wakeups/s, the awake fraction (wake + drain + compute, from the
+ * simulated clock) and the FIFO_A_FULL reached. Sleep power itself is not
+ * modelled: the awake fraction is what the sleep current multiplies.
+ */
+#include "bench.h"
+#include <duty.h>
+#include <max30102.h>
+#include <max30102_sim.h>
+#include <stdio.h>
+
+#define BENCH_DUTY_SECONDS 120
+#define BENCH_DUTY_STEP_US 100 // sleep resolution
+#define BENCH_DUTY_POLL_US 1500000 // ACQ_POLL_TIMEOUT_MS
+#define BENCH_DUTY_HOP 25 // samples per estimate
+#define BENCH_DUTY_WIRE_BUFFER 128
+
+struct bench_duty_case {
+  const char* s_name;
+  uint8_t uch_sample_rate; // SPO2_SR[2:0]: 1 = 100 sps, 3 = 400 sps
+  uint8_t uch_average;     // SMP_AVE[2:0]: 0 = none, 2 = 4 samples
+  uint32_t un_wake_us;     // actual light sleep exit, duty_config keeps its default
+  uint32_t un_sample_us;   // compute per drained sample
+  uint32_t un_estimate_us; // compute per estimate
+};
+
+struct bench_duty_result {
+  float f_wakeups_per_s, f_awake;
+  uint32_t un_dropped, un_full_drains, un_short_lead, un_changes;
+  uint8_t uch_a_full;
+};
+
+static float bench_duty_source(void* p_context, uint8_t uch_led, float f_led_ma, uint64_t ul_time_us)
+{
+  (void)p_context;
+  (void)f_led_ma;
+  (void)ul_time_us;
+  return uch_led == MAX30102_SIM_LED_IR ? 900.0f : 600.0f;
+}
+
+// n_fixed_a_full < 0: follow duty_done(), else keep that FIFO_A_FULL
+static bool bench_duty_run(const bench_duty_case& s_case, int n_fixed_a_full, bench_duty_result* ps_result)
+{
+  max30102_sim s_sim;
+  max30102_hal s_hal;
+  duty_config s_cfg;
+  duty_scheduler s_sched;
+  uint32_t aun_red[MAX30102_FIFO_DEPTH], aun_ir[MAX30102_FIFO_DEPTH];
+  uint32_t un_since_estimate = 0;
+  uint64_t ul_start, ul_sleep, ul_t;
+  uint8_t uch_reg, uch_num, uch_a_full;
+
+  max30102_sim_init(&s_sim, bench_duty_source, NULL);
+  max30102_sim_hal(&s_sim, &s_hal);
+  s_hal.uw_max_read = BENCH_DUTY_WIRE_BUFFER;
+  maxim_max30102_set_hal(&s_hal);
+  if (!maxim_max30102_init())
+    return false;
+  maxim_max30102_read_reg(REG_SPO2_CONFIG, &uch_reg);
+  maxim_max30102_write_reg(REG_SPO2_CONFIG, (uch_reg & ~0x1C) | s_case.uch_sample_rate << 2);
+  maxim_max30102_read_reg(REG_FIFO_CONFIG, &uch_reg);
+  maxim_max30102_write_reg(REG_FIFO_CONFIG, (uch_reg & ~0xE0) | s_case.uch_average << 5);
+  maxim_max30102_write_reg(REG_FIFO_WRITE_POINTER, 0);
+  maxim_max30102_write_reg(REG_OVERFLOW_COUNTER, 0);
+  maxim_max30102_write_reg(REG_FIFO_READ_POINTER, 0);
+  maxim_max30102_read_reg(REG_INTR_STATUS_1, &uch_num);
+
+  duty_default_config(&s_cfg, max30102_sim_sample_period_us(&s_sim));
+  uch_a_full = duty_init(&s_sched, &s_cfg);
+  if (!maxim_max30102_set_fifo_a_full(n_fixed_a_full < 0 ? uch_a_full : (uint8_t)n_fixed_a_full))
+    return false;
+  s_sim.s_stats = max30102_sim_stats();
+  ul_start = s_sim.ul_now_us;
+  while (s_sim.ul_now_us - ul_start < (uint64_t)BENCH_DUTY_SECONDS * 1000000) {
+    uint32_t un_compute = 0;
+    ul_sleep = s_sim.ul_now_us;
+    while (!max30102_sim_int_asserted(&s_sim) && s_sim.ul_now_us - ul_sleep < BENCH_DUTY_POLL_US)
+      max30102_sim_advance_us(&s_sim, BENCH_DUTY_STEP_US);
+    max30102_sim_advance_us(&s_sim, s_case.un_wake_us);
+    duty_wake(&s_sched, (uint32_t)s_sim.ul_now_us, true);
+    // as loop(): drain, work on the samples, drain again if INT fell meanwhile
+    do {
+      ul_t = s_sim.ul_now_us;
+      if (!maxim_max30102_read_fifo_burst(aun_red, aun_ir, MAX30102_FIFO_DEPTH, &uch_num))
+        return false;
+      duty_drained(&s_sched, (uint32_t)(s_sim.ul_now_us - ul_t), uch_num);
+      ul_t = s_sim.ul_now_us;
+      max30102_sim_advance_us(&s_sim, (uint64_t)uch_num * s_case.un_sample_us);
+      for (un_since_estimate += uch_num; un_since_estimate >= BENCH_DUTY_HOP; un_since_estimate -= BENCH_DUTY_HOP)
+        max30102_sim_advance_us(&s_sim, s_case.un_estimate_us);
+      un_compute += (uint32_t)(s_sim.ul_now_us - ul_t);
+    } while (max30102_sim_int_asserted(&s_sim));
+    if (duty_done(&s_sched, un_compute, &uch_a_full) && n_fixed_a_full < 0
+        && !maxim_max30102_set_fifo_a_full(uch_a_full))
+      return false;
+  }
+  ps_result->f_wakeups_per_s = duty_wakeups_per_s(&s_sched);
+  ps_result->f_awake = duty_awake_fraction(&s_sched);
+  ps_result->un_dropped = s_sim.s_stats.un_samples_dropped;
+  ps_result->un_full_drains = s_sched.s_stats.un_full_drains;
+  ps_result->un_short_lead = s_sched.s_stats.un_short_lead;
+  ps_result->un_changes = s_sched.s_stats.un_threshold_changes;
+  maxim_max30102_read_reg(REG_FIFO_CONFIG, &uch_reg);
+  ps_result->uch_a_full = uch_reg & 0x0F;
+  return true;
+}
+
+static void bench_duty_print(const bench_duty_case& s_case, uint32_t un_sps, const char* s_mode, const bench_duty_result& s_result)
+{
+  printf("duty\t%s\t%u sps\t%s\tFIFO_A_FULL %u\t%.2f wakeups/s\tawake %.2f%%\tdropped %u\tfull drains %u\n", s_case.s_name,
+      (unsigned)un_sps, s_mode, s_result.uch_a_full, s_result.f_wakeups_per_s, 100.0f * s_result.f_awake, (unsigned)s_result.un_dropped,
+      (unsigned)s_result.un_full_drains);
+}
+
+bool bench_duty()
+{
+  // ESP8266 at 80 MHz: ~12 ms light sleep exit including the 10 ms delay(), ~40 ms per estimate
+  static const bench_duty_case as_cases[] = {
+    { "firmware", 1, 2, 11000, 60, 40000 },
+    { "100sps", 1, 0, 11000, 60, 40000 },
+    { "200sps", 2, 0, 11000, 60, 40000 },
+    { "400sps", 3, 0, 11000, 60, 30000 },
+    { "slow-wake", 3, 0, 25000, 60, 30000 },
+  };
+  static const uint32_t aun_sps[] = { 50, 100, 200, 400 };
+  bench_duty_result s_adaptive, s_fixed2, s_fixed15;
+  bool b_pass = true;
+  size_t i;
+
+  for (i = 0; i < sizeof(as_cases) / sizeof(as_cases[0]); i++) {
+    const bench_duty_case& s_case = as_cases[i];
+    uint32_t un_sps = aun_sps[s_case.uch_sample_rate] >> s_case.uch_average;
+    if (!bench_duty_run(s_case, -1, &s_adaptive) || !bench_duty_run(s_case, 2, &s_fixed2) || !bench_duty_run(s_case, 15, &s_fixed15))
+      return false;
+    bench_duty_print(s_case, un_sps, "adaptive", s_adaptive);
+    bench_duty_print(s_case, un_sps, "fixed", s_fixed2);
+    bench_duty_print(s_case, un_sps, "fixed", s_fixed15);
+    // never drops, and never wakes more often than the earliest threshold
+    b_pass &= s_adaptive.un_dropped == 0 && s_adaptive.un_short_lead == 0 && s_adaptive.f_wakeups_per_s <= s_fixed15.f_wakeups_per_s * 1.01f;
+    printf("duty\t%s\t%u sps\tadaptive\t%u threshold changes, %.0f%% of the fixed 15 wakeups\n", s_case.s_name, (unsigned)un_sps,
+        (unsigned)s_adaptive.un_changes, 100.0f * s_adaptive.f_wakeups_per_s / s_fixed15.f_wakeups_per_s);
+  }
+  return b_pass;
+}
@@ -0,0 +1,110 @@
+/*
+ * Fixed-point vs. float RF estimator
+ * Runs both over the same corpus of synthetic recordings and reports their
+ * HR/SpO2 disagreement and cycles per window. Fails if the disagreement
+ * exceeds the stated tolerance.
+ * - hr-only: windows without red (NULL): correl 1 and SpO2 invalid
+ *   from both, heart rate within the same tolerances
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_FIXED_SUBJECTS 200
+#define BENCH_FIXED_WINDOWS 10 // consecutive windows per subject, both estimators keep state between them
+#define BENCH_FIXED_HR_TOLERANCE 2 // bpm
+#define BENCH_FIXED_SPO2_TOLERANCE 0.5 // %
+#define BENCH_FIXED_VALIDITY_AGREEMENT 0.98 // fraction of windows both must call valid/invalid alike
+
+static void bench_fixed_window(uint32_t* pun_ir, uint32_t* pun_red, int32_t n_first, float f_bpm, float f_ratio, float f_noise, float f_trend)
+{
+  const float f_ir_dc = 120000, f_red_dc = 90000, f_ir_ac = 0.01f;
+  int32_t k;
+  for (k = 0; k < BUFFER_SIZE; ++k) {
+    float t = (float)(n_first + k) / FS;
+    float f_pulse = sinf(2 * M_PI * f_bpm / 60 * t) + 0.4f * sinf(4 * M_PI * f_bpm / 60 * t + 0.7f);
+    float f_noise_ir = f_noise * ((rand() % 2001) - 1000) / 1000.0f;
+    float f_noise_red = f_noise * ((rand() % 2001) - 1000) / 1000.0f;
+    pun_ir[k] = (uint32_t)(f_ir_dc * (1 + f_ir_ac * f_pulse) + f_trend * t + f_noise_ir);
+    pun_red[k] = (uint32_t)(f_red_dc * (1 + f_ratio * f_ir_ac * f_pulse) + f_trend * t + f_noise_red);
+  }
+}
+
+static bool bench_fixed_hr_only()
+{
+  static uint32_t aun_ir[BUFFER_SIZE], aun_red[BUFFER_SIZE];
+  static rf_channel_state s_float, s_fixed;
+  float f_spo2, f_spo2_q, f_ratio, f_ratio_q, f_correl, f_correl_q;
+  int32_t n_hr, n_hr_q, n_max_dhr = 0, n_windows = 0, n_agree = 0, n_valid = 0, n_wrong = 0, i, w;
+  int8_t ch_spo2_valid, ch_spo2_valid_q, ch_hr_valid, ch_hr_valid_q;
+
+  srand(11);
+  for (i = 0; i < BENCH_FIXED_SUBJECTS / 4; ++i) {
+    float f_bpm = 45 + rand() % 125;
+    float f_noise = (rand() % 4) * 100.0f;
+    float f_trend = (rand() % 200) - 100.0f;
+    rf_channel_init(&s_float);
+    rf_channel_init(&s_fixed);
+    for (w = 0; w < BENCH_FIXED_WINDOWS; ++w, ++n_windows) {
+      bench_fixed_window(aun_ir, aun_red, w * BUFFER_SIZE, f_bpm, 0.5f, f_noise, f_trend);
+      rf_heart_rate_and_oxygen_saturation_r(&s_float, aun_ir, BUFFER_SIZE, NULL, &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+      rf_heart_rate_and_oxygen_saturation_fixed_r(&s_fixed, aun_ir, BUFFER_SIZE, NULL, &f_spo2_q, &ch_spo2_valid_q, &n_hr_q, &ch_hr_valid_q, &f_ratio_q,
+          &f_correl_q);
+      n_wrong += ch_spo2_valid || ch_spo2_valid_q || f_correl != 1.0f || f_correl_q != 1.0f;
+      if (ch_hr_valid == ch_hr_valid_q)
+        n_agree++;
+      if (ch_hr_valid && ch_hr_valid_q) {
+        n_valid++;
+        if (abs(n_hr - n_hr_q) > n_max_dhr)
+          n_max_dhr = abs(n_hr - n_hr_q);
+      }
+    }
+  }
+  bool b_pass = n_wrong == 0 && n_valid > 0 && n_max_dhr <= BENCH_FIXED_HR_TOLERANCE && n_agree >= BENCH_FIXED_VALIDITY_AGREEMENT * n_windows;
+  printf("fixed\thr-only\tvalidity agreement %d/%d\tboth valid %d\tmax |dHR| %d bpm (tol %d)\t%d with SpO2 or correl != 1\t%s\n", n_agree, n_windows,
+      n_valid, n_max_dhr, BENCH_FIXED_HR_TOLERANCE, n_wrong, b_pass ? "PASS" : "FAIL");
+  return b_pass;
+}
+
+bool bench_fixed()
+{
+  static uint32_t aun_ir[BUFFER_SIZE], aun_red[BUFFER_SIZE];
+  float f_spo2, f_spo2_q, f_ratio, f_ratio_q, f_correl, f_correl_q, f_max_dspo2 = 0;
+  int32_t n_hr, n_hr_q, n_max_dhr = 0, n_windows = 0, n_agree = 0, n_both_valid = 0, i, w;
+  int8_t ch_spo2_valid, ch_spo2_valid_q, ch_hr_valid, ch_hr_valid_q;
+  uint64_t ul_start, ul_float = 0, ul_fixed = 0;
+
+  srand(7);
+  for (i = 0; i < BENCH_FIXED_SUBJECTS; ++i) {
+    float f_bpm = 45 + rand() % 125;
+    float f_r = 0.4f + (rand() % 600) / 1000.0f;
+    float f_noise = (rand() % 4) * 100.0f;
+    float f_trend = (rand() % 200) - 100.0f;
+    for (w = 0; w < BENCH_FIXED_WINDOWS; ++w, ++n_windows) {
+      bench_fixed_window(aun_ir, aun_red, w * BUFFER_SIZE, f_bpm, f_r, f_noise, f_trend);
+      ul_start = bench_cycles();
+      rf_heart_rate_and_oxygen_saturation(aun_ir, BUFFER_SIZE, aun_red, &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+      ul_float += bench_cycles() - ul_start;
+      ul_start = bench_cycles();
+      rf_heart_rate_and_oxygen_saturation_fixed(aun_ir, BUFFER_SIZE, aun_red, &f_spo2_q, &ch_spo2_valid_q, &n_hr_q, &ch_hr_valid_q, &f_ratio_q, &f_correl_q);
+      ul_fixed += bench_cycles() - ul_start;
+      if (ch_hr_valid == ch_hr_valid_q && ch_spo2_valid == ch_spo2_valid_q)
+        n_agree++;
+      if (ch_hr_valid && ch_hr_valid_q && ch_spo2_valid && ch_spo2_valid_q) {
+        n_both_valid++;
+        if (abs(n_hr - n_hr_q) > n_max_dhr)
+          n_max_dhr = abs(n_hr - n_hr_q);
+        if (fabsf(f_spo2 - f_spo2_q) > f_max_dspo2)
+          f_max_dspo2 = fabsf(f_spo2 - f_spo2_q);
+      }
+    }
+  }
+  bool b_pass = n_max_dhr <= BENCH_FIXED_HR_TOLERANCE && f_max_dspo2 <= BENCH_FIXED_SPO2_TOLERANCE
+      && n_agree >= BENCH_FIXED_VALIDITY_AGREEMENT * n_windows;
+  printf("fixed\tfloat %8.0f cycles/window\tfixed %8.0f cycles/window\n", (double)ul_float / n_windows, (double)ul_fixed / n_windows);
+  printf("fixed\tvalidity agreement %d/%d\tboth valid %d\tmax |dHR| %d bpm (tol %d)\tmax |dSpO2| %.3f %% (tol %.1f)\t%s\n", n_agree, n_windows,
+      n_both_valid, n_max_dhr, BENCH_FIXED_HR_TOLERANCE, f_max_dspo2, BENCH_FIXED_SPO2_TOLERANCE, b_pass ? "PASS" : "FAIL");
+  return bench_fixed_hr_only() && b_pass;
+}
@@ -0,0 +1,157 @@
+/*
+ * Multi-device ingest (lib/ingest) against a fake fleet (ingest_fleet)
+ * 256 simulated nodes: 192 on PTYs opened like USB serial ports, 64 over
+ * loopback TCP, each sending framed telemetry of a different heart rate.
+ * - paced: 10x real time, the latency a live deployment would see
+ * - flat-out: the devices send as fast as the server reads, windows/s and MB/s
+ * - portable: flat-out with rf_batch limited to its portable kernels (what a
+ *   non-x86 host gets), which must not batch: they are slower than scalar
+ * Every stream must yield every window, nothing lost or dropped, and each
+ * device's mean estimated heart rate must match what it simulates.
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <ingest.h>
+#include <rf_batch.h>
+#include <ingest_fleet.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#define BENCH_INGEST_PTY 192
+#define BENCH_INGEST_TCP 64
+#define BENCH_INGEST_DEVICES (BENCH_INGEST_PTY + BENCH_INGEST_TCP)
+#define BENCH_INGEST_TIMEOUT_S 120
+
+struct bench_ingest_sums {
+  double f_hr_sum;             // valid estimates only
+  uint32_t un_hr_valid;
+};
+
+static void bench_ingest_result(void* p_context, const ingest_result* ps_result)
+{
+  // windows of one stream never run concurrently, so per-stream sums need no lock
+  bench_ingest_sums* ps_sums = (bench_ingest_sums*)p_context + ps_result->n_stream;
+  if (ps_result->ch_hr_valid) {
+    ps_sums->f_hr_sum += ps_result->n_heart_rate;
+    ps_sums->un_hr_valid++;
+  }
+}
+
+static uint64_t bench_ingest_samples(ingest_server* ps_server)
+{
+  ingest_stream_stats s_stats;
+  uint64_t ul_samples = 0;
+  for (int32_t i = 0; ingest_stream_stats_get(ps_server, i, &s_stats); i++)
+    ul_samples += s_stats.ul_samples;
+  return ul_samples;
+}
+
+static bool bench_ingest_case(const char* s_name, float f_speed, uint32_t un_seconds, rf_batch_isa e_isa)
+{
+  static bench_ingest_sums as_sums[BENCH_INGEST_DEVICES];
+  ingest_server s_server;
+  ingest_config s_config;
+  ingest_fleet s_fleet;
+  ingest_fleet_config s_fleet_config;
+  ingest_stream_stats s_stats;
+  const uint32_t un_samples = un_seconds * FS;
+  const uint32_t un_expected = (un_samples - BUFFER_SIZE) / FS + 1;
+  uint64_t ul_start, ul_ns, ul_deadline, ul_bytes = 0, ul_latency_sum = 0, ul_latency_max = 0, ul_p50_max = 0, ul_p99_max = 0;
+  uint32_t un_windows = 0, un_valid = 0, un_batched = 0, un_incomplete = 0, un_lost = 0, un_dropped = 0, un_pauses = 0, un_errors = 0, un_off = 0;
+  float f_err, f_err_max = 0.0f;
+  int32_t i, n_device, n_streams;
+  bool b_pass = true;
+
+  memset(as_sums, 0, sizeof(as_sums));
+  rf_batch_set_isa(e_isa);
+  ingest_default_config(&s_config);
+  s_config.handler = bench_ingest_result;
+  s_config.p_context = as_sums;
+  if (!ingest_init(&s_server, &s_config) || !ingest_listen_tcp(&s_server, "127.0.0.1", 0)) {
+    printf("ingest\t%s\tcannot set up epoll or the TCP listener\n", s_name);
+    return false;
+  }
+  ingest_fleet_default_config(&s_fleet_config);
+  s_fleet_config.n_pty_devices = BENCH_INGEST_PTY;
+  s_fleet_config.n_tcp_devices = BENCH_INGEST_TCP;
+  s_fleet_config.uw_tcp_port = ingest_tcp_port(&s_server);
+  s_fleet_config.f_speed = f_speed;
+  s_fleet_config.un_seconds = un_seconds;
+  if (!ingest_fleet_open(&s_fleet, &s_fleet_config)) {
+    printf("ingest\t%s\tcannot open the fleet's PTYs or connections\n", s_name);
+    ingest_fleet_close(&s_fleet);
+    ingest_shutdown(&s_server);
+    return false;
+  }
+  for (i = 0; i < BENCH_INGEST_PTY; i++)
+    b_pass &= ingest_add_serial(&s_server, ingest_fleet_name(&s_fleet, i), 921600) >= 0;
+
+  ul_start = bench_ns();
+  ul_deadline = ul_start + BENCH_INGEST_TIMEOUT_S * 1000000000ull;
+  ingest_fleet_start(&s_fleet);
+  // until every sample arrived, then hang up and wait for the last estimates
+  while (bench_ingest_samples(&s_server) < (uint64_t)un_samples * BENCH_INGEST_DEVICES && bench_ns() < ul_deadline)
+    ingest_poll(&s_server, 20);
+  ingest_drain(&s_server);
+  ul_ns = bench_ns() - ul_start;
+
+  n_streams = ingest_stream_count(&s_server);
+  for (i = 0; i < n_streams; i++) {
+    ingest_stream_stats_get(&s_server, i, &s_stats);
+    ul_bytes += s_stats.ul_bytes;
+    un_windows += s_stats.un_windows;
+    un_valid += s_stats.un_hr_valid;
+    un_batched += s_stats.un_batched;
+    un_incomplete += s_stats.un_windows != un_expected || s_stats.ul_samples != un_samples || s_stats.f_sample_rate != FS;
+    un_lost += s_stats.un_lost_frames + s_stats.un_missing_samples;
+    un_errors += s_stats.un_crc_errors;
+    un_dropped += s_stats.un_dropped_windows;
+    un_pauses += s_stats.un_pauses;
+    ul_latency_sum += s_stats.ul_latency_sum_ns;
+    if (s_stats.ul_latency_max_ns > ul_latency_max)
+      ul_latency_max = s_stats.ul_latency_max_ns;
+    if (ingest_latency_percentile_us(&s_stats, 0.5f) > ul_p50_max)
+      ul_p50_max = ingest_latency_percentile_us(&s_stats, 0.5f);
+    if (ingest_latency_percentile_us(&s_stats, 0.99f) > ul_p99_max)
+      ul_p99_max = ingest_latency_percentile_us(&s_stats, 0.99f);
+    // the stream's device: PTYs were added in order, TCP connections are known by address
+    for (n_device = 0; n_device < BENCH_INGEST_DEVICES && strcmp(ingest_fleet_name(&s_fleet, n_device), s_stats.s_name) != 0; n_device++)
+      ;
+    if (n_device == BENCH_INGEST_DEVICES || as_sums[i].un_hr_valid == 0) {
+      un_off++;
+      continue;
+    }
+    f_err = fabsf((float)(as_sums[i].f_hr_sum / as_sums[i].un_hr_valid) - ingest_fleet_heart_rate(&s_fleet, n_device));
+    if (f_err > f_err_max)
+      f_err_max = f_err;
+    un_off += f_err > 5.0f || as_sums[i].un_hr_valid < 0.9f * s_stats.un_windows;
+  }
+  b_pass &= !s_fleet.b_write_error;
+  ingest_fleet_close(&s_fleet);
+  while (ingest_open_streams(&s_server) > 0 && bench_ns() < ul_deadline)
+    ingest_poll(&s_server, 20);
+  b_pass &= ingest_open_streams(&s_server) == 0; // every hang-up was noticed
+
+  printf("ingest\t%-8s\t%d streams (%d PTY, %d TCP) x %u s at %s\t%.2f s\t%8.0f windows/s\t%.2f MB/s\tlatency mean %.2f ms, p50 <%.2f ms, "
+         "p99 <%.2f ms, max %.2f ms\tHR valid %.1f%%, worst mean error %.2f bpm\t%u windows of %u\t%u incomplete, %u off, %u lost, %u errors, "
+         "%u dropped, %u pauses\t%s, %u batched\n",
+      s_name, n_streams, BENCH_INGEST_PTY, BENCH_INGEST_TCP, un_seconds, f_speed > 0.0f ? "paced" : "full speed", ul_ns / 1e9, un_windows / (ul_ns / 1e9),
+      ul_bytes / (ul_ns / 1e3), un_windows ? ul_latency_sum / 1e6 / un_windows : 0.0, ul_p50_max / 1e3, ul_p99_max / 1e3, ul_latency_max / 1e6,
+      un_windows ? 100.0 * un_valid / un_windows : 0.0, f_err_max, un_windows, un_expected * BENCH_INGEST_DEVICES, un_incomplete, un_off, un_lost,
+      un_errors, un_dropped, un_pauses, rf_batch_isa_name(e_isa), un_batched);
+  ingest_shutdown(&s_server);
+  b_pass &= e_isa != RF_BATCH_PORTABLE || un_batched == 0;
+  return b_pass && n_streams == BENCH_INGEST_DEVICES && un_incomplete == 0 && un_off == 0 && un_lost == 0 && un_errors == 0 && un_dropped == 0;
+}
+
+bool bench_ingest()
+{
+  const rf_batch_isa e_default = rf_batch_get_isa();
+  bool b_pass = bench_ingest_case("paced", 10.0f, 60, e_default);
+  b_pass &= bench_ingest_case("flat-out", 0.0f, 120, e_default);
+  b_pass &= bench_ingest_case("portable", 0.0f, 120, RF_BATCH_PORTABLE);
+  rf_batch_set_isa(e_default);
+  return b_pass;
+}
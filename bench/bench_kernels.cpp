@@ -0,0 +1,177 @@
+/*
+ * DSP kernel microbenchmarks, algorithmRF half (the Maxim half is in
+ * bench_kernels_maxim.cpp)
+ * Every kernel and both pipelines run over 4 s windows at 25, 50, 100 and
+ * 200 Hz (N = 100 .. 800) of ppg_synth windows and, if BENCH_RECORDING names a
+ * text file of "red ir" lines, of recorded data. Reports ns/call, windows/s
+ * and the slowest call; rows go to bench_record() for --out / --baseline.
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <ppg_synth.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#define BENCH_KERNEL_WINDOWS 64
+#define BENCH_KERNEL_CALLS 8192
+
+void bench_ppg_window(uint32_t* pun_ir, uint32_t* pun_red, int32_t n_size, float f_fs, uint32_t un_seed)
+/*
+ * One window of ppg_synth output, heart rate 45..170 bpm picked by the seed
+ */
+{
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.un_seed = un_seed + 1;
+  s_cfg.f_fs = f_fs;
+  s_cfg.f_hr_bpm = 45.0f + (float)((un_seed * 2654435761u) >> 16) * 125.0f / 65536.0f;
+  ppg_synth_init(&s_synth, &s_cfg);
+  ppg_synth_fill(&s_synth, pun_red, pun_ir, n_size);
+}
+
+int32_t bench_recorded_windows(int32_t n_size, std::vector<uint32_t>& aun_ir, std::vector<uint32_t>& aun_red)
+/*
+ * Cuts the BENCH_RECORDING file into consecutive windows of n_size samples
+ * Returns the number of windows (at most BENCH_KERNEL_WINDOWS), 0 without a recording
+ */
+{
+  const char* s_path = getenv("BENCH_RECORDING");
+  unsigned long ul_red, ul_ir;
+  int32_t n_samples = 0;
+  char s_line[128];
+  FILE* p_file;
+
+  aun_ir.clear();
+  aun_red.clear();
+  if (s_path == NULL || (p_file = fopen(s_path, "r")) == NULL)
+    return 0;
+  while (n_samples < n_size * BENCH_KERNEL_WINDOWS && fgets(s_line, sizeof(s_line), p_file)) {
+    if (sscanf(s_line, "%lu%*[ ,\t]%lu", &ul_red, &ul_ir) != 2)
+      continue;
+    aun_red.push_back((uint32_t)ul_red);
+    aun_ir.push_back((uint32_t)ul_ir);
+    n_samples++;
+  }
+  fclose(p_file);
+  return n_samples / n_size;
+}
+
+void bench_kernel_report(const char* s_kernel, const char* s_source, int32_t n_size, const bench_timing& s_timing)
+{
+  char s_case[96];
+  snprintf(s_case, sizeof(s_case), "%s/%s", s_kernel, s_source);
+  printf("kernels\t%-40s\tN=%4d\t%10.1f ns/call\t%10.0f windows/s\tworst %10.1f ns\n", s_case, (int)n_size,
+      s_timing.f_mean_ns, 1e9 / s_timing.f_mean_ns, s_timing.f_worst_ns);
+  bench_record("kernels", s_case, n_size, s_timing);
+}
+
+template <class CFG>
+static void bench_rf_kernels(const char* s_source, const uint32_t* pun_ir, const uint32_t* pun_red, int32_t n_windows)
+{
+  const int32_t N = CFG::buffer_size;
+  std::vector<float> af_ir(N * n_windows), af_red(N * n_windows), af_sumsq(n_windows), af_aut(N);
+  std::vector<int32_t> an_fixed(N * n_windows);
+  static rf_channel_state_t<CFG> s_channel;
+  static rf_channel_state s_default_channel;
+  static rf_stream_state s_stream;
+  float f_spo2, f_ratio, f_correl, f_sumsq;
+  int32_t n_hr, w, k;
+  int8_t ch_spo2_valid, ch_hr_valid;
+
+  // detrended windows as the pipeline sees them
+  for (w = 0; w < n_windows; w++) {
+    float *pf_ir = &af_ir[w * N], *pf_red = &af_red[w * N], f_ir_mean = 0.0f, f_red_mean = 0.0f, f_beta;
+    for (k = 0; k < N; k++) {
+      f_ir_mean += pun_ir[w * N + k];
+      f_red_mean += pun_red[w * N + k];
+    }
+    f_ir_mean /= N;
+    f_red_mean /= N;
+    for (k = 0; k < N; k++) {
+      pf_ir[k] = pun_ir[w * N + k] - f_ir_mean;
+      pf_red[k] = pun_red[w * N + k] - f_red_mean;
+      an_fixed[w * N + k] = (int32_t)pf_ir[k];
+    }
+    f_beta = rf_linear_regression_beta(pf_ir, CFG::mean_x, CFG::sum_x2);
+    for (k = 0; k < N; k++)
+      pf_ir[k] -= f_beta * (k - CFG::mean_x);
+    rf_rms(pf_ir, N, &af_sumsq[w]);
+  }
+
+  auto ir = [&](int32_t i) { return &af_ir[(i % n_windows) * N]; };
+  bench_kernel_report("rf_linear_regression_beta", s_source, N,
+      bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) { bench_keep(rf_linear_regression_beta(ir(i), CFG::mean_x, CFG::sum_x2)); }));
+  bench_kernel_report("rf_autocorrelation", s_source, N,
+      bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) { bench_keep(rf_autocorrelation(ir(i), N, CFG::lowest_period + i % (CFG::highest_period - CFG::lowest_period))); }));
+  bench_kernel_report("rf_rms", s_source, N,
+      bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) { bench_keep(rf_rms(ir(i), N, &f_sumsq)); }));
+  bench_kernel_report("rf_Pcorrelation", s_source, N,
+      bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) { bench_keep(rf_Pcorrelation(ir(i), &af_red[(i % n_windows) * N], N)); }));
+  bench_kernel_report("rf_signal_periodicity", s_source, N, bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) {
+    int32_t n_last = CFG::lowest_period;
+    rf_initialize_periodicity_search(ir(i), N, &n_last, CFG::highest_period, min_autocorrelation_ratio, af_sumsq[i % n_windows]);
+    if (n_last != 0)
+      rf_signal_periodicity(ir(i), N, &n_last, CFG::lowest_period, CFG::highest_period, min_autocorrelation_ratio, af_sumsq[i % n_windows], &f_ratio);
+    bench_keep(n_last);
+  }));
+  if (N <= RF_FFT_SIZE / 2) // fixed FFT size
+    bench_kernel_report("rf_autocorrelation_all", s_source, N,
+        bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) { rf_autocorrelation_all(ir(i), N, af_aut.data(), N - 1); bench_keep(af_aut[1]); }));
+  bench_kernel_report("rf_autocorrelation_fixed", s_source, N, bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) {
+    bench_keep(rf_autocorrelation_fixed(&an_fixed[(i % n_windows) * N], N, CFG::lowest_period + i % (CFG::highest_period - CFG::lowest_period)));
+  }));
+
+  rf_channel_init_cfg(&s_channel);
+  bench_kernel_report("rf_pipeline", s_source, N, bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) {
+    rf_heart_rate_and_oxygen_saturation_cfg(&s_channel, pun_ir + (i % n_windows) * N, pun_red + (i % n_windows) * N,
+        &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+    bench_keep(n_hr);
+  }));
+  bench_kernel_report("rf_pipeline_hr_only", s_source, N, bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) {
+    rf_heart_rate_and_oxygen_saturation_cfg(&s_channel, pun_ir + (i % n_windows) * N, (const uint32_t*)NULL,
+        &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+    bench_keep(n_hr);
+  }));
+  if (N != BUFFER_SIZE) // the fixed-point and streaming paths are built for the default configuration only
+    return;
+  rf_channel_init(&s_default_channel);
+  bench_kernel_report("rf_pipeline_fixed", s_source, N, bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) {
+    rf_heart_rate_and_oxygen_saturation_fixed_r(&s_default_channel, (uint32_t*)pun_ir + (i % n_windows) * N, N, (uint32_t*)pun_red + (i % n_windows) * N,
+        &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+    bench_keep(n_hr);
+  }));
+  // one call = one hop of FS samples, which yields one estimate
+  rf_stream_init(&s_stream, FS);
+  bench_kernel_report("rf_stream_push_hop", s_source, N, bench_time(BENCH_KERNEL_CALLS, [&](int32_t i) {
+    const int32_t n_offset = (i * FS) % (N * n_windows);
+    for (int32_t j = 0; j < FS; j++)
+      rf_stream_push(&s_stream, pun_ir[(n_offset + j) % (N * n_windows)], pun_red[(n_offset + j) % (N * n_windows)],
+          &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+    bench_keep(n_hr);
+  }));
+}
+
+template <class CFG>
+static void bench_rf_size()
+{
+  const int32_t N = CFG::buffer_size;
+  std::vector<uint32_t> aun_ir(N * BENCH_KERNEL_WINDOWS), aun_red(N * BENCH_KERNEL_WINDOWS);
+  int32_t n_recorded;
+  for (int32_t w = 0; w < BENCH_KERNEL_WINDOWS; w++)
+    bench_ppg_window(&aun_ir[w * N], &aun_red[w * N], N, (float)CFG::fs, w);
+  bench_rf_kernels<CFG>("synthetic", aun_ir.data(), aun_red.data(), BENCH_KERNEL_WINDOWS);
+  n_recorded = bench_recorded_windows(N, aun_ir, aun_red);
+  if (n_recorded > 0)
+    bench_rf_kernels<CFG>("recorded", aun_ir.data(), aun_red.data(), n_recorded);
+}
+
+bool bench_kernels()
+{
+  bench_rf_size<rf_default_config>();
+  bench_rf_size<rf_config<50, 4> >();
+  bench_rf_size<rf_config<100, 4> >();
+  bench_rf_size<rf_config<200, 4> >();
+  return bench_kernels_maxim();
+}
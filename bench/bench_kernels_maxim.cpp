@@ -0,0 +1,89 @@
+/*
+ * DSP kernel microbenchmarks, Maxim half (see bench_kernels.cpp)
+ * The peak kernels run over the inverted, 4-point averaged IR the pipeline
+ * hands them. maxim_heart_rate_and_oxygen_saturation() is sized by the
+ * MAXIM_BUFFER_SIZE macro and only runs at N = 100.
+ */
+#include "bench.h"
+#include <stdio.h>
+#include <algorithm.h>
+
+#define BENCH_MAXIM_WINDOWS 64
+#define BENCH_MAXIM_CALLS 8192
+#define BENCH_MAXIM_MAX_PEAKS 15
+
+static void bench_maxim_size(const char* s_source, const uint32_t* pun_ir, const uint32_t* pun_red, int32_t n_size, int32_t n_windows)
+{
+  const int32_t n_ma4 = n_size - MA4_SIZE;
+  std::vector<int32_t> an_x(n_size * n_windows), an_th(n_windows), an_locs(BENCH_MAXIM_MAX_PEAKS * n_windows), an_npks(n_windows);
+  static maxim_channel_state s_channel;
+  int32_t an_locs_tmp[BENCH_MAXIM_MAX_PEAKS], n_npks, n_hr, w, k;
+  int8_t ch_spo2_valid, ch_hr_valid;
+  float f_spo2;
+
+  // inverted, DC free, 4-point averaged IR and its clamped mean as in the pipeline
+  for (w = 0; w < n_windows; w++) {
+    int32_t* pn_x = &an_x[w * n_size];
+    uint32_t un_mean = 0;
+    for (k = 0; k < n_size; k++)
+      un_mean += pun_ir[w * n_size + k];
+    un_mean /= n_size;
+    for (k = 0; k < n_size; k++)
+      pn_x[k] = un_mean - pun_ir[w * n_size + k];
+    for (k = 0; k < n_ma4; k++)
+      pn_x[k] = (pn_x[k] + pn_x[k + 1] + pn_x[k + 2] + pn_x[k + 3]) / 4;
+    an_th[w] = 0;
+    for (k = 0; k < n_ma4; k++)
+      an_th[w] += pn_x[k];
+    an_th[w] /= n_ma4;
+    an_th[w] = an_th[w] < 30 ? 30 : an_th[w] > 60 ? 60 : an_th[w];
+    maxim_peaks_above_min_height(&an_locs[w * BENCH_MAXIM_MAX_PEAKS], &an_npks[w], pn_x, n_ma4, an_th[w]);
+  }
+
+  auto x = [&](int32_t i) { return &an_x[(i % n_windows) * n_size]; };
+  bench_kernel_report("maxim_find_peaks", s_source, n_size, bench_time(BENCH_MAXIM_CALLS, [&](int32_t i) {
+    maxim_find_peaks(an_locs_tmp, &n_npks, x(i), n_ma4, an_th[i % n_windows], 4, BENCH_MAXIM_MAX_PEAKS);
+    bench_keep(n_npks);
+  }));
+  bench_kernel_report("maxim_peaks_above_min_height", s_source, n_size, bench_time(BENCH_MAXIM_CALLS, [&](int32_t i) {
+    maxim_peaks_above_min_height(an_locs_tmp, &n_npks, x(i), n_ma4, an_th[i % n_windows]);
+    bench_keep(n_npks);
+  }));
+  // includes copying the candidate list, which the call overwrites
+  bench_kernel_report("maxim_remove_close_peaks", s_source, n_size, bench_time(BENCH_MAXIM_CALLS, [&](int32_t i) {
+    n_npks = an_npks[i % n_windows];
+    for (k = 0; k < n_npks; k++)
+      an_locs_tmp[k] = an_locs[(i % n_windows) * BENCH_MAXIM_MAX_PEAKS + k];
+    maxim_remove_close_peaks(an_locs_tmp, &n_npks, x(i), 4);
+    bench_keep(n_npks);
+  }));
+
+  if (n_size != MAXIM_BUFFER_SIZE)
+    return;
+  maxim_channel_init(&s_channel);
+  bench_kernel_report("maxim_pipeline", s_source, n_size, bench_time(BENCH_MAXIM_CALLS, [&](int32_t i) {
+    maxim_heart_rate_and_oxygen_saturation_r(&s_channel, (uint32_t*)pun_ir + (i % n_windows) * n_size, n_size,
+        (uint32_t*)pun_red + (i % n_windows) * n_size, &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid);
+    bench_keep(n_hr);
+  }));
+}
+
+bool bench_kernels_maxim()
+{
+  static const int32_t an_fs[] = { 25, 50, 100, 200 };
+  std::vector<uint32_t> aun_ir, aun_red;
+  int32_t n_size, n_recorded;
+
+  for (int32_t n_fs : an_fs) {
+    n_size = 4 * n_fs;
+    aun_ir.resize(n_size * BENCH_MAXIM_WINDOWS);
+    aun_red.resize(n_size * BENCH_MAXIM_WINDOWS);
+    for (int32_t w = 0; w < BENCH_MAXIM_WINDOWS; w++)
+      bench_ppg_window(&aun_ir[w * n_size], &aun_red[w * n_size], n_size, (float)n_fs, w);
+    bench_maxim_size("synthetic", aun_ir.data(), aun_red.data(), n_size, BENCH_MAXIM_WINDOWS);
+    n_recorded = bench_recorded_windows(n_size, aun_ir, aun_red);
+    if (n_recorded > 0)
+      bench_maxim_size("recorded", aun_ir.data(), aun_red.data(), n_size, n_recorded);
+  }
+  return true;
+}
@@ -0,0 +1,189 @@
+/*
+ * Low-RAM streaming estimator
+ * - same: rf_packed_push() against rf_stream_push() over a long synthetic
+ *   stream, every estimate must be identical
+ * - batch: rf_stream_push() against rf_heart_rate_and_oxygen_saturation_r()
+ *   on the same windows, hop BUFFER_SIZE and FS; heart rate and validity must
+ *   be identical, SpO2 within BENCH_LOWRAM_SPO2_TOL (integer against float sums)
+ * - cost: time per pushed sample of both
+ * - memory: static RAM of each state and peak stack of a push that produces an
+ *   estimate, measured on a thread whose stack is painted beforehand
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <math.h>
+#include <ppg_synth.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define BENCH_LOWRAM_SAMPLES (FS * 3600)
+#define BENCH_LOWRAM_STACK (256 * 1024)
+#define BENCH_LOWRAM_PAINT 0xA5
+#define BENCH_LOWRAM_SPO2_TOL 1e-3f // % SpO2
+
+struct bench_stack_call {
+  void (*f)(void*);
+  void* p_context;
+};
+
+static void* bench_stack_thread(void* p_call)
+{
+  bench_stack_call* ps_call = (bench_stack_call*)p_call;
+  if (ps_call->f != NULL)
+    ps_call->f(ps_call->p_context);
+  return NULL;
+}
+
+static size_t bench_stack_used(void (*f)(void*), void* p_context)
+{
+  bench_stack_call s_call = { f, p_context };
+  uint8_t* puch_stack = (uint8_t*)aligned_alloc(4096, BENCH_LOWRAM_STACK);
+  pthread_attr_t s_attr;
+  pthread_t s_thread;
+  size_t un_free = 0;
+
+  memset(puch_stack, BENCH_LOWRAM_PAINT, BENCH_LOWRAM_STACK);
+  pthread_attr_init(&s_attr);
+  pthread_attr_setstack(&s_attr, puch_stack, BENCH_LOWRAM_STACK);
+  if (pthread_create(&s_thread, &s_attr, bench_stack_thread, &s_call) == 0) {
+    pthread_join(s_thread, NULL);
+    while (un_free < BENCH_LOWRAM_STACK && puch_stack[un_free] == BENCH_LOWRAM_PAINT) // the stack grows down
+      un_free++;
+  }
+  pthread_attr_destroy(&s_attr);
+  free(puch_stack);
+  return BENCH_LOWRAM_STACK - un_free;
+}
+
+size_t bench_stack_peak(void (*f)(void*), void* p_context)
+/*
+ * Peak stack use of f(p_context) in bytes: the painted stack of a thread that calls it,
+ * minus the same for a thread that calls nothing (thread start-up, TLS)
+ */
+{
+  size_t un_used = bench_stack_used(f, p_context), un_idle = bench_stack_used(NULL, NULL);
+  return un_used > un_idle ? un_used - un_idle : 0;
+}
+
+struct bench_lowram_run {
+  const uint32_t *pun_ir, *pun_red;
+  int32_t n_samples;
+  rf_stream_state s_stream;
+  rf_packed_state s_packed;
+};
+
+static void bench_lowram_stream(void* p_context)
+{
+  bench_lowram_run* ps_run = (bench_lowram_run*)p_context;
+  float f_spo2, f_ratio, f_correl;
+  int32_t n_hr;
+  int8_t ch_spo2_valid, ch_hr_valid;
+  rf_stream_init(&ps_run->s_stream, FS);
+  for (int32_t i = 0; i < ps_run->n_samples; i++)
+    rf_stream_push(&ps_run->s_stream, ps_run->pun_ir[i], ps_run->pun_red[i], &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+}
+
+static void bench_lowram_packed(void* p_context)
+{
+  bench_lowram_run* ps_run = (bench_lowram_run*)p_context;
+  float f_spo2, f_ratio, f_correl;
+  int32_t n_hr;
+  int8_t ch_spo2_valid, ch_hr_valid;
+  rf_packed_init(&ps_run->s_packed, FS);
+  for (int32_t i = 0; i < ps_run->n_samples; i++)
+    rf_packed_push(&ps_run->s_packed, ps_run->pun_ir[i], ps_run->pun_red[i], &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+}
+
+// The stream with hop n_hop against the batch estimator on the window each estimate covers
+static bool bench_lowram_batch(const std::vector<uint32_t>& aun_ir, const std::vector<uint32_t>& aun_red, int32_t n_hop)
+{
+  static rf_stream_state s_stream;
+  static rf_channel_state s_channel;
+  float af_spo2[2], af_ratio[2], af_correl[2], f_max_dspo2 = 0.0f;
+  int32_t an_hr[2], i, n_estimates = 0, n_different = 0;
+  int8_t ach_spo2_valid[2], ach_hr_valid[2];
+
+  rf_stream_init(&s_stream, n_hop);
+  rf_channel_init(&s_channel);
+  for (i = 0; i < (int32_t)aun_ir.size(); i++) {
+    if (!rf_stream_push(&s_stream, aun_ir[i], aun_red[i], &af_spo2[0], &ach_spo2_valid[0], &an_hr[0], &ach_hr_valid[0], &af_ratio[0], &af_correl[0]))
+      continue;
+    rf_heart_rate_and_oxygen_saturation_r(&s_channel, (uint32_t*)&aun_ir[i + 1 - BUFFER_SIZE], BUFFER_SIZE, (uint32_t*)&aun_red[i + 1 - BUFFER_SIZE],
+        &af_spo2[1], &ach_spo2_valid[1], &an_hr[1], &ach_hr_valid[1], &af_ratio[1], &af_correl[1]);
+    n_estimates++;
+    if (an_hr[0] != an_hr[1] || ach_hr_valid[0] != ach_hr_valid[1] || ach_spo2_valid[0] != ach_spo2_valid[1])
+      n_different++;
+    else if (ach_hr_valid[0] && fabsf(af_spo2[0] - af_spo2[1]) > f_max_dspo2)
+      f_max_dspo2 = fabsf(af_spo2[0] - af_spo2[1]);
+  }
+  printf("lowram\tbatch\thop %3d\t%d estimates over an hour\t%d different\tmax |dSpO2| %.2g %%\n", (int)n_hop, (int)n_estimates, (int)n_different,
+      f_max_dspo2);
+  return n_estimates > 0 && n_different == 0 && f_max_dspo2 <= BENCH_LOWRAM_SPO2_TOL;
+}
+
+bool bench_lowram()
+{
+  static bench_lowram_run s_run;
+  std::vector<uint32_t> aun_ir(BENCH_LOWRAM_SAMPLES), aun_red(BENCH_LOWRAM_SAMPLES);
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  float af_spo2[2], af_ratio[2], af_correl[2];
+  int32_t an_hr[2], i, n_estimates = 0, n_different = 0;
+  int8_t ach_spo2_valid[2], ach_hr_valid[2];
+  bool ab_new[2];
+  size_t un_stack_stream, un_stack_packed;
+
+  // an hour with motion, dropouts and the odd saturated sample
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.f_fs = FS;
+  s_cfg.f_motion_per_s = 0.05f;
+  s_cfg.f_dropout_per_s = 0.01f;
+  s_cfg.f_ir_dc = 240000.0f;
+  ppg_synth_init(&s_synth, &s_cfg);
+  ppg_synth_fill(&s_synth, aun_red.data(), aun_ir.data(), BENCH_LOWRAM_SAMPLES);
+
+  rf_stream_init(&s_run.s_stream, FS);
+  rf_packed_init(&s_run.s_packed, FS);
+  for (i = 0; i < BENCH_LOWRAM_SAMPLES; i++) {
+    ab_new[0] = rf_stream_push(&s_run.s_stream, aun_ir[i], aun_red[i], &af_spo2[0], &ach_spo2_valid[0], &an_hr[0], &ach_hr_valid[0], &af_ratio[0],
+        &af_correl[0]);
+    ab_new[1] = rf_packed_push(&s_run.s_packed, aun_ir[i], aun_red[i], &af_spo2[1], &ach_spo2_valid[1], &an_hr[1], &ach_hr_valid[1], &af_ratio[1],
+        &af_correl[1]);
+    if (ab_new[0] != ab_new[1]) {
+      n_different++;
+      continue;
+    }
+    if (!ab_new[0])
+      continue;
+    n_estimates++;
+    if (an_hr[0] != an_hr[1] || ach_hr_valid[0] != ach_hr_valid[1] || ach_spo2_valid[0] != ach_spo2_valid[1] || af_correl[0] != af_correl[1]
+        || (ach_hr_valid[0] && (af_spo2[0] != af_spo2[1] || af_ratio[0] != af_ratio[1])))
+      n_different++;
+  }
+  printf("lowram\tsame\t%d estimates over an hour\t%d different\n", (int)n_estimates, (int)n_different);
+  bool b_batch = bench_lowram_batch(aun_ir, aun_red, BUFFER_SIZE);
+  b_batch &= bench_lowram_batch(aun_ir, aun_red, FS);
+
+  bench_timing s_stream = bench_time(BENCH_LOWRAM_SAMPLES, [&](int32_t k) {
+    rf_stream_push(&s_run.s_stream, aun_ir[k], aun_red[k], &af_spo2[0], &ach_spo2_valid[0], &an_hr[0], &ach_hr_valid[0], &af_ratio[0], &af_correl[0]);
+  });
+  bench_timing s_packed = bench_time(BENCH_LOWRAM_SAMPLES, [&](int32_t k) {
+    rf_packed_push(&s_run.s_packed, aun_ir[k], aun_red[k], &af_spo2[1], &ach_spo2_valid[1], &an_hr[1], &ach_hr_valid[1], &af_ratio[1], &af_correl[1]);
+  });
+  bench_record("lowram", "stream", BUFFER_SIZE, s_stream);
+  bench_record("lowram", "packed", BUFFER_SIZE, s_packed);
+
+  s_run.pun_ir = aun_ir.data();
+  s_run.pun_red = aun_red.data();
+  s_run.n_samples = 10 * BUFFER_SIZE;
+  un_stack_stream = bench_stack_peak(bench_lowram_stream, &s_run);
+  un_stack_packed = bench_stack_peak(bench_lowram_packed, &s_run);
+  printf("lowram\tstream\t%.1f ns/sample, worst %.0f ns\tstatic %u B, peak stack %u B\n", s_stream.f_mean_ns, s_stream.f_worst_ns,
+      (unsigned)sizeof(rf_stream_state), (unsigned)un_stack_stream);
+  printf("lowram\tpacked\t%.1f ns/sample, worst %.0f ns\tstatic %u B, peak stack %u B\n", s_packed.f_mean_ns, s_packed.f_worst_ns,
+      (unsigned)sizeof(rf_packed_state), (unsigned)un_stack_packed);
+  return b_batch && n_different == 0 && n_estimates > 0 && sizeof(rf_packed_state) + un_stack_packed < sizeof(rf_stream_state) + un_stack_stream;
+}
@@ -0,0 +1,140 @@
+/*
+ * Host benchmark runner
+ * Usage: bench [suite] [--out FILE] [--baseline FILE] [--tolerance PERCENT]
+ *   suite         run only this suite (default: all)
+ *   --out         write the recorded timings as tab separated rows:
+ *                 suite  case  n  ns_per_call  windows_per_s  worst_ns
+ *   --baseline    compare against rows written by an earlier --out; a case whose
+ *                 ns_per_call grew by more than --tolerance (default 25 %) fails
+ * Exit code: 0 pass, 1 usage, 2 a suite failed its tolerance, 3 timing regression
+ */
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct bench_suite {
+  const char* s_name;
+  bool (*run)();
+};
+
+static const bench_suite as_suites[] = {
+  { "autocorrelation", bench_autocorrelation },
+  { "fixed", bench_fixed },
+  { "config", bench_config },
+  { "channels", bench_channels },
+  { "driver", bench_driver },
+  { "kernels", bench_kernels },
+  { "synth", bench_synth },
+  { "capture", bench_capture },
+  { "lowram", bench_lowram },
+  { "peaks", bench_peaks },
+  { "cascade", bench_cascade },
+  { "agc", bench_agc },
+  { "temp", bench_temp },
+  { "telemetry", bench_telemetry },
+  { "ingest", bench_ingest },
+  { "uplink", bench_uplink },
+  { "profile", bench_profile },
+  { "duty", bench_duty },
+  { "batch", bench_batch },
+  { "spo2", bench_spo2 },
+};
+
+struct bench_row {
+  std::string s_suite, s_case;
+  int32_t n_size;
+  double f_ns_per_call, f_worst_ns;
+};
+
+static std::vector<bench_row> as_rows;
+
+void bench_record(const char* s_suite, const char* s_case, int32_t n_size, const bench_timing& s_timing)
+{
+  as_rows.push_back({ s_suite, s_case, n_size, s_timing.f_mean_ns, s_timing.f_worst_ns });
+}
+
+static bool bench_write(const char* s_path)
+{
+  FILE* p_file = fopen(s_path, "w");
+  if (p_file == NULL)
+    return false;
+  fprintf(p_file, "# suite\tcase\tn\tns_per_call\twindows_per_s\tworst_ns\n");
+  for (const bench_row& s_row : as_rows)
+    fprintf(p_file, "%s\t%s\t%d\t%.1f\t%.0f\t%.1f\n", s_row.s_suite.c_str(), s_row.s_case.c_str(), (int)s_row.n_size,
+        s_row.f_ns_per_call, 1e9 / s_row.f_ns_per_call, s_row.f_worst_ns);
+  return fclose(p_file) == 0;
+}
+
+static bool bench_compare(const char* s_path, double f_tolerance)
+{
+  char s_line[256], s_suite[64], s_case[64];
+  int n_size;
+  double f_ns;
+  bool b_pass = true;
+  FILE* p_file = fopen(s_path, "r");
+  if (p_file == NULL) {
+    fprintf(stderr, "cannot read baseline %s\n", s_path);
+    return false;
+  }
+  while (fgets(s_line, sizeof(s_line), p_file)) {
+    if (s_line[0] == '#' || sscanf(s_line, "%63[^\t]\t%63[^\t]\t%d\t%lf", s_suite, s_case, &n_size, &f_ns) != 4)
+      continue;
+    for (const bench_row& s_row : as_rows) {
+      if (s_row.s_suite != s_suite || s_row.s_case != s_case || s_row.n_size != n_size)
+        continue;
+      if (s_row.f_ns_per_call > f_ns * (1.0 + f_tolerance / 100.0)) {
+        printf("regression\t%s\t%s\tN=%d\t%.1f ns/call, baseline %.1f (+%.0f%%)\n", s_suite, s_case, n_size,
+            s_row.f_ns_per_call, f_ns, 100.0 * (s_row.f_ns_per_call / f_ns - 1.0));
+        b_pass = false;
+      }
+    }
+  }
+  fclose(p_file);
+  return b_pass;
+}
+
+int main(int argc, char** argv)
+{
+  const char *s_only = NULL, *s_out = NULL, *s_baseline = NULL;
+  double f_tolerance = 25.0;
+  bool b_found = false, b_pass = true;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+      s_out = argv[++i];
+    else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+      s_baseline = argv[++i];
+    else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+      f_tolerance = atof(argv[++i]);
+    else if (argv[i][0] != '-' && s_only == NULL)
+      s_only = argv[i];
+    else {
+      fprintf(stderr, "usage: %s [suite] [--out FILE] [--baseline FILE] [--tolerance PERCENT]\n", argv[0]);
+      return 1;
+    }
+  }
+  for (const bench_suite& s_suite : as_suites) {
+    if (s_only != NULL && strcmp(s_only, s_suite.s_name) != 0)
+      continue;
+    b_found = true;
+    if (!s_suite.run())
+      b_pass = false;
+  }
+  if (!b_found) {
+    fprintf(stderr, "unknown suite %s\n", s_only);
+    return 1;
+  }
+  if (s_out != NULL && !bench_write(s_out)) {
+    fprintf(stderr, "cannot write %s\n", s_out);
+    return 1;
+  }
+  if (!b_pass)
+    return 2;
+  if (s_baseline != NULL && !bench_compare(s_baseline, f_tolerance))
+    return 3;
+  return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Linear-time peak detection
+ * - random: maxim_find_peaks_linear() against the quadratic reference (all
+ *   candidates, maxim_remove_close_peaks()) on random vectors with plateaus
+ * - pipeline: against maxim_find_peaks() on 4 s windows at 25 Hz prepared as
+ *   the Maxim pipeline does; identical wherever its 15 candidate limit is not hit
+ * - time: both at 10, 20 and 30 s windows at 100 Hz, where the sort and the
+ *   nested loop of the reference grow with the square of the peak count
+ */
+#include "bench.h"
+#include <ppg_synth.h>
+#include <stdio.h>
+#include <vector>
+#include <algorithm.h>
+
+#define BENCH_PEAKS_RANDOM 100000
+#define BENCH_PEAKS_WINDOWS 2000
+#define BENCH_PEAKS_TIMED 16
+
+// maxim_peaks_above_min_height() without its limit of 15, reading no further than n_size
+static void bench_peaks_candidates(int32_t* pn_locs, int32_t* pn_npks, const int32_t* pn_x, int32_t n_size, int32_t n_min_height)
+{
+  int32_t i = 1, n_width;
+  *pn_npks = 0;
+  while (i < n_size - 1) {
+    if (pn_x[i] > n_min_height && pn_x[i] > pn_x[i - 1]) {
+      n_width = 1;
+      while (i + n_width < n_size && pn_x[i] == pn_x[i + n_width])
+        n_width++;
+      if (i + n_width < n_size && pn_x[i] > pn_x[i + n_width]) {
+        pn_locs[(*pn_npks)++] = i;
+        i += n_width + 1;
+      } else
+        i += n_width;
+    } else
+      i++;
+  }
+}
+
+static void bench_peaks_reference(int32_t* pn_locs, int32_t* pn_npks, int32_t* pn_x, int32_t n_size, int32_t n_min_height, int32_t n_min_distance)
+{
+  bench_peaks_candidates(pn_locs, pn_npks, pn_x, n_size, n_min_height);
+  maxim_remove_close_peaks(pn_locs, pn_npks, pn_x, n_min_distance);
+}
+
+static bool bench_peaks_same(const int32_t* pn_a, int32_t n_a, const int32_t* pn_b, int32_t n_b)
+{
+  if (n_a != n_b)
+    return false;
+  for (int32_t k = 0; k < n_a; k++)
+    if (pn_a[k] != pn_b[k])
+      return false;
+  return true;
+}
+
+static bool bench_peaks_random()
+{
+  std::vector<int32_t> an_x(1024 + 1), an_ref(MAXIM_MAX_PEAKS(1024)), an_lin(MAXIM_MAX_PEAKS(1024));
+  std::vector<int16_t> aw_scratch(MAXIM_PEAK_SCRATCH(1024));
+  uint32_t un_rng = 12345;
+  int32_t n_size, n_height, n_distance, n_ref, n_lin, n_mismatch = 0, n_peaks = 0, i, k;
+  auto rand = [&]() {
+    un_rng ^= un_rng << 13;
+    un_rng ^= un_rng >> 17;
+    un_rng ^= un_rng << 5;
+    return un_rng;
+  };
+
+  for (i = 0; i < BENCH_PEAKS_RANDOM; i++) {
+    n_size = 3 + rand() % 1022;
+    n_distance = 1 + rand() % 24;
+    n_height = rand() % 3;
+    for (k = 0; k < n_size; k++) // few levels, so plateaus and equal peaks are common
+      an_x[k] = rand() % 6;
+    bench_peaks_reference(an_ref.data(), &n_ref, an_x.data(), n_size, n_height, n_distance);
+    maxim_find_peaks_linear(an_lin.data(), &n_lin, an_x.data(), n_size, n_height, n_distance, aw_scratch.data());
+    n_peaks += n_ref;
+    if (!bench_peaks_same(an_ref.data(), n_ref, an_lin.data(), n_lin))
+      n_mismatch++;
+  }
+  printf("peaks\trandom\t%d vectors of 3..1024 samples, %d peaks\t%d mismatches against the reference\n", BENCH_PEAKS_RANDOM, (int)n_peaks,
+      (int)n_mismatch);
+  return n_mismatch == 0;
+}
+
+// Inverted, DC free, 4-point averaged IR and its clamped mean, as maxim_heart_rate_and_oxygen_saturation_r() prepares it
+static int32_t bench_peaks_prepare(const uint32_t* pun_ir, int32_t* pn_x, int32_t n_size)
+{
+  uint32_t un_mean = 0;
+  int32_t n_th = 0, k;
+  for (k = 0; k < n_size; k++)
+    un_mean += pun_ir[k];
+  un_mean /= n_size;
+  for (k = 0; k < n_size; k++)
+    pn_x[k] = un_mean - pun_ir[k];
+  for (k = 0; k < n_size - MA4_SIZE; k++)
+    pn_x[k] = (pn_x[k] + pn_x[k + 1] + pn_x[k + 2] + pn_x[k + 3]) / 4;
+  for (k = 0; k < n_size - MA4_SIZE; k++)
+    n_th += pn_x[k];
+  n_th /= n_size - MA4_SIZE;
+  return n_th < 30 ? 30 : n_th > 60 ? 60 : n_th;
+}
+
+static bool bench_peaks_pipeline()
+{
+  uint32_t aun_ir[MAXIM_BUFFER_SIZE], aun_red[MAXIM_BUFFER_SIZE];
+  int32_t an_x[MAXIM_BUFFER_SIZE], an_old[15], an_lin[MAXIM_MAX_PEAKS(MAXIM_BUFFER_SIZE_MA4)], an_candidates[MAXIM_MAX_PEAKS(MAXIM_BUFFER_SIZE_MA4)];
+  int16_t aw_scratch[MAXIM_PEAK_SCRATCH(MAXIM_BUFFER_SIZE_MA4)];
+  int32_t n_th, n_old, n_lin, n_candidates, n_capped = 0, n_compared = 0, n_mismatch = 0, w;
+
+  for (w = 0; w < BENCH_PEAKS_WINDOWS; w++) {
+    bench_ppg_window(aun_ir, aun_red, MAXIM_BUFFER_SIZE, MAXIM_FS, w);
+    n_th = bench_peaks_prepare(aun_ir, an_x, MAXIM_BUFFER_SIZE);
+    bench_peaks_candidates(an_candidates, &n_candidates, an_x, MAXIM_BUFFER_SIZE_MA4, n_th);
+    maxim_find_peaks(an_old, &n_old, an_x, MAXIM_BUFFER_SIZE_MA4, n_th, 4, 15);
+    maxim_find_peaks_linear(an_lin, &n_lin, an_x, MAXIM_BUFFER_SIZE_MA4, n_th, 4, aw_scratch);
+    if (n_candidates > 15) {
+      n_capped++;
+      continue;
+    }
+    n_compared++;
+    if (!bench_peaks_same(an_old, n_old, an_lin, n_lin))
+      n_mismatch++;
+  }
+  printf("peaks\tpipeline\t%d windows of %d samples\t%d compared, %d mismatches, %d over the 15 candidate limit\n", BENCH_PEAKS_WINDOWS,
+      (int)MAXIM_BUFFER_SIZE, (int)n_compared, (int)n_mismatch, (int)n_capped);
+  return n_mismatch == 0 && n_compared > 0;
+}
+
+static bool bench_peaks_time(int32_t n_seconds)
+{
+  const int32_t n_fs = 100, n_size = n_seconds * n_fs, n_ma4 = n_size - MA4_SIZE, n_distance = 4 * n_fs / MAXIM_FS;
+  std::vector<uint32_t> aun_ir(n_size), aun_red(n_size);
+  std::vector<int32_t> an_x(n_size * BENCH_PEAKS_TIMED), an_th(BENCH_PEAKS_TIMED), an_locs(MAXIM_MAX_PEAKS(n_size));
+  std::vector<int16_t> aw_scratch(MAXIM_PEAK_SCRATCH(n_size));
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  int32_t n_npks, n_candidates = 0, n_peaks = 0, n_mismatch = 0, w;
+  char s_case[32];
+
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.f_fs = (float)n_fs;
+  s_cfg.f_motion_per_s = 0.1f;
+  for (w = 0; w < BENCH_PEAKS_TIMED; w++) {
+    s_cfg.un_seed = w + 1;
+    s_cfg.f_hr_bpm = 50.0f + 7.0f * w;
+    ppg_synth_init(&s_synth, &s_cfg);
+    ppg_synth_fill(&s_synth, aun_red.data(), aun_ir.data(), n_size);
+    an_th[w] = bench_peaks_prepare(aun_ir.data(), &an_x[w * n_size], n_size);
+    bench_peaks_candidates(an_locs.data(), &n_npks, &an_x[w * n_size], n_ma4, an_th[w]);
+    n_candidates += n_npks;
+    std::vector<int32_t> an_ref(MAXIM_MAX_PEAKS(n_size));
+    int32_t n_ref;
+    bench_peaks_reference(an_ref.data(), &n_ref, &an_x[w * n_size], n_ma4, an_th[w], n_distance);
+    maxim_find_peaks_linear(an_locs.data(), &n_npks, &an_x[w * n_size], n_ma4, an_th[w], n_distance, aw_scratch.data());
+    n_peaks += n_npks;
+    if (!bench_peaks_same(an_ref.data(), n_ref, an_locs.data(), n_npks))
+      n_mismatch++;
+  }
+
+  bench_timing s_reference = bench_time(BENCH_PEAKS_TIMED * 8, [&](int32_t i) {
+    bench_peaks_reference(an_locs.data(), &n_npks, &an_x[(i % BENCH_PEAKS_TIMED) * n_size], n_ma4, an_th[i % BENCH_PEAKS_TIMED], n_distance);
+    bench_keep(n_npks);
+  });
+  bench_timing s_linear = bench_time(BENCH_PEAKS_TIMED * 8, [&](int32_t i) {
+    maxim_find_peaks_linear(an_locs.data(), &n_npks, &an_x[(i % BENCH_PEAKS_TIMED) * n_size], n_ma4, an_th[i % BENCH_PEAKS_TIMED], n_distance,
+        aw_scratch.data());
+    bench_keep(n_npks);
+  });
+  snprintf(s_case, sizeof(s_case), "reference_%ds", (int)n_seconds);
+  bench_record("peaks", s_case, n_size, s_reference);
+  snprintf(s_case, sizeof(s_case), "linear_%ds", (int)n_seconds);
+  bench_record("peaks", s_case, n_size, s_linear);
+  printf("peaks\ttime\t%2d s at %d Hz, N=%d\t%d candidates, %d peaks per window\treference %.1f us, linear %.1f us (%.1fx)\t%d mismatches\n",
+      (int)n_seconds, (int)n_fs, (int)n_size, (int)(n_candidates / BENCH_PEAKS_TIMED), (int)(n_peaks / BENCH_PEAKS_TIMED),
+      s_reference.f_mean_ns / 1e3, s_linear.f_mean_ns / 1e3, s_reference.f_mean_ns / s_linear.f_mean_ns, (int)n_mismatch);
+  return n_mismatch == 0;
+}
+
+bool bench_peaks()
+{
+  bool b_pass = bench_peaks_random();
+  b_pass &= bench_peaks_pipeline();
+  b_pass &= bench_peaks_time(4);
+  b_pass &= bench_peaks_time(10);
+  b_pass &= bench_peaks_time(20);
+  b_pass &= bench_peaks_time(30);
+  return b_pass;
+}
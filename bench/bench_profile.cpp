@@ -0,0 +1,152 @@
+/*
+ * Hot-path stage timing (lib/profile)
+ * - stream: two minutes of synthetic PPG through the simulated sensor,
+ *   drained in bursts and fed to rf_stream_push() as main.cpp does, every
+ *   stage of the estimate and every driver bus call timed
+ * - window: whole windows through rf_heart_rate_and_oxygen_saturation_r(),
+ *   DC removal, detrend, RMS and correlation as separate stages
+ * One line per stage: count, mean, p50, p99 and max in host nanoseconds
+ * (lags: autocorrelation lags evaluated per window). Needs -DPROFILE, i.e.
+ * `pio run -e bench_profile -t exec`; the plain bench build only reports
+ * that the timing compiled out.
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <max30102.h>
+#include <max30102_sim.h>
+#include <ppg_synth.h>
+#include <profile.h>
+#include <stdio.h>
+
+#ifdef PROFILE
+
+#define BENCH_PROFILE_SECONDS 120
+#define BENCH_PROFILE_WINDOWS 1000
+
+struct bench_profile_source {
+  ppg_synth_state s_synth;
+  uint32_t un_red, un_ir;
+};
+
+// Same optical front end as bench_synth.cpp: counts at 4096 nA range and 12 mA
+static float bench_profile_photocurrent(void* p_context, uint8_t uch_led, float f_led_ma, uint64_t ul_time_us)
+{
+  bench_profile_source* ps_source = (bench_profile_source*)p_context;
+  (void)ul_time_us;
+  if (uch_led == MAX30102_SIM_LED_RED && !ppg_synth_next(&ps_source->s_synth, &ps_source->un_red, &ps_source->un_ir))
+    ps_source->un_red = ps_source->un_ir = 0;
+  return (uch_led == MAX30102_SIM_LED_RED ? ps_source->un_red : ps_source->un_ir) * (4096.0f / 262144.0f) * (f_led_ma / 12.0f);
+}
+
+// Prints every recorded stage of one case; checks that each window ran the stages
+// in ae_inner exactly once and that the stages fit inside their window
+static bool bench_profile_report(const char* s_case, uint32_t un_windows, const profile_stage* ae_inner, size_t un_inner)
+{
+  uint64_t ul_inner = 0;
+  char s_line[96];
+  bool b_pass = un_windows > 0;
+  size_t i;
+  int k;
+
+  for (k = 0; k < PROFILE_STAGES; k++) {
+    const profile_histogram* ps_hist = profile_get((profile_stage)k);
+    if (profile_format((profile_stage)k, s_line, sizeof(s_line)) > 0)
+      printf("profile\t%s\t%s\n", s_case, s_line);
+    b_pass &= profile_percentile((profile_stage)k, 0.5f) <= profile_percentile((profile_stage)k, 0.99f)
+        && profile_percentile((profile_stage)k, 0.99f) <= ps_hist->un_max;
+  }
+  for (i = 0; i < un_inner; i++) {
+    b_pass &= profile_get(ae_inner[i])->un_count == un_windows;
+    ul_inner += profile_get(ae_inner[i])->ul_sum;
+  }
+  b_pass &= profile_get(PROFILE_WINDOW)->un_count == un_windows && profile_get(PROFILE_LAGS)->un_count == un_windows
+      && profile_percentile(PROFILE_LAGS, 0.5f) > 0 && ul_inner <= profile_get(PROFILE_WINDOW)->ul_sum;
+  printf("profile\t%s\t%u windows\tstages %.1f%% of the window time, periodicity %.1f%%, %.1f lags per window\n", s_case, (unsigned)un_windows,
+      100.0 * ul_inner / profile_get(PROFILE_WINDOW)->ul_sum, 100.0 * profile_get(PROFILE_PERIODICITY)->ul_sum / profile_get(PROFILE_WINDOW)->ul_sum,
+      (double)profile_get(PROFILE_LAGS)->ul_sum / un_windows);
+  return b_pass;
+}
+
+// The firmware's path: burst reads at A_FULL, rf_stream_push() with a one second hop
+static bool bench_profile_stream()
+{
+  static bench_profile_source s_source;
+  static const profile_stage ae_inner[] = { PROFILE_MOMENTS, PROFILE_DETREND, PROFILE_PERIODICITY };
+  ppg_synth_config s_cfg;
+  max30102_sim s_sim;
+  max30102_hal s_hal;
+  rf_stream_state s_stream;
+  uint32_t aun_red[MAX30102_FIFO_DEPTH], aun_ir[MAX30102_FIFO_DEPTH];
+  uint32_t un_bursts = 0, un_estimates = 0;
+  float f_spo2, f_ratio, f_correl;
+  int32_t n_hr;
+  int8_t ch_spo2_valid, ch_hr_valid;
+  uint8_t uch_num, i;
+
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.f_fs = 100.0f;
+  ppg_synth_init(&s_source.s_synth, &s_cfg);
+  max30102_sim_init(&s_sim, bench_profile_photocurrent, &s_source);
+  max30102_sim_hal(&s_sim, &s_hal);
+  maxim_max30102_set_hal(&s_hal);
+  profile_reset();
+  if (!maxim_max30102_init())
+    return false;
+  rf_stream_init(&s_stream, FS);
+  while (s_sim.ul_now_us < (uint64_t)BENCH_PROFILE_SECONDS * 1000000) {
+    max30102_sim_advance_us(&s_sim, 1000);
+    if (!max30102_sim_int_asserted(&s_sim))
+      continue;
+    if (!maxim_max30102_read_fifo_burst(aun_red, aun_ir, MAX30102_FIFO_DEPTH, &uch_num))
+      return false;
+    un_bursts++;
+    for (i = 0; i < uch_num; i++)
+      un_estimates += rf_stream_push(&s_stream, aun_ir[i], aun_red[i], &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+  }
+  // every bus call is seen once: a status read and at least one FIFO read per burst
+  return bench_profile_report("stream", un_estimates, ae_inner, sizeof(ae_inner) / sizeof(ae_inner[0]))
+      && profile_get(PROFILE_FIFO_READ)->un_count == un_bursts && profile_get(PROFILE_INIT)->un_count == 1
+      && profile_get(PROFILE_I2C_READ)->un_count >= 2 * un_bursts;
+}
+
+// Whole windows through rf_heart_rate_and_oxygen_saturation_r(): every batch stage
+static bool bench_profile_window()
+{
+  static const profile_stage ae_inner[] = { PROFILE_DC_REMOVAL, PROFILE_DETREND, PROFILE_RMS, PROFILE_PCORRELATION, PROFILE_PERIODICITY };
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  rf_channel_state s_channel;
+  uint32_t aun_red[BUFFER_SIZE], aun_ir[BUFFER_SIZE];
+  float f_spo2, f_ratio, f_correl;
+  int32_t n_hr, i;
+  int8_t ch_spo2_valid, ch_hr_valid;
+
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.f_fs = FS;
+  ppg_synth_init(&s_synth, &s_cfg);
+  rf_channel_init(&s_channel);
+  profile_reset();
+  for (i = 0; i < BENCH_PROFILE_WINDOWS; i++) {
+    ppg_synth_fill(&s_synth, aun_red, aun_ir, BUFFER_SIZE);
+    rf_heart_rate_and_oxygen_saturation_r(&s_channel, aun_ir, BUFFER_SIZE, aun_red, &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+  }
+  return bench_profile_report("window", BENCH_PROFILE_WINDOWS, ae_inner, sizeof(ae_inner) / sizeof(ae_inner[0]));
+}
+
+bool bench_profile()
+{
+  printf("profile\tcase\tstage\tcount\tmean\tp50\tp99\tmax\t(%s; lags: per window)\n", profile_unit());
+  bool b_pass = bench_profile_stream();
+  b_pass &= bench_profile_window();
+  return b_pass;
+}
+
+#else
+
+bool bench_profile()
+{
+  printf("profile\tdisabled\tbuilt without -DPROFILE, the stage timing compiled out; run `pio run -e bench_profile -t exec`\n");
+  return true;
+}
+
+#endif /* PROFILE */
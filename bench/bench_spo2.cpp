@@ -0,0 +1,58 @@
+/*
+ * SpO2 calibration table of lib/algorithm, generated at compile time into flash
+ * - table: every entry against -45.060*r*r + 30.354*r + 94.845 (0 where
+ *   negative) evaluated at run time, must match exactly
+ * - lookup: maxim_spo2_from_ratio() against the curve over the RF range
+ *   0.02 to 1.84, 0.0001 apart; within 0.0012 % SpO2 between entries where the
+ *   curve is positive (not across its zero near 1.83, clamped to 0)
+ * - cost: a lookup against the double polynomial of the RF path (which
+ *   RF_USE_SPO2_TABLE replaces); on the ESP8266 both are soft float, the
+ *   lookup in single precision
+ * Also the DRAM the former table took on the ESP8266, calculated from its
+ * size; the firmware build prints the table's placement (pio run -e esp01).
+ */
+#include "bench.h"
+#include <algorithm.h>
+#include <math.h>
+#include <stdio.h>
+
+#define BENCH_SPO2_OLD_TABLE 184 // entries of the former const float uch_spo2_table[]
+#define BENCH_SPO2_CALLS 1000000
+
+static double bench_spo2_curve(double r)
+{
+  double f_spo2 = -45.060 * r * r + 30.354 * r + 94.845;
+  return f_spo2 > 0.0 ? f_spo2 : 0.0;
+}
+
+bool bench_spo2()
+{
+  uint32_t un_mismatches = 0;
+  double f_err, f_max_err = 0.0, f_max_at = 0.0;
+  volatile float f_ratio = 0.5f;
+  bench_timing s_table, s_poly;
+  int32_t i;
+
+  for (i = 0; i < MAXIM_SPO2_TABLE_SIZE; i++)
+    un_mismatches += maxim_spo2_table(i) != (float)bench_spo2_curve(i / 100.0);
+  for (i = 200; i < 18400; i++) {
+    float r = i / 10000.0f;
+    f_err = fabs(maxim_spo2_from_ratio(r) - bench_spo2_curve(r));
+    if (maxim_spo2_table(i / 100 + 1) > 0.0f && f_err > f_max_err) {
+      f_max_err = f_err;
+      f_max_at = r;
+    }
+  }
+  s_table = bench_time(BENCH_SPO2_CALLS, [&](int32_t n) { bench_keep(maxim_spo2_from_ratio(f_ratio + n * 1e-6f)); });
+  s_poly = bench_time(BENCH_SPO2_CALLS, [&](int32_t n) {
+    float xy_ratio = f_ratio + n * 1e-6f;
+    float f_spo2 = (-45.060 * xy_ratio + 30.354) * xy_ratio + 94.845;
+    bench_keep(f_spo2);
+  });
+
+  printf("spo2\ttable\t%d entries\t%u mismatches\t%u bytes flash\t%u bytes DRAM freed (calculated: %d floats of the former table)\n", MAXIM_SPO2_TABLE_SIZE, (unsigned)un_mismatches,
+      (unsigned)(MAXIM_SPO2_TABLE_SIZE * sizeof(float)), (unsigned)(BENCH_SPO2_OLD_TABLE * sizeof(float)), BENCH_SPO2_OLD_TABLE);
+  printf("spo2\tlookup\tmax error %.6f %% SpO2 at ratio %.4f\t%.2f ns/call\tpolynomial %.2f ns/call\n", f_max_err, f_max_at, s_table.f_mean_ns,
+      s_poly.f_mean_ns);
+  return un_mismatches == 0 && f_max_err < 0.0012;
+}
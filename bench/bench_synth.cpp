@@ -0,0 +1,163 @@
+/*
+ * Synthetic PPG generator
+ * - throughput: ten hours at 25 Hz, samples/s and speed-up over real time
+ * - sweep: RF estimator error against ground truth over heart rate, SpO2 and
+ *   noise, windows of BUFFER_SIZE as main.cpp feeds them
+ * - sim: the generator as optical front end of the MAX30102 simulator, read by
+ *   the driver and fed to the RF estimator, end to end
+ */
+#include "bench.h"
+#include <algorithmRF.h>
+#include <max30102.h>
+#include <max30102_sim.h>
+#include <ppg_synth.h>
+#include <math.h>
+#include <stdio.h>
+
+#define BENCH_SYNTH_HOURS 10
+#define BENCH_SYNTH_WINDOWS 150
+#define BENCH_SYNTH_SIM_SECONDS 120
+
+static bool bench_synth_throughput()
+{
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  uint32_t aun_red[1024], aun_ir[1024];
+  const uint64_t ul_total = (uint64_t)BENCH_SYNTH_HOURS * 3600 * 25;
+  uint64_t ul_start, ul_ns, ul_done;
+  uint32_t un_sum = 0;
+
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.f_motion_per_s = 0.05f;
+  s_cfg.f_dropout_per_s = 0.01f;
+  ppg_synth_init(&s_synth, &s_cfg);
+  ul_start = bench_ns();
+  for (ul_done = 0; ul_done < ul_total; ul_done += 1024) {
+    ppg_synth_fill(&s_synth, aun_red, aun_ir, 1024);
+    un_sum += aun_red[0] + aun_ir[1023];
+  }
+  ul_ns = bench_ns() - ul_start;
+  bench_keep(un_sum);
+  printf("synth\tthroughput\t%d h at 25 Hz in %.3f s\t%.1f Msamples/s\t%.0fx real time\tdropped %.2f%%\n", BENCH_SYNTH_HOURS,
+      ul_ns / 1e9, ul_done * 1e3 / ul_ns, ul_done / 25.0 / (ul_ns / 1e9), 100.0 * s_synth.ul_dropped / s_synth.ul_samples);
+  return ul_ns / 1e9 < BENCH_SYNTH_HOURS * 3600 / 1000.0; // at least 1000x real time
+}
+
+// Reports the mean absolute error of valid estimates and the fraction of valid windows
+static bool bench_synth_case(float f_hr, float f_spo2, float f_noise, float f_motion_per_s, bool b_check)
+{
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  rf_channel_state s_channel;
+  uint32_t aun_red[BUFFER_SIZE], aun_ir[BUFFER_SIZE];
+  float f_est_spo2, f_ratio, f_correl, f_hr_err = 0.0f, f_spo2_err = 0.0f;
+  int32_t n_hr, i, n_hr_valid = 0, n_spo2_valid = 0;
+  int8_t ch_spo2_valid, ch_hr_valid;
+
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.un_seed = (uint32_t)(f_hr * 100 + f_spo2 * 10 + f_noise);
+  s_cfg.f_fs = FS;
+  s_cfg.f_hr_bpm = f_hr;
+  s_cfg.f_spo2 = f_spo2;
+  s_cfg.f_noise = f_noise;
+  s_cfg.f_motion_per_s = f_motion_per_s;
+  ppg_synth_init(&s_synth, &s_cfg);
+  rf_channel_init(&s_channel);
+  for (i = 0; i < BENCH_SYNTH_WINDOWS; i++) {
+    ppg_synth_fill(&s_synth, aun_red, aun_ir, BUFFER_SIZE);
+    rf_heart_rate_and_oxygen_saturation_r(&s_channel, aun_ir, BUFFER_SIZE, aun_red, &f_est_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl);
+    if (ch_hr_valid) {
+      n_hr_valid++;
+      f_hr_err += fabsf(n_hr - f_hr);
+    }
+    if (ch_spo2_valid) {
+      n_spo2_valid++;
+      f_spo2_err += fabsf(f_est_spo2 - f_spo2);
+    }
+  }
+  f_hr_err = n_hr_valid ? f_hr_err / n_hr_valid : 0.0f;
+  f_spo2_err = n_spo2_valid ? f_spo2_err / n_spo2_valid : 0.0f;
+  printf("synth\tsweep\tHR %3.0f SpO2 %4.1f noise %4.0f motion %4.2f/s\tHR valid %3d%% err %5.2f bpm\tSpO2 valid %3d%% err %5.2f %%\n", f_hr, f_spo2,
+      f_noise, f_motion_per_s, 100 * n_hr_valid / BENCH_SYNTH_WINDOWS, f_hr_err, 100 * n_spo2_valid / BENCH_SYNTH_WINDOWS, f_spo2_err);
+  // clean signals must be read back: mostly valid, SpO2 within 1 %, HR within 3 bpm or one
+  // lag step of the periodicity search (HR^2 / FS60) if that is coarser
+  float f_hr_tolerance = f_hr * f_hr / FS60 > 3.0f ? f_hr * f_hr / FS60 : 3.0f;
+  return !b_check || (n_hr_valid >= BENCH_SYNTH_WINDOWS * 8 / 10 && f_hr_err <= f_hr_tolerance && f_spo2_err <= 1.0f);
+}
+
+struct bench_synth_source {
+  ppg_synth_state s_synth;
+  uint32_t un_red, un_ir;
+};
+
+// Photocurrent for the simulator: counts at the configured 4096 nA range and 12 mA LED
+// current, scaled with the LED current the sensor actually drives
+static float bench_synth_photocurrent(void* p_context, uint8_t uch_led, float f_led_ma, uint64_t ul_time_us)
+{
+  bench_synth_source* ps_source = (bench_synth_source*)p_context;
+  (void)ul_time_us;
+  if (uch_led == MAX30102_SIM_LED_RED && !ppg_synth_next(&ps_source->s_synth, &ps_source->un_red, &ps_source->un_ir))
+    ps_source->un_red = ps_source->un_ir = 0; // finger lifted
+  return (uch_led == MAX30102_SIM_LED_RED ? ps_source->un_red : ps_source->un_ir) * (4096.0f / 262144.0f) * (f_led_ma / 12.0f);
+}
+
+static bool bench_synth_sim()
+{
+  static bench_synth_source s_source;
+  ppg_synth_config s_cfg;
+  max30102_sim s_sim;
+  max30102_hal s_hal;
+  rf_stream_state s_stream;
+  uint32_t aun_red[MAX30102_FIFO_DEPTH], aun_ir[MAX30102_FIFO_DEPTH];
+  float f_spo2, f_ratio, f_correl, f_hr_err = 0.0f;
+  int32_t n_hr, n_estimates = 0, n_valid = 0;
+  int8_t ch_spo2_valid, ch_hr_valid;
+  uint8_t uch_num, i;
+
+  // the sensor converts at 100 Hz and averages 4, the generator runs at the conversion rate
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.f_fs = 100.0f;
+  ppg_synth_init(&s_source.s_synth, &s_cfg);
+  max30102_sim_init(&s_sim, bench_synth_photocurrent, &s_source);
+  max30102_sim_hal(&s_sim, &s_hal);
+  maxim_max30102_set_hal(&s_hal);
+  if (!maxim_max30102_init())
+    return false;
+  rf_stream_init(&s_stream, FS);
+  while (s_sim.ul_now_us < (uint64_t)BENCH_SYNTH_SIM_SECONDS * 1000000) {
+    max30102_sim_advance_us(&s_sim, 1000);
+    if (!max30102_sim_int_asserted(&s_sim))
+      continue;
+    if (!maxim_max30102_read_fifo_burst(aun_red, aun_ir, MAX30102_FIFO_DEPTH, &uch_num))
+      return false;
+    for (i = 0; i < uch_num; i++) {
+      if (!rf_stream_push(&s_stream, aun_ir[i], aun_red[i], &f_spo2, &ch_spo2_valid, &n_hr, &ch_hr_valid, &f_ratio, &f_correl))
+        continue;
+      n_estimates++;
+      if (ch_hr_valid) {
+        n_valid++;
+        f_hr_err += fabsf(n_hr - s_cfg.f_hr_bpm);
+      }
+    }
+  }
+  f_hr_err = n_valid ? f_hr_err / n_valid : 0.0f;
+  printf("synth\tsim\t%d s through the simulated sensor\t%d estimates, HR valid %d%% err %.2f bpm\n", BENCH_SYNTH_SIM_SECONDS,
+      (int)n_estimates, n_estimates ? 100 * n_valid / n_estimates : 0, f_hr_err);
+  return n_valid >= n_estimates * 8 / 10 && f_hr_err <= 3.0f;
+}
+
+bool bench_synth()
+{
+  static const float af_hr[] = { 50, 75, 100, 140 };
+  static const float af_spo2[] = { 88, 94, 98 };
+  bool b_pass = bench_synth_throughput();
+  for (float f_hr : af_hr)
+    for (float f_spo2 : af_spo2)
+      b_pass &= bench_synth_case(f_hr, f_spo2, 30.0f, 0.0f, true);
+  for (float f_hr : af_hr) {
+    bench_synth_case(f_hr, 96.0f, 120.0f, 0.0f, false);
+    bench_synth_case(f_hr, 96.0f, 30.0f, 0.2f, false);
+  }
+  b_pass &= bench_synth_sim();
+  return b_pass;
+}
@@ -0,0 +1,225 @@
+/*
+ * Framed telemetry (lib/telemetry)
+ * - mux: an hour of raw samples with one result and one quality frame per
+ *   second and a temperature every 30 s, at 25 Hz (the default FIFO rate) and
+ *   at 400 Hz without averaging. Bytes/s on the wire against the UART at 115200
+ *   and 921600 baud (10 bits per byte), encode cost, and a round trip that must
+ *   return every sample and frame unchanged
+ * - decode: the 400 Hz stream pushed in 4 KiB reads, MB/s
+ * - damage: bit errors and dropped spans; every intact frame still decodes,
+ *   the lost frames and samples are counted exactly and nothing corrupted passes
+ */
+#include "bench.h"
+#include <telemetry.h>
+#include <ppg_synth.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define BENCH_TELEMETRY_SECONDS 3600
+#define BENCH_TELEMETRY_CHUNK 4096
+
+struct bench_telemetry_check {
+  const uint32_t* pun_red;
+  const uint32_t* pun_ir;
+  uint32_t un_samples;         // decoded
+  uint32_t un_mismatch;        // samples or frames that differ from what was sent
+  uint32_t un_results, un_quality, un_temperature, un_text, un_config;
+  capture_record s_record;
+};
+
+static bool bench_telemetry_to_vector(void* p_context, const uint8_t* puch_data, size_t un_len)
+{
+  std::vector<uint8_t>* p_bytes = (std::vector<uint8_t>*)p_context;
+  p_bytes->insert(p_bytes->end(), puch_data, puch_data + un_len);
+  return true;
+}
+
+// Checks each frame against what bench_telemetry_encode() put in
+static void bench_telemetry_handler(void* p_context, const telemetry_frame* ps_frame)
+{
+  bench_telemetry_check* ps_check = (bench_telemetry_check*)p_context;
+  telemetry_result s_result;
+  telemetry_quality s_quality;
+  capture_config s_config;
+  uint32_t i, un_time_ms;
+  float f_celsius;
+
+  switch (ps_frame->uch_stream) {
+  case TELEMETRY_STREAM_SAMPLES:
+    if (!telemetry_parse_samples(ps_frame, &ps_check->s_record)) {
+      ps_check->un_mismatch++;
+      break;
+    }
+    for (i = 0; i < ps_check->s_record.uw_count; i++)
+      if (ps_check->s_record.aun_red[i] != ps_check->pun_red[ps_check->s_record.un_index + i]
+          || ps_check->s_record.aun_ir[i] != ps_check->pun_ir[ps_check->s_record.un_index + i])
+        ps_check->un_mismatch++;
+    ps_check->un_samples += ps_check->s_record.uw_count;
+    break;
+  case TELEMETRY_STREAM_RESULT:
+    ps_check->un_mismatch += !telemetry_parse_result(ps_frame, &s_result) || s_result.w_heart_rate != 60 + (int16_t)(s_result.un_time_ms / 1000 % 40)
+        || s_result.uch_flags != (TELEMETRY_RESULT_HR_VALID | TELEMETRY_RESULT_SPO2_VALID);
+    ps_check->un_results++;
+    break;
+  case TELEMETRY_STREAM_QUALITY:
+    ps_check->un_mismatch += !telemetry_parse_quality(ps_frame, &s_quality) || s_quality.uch_led_ir != 0x24;
+    ps_check->un_quality++;
+    break;
+  case TELEMETRY_STREAM_TEMPERATURE:
+    ps_check->un_mismatch += !telemetry_parse_temperature(ps_frame, &un_time_ms, &f_celsius) || f_celsius != 31.5f;
+    ps_check->un_temperature++;
+    break;
+  case TELEMETRY_STREAM_CONFIG:
+    ps_check->un_mismatch += !telemetry_parse_config(ps_frame, &s_config);
+    ps_check->un_config++;
+    break;
+  case TELEMETRY_STREAM_TEXT:
+    ps_check->un_text++;
+    break;
+  default:
+    ps_check->un_mismatch++;
+  }
+}
+
+// The multiplexed stream of an acquisition at f_fs; returns the encode time in ns
+static uint64_t bench_telemetry_encode(float f_fs, std::vector<uint32_t>& aun_red, std::vector<uint32_t>& aun_ir, std::vector<uint8_t>& auch_bytes,
+    uint32_t* pun_frames)
+{
+  static const uint8_t auch_regs_08_0d[6] = { 0x4F, 0x03, 0x27, 0x00, 0x24, 0x24 };
+  const uint32_t un_total = (uint32_t)(BENCH_TELEMETRY_SECONDS * f_fs);
+  const uint32_t un_per_s = (uint32_t)f_fs;
+  ppg_synth_config s_cfg;
+  ppg_synth_state s_synth;
+  capture_config s_config;
+  static telemetry_writer s_writer;
+  telemetry_result s_result;
+  telemetry_quality s_quality = { 0, 0x24, 0x24, 0x27, 0x03, 0, 0 };
+  uint32_t i, un_time_ms;
+  uint64_t ul_start;
+
+  ppg_synth_default_config(&s_cfg);
+  s_cfg.f_fs = f_fs;
+  ppg_synth_init(&s_synth, &s_cfg);
+  aun_red.resize(un_total);
+  aun_ir.resize(un_total);
+  ppg_synth_fill(&s_synth, aun_red.data(), aun_ir.data(), un_total);
+  auch_bytes.clear();
+  auch_bytes.reserve(un_total * 5);
+
+  capture_config_from_regs(&s_config, auch_regs_08_0d, 0x00, 0x00);
+  telemetry_writer_init(&s_writer, bench_telemetry_to_vector, &auch_bytes);
+  ul_start = bench_ns();
+  telemetry_write_text(&s_writer, "MAX30102 ready");
+  telemetry_write_config(&s_writer, &s_config);
+  for (i = 0; i < un_total; i++) {
+    un_time_ms = (uint32_t)(i * 1000.0f / f_fs);
+    telemetry_write_sample(&s_writer, aun_red[i], aun_ir[i], un_time_ms);
+    if ((i + 1) % un_per_s != 0)
+      continue;
+    telemetry_result_from_estimate(&s_result, un_time_ms, i, 97.25f, 1, 60 + (int32_t)(un_time_ms / 1000 % 40), 1, 0.71f, 0.93f);
+    telemetry_write_result(&s_writer, &s_result);
+    s_quality.un_time_ms = un_time_ms;
+    telemetry_write_quality(&s_writer, &s_quality);
+    if ((i + 1) % (30 * un_per_s) == 0)
+      telemetry_write_temperature(&s_writer, un_time_ms, 31, 8);
+  }
+  telemetry_flush_samples(&s_writer);
+  *pun_frames = s_writer.un_frames;
+  return bench_ns() - ul_start;
+}
+
+static bool bench_telemetry_mux(const char* s_name, float f_fs, std::vector<uint32_t>& aun_red, std::vector<uint32_t>& aun_ir,
+    std::vector<uint8_t>& auch_bytes)
+{
+  static telemetry_decoder s_decoder;
+  static bench_telemetry_check s_check;
+  const uint32_t un_total = (uint32_t)(BENCH_TELEMETRY_SECONDS * f_fs);
+  uint32_t un_frames;
+  uint64_t ul_ns = bench_telemetry_encode(f_fs, aun_red, aun_ir, auch_bytes, &un_frames);
+  double f_bytes_per_s = (double)auch_bytes.size() / BENCH_TELEMETRY_SECONDS;
+
+  memset(&s_check, 0, sizeof(s_check));
+  s_check.pun_red = aun_red.data();
+  s_check.pun_ir = aun_ir.data();
+  telemetry_decoder_init(&s_decoder);
+  telemetry_decoder_push(&s_decoder, auch_bytes.data(), auch_bytes.size(), bench_telemetry_handler, &s_check);
+
+  printf("telemetry\t%-9s\t%.2f bytes/sample\t%8.0f bytes/s\t%5.1f%% of 115200\t%5.1f%% of 921600\tencode %.1f ns/sample\t"
+         "round trip %u/%u samples, %u/%u frames, %u mismatches\n",
+      s_name, (double)auch_bytes.size() / un_total, f_bytes_per_s, f_bytes_per_s / 115.2, f_bytes_per_s / 921.6, (double)ul_ns / un_total,
+      s_check.un_samples, un_total, s_decoder.un_frames, un_frames, s_check.un_mismatch);
+  return s_check.un_samples == un_total && s_decoder.un_frames == un_frames && s_check.un_mismatch == 0 && s_decoder.un_crc_errors == 0
+      && s_decoder.un_framing_errors == 0 && s_decoder.un_lost_frames == 0 && s_decoder.un_missing_samples == 0
+      && s_check.un_results == BENCH_TELEMETRY_SECONDS && s_check.un_temperature == BENCH_TELEMETRY_SECONDS / 30 && s_check.un_config == 1
+      && s_check.un_text == 1;
+}
+
+static bool bench_telemetry_decode(const std::vector<uint8_t>& auch_bytes)
+{
+  static telemetry_decoder s_decoder;
+  const int32_t n_chunks = (int32_t)(auch_bytes.size() / BENCH_TELEMETRY_CHUNK);
+  uint32_t un_frames = 0;
+  bench_timing s_timing;
+
+  telemetry_decoder_init(&s_decoder);
+  s_timing = bench_time(n_chunks, [&](int32_t i) {
+    telemetry_decoder_push(&s_decoder, auch_bytes.data() + (size_t)i * BENCH_TELEMETRY_CHUNK, BENCH_TELEMETRY_CHUNK,
+        [](void* p_context, const telemetry_frame* ps_frame) { *(uint32_t*)p_context += ps_frame->uw_len; }, &un_frames);
+  });
+  bench_record("telemetry", "decode", BENCH_TELEMETRY_CHUNK, s_timing);
+  printf("telemetry\tdecode\t%.1f MB in %d KiB reads\t%7.1f MB/s\tworst read %.1f us\t%u CRC errors\n", auch_bytes.size() / 1e6,
+      BENCH_TELEMETRY_CHUNK / 1024, BENCH_TELEMETRY_CHUNK / s_timing.f_mean_ns * 1e3, s_timing.f_worst_ns / 1e3, s_decoder.un_crc_errors);
+  // a 921600 baud link delivers 0.09 MB/s; one core should keep up with a few hundred of them
+  return s_decoder.un_crc_errors == 0 && BENCH_TELEMETRY_CHUNK / s_timing.f_mean_ns * 1e3 >= 50.0;
+}
+
+static bool bench_telemetry_damage(const std::vector<uint8_t>& auch_clean, const std::vector<uint32_t>& aun_red, const std::vector<uint32_t>& aun_ir)
+{
+  static telemetry_decoder s_clean, s_decoder;
+  static bench_telemetry_check s_check;
+  std::vector<uint8_t> auch_bytes(auch_clean);
+  uint32_t un_seed = 12345, un_flips = 0, un_cuts = 0, un_pos;
+  size_t un_len;
+
+  telemetry_decoder_init(&s_clean);
+  telemetry_decoder_push(&s_clean, auch_clean.data(), auch_clean.size(), NULL, NULL);
+
+  // keep the first and the last 64 KiB clean, so gaps are never at either end
+  for (un_pos = 65536; un_pos + 131072 < auch_bytes.size(); un_pos += 1 + un_seed % 40000) {
+    un_seed = un_seed * 1664525u + 1013904223u;
+    if (un_seed & 0x100) {
+      auch_bytes[un_pos] ^= (uint8_t)(1 << (un_seed >> 29));
+      un_flips++;
+    } else {
+      un_len = 1 + (un_seed >> 20) % 600;
+      auch_bytes.erase(auch_bytes.begin() + un_pos, auch_bytes.begin() + un_pos + un_len);
+      un_cuts++;
+    }
+  }
+
+  memset(&s_check, 0, sizeof(s_check));
+  s_check.pun_red = aun_red.data();
+  s_check.pun_ir = aun_ir.data();
+  telemetry_decoder_init(&s_decoder);
+  for (un_pos = 0; un_pos < auch_bytes.size(); un_pos += 1000) // odd read sizes split frames anywhere
+    telemetry_decoder_push(&s_decoder, auch_bytes.data() + un_pos, auch_bytes.size() - un_pos < 1000 ? auch_bytes.size() - un_pos : 1000,
+        bench_telemetry_handler, &s_check);
+
+  printf("telemetry\tdamage\t%u bit errors, %u cuts\t%u/%u frames, %u lost, %u CRC, %u framing errors\t%u/%u samples, %u missing, %u mismatches\n",
+      un_flips, un_cuts, s_decoder.un_frames, s_clean.un_frames, s_decoder.un_lost_frames, s_decoder.un_crc_errors, s_decoder.un_framing_errors,
+      s_check.un_samples, (uint32_t)aun_red.size(), s_decoder.un_missing_samples, s_check.un_mismatch);
+  return s_check.un_mismatch == 0 && s_decoder.un_restarts == 0 && s_decoder.un_frames + s_decoder.un_lost_frames == s_clean.un_frames
+      && s_check.un_samples + s_decoder.un_missing_samples == aun_red.size() && s_decoder.un_lost_frames > 0;
+}
+
+bool bench_telemetry()
+{
+  std::vector<uint8_t> auch_bytes;
+  std::vector<uint32_t> aun_red, aun_ir;
+  bool b_pass = bench_telemetry_mux("mux-25hz", 25.0f, aun_red, aun_ir, auch_bytes);
+  b_pass &= bench_telemetry_mux("mux-400hz", 400.0f, aun_red, aun_ir, auch_bytes);
+  b_pass &= bench_telemetry_decode(auch_bytes);
+  b_pass &= bench_telemetry_damage(auch_bytes, aun_red, aun_ir);
+  return b_pass;
+}
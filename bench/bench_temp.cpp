@@ -0,0 +1,111 @@
+/*
+ * Cached die temperature (max30102_temp) against the register level simulator
+ * The die warms by 1 C per minute. Acquisition drains the FIFO whenever INT
+ * is asserted, and every 25 samples an estimate needs the temperature:
+ * - blocking: maxim_max30102_read_temperature() on the hot path, as loop() did
+ * - polled / interrupt: max30102_temp_service() every millisecond, the hot
+ *   path reads the cache
+ * - interrupt-late: the FIFO is only drained every 1.5 s, so DIE_TEMP_RDY
+ *   mostly goes unseen and the conversions fall back to polling
+ * Reports bus bytes spent on the temperature, time the hot path is blocked and
+ * the error against the die temperature at the time of the read.
+ */
+#include "bench.h"
+#include <max30102.h>
+#include <max30102_sim.h>
+#include <max30102_temp.h>
+#include <math.h>
+#include <stdio.h>
+
+#define BENCH_TEMP_SECONDS 120
+#define BENCH_TEMP_REFRESH_MS 10000
+#define BENCH_TEMP_C_PER_S (1.0f / 60.0f)
+
+enum bench_temp_mode { BENCH_TEMP_BLOCKING, BENCH_TEMP_POLLED, BENCH_TEMP_INTERRUPT, BENCH_TEMP_INTERRUPT_LATE };
+
+static bool bench_temp_case(const char* s_name, bench_temp_mode e_mode)
+{
+  max30102_sim s_sim;
+  max30102_hal s_hal;
+  max30102_temp s_temp;
+  uint32_t aun_red[MAX30102_FIFO_DEPTH], aun_ir[MAX30102_FIFO_DEPTH];
+  uint32_t un_ms, un_samples = 0, un_reads = 0, un_temp_bytes = 0, un_hot_bytes = 0, un_bytes;
+  uint64_t ul_start_us, ul_blocked_us = 0, ul_service_max_us = 0;
+  float f_celsius, f_err, f_err_max = 0.0f;
+  int8_t ch_integer;
+  uint8_t uch_fraction, uch_num;
+  bool b_have;
+
+  max30102_sim_init(&s_sim, NULL, NULL);
+  max30102_sim_hal(&s_sim, &s_hal);
+  maxim_max30102_set_hal(&s_hal);
+  if (!maxim_max30102_init())
+    return false;
+  if (e_mode != BENCH_TEMP_BLOCKING && !max30102_temp_init(&s_temp, BENCH_TEMP_REFRESH_MS, e_mode != BENCH_TEMP_POLLED))
+    return false;
+  s_sim.s_stats = max30102_sim_stats();
+
+  for (un_ms = 0; un_ms < BENCH_TEMP_SECONDS * 1000; un_ms++) {
+    max30102_sim_advance_us(&s_sim, 1000);
+    s_sim.f_die_temp_c = 30.0f + BENCH_TEMP_C_PER_S * (float)(s_sim.ul_now_us / 1e6);
+    if (e_mode != BENCH_TEMP_BLOCKING) {
+      un_bytes = s_sim.s_stats.un_bytes;
+      ul_start_us = s_sim.ul_now_us;
+      max30102_temp_service(&s_temp);
+      un_temp_bytes += s_sim.s_stats.un_bytes - un_bytes;
+      if (s_sim.ul_now_us - ul_start_us > ul_service_max_us)
+        ul_service_max_us = s_sim.ul_now_us - ul_start_us;
+    }
+    if (e_mode == BENCH_TEMP_INTERRUPT_LATE ? un_ms % 1500 != 0 : !max30102_sim_int_asserted(&s_sim))
+      continue;
+    if (!maxim_max30102_read_fifo_burst(aun_red, aun_ir, MAX30102_FIFO_DEPTH, &uch_num))
+      return false;
+    if (un_samples / 25 == (un_samples + uch_num) / 25) {
+      un_samples += uch_num;
+      continue;
+    }
+    un_samples += uch_num;
+
+    // estimate: the hot path wants the temperature
+    un_bytes = s_sim.s_stats.un_bytes;
+    ul_start_us = s_sim.ul_now_us;
+    if (e_mode == BENCH_TEMP_BLOCKING) {
+      b_have = maxim_max30102_read_temperature(&ch_integer, &uch_fraction);
+      f_celsius = ch_integer + uch_fraction / 16.0f;
+      b_have &= un_reads > 0; // the first read returns the power-on registers
+    } else
+      b_have = max30102_temp_read(&s_temp, &f_celsius);
+    un_hot_bytes += s_sim.s_stats.un_bytes - un_bytes;
+    ul_blocked_us += s_sim.ul_now_us - ul_start_us;
+    un_reads++;
+    if (!b_have)
+      continue;
+    f_err = fabsf(f_celsius - s_sim.f_die_temp_c);
+    if (f_err > f_err_max)
+      f_err_max = f_err;
+  }
+
+  printf("temp\t%-14s\t%6.2f bus bytes/s\thot path %6.1f bytes %7.1f us/estimate\tservice max %5.1f us\terror max %5.3f C\t"
+         "%3u conversions %4u polls %3u timeouts\tdropped %u samples\n",
+      s_name, (double)(un_temp_bytes + un_hot_bytes) / BENCH_TEMP_SECONDS, (double)un_hot_bytes / un_reads, (double)ul_blocked_us / un_reads,
+      (double)ul_service_max_us, f_err_max, e_mode == BENCH_TEMP_BLOCKING ? un_reads : s_temp.un_conversions,
+      e_mode == BENCH_TEMP_BLOCKING ? 0 : s_temp.un_polls, e_mode == BENCH_TEMP_BLOCKING ? 0 : s_temp.un_timeouts, s_sim.s_stats.un_samples_dropped);
+  if (e_mode == BENCH_TEMP_BLOCKING)
+    return true;
+  // the hot path never waits, and the cache is at most one refresh (plus quantization) behind
+  bool b_pass = un_hot_bytes == 0 && ul_service_max_us < 1000 && f_err_max <= BENCH_TEMP_C_PER_S * BENCH_TEMP_REFRESH_MS / 1000 + 0.07f;
+  if (e_mode == BENCH_TEMP_INTERRUPT)
+    b_pass &= s_temp.un_polls == 0;
+  if (e_mode == BENCH_TEMP_INTERRUPT_LATE)
+    b_pass &= s_temp.un_timeouts >= s_temp.un_conversions / 2; // unless a FIFO read happens to fall into the window
+  return b_pass;
+}
+
+bool bench_temp()
+{
+  bool b_pass = bench_temp_case("blocking", BENCH_TEMP_BLOCKING);
+  b_pass &= bench_temp_case("polled", BENCH_TEMP_POLLED);
+  b_pass &= bench_temp_case("interrupt", BENCH_TEMP_INTERRUPT);
+  b_pass &= bench_temp_case("interrupt-late", BENCH_TEMP_INTERRUPT_LATE);
+  return b_pass;
+}
@@ -0,0 +1,380 @@
+/*
+ * Store-and-forward uplink (lib/uplink) against a loopback UDP receiver
+ * Two hours of device time on the simulated clock at 25 Hz: one result per
+ * second, quality every 10 s, temperature every 30 s, as src/main.cpp with
+ * -DUPLINK. The link goes down for 1 min, for 15 min, for 10 s, refuses
+ * 1 send in 20 for 5 min, and stays up for 2 min while the receiver is down.
+ * The receiver acks every batch to its source, as teldump --udp does.
+ * - results: no raw samples, and a planned restart of the device in the
+ *   middle of the long outage; every record must arrive exactly once and in
+ *   order, also those sent while the receiver was down, the backlog must
+ *   drain within the rate limit
+ * - raw: raw blocks too, into a queue too small for the long outage; the
+ *   oldest batches are dropped, and exactly those must be missing
+ * Reports packets and bytes per second against one datagram per record
+ * (28 bytes of IP/UDP header each), the peak queue depth, how long the
+ * backlog took to drain, delivery delays, and how long a full queue lasts.
+ */
+#include "bench.h"
+#include <uplink.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#define BENCH_UPLINK_SECONDS 7200
+#define BENCH_UPLINK_FS 25
+#define BENCH_UPLINK_STEP_MS (1000 / BENCH_UPLINK_FS)
+#define BENCH_UPLINK_IP_UDP 28 // header bytes per datagram
+#define BENCH_UPLINK_RATE 2048 // drain bytes/s
+#define BENCH_UPLINK_QUEUE_FIRMWARE 262144 // UPLINK_QUEUE_BYTES in src/main.cpp
+
+struct bench_uplink_outage {
+  uint32_t un_from_s, un_to_s;
+  uint32_t un_refuse_every;    // 0: link down; else up but every n-th send fails
+  bool b_no_receiver;          // link up and sends succeed, but nobody receives them
+};
+
+static const bench_uplink_outage as_bench_uplink_outages[] = {
+  { 600, 660, 0, false }, { 1800, 2700, 0, false }, { 4000, 4010, 0, false }, { 5000, 5300, 20, false }, { 6000, 6120, 0, true },
+};
+
+struct bench_uplink_net {
+  int n_tx, n_rx;
+  struct sockaddr_in s_to;
+  bool b_up;
+  bool b_no_receiver;
+  uint32_t un_refuse_every;
+  uint32_t un_sends;
+  uint32_t un_second;          // device time, for the per second byte counts
+  std::vector<uint32_t> aun_bytes_per_s;
+};
+
+struct bench_uplink_receiver {
+  telemetry_decoder s_decoder;
+  bool b_started;
+  uint32_t un_next_batch;
+  uint32_t un_batch_gap;       // batch sequence numbers skipped
+  uint32_t un_datagrams;       // batches received, also duplicates and those nobody was there for
+  uint32_t un_unheard;         // arrived while the receiver was down: not acked
+  uint32_t un_duplicates;      // seen before: acked again, not decoded
+  uint32_t un_batches, un_stored, un_foreign;
+  uint32_t un_results, un_quality, un_temperature, un_config, un_samples;
+  uint32_t un_next_result_index;
+  uint32_t un_result_order;    // results out of order or repeated
+  uint32_t un_mismatch;        // contents differ from what was published
+  uint32_t un_now_ms;
+  uint64_t ul_delay_sum_ms;
+  uint32_t un_delay_max_ms;
+  capture_record s_record;
+};
+
+static bool bench_uplink_up(void* p_context)
+{
+  return ((bench_uplink_net*)p_context)->b_up;
+}
+
+static bool bench_uplink_send(void* p_context, const uint8_t* puch_data, uint16_t uw_len)
+{
+  bench_uplink_net* ps_net = (bench_uplink_net*)p_context;
+  if (!ps_net->b_up || (ps_net->un_refuse_every > 0 && ++ps_net->un_sends % ps_net->un_refuse_every == 0))
+    return false;
+  if (sendto(ps_net->n_tx, puch_data, uw_len, 0, (struct sockaddr*)&ps_net->s_to, sizeof(ps_net->s_to)) != uw_len)
+    return false;
+  ps_net->aun_bytes_per_s[ps_net->un_second] += uw_len;
+  return true;
+}
+
+static uint16_t bench_uplink_ack(void* p_context, uint8_t* puch_data, uint16_t uw_size)
+{
+  ssize_t n_len = recv(((bench_uplink_net*)p_context)->n_tx, puch_data, uw_size, MSG_DONTWAIT);
+  return n_len > 0 ? (uint16_t)n_len : 0;
+}
+
+static uint32_t bench_uplink_sample(uint32_t un_index, bool b_red)
+{
+  return ((un_index * (b_red ? 2654435761u : 40503u)) >> 7) & 0x3FFFF;
+}
+
+static void bench_uplink_frame(void* p_context, const telemetry_frame* ps_frame)
+{
+  bench_uplink_receiver* ps_rx = (bench_uplink_receiver*)p_context;
+  telemetry_result s_result;
+  telemetry_quality s_quality;
+  capture_config s_config;
+  uint32_t un_time_ms, i;
+  float f_celsius;
+
+  switch (ps_frame->uch_stream) {
+  case TELEMETRY_STREAM_RESULT:
+    if (!telemetry_parse_result(ps_frame, &s_result)) {
+      ps_rx->un_mismatch++;
+      break;
+    }
+    ps_rx->un_mismatch += s_result.w_heart_rate != 60 + (int16_t)(s_result.un_time_ms / 1000 % 40);
+    ps_rx->un_result_order += s_result.un_sample_index < ps_rx->un_next_result_index;
+    ps_rx->un_next_result_index = s_result.un_sample_index + 1;
+    ps_rx->ul_delay_sum_ms += ps_rx->un_now_ms - s_result.un_time_ms;
+    if (ps_rx->un_now_ms - s_result.un_time_ms > ps_rx->un_delay_max_ms)
+      ps_rx->un_delay_max_ms = ps_rx->un_now_ms - s_result.un_time_ms;
+    ps_rx->un_results++;
+    break;
+  case TELEMETRY_STREAM_QUALITY:
+    ps_rx->un_mismatch += !telemetry_parse_quality(ps_frame, &s_quality) || s_quality.uch_led_ir != 0x24;
+    ps_rx->un_quality++;
+    break;
+  case TELEMETRY_STREAM_TEMPERATURE:
+    ps_rx->un_mismatch += !telemetry_parse_temperature(ps_frame, &un_time_ms, &f_celsius) || f_celsius != 31.5f;
+    ps_rx->un_temperature++;
+    break;
+  case TELEMETRY_STREAM_CONFIG:
+    ps_rx->un_mismatch += !telemetry_parse_config(ps_frame, &s_config);
+    ps_rx->un_config++;
+    break;
+  case TELEMETRY_STREAM_SAMPLES:
+    if (!telemetry_parse_samples(ps_frame, &ps_rx->s_record)) {
+      ps_rx->un_mismatch++;
+      break;
+    }
+    for (i = 0; i < ps_rx->s_record.uw_count; i++)
+      ps_rx->un_mismatch += ps_rx->s_record.aun_red[i] != bench_uplink_sample(ps_rx->s_record.un_index + i, true)
+          || ps_rx->s_record.aun_ir[i] != bench_uplink_sample(ps_rx->s_record.un_index + i, false);
+    ps_rx->un_samples += ps_rx->s_record.uw_count;
+    break;
+  default:
+    ps_rx->un_mismatch++;
+  }
+}
+
+static void bench_uplink_receive(bench_uplink_net* ps_net, bench_uplink_receiver* ps_rx)
+{
+  uint8_t auch_datagram[2048], auch_ack[UPLINK_ACK_BYTES];
+  struct sockaddr_in s_from;
+  socklen_t un_from_len = sizeof(s_from);
+  uplink_batch s_batch;
+  ssize_t n_len;
+
+  while ((n_len = recvfrom(ps_net->n_rx, auch_datagram, sizeof(auch_datagram), MSG_DONTWAIT, (struct sockaddr*)&s_from, &un_from_len)) > 0) {
+    un_from_len = sizeof(s_from);
+    if (!uplink_parse_batch(auch_datagram, (size_t)n_len, &s_batch) || s_batch.uw_device_id != 0x0102) {
+      ps_rx->un_foreign++;
+      continue;
+    }
+    ps_rx->un_datagrams++;
+    ps_rx->un_stored += (s_batch.uch_flags & UPLINK_BATCH_STORED) != 0;
+    if (ps_net->b_no_receiver) {
+      ps_rx->un_unheard++;
+      continue;
+    }
+    sendto(ps_net->n_rx, auch_ack, uplink_make_ack(&s_batch, auch_ack), 0, (struct sockaddr*)&s_from, sizeof(s_from));
+    if (ps_rx->b_started && s_batch.un_sequence < ps_rx->un_next_batch) {
+      ps_rx->un_duplicates++;
+      continue;
+    }
+    if (ps_rx->b_started && s_batch.un_sequence > ps_rx->un_next_batch)
+      ps_rx->un_batch_gap += s_batch.un_sequence - ps_rx->un_next_batch;
+    ps_rx->b_started = true;
+    ps_rx->un_next_batch = s_batch.un_sequence + 1;
+    ps_rx->un_batches++;
+    telemetry_decoder_push(&ps_rx->s_decoder, s_batch.puch_frames, s_batch.uw_frames_len, bench_uplink_frame, ps_rx);
+  }
+}
+
+static void bench_uplink_add(uplink_stats* ps_sum, const uplink_stats* ps_stats)
+{
+  ps_sum->un_records += ps_stats->un_records;
+  ps_sum->un_batches += ps_stats->un_batches;
+  ps_sum->un_sent_live += ps_stats->un_sent_live;
+  ps_sum->un_stored += ps_stats->un_stored;
+  ps_sum->un_drained += ps_stats->un_drained;
+  ps_sum->un_dropped += ps_stats->un_dropped;
+  ps_sum->un_send_failures += ps_stats->un_send_failures;
+  ps_sum->un_acked += ps_stats->un_acked;
+  ps_sum->un_ack_timeouts += ps_stats->un_ack_timeouts;
+  ps_sum->un_store_errors += ps_stats->un_store_errors;
+  ps_sum->ul_bytes_sent += ps_stats->ul_bytes_sent;
+  ps_sum->ul_batch_bytes += ps_stats->ul_batch_bytes;
+  if (ps_stats->un_peak_depth > ps_sum->un_peak_depth)
+    ps_sum->un_peak_depth = ps_stats->un_peak_depth;
+  if (ps_stats->un_peak_depth_bytes > ps_sum->un_peak_depth_bytes)
+    ps_sum->un_peak_depth_bytes = ps_stats->un_peak_depth_bytes;
+}
+
+static bool bench_uplink_case(const char* s_name, bool b_raw, uint32_t un_queue_bytes, uint32_t un_restart_s)
+{
+  static uplink_publisher s_pub;
+  static bench_uplink_receiver s_rx;
+  const uint32_t un_steps = BENCH_UPLINK_SECONDS * BENCH_UPLINK_FS;
+  std::vector<uint8_t> auch_flash(un_queue_bytes, 0xFF); // erased flash
+  bench_uplink_net s_net = {};
+  uplink_config s_config;
+  uplink_link s_link;
+  uplink_store s_store;
+  uplink_stats s_sum;
+  telemetry_result s_result;
+  telemetry_quality s_quality;
+  capture_config s_capture;
+  socklen_t un_addr_len = sizeof(s_net.s_to);
+  uint32_t un_now_ms = 0, un_step, un_second, un_jump = 0, un_drained_s = 0, un_worst_10s = 0, un_window = 0, un_depth, i;
+  uint32_t un_expected_results = 0, un_expected_quality = 0, un_expected_temperature = 0, un_first_index = 0;
+  double f_records_per_s;
+  uint64_t ul_start, ul_ns;
+  int n_rcvbuf = 4 << 20;
+  bool b_pass = true, b_draining = false;
+
+  memset(&s_rx, 0, sizeof(s_rx));
+  memset(&s_sum, 0, sizeof(s_sum));
+  s_net.aun_bytes_per_s.assign(BENCH_UPLINK_SECONDS + 1, 0);
+  s_net.n_tx = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  s_net.n_rx = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  s_net.s_to.sin_family = AF_INET;
+  s_net.s_to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  setsockopt(s_net.n_rx, SOL_SOCKET, SO_RCVBUF, &n_rcvbuf, sizeof(n_rcvbuf));
+  if (s_net.n_tx < 0 || s_net.n_rx < 0 || bind(s_net.n_rx, (struct sockaddr*)&s_net.s_to, sizeof(s_net.s_to)) != 0
+      || getsockname(s_net.n_rx, (struct sockaddr*)&s_net.s_to, &un_addr_len) != 0) {
+    printf("uplink\t%s\tcannot open the loopback UDP sockets\n", s_name);
+    return false;
+  }
+  telemetry_decoder_init(&s_rx.s_decoder);
+
+  uplink_default_config(&s_config);
+  s_config.uw_device_id = 0x0102;
+  s_config.un_drain_bytes_per_s = BENCH_UPLINK_RATE;
+  s_config.b_raw = b_raw;
+  s_link.p_context = &s_net;
+  s_link.up = bench_uplink_up;
+  s_link.send = bench_uplink_send;
+  s_link.receive = bench_uplink_ack;
+  uplink_store_ram(&s_store, auch_flash.data(), un_queue_bytes);
+  b_pass &= uplink_init(&s_pub, &s_config, &s_link, &s_store, un_now_ms);
+  memset(&s_capture, 0, sizeof(s_capture));
+  s_capture.auch_regs[0] = 0x4F;
+  uplink_publish_config(&s_pub, &s_capture, un_now_ms);
+  memset(&s_quality, 0, sizeof(s_quality));
+  s_quality.uch_led_ir = 0x24;
+
+  ul_start = bench_ns();
+  for (un_step = 0; un_step < un_steps; un_step++) {
+    un_now_ms = un_step * BENCH_UPLINK_STEP_MS;
+    un_second = un_now_ms / 1000;
+    s_net.un_second = un_second;
+    s_net.b_up = true;
+    s_net.b_no_receiver = false;
+    s_net.un_refuse_every = 0;
+    for (i = 0; i < sizeof(as_bench_uplink_outages) / sizeof(as_bench_uplink_outages[0]); i++)
+      if (un_second >= as_bench_uplink_outages[i].un_from_s && un_second < as_bench_uplink_outages[i].un_to_s) {
+        s_net.b_up = as_bench_uplink_outages[i].un_refuse_every > 0 || as_bench_uplink_outages[i].b_no_receiver;
+        s_net.un_refuse_every = as_bench_uplink_outages[i].un_refuse_every;
+        s_net.b_no_receiver = as_bench_uplink_outages[i].b_no_receiver;
+      }
+    if (un_restart_s > 0 && un_now_ms == un_restart_s * 1000) {
+      // planned restart: close the open batch, lose the RAM, come back from the store
+      uplink_flush(&s_pub, un_now_ms);
+      bench_uplink_add(&s_sum, &s_pub.s_stats);
+      un_jump = s_pub.un_next_sequence;
+      b_pass &= uplink_init(&s_pub, &s_config, &s_link, &s_store, un_now_ms) && uplink_queue_depth(&s_pub, NULL) > 0;
+      un_jump = s_pub.un_next_sequence - un_jump;
+      uplink_publish_config(&s_pub, &s_capture, un_now_ms);
+      un_first_index = un_step; // sample indices start over
+    }
+
+    uplink_publish_sample(&s_pub, bench_uplink_sample(un_step - un_first_index, true), bench_uplink_sample(un_step - un_first_index, false),
+        un_now_ms);
+    if (un_step % BENCH_UPLINK_FS == BENCH_UPLINK_FS - 1) {
+      memset(&s_result, 0, sizeof(s_result));
+      s_result.un_time_ms = un_now_ms;
+      s_result.un_sample_index = un_step;
+      s_result.w_heart_rate = 60 + (int16_t)(un_second % 40);
+      s_result.uch_flags = TELEMETRY_RESULT_HR_VALID;
+      uplink_publish_result(&s_pub, &s_result, un_now_ms);
+      un_expected_results++;
+      if (un_second % 10 == 0) {
+        s_quality.un_time_ms = un_now_ms;
+        uplink_publish_quality(&s_pub, &s_quality, un_now_ms);
+        un_expected_quality++;
+      }
+      if (un_second % 30 == 0) {
+        uplink_publish_temperature(&s_pub, 31, 8, un_now_ms);
+        un_expected_temperature++;
+      }
+    }
+    uplink_service(&s_pub, un_now_ms);
+    s_rx.un_now_ms = un_now_ms;
+    bench_uplink_receive(&s_net, &s_rx);
+
+    // after the long outage: how long until the backlog is gone
+    un_depth = uplink_queue_depth(&s_pub, NULL);
+    if (un_second == as_bench_uplink_outages[1].un_to_s && un_depth > 0 && !b_draining && un_drained_s == 0)
+      b_draining = true;
+    if (b_draining && un_depth == 0) {
+      b_draining = false;
+      un_drained_s = un_second - as_bench_uplink_outages[1].un_to_s;
+    }
+  }
+  uplink_flush(&s_pub, un_now_ms);
+  for (i = 0; i < 100000 && uplink_queue_depth(&s_pub, NULL) > 0; i++) { // the last batches, if any, until acked
+    uplink_service(&s_pub, un_now_ms += BENCH_UPLINK_STEP_MS);
+    s_rx.un_now_ms = un_now_ms;
+    bench_uplink_receive(&s_net, &s_rx);
+  }
+  ul_ns = bench_ns() - ul_start;
+  usleep(10000);
+  bench_uplink_receive(&s_net, &s_rx);
+  bench_uplink_add(&s_sum, &s_pub.s_stats);
+
+  // the drain rate: no 10 s window above rate * 10 s plus the burst
+  for (i = 0; i <= BENCH_UPLINK_SECONDS; i++) {
+    un_window += s_net.aun_bytes_per_s[i] - (i >= 10 ? s_net.aun_bytes_per_s[i - 10] : 0);
+    if (un_window > un_worst_10s)
+      un_worst_10s = un_window;
+  }
+  close(s_net.n_tx);
+  close(s_net.n_rx);
+
+  f_records_per_s = (double)(un_expected_results + un_expected_quality + un_expected_temperature + (b_raw ? un_steps / TELEMETRY_BLOCK_SAMPLES : 0))
+      / BENCH_UPLINK_SECONDS;
+  printf("uplink\t%-8s\t%u s, queue %u KiB\t%.3f packets/s, %.1f B/s incl. IP/UDP (one per record: %.2f packets/s, %.1f B/s)\tmean batch %.0f B\t"
+         "%u live, %u stored, %u drained, %u dropped, %u send failures\t%u acked, %u ack timeouts, %u unheard, %u duplicates\tpeak depth %u batches, %.1f KiB\tlong outage drained in %u s, "
+         "worst 10 s %u B (limit %u)\tresult delay mean %.2f s, max %u s\t%u KiB queue lasts %.1f min\thost %.0f ns/sample\n",
+      s_name, BENCH_UPLINK_SECONDS, un_queue_bytes / 1024, (double)s_rx.un_batches / BENCH_UPLINK_SECONDS,
+      (s_sum.ul_bytes_sent + (double)BENCH_UPLINK_IP_UDP * (s_sum.un_sent_live + s_sum.un_drained)) / BENCH_UPLINK_SECONDS, f_records_per_s,
+      (s_sum.ul_batch_bytes - (double)UPLINK_BATCH_HEADER * s_sum.un_batches) / BENCH_UPLINK_SECONDS + BENCH_UPLINK_IP_UDP * f_records_per_s,
+      s_sum.un_batches ? (double)s_sum.ul_batch_bytes / s_sum.un_batches : 0.0, s_sum.un_sent_live, s_sum.un_stored, s_sum.un_drained,
+      s_sum.un_dropped, s_sum.un_send_failures, s_sum.un_acked, s_sum.un_ack_timeouts, s_rx.un_unheard, s_rx.un_duplicates, s_sum.un_peak_depth, s_sum.un_peak_depth_bytes / 1024.0, un_drained_s, un_worst_10s,
+      BENCH_UPLINK_RATE * 10 + s_config.un_drain_burst_bytes, s_rx.un_results ? s_rx.ul_delay_sum_ms / 1e3 / s_rx.un_results : 0.0,
+      s_rx.un_delay_max_ms / 1000, BENCH_UPLINK_QUEUE_FIRMWARE / 1024,
+      BENCH_UPLINK_QUEUE_FIRMWARE / ((s_sum.ul_batch_bytes + (double)UPLINK_RING_RECORD * s_sum.un_batches) / BENCH_UPLINK_SECONDS) / 60.0,
+      (double)ul_ns / un_steps);
+
+  b_pass &= s_sum.un_store_errors == 0 && s_rx.un_foreign == 0 && s_rx.un_mismatch == 0 && s_rx.un_result_order == 0;
+  b_pass &= s_rx.s_decoder.un_crc_errors == 0 && s_rx.s_decoder.un_framing_errors == 0
+      && s_rx.s_decoder.un_restarts == (un_restart_s > 0 ? 1u : 0u);
+  b_pass &= s_rx.un_datagrams == s_sum.un_sent_live + s_sum.un_drained && s_rx.un_stored == s_sum.un_drained;
+  // every batch heard is acked once, and the receiver outage was noticed and made up for
+  b_pass &= s_rx.un_batches == s_sum.un_acked && s_rx.un_unheard > 0 && s_sum.un_ack_timeouts > 0 && uplink_queue_depth(&s_pub, NULL) == 0;
+  b_pass &= s_rx.un_batch_gap == un_jump + s_sum.un_dropped; // the restart skips ahead, drops leave holes
+  b_pass &= un_drained_s > 0 && un_worst_10s <= BENCH_UPLINK_RATE * 10 + s_config.un_drain_burst_bytes;
+  if (s_sum.un_dropped == 0)
+    b_pass &= s_rx.un_results == un_expected_results && s_rx.un_quality == un_expected_quality && s_rx.un_temperature == un_expected_temperature
+        && s_rx.s_decoder.un_lost_frames == 0 && s_rx.un_samples == (b_raw ? un_steps : 0);
+  else
+    b_pass &= b_raw && s_rx.s_decoder.un_lost_frames > 0 && s_rx.un_samples + s_rx.s_decoder.un_missing_samples == un_steps;
+  if (!b_pass)
+    printf("uplink\t%s\tFAIL: %u/%u results, %u/%u quality, %u/%u temperature, %u samples + %u missing, %u lost frames, %u restarts, "
+           "batch gap %u (restart %u, dropped %u), %u batches / %u acked, %u mismatches, %u out of order, %u store errors\n",
+        s_name, s_rx.un_results, un_expected_results, s_rx.un_quality, un_expected_quality, s_rx.un_temperature, un_expected_temperature,
+        s_rx.un_samples, s_rx.s_decoder.un_missing_samples, s_rx.s_decoder.un_lost_frames, s_rx.s_decoder.un_restarts, s_rx.un_batch_gap,
+        un_jump, s_sum.un_dropped, s_rx.un_batches, s_sum.un_acked, s_rx.un_mismatch, s_rx.un_result_order, s_sum.un_store_errors);
+  return b_pass;
+}
+
+bool bench_uplink()
+{
+  bool b_pass = bench_uplink_case("results", false, 65536, 2250);
+  b_pass &= bench_uplink_case("raw", true, 65536, 0);
+  return b_pass;
+}
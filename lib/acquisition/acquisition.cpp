@@ -0,0 +1,232 @@
+/** \file acquisition.cpp ******************************************************
+*
+* Description: Interrupt driven MAX30102 sample acquisition
+*
+* Producer: acq_service() (loop context, does the I2C work)
+* Consumer: acq_read()    (loop context or another task)
+* The ISR never touches the ring, it only sets b_int_pending.
+*
+* ------------------------------------------------------------------------- */
+
+#include "acquisition.h"
+#include <max30102.h>
+#if defined(ARDUINO_ARCH_ESP8266)
+extern "C" {
+#include <user_interface.h>
+#include <gpio.h>
+}
+#endif
+
+#define ACQ_RING_MASK (ACQ_RING_SIZE - 1)
+#define acq_barrier() __asm__ __volatile__("" ::: "memory")
+
+static uint32_t aun_ring_red[ACQ_RING_SIZE];
+static uint32_t aun_ring_ir[ACQ_RING_SIZE];
+static volatile uint16_t uw_ring_head = 0; // written by the producer only
+static volatile uint16_t uw_ring_tail = 0; // written by the consumer only
+
+static volatile bool b_int_pending = false;
+static uint8_t uch_acq_int_pin;
+static bool b_poll_due = false; // woken by the timer: millis() stood still, poll now
+static uint32_t un_empty_polls = 0; // in a row, for acq_stalled() across sleeps
+static uint32_t un_last_service_ms, un_last_sample_ms;
+static uint32_t un_missed_interrupts = 0;
+static uint32_t un_overruns = 0;
+
+static void IRAM_ATTR acq_isr()
+{
+  b_int_pending = true;
+}
+
+bool acq_begin(uint8_t uch_int_pin)
+/**
+* \brief        Start interrupt driven acquisition
+* \par          Details
+*               Empties the ring and attaches the ISR to the falling edge of the MAX30102
+*               INT pin (active low). The sensor must already be initialized.
+*
+* \param[in]    uch_int_pin    - GPIO connected to the MAX30102 INT pin
+*
+* \retval       true on success
+*/
+{
+  uw_ring_head = 0;
+  uw_ring_tail = 0;
+  un_missed_interrupts = 0;
+  un_overruns = 0;
+  un_empty_polls = 0;
+  b_poll_due = false;
+  uch_acq_int_pin = uch_int_pin;
+  un_last_service_ms = un_last_sample_ms = millis();
+  pinMode(uch_int_pin, INPUT);
+  attachInterrupt(digitalPinToInterrupt(uch_int_pin), acq_isr, FALLING);
+  // INT may already be low from samples collected before the ISR was attached
+  b_int_pending = (digitalRead(uch_int_pin) == LOW);
+  return true;
+}
+
+uint8_t acq_service(void)
+/**
+* \brief        Move samples from the sensor FIFO into the ring
+* \par          Details
+*               Call from loop(). Does nothing unless the ISR flagged the FIFO almost full
+*               interrupt or ACQ_POLL_TIMEOUT_MS passed without one; in the latter case the
+*               FIFO is polled and, if it held data, the interrupt is counted as missed.
+*               Samples that do not fit into the ring stay in the sensor FIFO.
+*
+* \retval       Number of samples moved into the ring
+*/
+{
+  uint32_t un_now = millis();
+  uint16_t uw_head, uw_free;
+  uint8_t uch_samples;
+  bool b_polled;
+
+  if (b_int_pending) {
+    b_int_pending = false;
+    b_polled = false;
+  } else if (b_poll_due || un_now - un_last_service_ms >= ACQ_POLL_TIMEOUT_MS) {
+    b_polled = true;
+  } else
+    return 0;
+  un_last_service_ms = un_now;
+  b_poll_due = false;
+
+  uw_head = uw_ring_head;
+  uw_free = ACQ_RING_SIZE - (uint16_t)(uw_head - uw_ring_tail);
+  if (uw_free == 0) {
+    un_overruns++; // consumer is behind, leave the data in the sensor FIFO
+    return 0;
+  }
+  // read straight into the ring and across its end: stopping there would leave samples in the
+  // FIFO after the status read cleared A_FULL, and no new interrupt if they are above the threshold
+  if (uw_free > MAX30102_FIFO_DEPTH)
+    uw_free = MAX30102_FIFO_DEPTH;
+  if (!maxim_max30102_read_fifo_ring(aun_ring_red, aun_ring_ir, ACQ_RING_SIZE, uw_head, uw_free, &uch_samples))
+    return 0;
+  if (uch_samples == 0) {
+    if (b_polled)
+      un_empty_polls++;
+    return 0;
+  }
+  if (b_polled)
+    un_missed_interrupts++;
+  un_empty_polls = 0;
+  un_last_sample_ms = un_now;
+  acq_barrier(); // publish the samples before the new head
+  uw_ring_head = uw_head + uch_samples;
+  return uch_samples;
+}
+
+bool acq_read(uint32_t *pun_red_led, uint32_t *pun_ir_led)
+/**
+* \brief        Take one sample from the ring
+* \par          Details
+*               Never blocks.
+*
+* \param[out]   *pun_red_led    - red LED reading
+* \param[out]   *pun_ir_led     - IR LED reading
+*
+* \retval       true if a sample was available
+*/
+{
+  uint16_t uw_tail = uw_ring_tail;
+  if (uw_tail == uw_ring_head)
+    return false;
+  acq_barrier();
+  *pun_red_led = aun_ring_red[uw_tail & ACQ_RING_MASK];
+  *pun_ir_led = aun_ring_ir[uw_tail & ACQ_RING_MASK];
+  acq_barrier(); // consume before releasing the slot
+  uw_ring_tail = uw_tail + 1;
+  return true;
+}
+
+uint16_t acq_available(void)
+{
+  return (uint16_t)(uw_ring_head - uw_ring_tail);
+}
+
+bool acq_stalled(void)
+/**
+* \brief        Sensor watchdog
+* \retval       true if no sample arrived for ACQ_STALL_TIMEOUT_MS, or for as many empty
+*               polls when acq_sleep() kept millis() from advancing
+*/
+{
+  return millis() - un_last_sample_ms >= ACQ_STALL_TIMEOUT_MS
+      || un_empty_polls * ACQ_POLL_TIMEOUT_MS >= ACQ_STALL_TIMEOUT_MS;
+}
+
+uint32_t acq_missed_interrupts(void)
+{
+  return un_missed_interrupts;
+}
+
+uint32_t acq_overruns(void)
+{
+  return un_overruns;
+}
+
+bool acq_sleep(uint32_t un_max_ms)
+/**
+* \brief        Sleep until the sensor interrupt, or un_max_ms at most
+* \par          Details
+*               ESP8266 forced light sleep with a low level GPIO wakeup on the INT pin. Turns
+*               the radio off for good on the first call: do not combine with Wi-Fi. The SDK
+*               enters the sleep in the delay() below and finishes that delay after waking.
+*               A wake by the timer makes the next acq_service() poll the FIFO, as millis()
+*               stood still meanwhile. Flush the serial port first. Elsewhere this returns
+*               at once.
+*
+* \param[in]    un_max_ms    - timer wakeup, ACQ_POLL_TIMEOUT_MS keeps the poll cadence
+*
+* \retval       true if it slept, false if an interrupt was already pending
+*/
+{
+  if (b_int_pending || digitalRead(uch_acq_int_pin) == LOW)
+    return false;
+#if defined(ARDUINO_ARCH_ESP8266)
+  static bool b_radio_off = false;
+  if (!b_radio_off) {
+    wifi_set_opmode_current(NULL_MODE);
+    b_radio_off = true;
+  }
+  wifi_fpm_set_sleep_type(LIGHT_SLEEP_T);
+  wifi_fpm_open();
+  gpio_pin_wakeup_enable(GPIO_ID_PIN(uch_acq_int_pin), GPIO_PIN_INTR_LOLEVEL);
+  wifi_fpm_do_sleep(un_max_ms * 1000);
+  delay(10);
+  gpio_pin_wakeup_disable();
+  wifi_fpm_close();
+  if (digitalRead(uch_acq_int_pin) == LOW)
+    b_int_pending = true; // the level wakeup beat the edge interrupt
+  else
+    b_poll_due = true;
+  return true;
+#else
+  (void)un_max_ms;
+  return false;
+#endif
+}
+
+uint32_t acq_clock_us(void)
+/**
+* \brief        Microseconds that keep counting through acq_sleep()
+* \par          Details
+*               The RTC timer on the ESP8266, scaled by its calibration (Q12 us per tick);
+*               micros() elsewhere. Wraps like micros(): compare differences.
+*/
+{
+#if defined(ARDUINO_ARCH_ESP8266)
+  static uint32_t un_rtc_last = 0, un_clock_us = 0;
+  static uint64_t ul_frac = 0;
+  uint32_t un_rtc = system_get_rtc_time();
+  ul_frac += (uint64_t)(un_rtc - un_rtc_last) * system_rtc_clock_cali_proc();
+  un_rtc_last = un_rtc;
+  un_clock_us += (uint32_t)(ul_frac >> 12);
+  ul_frac &= 0xFFF;
+  return un_clock_us;
+#else
+  return micros();
+#endif
+}
@@ -0,0 +1,35 @@
+/** \file acquisition.h ******************************************************
+*
+* Description: Interrupt driven MAX30102 sample acquisition
+*
+* The INT pin interrupt only raises a flag. acq_service(), called from loop(),
+* drains the sensor FIFO into a single-producer/single-consumer ring buffer
+* that the application empties with acq_read() without ever blocking.
+*
+* Between FIFO almost full interrupts the application may acq_sleep(): forced
+* light sleep on the ESP8266, woken by INT going low (see lib/duty for the
+* threshold). The CPU clocks stop while asleep, so acq_clock_us() is the time
+* to measure sleeping with.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef ACQUISITION_H_
+#define ACQUISITION_H_
+
+#include <Arduino.h>
+
+#define ACQ_RING_SIZE 128 // samples, must be a power of two and at least MAX30102_FIFO_DEPTH
+#define ACQ_POLL_TIMEOUT_MS 1500 // poll the FIFO if no interrupt arrived for this long (almost full fires every ~1.1 s at 25 sps)
+#define ACQ_STALL_TIMEOUT_MS 5000 // no samples at all for this long means the sensor is dead
+
+bool acq_begin(uint8_t uch_int_pin);
+uint8_t acq_service(void);
+bool acq_read(uint32_t *pun_red_led, uint32_t *pun_ir_led);
+uint16_t acq_available(void);
+bool acq_stalled(void);
+uint32_t acq_missed_interrupts(void);
+uint32_t acq_overruns(void);
+bool acq_sleep(uint32_t un_max_ms);
+uint32_t acq_clock_us(void);
+
+#endif /* ACQUISITION_H_ */
@@ -27,13 +27,105 @@
 
 
 #include "algorithm.h"
-#include <Arduino.h>
+
+#ifndef PROGMEM // Arduino cores keep PROGMEM data in flash, the host in memory
+#define PROGMEM
+#define pgm_read_float(p) (*(const float *)(p))
+#endif
+
+typedef struct {
+  float af[MAXIM_SPO2_TABLE_SIZE];
+} maxim_spo2_table_t;
+
+static constexpr maxim_spo2_table_t maxim_spo2_table_make()
+{
+  maxim_spo2_table_t s_table = {};
+  for (int32_t i = 0; i < MAXIM_SPO2_TABLE_SIZE; i++) {
+    double r = i / 100.0;
+    double f_spo2 = -45.060 * r * r + 30.354 * r + 94.845;
+    s_table.af[i] = f_spo2 > 0.0 ? (float)f_spo2 : 0.0f;
+  }
+  return s_table;
+}
+
+// The ESP8266 keeps const data in DRAM unless told otherwise; the 184 floats of the
+// former uch_spo2_table[] were 736 bytes of it
+static constexpr maxim_spo2_table_t s_spo2_table PROGMEM = maxim_spo2_table_make();
+static_assert(s_spo2_table.af[1] == 95.144034f && s_spo2_table.af[183] == 0.0f, "SpO2 table no longer matches the calibration");
+#if defined(ARDUINO_ARCH_ESP8266)
+// Shown in the firmware build output (pio run -e esp01); the size check keeps the message true
+static_assert(sizeof(s_spo2_table) == 740, "the SpO2 table changed size, update the message below");
+#pragma message("SpO2 table: 740 bytes in flash (PROGMEM), none in DRAM; the former uch_spo2_table[] took 736 bytes of DRAM")
+#endif
+
+float maxim_spo2_table(int32_t n_ratio_x100)
+/**
+* \brief        SpO2 for a red/IR ratio in percent
+* \par          Details
+*               The calibration table entry for n_ratio_x100 = 100*ratio, 0 to MAXIM_SPO2_TABLE_SIZE-1.
+*
+* \retval       SpO2 in percent
+*/
+{
+  return pgm_read_float(&s_spo2_table.af[n_ratio_x100]);
+}
+
+float maxim_spo2_from_ratio(float f_ratio)
+/**
+* \brief        SpO2 for a red/IR ratio, interpolated from the table
+* \par          Details
+*               Linear between the two neighbouring entries, within 0.0012 % SpO2 of the
+*               curve except next to its zero near 1.83, where the table is clamped to 0.
+*               Ratios outside 0 to 1.84 read the end entries.
+*               Single precision throughout, two flash reads.
+*
+* \retval       SpO2 in percent
+*/
+{
+  float f_x = f_ratio * 100.0f, f_lo, f_hi;
+  int32_t n_i;
+
+  if (!(f_x > 0.0f)) // also NaN
+    return pgm_read_float(&s_spo2_table.af[0]);
+  if (f_x >= MAXIM_SPO2_TABLE_SIZE - 1)
+    return pgm_read_float(&s_spo2_table.af[MAXIM_SPO2_TABLE_SIZE - 1]);
+  n_i = (int32_t)f_x;
+  f_lo = pgm_read_float(&s_spo2_table.af[n_i]);
+  f_hi = pgm_read_float(&s_spo2_table.af[n_i + 1]);
+  return f_lo + (f_hi - f_lo) * (f_x - n_i);
+}
 
 //#if defined(ARDUINO_AVR_UNO)
 //Arduino Uno doesn't have enough SRAM to store 100 samples of IR led data and red led data in 32-bit format
 //To solve this problem, 16-bit MSB of the sampled data will be truncated.  Samples become 16-bit data.
 void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, 
-int32_t *pn_spo2, int8_t *pch_spo2_valid,  int32_t *pn_heart_rate, int8_t *pch_hr_valid)
+float *pn_spo2, int8_t *pch_spo2_valid,  int32_t *pn_heart_rate, int8_t *pch_hr_valid)
+/**
+* \brief        Calculate the heart rate and SpO2 level
+* \par          Details
+*               Single channel version of maxim_heart_rate_and_oxygen_saturation_r(), not reentrant.
+*
+* \retval       None
+*/
+{
+  static maxim_channel_state s_default_channel = { MAXIM_FS, MAXIM_MIN_PEAK_DISTANCE, 0, {}, {} };
+  maxim_heart_rate_and_oxygen_saturation_r(&s_default_channel, pun_ir_buffer, n_ir_buffer_length, pun_red_buffer, pn_spo2, pch_spo2_valid, pn_heart_rate, pch_hr_valid);
+}
+
+void maxim_channel_init(maxim_channel_state *ps_state)
+/**
+* \brief        Reset a channel to its cold-start state
+*
+* \retval       None
+*/
+{
+  ps_state->n_last_peak_interval = MAXIM_FS;
+  ps_state->n_min_peak_distance = MAXIM_MIN_PEAK_DISTANCE;
+  ps_state->un_windows = 0;
+}
+
+void maxim_heart_rate_and_oxygen_saturation_r(maxim_channel_state *ps_state, uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer,
+float *pn_spo2, int8_t *pch_spo2_valid,  int32_t *pn_heart_rate, int8_t *pch_hr_valid)
 
 /**
 * \brief        Calculate the heart rate and SpO2 level
@@ -41,10 +133,14 @@ int32_t *pn_spo2, int8_t *pch_spo2_valid,  int32_t *pn_heart_rate, int8_t *pch_h
 *               By detecting  peaks of PPG cycle and corresponding AC/DC of red/infra-red signal, the an_ratio for the SPO2 is computed.
 *               Since this algorithm is aiming for Arm M0/M3. formaula for SPO2 did not achieve the accuracy due to register overflow.
 *               Thus, accurate SPO2 is precalculated and save longo uch_spo2_table[] per each an_ratio.
+*               All state and scratch buffers live in *ps_state, see maxim_channel_init(). Of two valleys
+*               at most ps_state->n_min_peak_distance apart only the deeper one counts.
+*               pun_red_buffer NULL estimates the heart rate alone, SpO2 is reported invalid.
 *
 * \param[in]    *pun_ir_buffer           - IR sensor data buffer
-* \param[in]    n_ir_buffer_length      - IR sensor data buffer length
-* \param[in]    *pun_red_buffer          - Red sensor data buffer
+* \param[in]    n_ir_buffer_length      - IR and red sensor data buffer length, must be MAXIM_BUFFER_SIZE: the pipeline
+*                                         is sized by it. Any other length reports heart rate and SpO2 invalid.
+* \param[in]    *pun_red_buffer          - Red sensor data buffer, NULL for heart rate only
 * \param[out]    *pn_spo2                - Calculated SpO2 value
 * \param[out]    *pch_spo2_valid         - 1 if the calculated SpO2 value is valid
 * \param[out]    *pn_heart_rate          - Calculated heart rate value
@@ -53,13 +149,13 @@ int32_t *pn_spo2, int8_t *pch_spo2_valid,  int32_t *pn_heart_rate, int8_t *pch_h
 * \retval       None
 */
 {
-  uint32_t un_ir_mean,un_only_once ;
+  uint32_t un_ir_mean;
   int32_t k, n_i_ratio_count;
-  int32_t i, s, m, n_exact_ir_valley_locs_count, n_middle_idx;
-  int32_t n_th1, n_npks, n_c_min;   
-  int32_t an_ir_valley_locs[15] ;
+  int32_t i, n_exact_ir_valley_locs_count, n_middle_idx;
+  int32_t n_th1, n_npks;   
+  int32_t an_ir_valley_locs[MAXIM_MAX_PEAKS(MAXIM_BUFFER_SIZE_MA4)] ;
+  int16_t aw_peak_scratch[MAXIM_PEAK_SCRATCH(MAXIM_BUFFER_SIZE_MA4)] ;
   int32_t n_peak_interval_sum;
-  static int32_t n_last_peak_interval=FS; // Initialize it to 25, which corresponds to heart rate of 60 bps, RF
   
   int32_t n_y_ac, n_x_ac;
 //  int32_t n_spo2_calc; 
@@ -67,48 +163,63 @@ int32_t *pn_spo2, int8_t *pch_spo2_valid,  int32_t *pn_heart_rate, int8_t *pch_h
   int32_t n_y_dc_max_idx, n_x_dc_max_idx; 
   int32_t an_ratio[5], n_ratio_average; 
   int32_t n_nume, n_denom ;
-  int32_t an_x[ BUFFER_SIZE]; //ir
-  int32_t an_y[ BUFFER_SIZE]; //red
+  int32_t *an_x = ps_state->an_x; //ir
+  int32_t *an_y = ps_state->an_y; //red
+
+  ps_state->un_windows++;
+  if (n_ir_buffer_length != MAXIM_BUFFER_SIZE) { // the pipeline and *ps_state are sized by MAXIM_BUFFER_SIZE
+    *pn_heart_rate = -999;
+    *pch_hr_valid  = 0;
+    *pn_spo2 =  -999 ;
+    *pch_spo2_valid  = 0;
+    return;
+  }
 
-  // calculates DC mean and subtracts DC from ir
+  // calculates DC mean and subtracts DC from ir, over MAXIM_BUFFER_SIZE as the moving average below:
+  // a constant trip count the compiler vectorizes
   un_ir_mean =0; 
-  for (k=0 ; k<n_ir_buffer_length ; k++ ) un_ir_mean += pun_ir_buffer[k] ;
-  un_ir_mean =un_ir_mean/n_ir_buffer_length ;
+  for (k=0 ; k<MAXIM_BUFFER_SIZE ; k++ ) un_ir_mean += pun_ir_buffer[k] ;
+  un_ir_mean =un_ir_mean/MAXIM_BUFFER_SIZE ;
   
   // remove DC and invert signal so that we can use peak detector as valley detector
-  for (k=0 ; k<n_ir_buffer_length ; k++ )  
+  for (k=0 ; k<MAXIM_BUFFER_SIZE ; k++ )  
     an_x[k] = un_ir_mean - pun_ir_buffer[k] ; 
 
   // 4 pt Moving Average
-  for(k=0; k< BUFFER_SIZE_MA4; k++){
+  for(k=0; k< MAXIM_BUFFER_SIZE_MA4; k++){
     an_x[k]=( an_x[k]+an_x[k+1]+ an_x[k+2]+ an_x[k+3])/(int)4;        
   }
   // calculate threshold  
   n_th1=0; 
-  for ( k=0 ; k<BUFFER_SIZE_MA4 ;k++){
+  for ( k=0 ; k<MAXIM_BUFFER_SIZE_MA4 ;k++){
     n_th1 +=  an_x[k];
   }
-  n_th1= n_th1/ (BUFFER_SIZE_MA4);
+  n_th1= n_th1/ (MAXIM_BUFFER_SIZE_MA4);
   if( n_th1<30) n_th1=30; // min allowed
   if( n_th1>60) n_th1=60; // max allowed
 
-  for ( k=0 ; k<15;k++) an_ir_valley_locs[k]=0;
   // since we flipped signal, we use peak detector as valley detector
-  maxim_find_peaks( an_ir_valley_locs, &n_npks, an_x, BUFFER_SIZE_MA4, n_th1, 4, 15 );//peak_height, peak_distance, max_num_peaks 
+  maxim_find_peaks_linear( an_ir_valley_locs, &n_npks, an_x, MAXIM_BUFFER_SIZE_MA4, n_th1, ps_state->n_min_peak_distance, aw_peak_scratch );//peak_height, peak_distance
   n_peak_interval_sum =0;
   if (n_npks>=2){
     for (k=1; k<n_npks; k++) n_peak_interval_sum += (an_ir_valley_locs[k] - an_ir_valley_locs[k -1] ) ;
     n_peak_interval_sum =n_peak_interval_sum/(n_npks-1);
-    *pn_heart_rate =(int32_t)( (FS*60)/ n_peak_interval_sum );
+    *pn_heart_rate =(int32_t)( (MAXIM_FS*60)/ n_peak_interval_sum );
     *pch_hr_valid  = 1;
+    ps_state->n_last_peak_interval = n_peak_interval_sum;
   }
   else  { 
     *pn_heart_rate = -999; // unable to calculate because # of peaks are too small
     *pch_hr_valid  = 0;
   }
+  if (pun_red_buffer == NULL) { // heart rate only, no red channel
+    *pn_spo2 =  -999 ;
+    *pch_spo2_valid  = 0;
+    return;
+  }
 
   //  load raw value again for SPO2 calculation : RED(=y) and IR(=X)
-  for (k=0 ; k<n_ir_buffer_length ; k++ )  {
+  for (k=0 ; k<MAXIM_BUFFER_SIZE ; k++ )  {
       an_x[k] =  pun_ir_buffer[k] ; 
       an_y[k] =  pun_red_buffer[k] ; 
   }
@@ -123,7 +234,7 @@ int32_t *pn_spo2, int8_t *pch_spo2_valid,  int32_t *pn_heart_rate, int8_t *pch_h
   n_i_ratio_count = 0; 
   for(k=0; k< 5; k++) an_ratio[k]=0;
   for (k=0; k< n_exact_ir_valley_locs_count; k++){
-    if (an_ir_valley_locs[k] > BUFFER_SIZE ) {
+    if (an_ir_valley_locs[k] > MAXIM_BUFFER_SIZE ) {
       *pn_spo2 =  -999 ; // do not use SPO2 since valley loc is out of range
       *pch_spo2_valid  = 0; 
       return;
@@ -165,7 +276,7 @@ int32_t *pn_spo2, int8_t *pch_spo2_valid,  int32_t *pn_heart_rate, int8_t *pch_h
 
   if( n_ratio_average>2 && n_ratio_average <184){
 //    n_spo2_calc= uch_spo2_table[n_ratio_average] ; uch_spo2_table is approximated as  -45.060*ratioAverage* ratioAverage + 30.354 *ratioAverage + 94.845 ;
-    *pn_spo2 = uch_spo2_table[n_ratio_average];
+    *pn_spo2 = maxim_spo2_table(n_ratio_average);
     *pch_spo2_valid  = 1;//  float_SPO2 =  -45.060*n_ratio_average* n_ratio_average/10000 + 30.354 *n_ratio_average/100 + 94.845 ;  // for comparison with table
   }
   else{
@@ -185,7 +296,110 @@ void maxim_find_peaks( int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32
 {
   maxim_peaks_above_min_height( pn_locs, n_npks, pn_x, n_size, n_min_height );
   maxim_remove_close_peaks( pn_locs, n_npks, pn_x, n_min_distance );
-  *n_npks = min( *n_npks, n_max_num );
+  if ( *n_npks > n_max_num ) *n_npks = n_max_num;
+}
+
+void maxim_find_peaks_linear( int32_t *pn_locs, int32_t *pn_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height, int32_t n_min_distance, int16_t *pw_scratch )
+/**
+* \brief        Find peaks in linear time
+* \par          Details
+*               Same peaks as maxim_find_peaks() without its limit of 15 candidates: all peaks above
+*               n_min_height, of two peaks at most n_min_distance apart only the taller (on a tie the
+*               earlier) one, none within n_min_distance of index -1, in ascending order.
+*               maxim_remove_close_peaks() gets there by sorting and a nested loop. Here the
+*               candidates go into a Cartesian tree (tallest at the root) built with a monotonic
+*               stack, and one walk down the tree decides each peak: it survives unless the nearest
+*               surviving ancestor on either side is too close. Peaks in the two subtrees of a
+*               survivor that are too close to each other are both too close to the survivor, so
+*               no other peak needs to be looked at. A plateau running into the end of pn_x is no peak.
+*
+* \param[out]   *pn_locs       - peak locations, room for MAXIM_MAX_PEAKS(n_size)
+* \param[in]    *pw_scratch    - MAXIM_PEAK_SCRATCH(n_size) words, n_size must be below 32768
+*
+* \retval       None
+*/
+{
+  int16_t *pw_left = pw_scratch;                              // tree: left child, later 1 if the peak survives
+  int16_t *pw_right = pw_left + MAXIM_MAX_PEAKS(n_size);      // tree: right child
+  int16_t *pw_stack = pw_right + MAXIM_MAX_PEAKS(n_size);     // monotonic stack, then (peak, left bound, right bound) triples
+  int32_t i, n_width, n_npks = 0, n_top, n_node, n_last, n_kept_left, n_kept_right;
+  bool b_plateau = false;
+
+  // candidates, as maxim_peaks_above_min_height(): every sample above n_min_height and its left
+  // neighbour and not below its right one, a test without a branch, which noisy data would mispredict.
+  // The location is stored either way and kept by counting it; at most i/2 peaks precede i.
+  for (i = 1; i < n_size-1; i++){
+    pn_locs[n_npks] = i;
+    n_npks += (pn_x[i] > n_min_height) & (pn_x[i] > pn_x[i-1]) & (pn_x[i] >= pn_x[i+1]);
+  }
+  // a candidate level with its right neighbour starts a plateau: the scan that walks it
+  for (i = 0; i < n_npks; i++)
+    b_plateau |= pn_x[pn_locs[i]] == pn_x[pn_locs[i]+1];
+  i = 1;
+  if (b_plateau)
+    n_npks = 0;
+  else
+    i = n_size;
+  while (i < n_size-1){
+    if (pn_x[i] > n_min_height && pn_x[i] > pn_x[i-1]){
+      n_width = 1;
+      while (i+n_width < n_size && pn_x[i] == pn_x[i+n_width])
+        n_width++;
+      if (i+n_width < n_size && pn_x[i] > pn_x[i+n_width]) {
+        pn_locs[n_npks++] = i;
+        i += n_width+1;
+      } else
+        i += n_width;
+    }
+    else
+      i++;
+  }
+
+  // Cartesian tree: everything popped by a taller peak becomes its left subtree, a peak is the
+  // right child of the next taller one still on the stack. Equal heights are not popped, the earlier wins.
+  n_top = 0;
+  for (i = 0; i < n_npks; i++){
+    n_last = -1;
+    while (n_top > 0 && pn_x[pn_locs[pw_stack[n_top-1]]] < pn_x[pn_locs[i]])
+      n_last = pw_stack[--n_top];
+    pw_left[i] = n_last;
+    pw_right[i] = -1;
+    if (n_top > 0)
+      pw_right[pw_stack[n_top-1]] = i;
+    pw_stack[n_top++] = i;
+  }
+
+  // Walk down from the root with the nearest surviving ancestor on each side, index -1 counts as one
+  if (n_top > 0){ // the root is at the bottom of the stack
+    pw_stack[1] = -1;
+    pw_stack[2] = INT16_MAX;
+    n_top = 3;
+  }
+  while (n_top > 0){
+    n_top -= 3;
+    n_node = pw_stack[n_top];
+    n_kept_left = pw_stack[n_top+1];
+    n_kept_right = pw_stack[n_top+2];
+    n_last = pw_left[n_node];
+    pw_left[n_node] = pn_locs[n_node] - n_kept_left > n_min_distance && n_kept_right - pn_locs[n_node] > n_min_distance;
+    if (n_last >= 0){
+      pw_stack[n_top] = n_last;
+      pw_stack[n_top+1] = n_kept_left;
+      pw_stack[n_top+2] = pw_left[n_node] ? pn_locs[n_node] : n_kept_right;
+      n_top += 3;
+    }
+    if (pw_right[n_node] >= 0){
+      pw_stack[n_top] = pw_right[n_node];
+      pw_stack[n_top+1] = pw_left[n_node] ? pn_locs[n_node] : n_kept_left;
+      pw_stack[n_top+2] = n_kept_right;
+      n_top += 3;
+    }
+  }
+
+  *pn_npks = 0;
+  for (i = 0; i < n_npks; i++)
+    if (pw_left[i])
+      pn_locs[(*pn_npks)++] = pn_locs[i];
 }
 
 void maxim_peaks_above_min_height( int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height )
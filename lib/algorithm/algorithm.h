@@ -61,15 +61,21 @@
 */
 #ifndef ALGORITHM_H_
 #define ALGORITHM_H_
+#ifdef ARDUINO
 #include <Arduino.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
 
-#define true 1
-#define false 0
-#define FS 25    //sampling frequency
-#define BUFFER_SIZE  (FS* 4) 
+// Prefixed so this header can share a translation unit with algorithmRF.h
+#define MAXIM_FS 25    //sampling frequency
+#define MAXIM_BUFFER_SIZE  (MAXIM_FS* 4)
 #define MA4_SIZE  4 // DONOT CHANGE
-#define BUFFER_SIZE_MA4 BUFFER_SIZE-MA4_SIZE
-#define min(x,y) ((x) < (y) ? (x) : (y))
+#define MAXIM_BUFFER_SIZE_MA4 (MAXIM_BUFFER_SIZE-MA4_SIZE)
+#define MAXIM_MAX_PEAKS(n) ((n) / 2) // peaks maxim_find_peaks_linear() can find in n samples
+#define MAXIM_PEAK_SCRATCH(n) (5 * MAXIM_MAX_PEAKS(n)) // int16_t scratch words maxim_find_peaks_linear() needs for n samples
+#define MAXIM_MIN_PEAK_DISTANCE 4 // valleys at most this many samples apart are one beat, unless the caller knows the period
 
 //uch_spo2_table is approximated as  -45.060*ratioAverage* ratioAverage + 30.354 *ratioAverage + 94.845 ;
 //const uint8_t uch_spo2_table[184]={ 95, 95, 95, 96, 96, 96, 97, 97, 97, 97, 97, 98, 98, 98, 98, 98, 99, 99, 99, 99, 
@@ -83,22 +89,23 @@
 //              28, 27, 26, 25, 23, 22, 21, 20, 19, 17, 16, 15, 14, 12, 11, 10, 9, 7, 6, 5, 
 //              3, 2, 1 } ;
 //
-//uch_spo2_table is approximated as  -45.060*ratioAverage* ratioAverage + 30.354 *ratioAverage + 94.845 ;
-const float uch_spo2_table[184]=
-              {94.845,95.144034,95.434056,95.715066,95.987064,96.25005,96.504024,96.748986,96.984936,97.211874,97.4298,97.638714,97.838616,98.029506,
-              98.211384,98.38425,98.548104,98.702946,98.848776,98.985594,99.1134,99.232194,99.341976,99.442746,99.534504,99.61725,99.690984,99.755706,
-              99.811416,99.858114,99.8958,99.924474,99.944136,99.954786,99.956424,99.94905,99.932664,99.907266,99.872856,99.829434,99.777,99.715554,
-              99.645096,99.565626,99.477144,99.37965,99.273144,99.157626,99.033096,98.899554,98.757,98.605434,98.444856,98.275266,98.096664,97.90905,
-              97.712424,97.506786,97.292136,97.068474,96.8358,96.594114,96.343416,96.083706,95.814984,95.53725,95.250504,94.954746,94.649976,94.336194,
-              94.0134,93.681594,93.340776,92.990946,92.632104,92.26425,91.887384,91.501506,91.106616,90.702714,90.2898,89.867874,89.436936,88.996986,
-              88.548024,88.09005,87.623064,87.147066,86.662056,86.168034,85.665,85.152954,84.631896,84.101826,83.562744,83.01465,82.457544,81.891426,
-              81.316296,80.732154,80.139,79.536834,78.925656,78.305466,77.676264,77.03805,76.390824,75.734586,75.069336,74.395074,73.7118,73.019514,
-              72.318216,71.607906,70.888584,70.16025,69.422904,68.676546,67.921176,67.156794,66.3834,65.600994,64.809576,64.009146,63.199704,62.38125,
-              61.553784,60.717306,59.871816,59.017314,58.1538,57.281274,56.399736,55.509186,54.609624,53.70105,52.783464,51.856866,50.921256,49.976634,
-              49.023,48.060354,47.088696,46.108026,45.118344,44.11965,43.111944,42.095226,41.069496,40.034754,38.991,37.938234,36.876456,35.805666,
-              34.725864,33.63705,32.539224,31.432386,30.316536,29.191674,28.0578,26.914914,25.763016,24.602106,23.432184,22.25325,21.065304,19.868346,
-              18.662376,17.447394,16.2234,14.990394,13.748376,12.497346,11.237304,9.96825,8.690184,7.403106,6.107016,4.801914,3.4878,2.164674,0.832536,
-              0.0};
+// SpO2 calibration curve -45.060*r*r + 30.354*r + 94.845 (0 where negative) at r = 0.00, 0.01, ...
+// Generated at compile time into flash; entry 184 only serves the interpolation up to the RF limit 1.84
+#define MAXIM_SPO2_TABLE_SIZE 185
+float maxim_spo2_table(int32_t n_ratio_x100);
+float maxim_spo2_from_ratio(float f_ratio);
+
+// Per-channel state: what is carried between windows plus scratch buffers, one per sensor or stream
+typedef struct {
+  int32_t n_last_peak_interval; // average valley distance of the last valid window in samples, MAXIM_FS until then
+  int32_t n_min_peak_distance;  // valleys at most this far apart count once, MAXIM_MIN_PEAK_DISTANCE unless the caller sets it
+  uint32_t un_windows;          // windows processed since maxim_channel_init()
+  int32_t an_x[MAXIM_BUFFER_SIZE];    // scratch: ir
+  int32_t an_y[MAXIM_BUFFER_SIZE];    // scratch: red
+} maxim_channel_state;
+
+void maxim_channel_init(maxim_channel_state *ps_state);
+void maxim_heart_rate_and_oxygen_saturation_r(maxim_channel_state *ps_state, uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, float *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid);
 
 //#if defined(ARDUINO_AVR_UNO)
 //Arduino Uno doesn't have enough SRAM to store 100 samples of IR led data and red led data in 32-bit format
@@ -108,6 +115,7 @@ const float uch_spo2_table[184]=
 void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, float *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid);
 //#endif
 void maxim_find_peaks(int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height, int32_t n_min_distance, int32_t n_max_num);
+void maxim_find_peaks_linear(int32_t *pn_locs, int32_t *pn_npks, int32_t *pn_x, int32_t n_size, int32_t n_min_height, int32_t n_min_distance, int16_t *pw_scratch);
 void maxim_peaks_above_min_height(int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height);
 void maxim_remove_close_peaks(int32_t *pn_locs, int32_t *pn_npks, int32_t *pn_x, int32_t n_min_distance);
 void maxim_sort_ascend(int32_t  *pn_x, int32_t n_size);
@@ -5,6 +5,7 @@
 
 #include "algorithmRF.h"
 #include <math.h>
+#include <string.h>
 
 void rf_heart_rate_and_oxygen_saturation(uint32_t* pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t* pun_red_buffer,
     float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate, int8_t* pch_hr_valid, float* ratio, float* correl)
@@ -14,7 +15,7 @@ void rf_heart_rate_and_oxygen_saturation(uint32_t* pun_ir_buffer, int32_t n_ir_b
  *               By detecting  peaks of PPG cycle and corresponding AC/DC of red/infra-red signal, the xy_ratio for the SPO2 is computed.
  *
  * \param[in]    *pun_ir_buffer           - IR sensor data buffer
- * \param[in]    n_ir_buffer_length      - IR sensor data buffer length
+ * \param[in]    n_ir_buffer_length      - IR sensor data buffer length, must be BUFFER_SIZE
  * \param[in]    *pun_red_buffer          - Red sensor data buffer
  * \param[out]    *pn_spo2                - Calculated SpO2 value
  * \param[out]    *pch_spo2_valid         - 1 if the calculated SpO2 value is valid
@@ -26,85 +27,308 @@ void rf_heart_rate_and_oxygen_saturation(uint32_t* pun_ir_buffer, int32_t n_ir_b
  *  REFERENCE: https://www.maximintegrated.com/en/design/technical-documents/app-notes/6/6845.html
  */
 {
-    int32_t k;
-    static int32_t n_last_peak_interval = LOWEST_PERIOD;
-    float f_ir_mean, f_red_mean, f_ir_sumsq, f_red_sumsq;
-    float f_red_ac, f_ir_ac, xy_ratio;
-    float beta_ir, beta_red, x;
-    float an_ir[BUFFER_SIZE], *pointer_ir; // ir, x
-    float an_red[BUFFER_SIZE], *pointer_red; // red, y
-
-    // calculates DC mean and subtracts DC from ir and red
-    f_ir_mean = 0.0;
-    f_red_mean = 0.0;
-    for (k = 0; k < n_ir_buffer_length; ++k) {
-        f_ir_mean += pun_ir_buffer[k];
-        f_red_mean += pun_red_buffer[k];
-    }
-    f_ir_mean = f_ir_mean / n_ir_buffer_length;
-    f_red_mean = f_red_mean / n_ir_buffer_length;
+    static rf_channel_state s_default_channel = { LOWEST_PERIOD, 0, 0, {}, {} }; // single channel, not reentrant
+    rf_heart_rate_and_oxygen_saturation_r(&s_default_channel, pun_ir_buffer, n_ir_buffer_length, pun_red_buffer, pn_spo2, pch_spo2_valid,
+        pn_heart_rate, pch_hr_valid, ratio, correl);
+}
 
-    // remove DC
-    for (k = 0, pointer_ir = an_ir, pointer_red = an_red; k < n_ir_buffer_length; ++k, ++pointer_ir, ++pointer_red) {
-        *pointer_ir = pun_ir_buffer[k] - f_ir_mean;
-        *pointer_red = pun_red_buffer[k] - f_red_mean;
-    }
+void rf_channel_init(rf_channel_state* ps_state)
+/**
+ * \brief        Reset a channel to its cold-start state
+ * \retval       None
+ */
+{
+    rf_channel_init_cfg(ps_state);
+}
 
-    // RF, remove linear trend (baseline leveling)
-    beta_ir = rf_linear_regression_beta(an_ir, mean_X, sum_X2);
-    beta_red = rf_linear_regression_beta(an_red, mean_X, sum_X2);
-    for (k = 0, x = -mean_X, pointer_ir = an_ir, pointer_red = an_red; k < n_ir_buffer_length; ++k, ++x, ++pointer_ir, ++pointer_red) {
-        *pointer_ir -= beta_ir * x;
-        *pointer_red -= beta_red * x;
-    }
+void rf_heart_rate_and_oxygen_saturation_r(rf_channel_state* ps_state, uint32_t* pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t* pun_red_buffer,
+    float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate, int8_t* pch_hr_valid, float* ratio, float* correl)
+/**
+ * \brief        Calculate the heart rate and SpO2 level for one of several channels
+ * \par          Details
+ *               Reentrant version of rf_heart_rate_and_oxygen_saturation(): periodicity, warm-up
+ *               status and scratch buffers live in *ps_state, initialized with rf_channel_init().
+ *               pun_red_buffer may be NULL for heart rate only, see rf_heart_rate_and_oxygen_saturation_cfg().
+ *
+ * \retval       None
+ */
+{
+    (void)n_ir_buffer_length; // always BUFFER_SIZE, the window length is fixed by rf_default_config
+    rf_heart_rate_and_oxygen_saturation_cfg(ps_state, pun_ir_buffer, pun_red_buffer, pn_spo2, pch_spo2_valid, pn_heart_rate, pch_hr_valid, ratio, correl);
+}
+
+// -----------------------------------
+// Sliding window estimators
+
+static void rf_sums_remove_oldest(rf_window_sums* ps_sums, int64_t n_ir, int64_t n_red)
+{
+    // Every remaining sample moves one position to the left, which lowers sum(k*x) by sum(x) of the survivors.
+    ps_sums->n_ir_ksum -= ps_sums->n_ir_sum - n_ir;
+    ps_sums->n_red_ksum -= ps_sums->n_red_sum - n_red;
+    ps_sums->n_ir_sum -= n_ir;
+    ps_sums->n_red_sum -= n_red;
+    ps_sums->n_ir_sumsq -= n_ir * n_ir;
+    ps_sums->n_red_sumsq -= n_red * n_red;
+    ps_sums->n_cross_sum -= n_ir * n_red;
+}
+
+static void rf_sums_add(rf_window_sums* ps_sums, int64_t n_ir, int64_t n_red, int32_t n_position)
+{
+    ps_sums->n_ir_ksum += n_position * n_ir;
+    ps_sums->n_red_ksum += n_position * n_red;
+    ps_sums->n_ir_sum += n_ir;
+    ps_sums->n_red_sum += n_red;
+    ps_sums->n_ir_sumsq += n_ir * n_ir;
+    ps_sums->n_red_sumsq += n_red * n_red;
+    ps_sums->n_cross_sum += n_ir * n_red;
+}
+
+static void rf_sums_moments(const rf_window_sums* ps_sums, float* pf_ir_mean, float* pf_red_mean, float* pf_ir_beta, double* pd_ir_sumsq,
+    double* pd_red_sumsq, float* correl)
+/**
+ * \brief        DC, IR trend and second moments of the detrended window of BUFFER_SIZE samples
+ * \par          Details
+ *               A window of red zeros is a heart rate only stream: correl is 1, as in
+ *               rf_heart_rate_and_oxygen_saturation_cfg() without a red buffer.
+ */
+{
+    int64_t n_ir_var, n_red_var, n_cov, n_ir_tx, n_red_tx;
+    double d_ir_beta, d_red_beta, d_cross;
+
+    // Mean-centered second moments, exact: N*sum(x*x) - sum(x)^2 fits easily into 64 bits for 18-bit samples
+    n_ir_var = BUFFER_SIZE * ps_sums->n_ir_sumsq - ps_sums->n_ir_sum * ps_sums->n_ir_sum;
+    n_red_var = BUFFER_SIZE * ps_sums->n_red_sumsq - ps_sums->n_red_sum * ps_sums->n_red_sum;
+    n_cov = BUFFER_SIZE * ps_sums->n_cross_sum - ps_sums->n_ir_sum * ps_sums->n_red_sum;
+    // 2*sum((k-mean_X)*x) = 2*sum(k*x) - (BUFFER_SIZE-1)*sum(x)
+    n_ir_tx = 2 * ps_sums->n_ir_ksum - (BUFFER_SIZE - 1) * ps_sums->n_ir_sum;
+    n_red_tx = 2 * ps_sums->n_red_ksum - (BUFFER_SIZE - 1) * ps_sums->n_red_sum;
+    d_ir_beta = (double)n_ir_tx / (2.0 * sum_X2);
+    d_red_beta = (double)n_red_tx / (2.0 * sum_X2);
+
+    // Moments of the detrended signals: removing beta*(k-mean_X) lowers sum(x*x) by beta^2*sum_X2
+    // and sum(ir*red) by beta_ir*beta_red*sum_X2
+    *pd_ir_sumsq = ((double)n_ir_var / BUFFER_SIZE - d_ir_beta * d_ir_beta * sum_X2) / BUFFER_SIZE;
+    *pd_red_sumsq = ((double)n_red_var / BUFFER_SIZE - d_red_beta * d_red_beta * sum_X2) / BUFFER_SIZE;
+    d_cross = ((double)n_cov / BUFFER_SIZE - d_ir_beta * d_red_beta * sum_X2) / BUFFER_SIZE;
+    if (*pd_ir_sumsq < 0.0)
+        *pd_ir_sumsq = 0.0;
+    if (*pd_red_sumsq < 0.0)
+        *pd_red_sumsq = 0.0;
+
+    *pf_ir_mean = (float)ps_sums->n_ir_sum / BUFFER_SIZE;
+    *pf_red_mean = (float)ps_sums->n_red_sum / BUFFER_SIZE;
+    *pf_ir_beta = d_ir_beta;
+    *correl = ps_sums->n_red_sum == 0 ? 1.0 : d_cross / sqrt(*pd_ir_sumsq * *pd_red_sumsq);
+}
 
-    // For SpO2 calculate RMS of both AC signals. In addition, pulse detector needs raw sum of squares for IR
-    f_red_ac = rf_rms(an_red, n_ir_buffer_length, &f_red_sumsq);
-    f_ir_ac = rf_rms(an_ir, n_ir_buffer_length, &f_ir_sumsq);
-
-    // Calculate Pearson correlation between red and IR
-    *correl = rf_Pcorrelation(an_ir, an_red, n_ir_buffer_length) / sqrt(f_red_sumsq * f_ir_sumsq);
-
-    // Find signal periodicity
-    if (*correl >= min_pearson_correlation) {
-        // At the beginning of oximetry run the exact range of heart rate is unknown. This may lead to wrong rate if the next call does not find the _first_
-        // peak of the autocorrelation function. E.g., second peak would yield only 50% of the true rate.
-        if (LOWEST_PERIOD == n_last_peak_interval)
-            rf_initialize_periodicity_search(an_ir, BUFFER_SIZE, &n_last_peak_interval, HIGHEST_PERIOD, min_autocorrelation_ratio, f_ir_sumsq);
-        // If correlation is good, then find average periodicity of the IR signal. If aperiodic, return periodicity of 0
-        if (n_last_peak_interval != 0)
-            rf_signal_periodicity(an_ir, BUFFER_SIZE, &n_last_peak_interval, LOWEST_PERIOD, HIGHEST_PERIOD, min_autocorrelation_ratio, f_ir_sumsq, ratio);
+void rf_stream_init(rf_stream_state* ps_state, int32_t n_hop)
+/**
+ * \brief        Reset a sliding window estimator
+ * \par          Details
+ *               n_hop is the number of new samples between two estimates, 1..BUFFER_SIZE.
+ *               n_hop = BUFFER_SIZE reproduces the batch behaviour of rf_heart_rate_and_oxygen_saturation().
+ *
+ * \retval       None
+ */
+{
+    if (n_hop < 1)
+        n_hop = 1;
+    if (n_hop > BUFFER_SIZE)
+        n_hop = BUFFER_SIZE;
+    ps_state->n_oldest = 0;
+    ps_state->n_count = 0;
+    ps_state->n_hop = n_hop;
+    ps_state->n_since_estimate = 0;
+    ps_state->n_last_peak_interval = LOWEST_PERIOD;
+    memset(&ps_state->s_sums, 0, sizeof(ps_state->s_sums));
+}
+
+bool rf_stream_push(rf_stream_state* ps_state, uint32_t un_ir, uint32_t un_red, float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate,
+    int8_t* pch_hr_valid, float* ratio, float* correl)
+/**
+ * \brief        Add one sample to a sliding window estimator
+ * \par          Details
+ *               Updates the running sums in O(1). Once the window is full, every n_hop-th call
+ *               detrends the window and runs the periodicity search, producing the same
+ *               results rf_heart_rate_and_oxygen_saturation() would for the current window.
+ *               Outputs are only written when an estimate is produced.
+ *
+ * \param[in]    un_ir, un_red           - new IR and red samples
+ * \param[out]   (see rf_heart_rate_and_oxygen_saturation)
+ *
+ * \retval       true if a new estimate was written to the outputs
+ */
+{
+    int32_t k, n_slot;
+    double d_ir_sumsq, d_red_sumsq;
+    float f_ir_mean, f_red_mean, f_ir_beta, x;
+    float an_ir[BUFFER_SIZE];
+
+    if (ps_state->n_count == BUFFER_SIZE) {
+        rf_sums_remove_oldest(&ps_state->s_sums, ps_state->aun_ir[ps_state->n_oldest], ps_state->aun_red[ps_state->n_oldest]);
+        n_slot = ps_state->n_oldest;
+        ps_state->n_oldest = (ps_state->n_oldest + 1) % BUFFER_SIZE;
+        ps_state->n_count--;
     } else
-        n_last_peak_interval = 0;
+        n_slot = (ps_state->n_oldest + ps_state->n_count) % BUFFER_SIZE;
 
-    // Calculate heart rate if periodicity detector was successful. Otherwise, reset peak interval to its initial value and report error.
-    if (n_last_peak_interval != 0) {
-        *pn_heart_rate = (int32_t)(FS60 / n_last_peak_interval);
-        *pch_hr_valid = 1;
-    } else {
-        n_last_peak_interval = LOWEST_PERIOD;
-        *pn_heart_rate = -888; // unable to calculate because signal looks aperiodic
-        *pch_hr_valid = 0;
-        *pn_spo2 = -888; // do not use SPO2 from this corrupt signal
-        *pch_spo2_valid = 0;
-        return;
+    ps_state->aun_ir[n_slot] = un_ir;
+    ps_state->aun_red[n_slot] = un_red;
+    rf_sums_add(&ps_state->s_sums, un_ir, un_red, ps_state->n_count);
+    ps_state->n_count++;
+    ps_state->n_since_estimate++;
+
+    if (ps_state->n_count < BUFFER_SIZE || ps_state->n_since_estimate < ps_state->n_hop)
+        return false;
+    ps_state->n_since_estimate = 0;
+    PROFILE_BEGIN(PROFILE_WINDOW);
+    PROFILE_COUNT_BEGIN();
+    PROFILE_BEGIN(PROFILE_MOMENTS);
+    rf_sums_moments(&ps_state->s_sums, &f_ir_mean, &f_red_mean, &f_ir_beta, &d_ir_sumsq, &d_red_sumsq, correl);
+    PROFILE_END(PROFILE_MOMENTS);
+
+    // Only the IR signal is needed sample by sample, for the autocorrelation
+    PROFILE_BEGIN(PROFILE_DETREND);
+    for (k = 0, x = -mean_X, n_slot = ps_state->n_oldest; k < BUFFER_SIZE; ++k, ++x) {
+        an_ir[k] = (ps_state->aun_ir[n_slot] - f_ir_mean) - f_ir_beta * x;
+        if (++n_slot == BUFFER_SIZE)
+            n_slot = 0;
     }
+    PROFILE_END(PROFILE_DETREND);
 
-    // After trend removal, the mean represents DC level
-    // Ratio = (AC_red / DC_red) / (AC_ir/DC_ir) = (red_AC * ir_DC) / (red_DC * ir_AC)
-    xy_ratio = (f_red_ac * f_ir_mean) / (f_ir_ac * f_red_mean); // formula is (f_red_ac*f_ir_dc) / (f_ir_ac*f_red_dc) ;
-    // Serial.println(xy_ratio);
-    if ((xy_ratio > 0.02) && (xy_ratio < 1.84)) { // Check boundaries of applicability, 2.5
-        // spO2 calc from RF
-        *pn_spo2 = (-45.060 * xy_ratio + 30.354) * xy_ratio + 94.845;
-        *pch_spo2_valid = 1;
-    }else{
-        // spO2 calc from SparkFun
-        *pn_spo2 = (-45.060 * xy_ratio * xy_ratio / 10000) + (30.354 * xy_ratio / 100) + 94.845; // float_SPO2 =  -45.060*n_ratio_average* n_ratio_average/10000 + 30.354 *n_ratio_average/100 + 94.845 ;
-        *pch_spo2_valid = 0;
+    PROFILE_BEGIN(PROFILE_PERIODICITY);
+    rf_periodicity_and_spo2_cfg<rf_default_config>(an_ir, d_ir_sumsq, sqrt(d_ir_sumsq), sqrt(d_red_sumsq), f_ir_mean, f_red_mean, *correl,
+        &ps_state->n_last_peak_interval, pn_spo2, pch_spo2_valid, pn_heart_rate, pch_hr_valid, ratio);
+    PROFILE_END(PROFILE_PERIODICITY);
+    PROFILE_COUNT_END(PROFILE_LAGS);
+    PROFILE_END(PROFILE_WINDOW);
+    return true;
+}
+
+#define RF_PACKED_MASK 0x3FFFF
+
+static inline uint32_t rf_packed_bits24(const uint8_t* puch)
+{
+    return (uint32_t)puch[0] | ((uint32_t)puch[1] << 8) | ((uint32_t)puch[2] << 16);
+}
+
+// Sample n_slot starts at byte 9*n_slot/2, in the upper nibble if n_slot is odd
+static inline uint32_t rf_packed_ir(const uint8_t* puch_window, int32_t n_slot)
+{
+    return (rf_packed_bits24(puch_window + (n_slot * 9 >> 1) + 2) >> (2 + 4 * (n_slot & 1))) & RF_PACKED_MASK;
+}
+
+static inline uint32_t rf_packed_red(const uint8_t* puch_window, int32_t n_slot)
+{
+    return (rf_packed_bits24(puch_window + (n_slot * 9 >> 1)) >> (4 * (n_slot & 1))) & RF_PACKED_MASK;
+}
+
+static void rf_packed_store(uint8_t* puch_window, int32_t n_slot, uint32_t un_ir, uint32_t un_red)
+{
+    uint8_t* puch = puch_window + (n_slot * 9 >> 1);
+    uint64_t ul_bits = (uint64_t)(un_red & RF_PACKED_MASK) | ((uint64_t)(un_ir & RF_PACKED_MASK) << 18);
+    if (n_slot & 1) { // shares its first byte with the sample before
+        ul_bits = (ul_bits << 4) | (puch[0] & 0x0F);
+    } else
+        ul_bits |= (uint64_t)(puch[4] & 0xF0) << 32;
+    puch[0] = (uint8_t)ul_bits;
+    puch[1] = (uint8_t)(ul_bits >> 8);
+    puch[2] = (uint8_t)(ul_bits >> 16);
+    puch[3] = (uint8_t)(ul_bits >> 24);
+    puch[4] = (uint8_t)(ul_bits >> 32);
+}
+
+// Autocorrelation of the detrended IR signal, straight from the packed ring: the same
+// terms in the same order as rf_autocorrelation_n() over the window rf_stream_push() builds
+struct rf_aut_packed {
+    const rf_packed_state* ps_state;
+    float f_ir_mean, f_ir_beta;
+    rf_aut_packed(const rf_packed_state* ps_state_, float f_ir_mean_, float f_ir_beta_) : ps_state(ps_state_), f_ir_mean(f_ir_mean_), f_ir_beta(f_ir_beta_) {}
+    float operator()(int32_t n_lag) const
+    {
+        PROFILE_COUNT(1);
+        int32_t i, n_temp = BUFFER_SIZE - n_lag, n_slot = ps_state->n_oldest, n_slot_lag = (ps_state->n_oldest + n_lag) % BUFFER_SIZE;
+        float sum = 0.0, x = -mean_X, x_lag = -mean_X + n_lag;
+        if (n_temp <= 0 || n_lag < 0)
+            return sum;
+        for (i = 0; i < n_temp; ++i, ++x, ++x_lag) {
+            sum += ((rf_packed_ir(ps_state->auch_window, n_slot) - f_ir_mean) - f_ir_beta * x)
+                * ((rf_packed_ir(ps_state->auch_window, n_slot_lag) - f_ir_mean) - f_ir_beta * x_lag);
+            if (++n_slot == BUFFER_SIZE)
+                n_slot = 0;
+            if (++n_slot_lag == BUFFER_SIZE)
+                n_slot_lag = 0;
+        }
+        return sum / n_temp;
     }
+};
+
+void rf_packed_init(rf_packed_state* ps_state, int32_t n_hop)
+/**
+ * \brief        Reset a low-RAM sliding window estimator, see rf_stream_init()
+ *
+ * \retval       None
+ */
+{
+    if (n_hop < 1)
+        n_hop = 1;
+    if (n_hop > BUFFER_SIZE)
+        n_hop = BUFFER_SIZE;
+    memset(ps_state, 0, sizeof(*ps_state));
+    ps_state->n_hop = n_hop;
+    ps_state->n_last_peak_interval = LOWEST_PERIOD;
 }
-// -----------------------------------
+
+bool rf_packed_push(rf_packed_state* ps_state, uint32_t un_ir, uint32_t un_red, float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate,
+    int8_t* pch_hr_valid, float* ratio, float* correl)
+/**
+ * \brief        Add one sample to a low-RAM sliding window estimator
+ * \par          Details
+ *               Same contract and, for samples below 2^18, the same results as rf_stream_push().
+ *               Samples are stored as 18-bit values. The estimate is computed in place on the
+ *               packed ring: each autocorrelation lag unpacks and detrends the IR samples it needs.
+ *
+ * \retval       true if a new estimate was written to the outputs
+ */
+{
+    int32_t n_slot;
+    double d_ir_sumsq, d_red_sumsq;
+    float f_ir_mean, f_red_mean, f_ir_beta;
+
+    un_ir &= RF_PACKED_MASK;
+    un_red &= RF_PACKED_MASK;
+    if (ps_state->n_count == BUFFER_SIZE) {
+        rf_sums_remove_oldest(&ps_state->s_sums, rf_packed_ir(ps_state->auch_window, ps_state->n_oldest),
+            rf_packed_red(ps_state->auch_window, ps_state->n_oldest));
+        n_slot = ps_state->n_oldest;
+        ps_state->n_oldest = (ps_state->n_oldest + 1) % BUFFER_SIZE;
+        ps_state->n_count--;
+    } else
+        n_slot = (ps_state->n_oldest + ps_state->n_count) % BUFFER_SIZE;
+
+    rf_packed_store(ps_state->auch_window, n_slot, un_ir, un_red);
+    rf_sums_add(&ps_state->s_sums, un_ir, un_red, ps_state->n_count);
+    ps_state->n_count++;
+    ps_state->n_since_estimate++;
+
+    if (ps_state->n_count < BUFFER_SIZE || ps_state->n_since_estimate < ps_state->n_hop)
+        return false;
+    ps_state->n_since_estimate = 0;
+    PROFILE_BEGIN(PROFILE_WINDOW);
+    PROFILE_COUNT_BEGIN();
+    PROFILE_BEGIN(PROFILE_MOMENTS);
+    rf_sums_moments(&ps_state->s_sums, &f_ir_mean, &f_red_mean, &f_ir_beta, &d_ir_sumsq, &d_red_sumsq, correl);
+    PROFILE_END(PROFILE_MOMENTS);
+    // the detrend happens inside every autocorrelation lag here
+    PROFILE_BEGIN(PROFILE_PERIODICITY);
+    rf_periodicity_and_spo2_aut<rf_default_config>(rf_aut_packed(ps_state, f_ir_mean, f_ir_beta), d_ir_sumsq, sqrt(d_ir_sumsq), sqrt(d_red_sumsq),
+        f_ir_mean, f_red_mean, *correl, &ps_state->n_last_peak_interval, pn_spo2, pch_spo2_valid, pn_heart_rate, pch_hr_valid, ratio);
+    PROFILE_END(PROFILE_PERIODICITY);
+    PROFILE_COUNT_END(PROFILE_LAGS);
+    PROFILE_END(PROFILE_WINDOW);
+    return true;
+}
+
 float rf_linear_regression_beta(float* pn_x, float xmean, float sum_x2)
 /**
  * \brief        Coefficient beta of linear regression
@@ -142,108 +366,174 @@ float rf_autocorrelation(float* pn_x, int32_t n_size, int32_t n_lag)
     return sum / n_temp;
 }
 
+// Twiddles e^(-2*pi*i*k/RF_FFT_SIZE) for rf_autocorrelation_all(), computed once
+typedef struct {
+    float af_cos[RF_FFT_SIZE / 2];
+    float af_sin[RF_FFT_SIZE / 2];
+} rf_fft_twiddles;
+
+// Per-call scratch for rf_autocorrelation_all(): half-size complex FFT and power spectrum
+typedef struct {
+    float af_re[RF_FFT_SIZE / 2];
+    float af_im[RF_FFT_SIZE / 2];
+    float af_power[RF_FFT_SIZE / 2 + 1];
+} rf_fft_scratch;
+
+static rf_fft_twiddles rf_make_twiddles(void)
+{
+    rf_fft_twiddles s_tw;
+    for (int32_t k = 0; k < RF_FFT_SIZE / 2; ++k) {
+        s_tw.af_cos[k] = cos(2.0 * M_PI * k / RF_FFT_SIZE);
+        s_tw.af_sin[k] = -sin(2.0 * M_PI * k / RF_FFT_SIZE);
+    }
+    return s_tw;
+}
+
+static void rf_fft_half(rf_fft_scratch* ps_fft, const rf_fft_twiddles* ps_tw)
+/**
+ * \brief        In-place radix-2 complex FFT of ps_fft->af_re/af_im, RF_FFT_SIZE/2 points
+ */
+{
+    const int32_t n_half = RF_FFT_SIZE / 2;
+    int32_t i, j, k, n_len, n_step, n_tw;
+    float t_re, t_im, w_re, w_im;
+    // bit reversal permutation
+    for (i = 1, j = 0; i < n_half; ++i) {
+        k = n_half >> 1;
+        while (j & k) {
+            j ^= k;
+            k >>= 1;
+        }
+        j |= k;
+        if (i < j) {
+            t_re = ps_fft->af_re[i]; ps_fft->af_re[i] = ps_fft->af_re[j]; ps_fft->af_re[j] = t_re;
+            t_im = ps_fft->af_im[i]; ps_fft->af_im[i] = ps_fft->af_im[j]; ps_fft->af_im[j] = t_im;
+        }
+    }
+    for (n_len = 2; n_len <= n_half; n_len <<= 1) {
+        n_step = RF_FFT_SIZE / n_len; // twiddle stride, the table is for the full size
+        for (i = 0; i < n_half; i += n_len) {
+            for (k = 0, n_tw = 0; k < n_len / 2; ++k, n_tw += n_step) {
+                w_re = ps_tw->af_cos[n_tw];
+                w_im = ps_tw->af_sin[n_tw];
+                j = i + k + n_len / 2;
+                t_re = ps_fft->af_re[j] * w_re - ps_fft->af_im[j] * w_im;
+                t_im = ps_fft->af_re[j] * w_im + ps_fft->af_im[j] * w_re;
+                ps_fft->af_re[j] = ps_fft->af_re[i + k] - t_re;
+                ps_fft->af_im[j] = ps_fft->af_im[i + k] - t_im;
+                ps_fft->af_re[i + k] += t_re;
+                ps_fft->af_im[i + k] += t_im;
+            }
+        }
+    }
+}
+
+static void rf_real_fft_bin(const rf_fft_scratch* ps_fft, const rf_fft_twiddles* ps_tw, int32_t k, float* p_re, float* p_im)
+/**
+ * \brief        Bin k (0..RF_FFT_SIZE/2) of a real FFT from the packed half-size complex FFT
+ * \par          Details
+ *               With z[n] = x[2n] + i*x[2n+1] and Z = FFT(z):
+ *               X[k] = (Z[k] + conj(Z[N/2-k]))/2 + W^k * (Z[k] - conj(Z[N/2-k]))/(2i)
+ */
+{
+    const int32_t n_half = RF_FFT_SIZE / 2;
+    int32_t k1 = k % n_half, k2 = (n_half - k) % n_half;
+    float e_re = 0.5 * (ps_fft->af_re[k1] + ps_fft->af_re[k2]);
+    float e_im = 0.5 * (ps_fft->af_im[k1] - ps_fft->af_im[k2]);
+    float o_re = 0.5 * (ps_fft->af_im[k1] + ps_fft->af_im[k2]);
+    float o_im = -0.5 * (ps_fft->af_re[k1] - ps_fft->af_re[k2]);
+    float w_re = k < n_half ? ps_tw->af_cos[k] : -1.0;
+    float w_im = k < n_half ? ps_tw->af_sin[k] : 0.0;
+    *p_re = e_re + w_re * o_re - w_im * o_im;
+    *p_im = e_im + w_re * o_im + w_im * o_re;
+}
+
+void rf_autocorrelation_all(float* pn_x, int32_t n_size, float* pn_aut, int32_t n_max_lag)
+/**
+ * \brief        Autocorrelation sequence for all lags at once
+ * \par          Details
+ *               Computes pn_aut[lag] = rf_autocorrelation(pn_x, n_size, lag) for lag = 0..n_max_lag
+ *               in O(N log N) (Wiener-Khinchin): the zero-padded signal is transformed with a
+ *               real FFT of RF_FFT_SIZE >= 2*n_size points, its power spectrum, which is real
+ *               and even, is transformed back with the same real FFT.
+ *               n_size must not exceed RF_FFT_SIZE/2 and n_max_lag must be below n_size.
+ *               Reentrant, the scratch (about 1.5 kB for BUFFER_SIZE = 100) lives on the stack.
+ * \retval       None
+ */
+{
+    const int32_t n_half = RF_FFT_SIZE / 2;
+    static const rf_fft_twiddles s_tw = rf_make_twiddles();
+    rf_fft_scratch s_fft;
+    int32_t k, n;
+    float x_re, x_im;
+    // forward real FFT of the zero-padded signal
+    for (n = 0; n < n_half; ++n) {
+        s_fft.af_re[n] = 2 * n < n_size ? pn_x[2 * n] : 0.0;
+        s_fft.af_im[n] = 2 * n + 1 < n_size ? pn_x[2 * n + 1] : 0.0;
+    }
+    rf_fft_half(&s_fft, &s_tw);
+    for (k = 0; k <= n_half; ++k) {
+        rf_real_fft_bin(&s_fft, &s_tw, k, &x_re, &x_im);
+        s_fft.af_power[k] = x_re * x_re + x_im * x_im;
+    }
+    // the power spectrum is even, P[RF_FFT_SIZE-k] = P[k], so its forward transform is the inverse one times RF_FFT_SIZE
+    for (n = 0; n < n_half; ++n) {
+        s_fft.af_re[n] = s_fft.af_power[2 * n <= n_half ? 2 * n : RF_FFT_SIZE - 2 * n];
+        s_fft.af_im[n] = s_fft.af_power[2 * n + 1 <= n_half ? 2 * n + 1 : RF_FFT_SIZE - 2 * n - 1];
+    }
+    rf_fft_half(&s_fft, &s_tw);
+    for (k = 0; k <= n_max_lag; ++k) {
+        rf_real_fft_bin(&s_fft, &s_tw, k, &x_re, &x_im);
+        pn_aut[k] = x_re / ((float)RF_FFT_SIZE * (n_size - k));
+    }
+}
+
 void rf_initialize_periodicity_search(float* pn_x, int32_t n_size, int32_t* p_last_periodicity, int32_t n_max_distance, float min_aut_ratio, float aut_lag0)
 /**
  * \brief        Search the range of true signal periodicity
  * \par          Details
- *               Determine the range of current heart rate by locating neighborhood of
- *               the _first_ peak of the autocorrelation function. If at all lags until
- *               n_max_distance the autocorrelation is less than min_aut_ratio fraction
- *               of the autocorrelation at lag=0, then the input signal is insufficiently
- *               periodic and probably indicates motion artifacts.
- *               Robert Fraczkiewicz, 04/25/2020
+ *               Evaluates the autocorrelation lag by lag with rf_autocorrelation().
+ *               See rf_initialize_periodicity_search_impl().
  * \retval       Average distance between peaks
  */
 {
-    int32_t n_lag;
-    float aut, aut_right;
-    // At this point, *p_last_periodicity = LOWEST_PERIOD. Start walking to the right,
-    // two steps at a time, until lag ratio fulfills quality criteria or HIGHEST_PERIOD
-    // is reached.
-    n_lag = *p_last_periodicity;
-    aut_right = aut = rf_autocorrelation(pn_x, n_size, n_lag);
-    // Check sanity
-    if (aut / aut_lag0 >= min_aut_ratio) {
-        // Either quality criterion, min_aut_ratio, is too low, or heart rate is too high.
-        // Are we on autocorrelation's downward slope? If yes, continue to a local minimum.
-        // If not, continue to the next block.
-        do {
-            aut = aut_right;
-            n_lag += 2;
-            aut_right = rf_autocorrelation(pn_x, n_size, n_lag);
-        } while (aut_right / aut_lag0 >= min_aut_ratio && aut_right < aut && n_lag <= n_max_distance);
-        if (n_lag > n_max_distance) {
-            // This should never happen, but if does return failure
-            *p_last_periodicity = 0;
-            return;
-        }
-        aut = aut_right;
-    }
-    // Walk to the right.
-    do {
-        aut = aut_right;
-        n_lag += 2;
-        aut_right = rf_autocorrelation(pn_x, n_size, n_lag);
-    } while (aut_right / aut_lag0 < min_aut_ratio && n_lag <= n_max_distance);
-    if (n_lag > n_max_distance) {
-        // This should never happen, but if does return failure
-        *p_last_periodicity = 0;
-    } else
-        *p_last_periodicity = n_lag;
+    rf_initialize_periodicity_search_impl(rf_aut_direct(pn_x, n_size), p_last_periodicity, n_max_distance, min_aut_ratio, aut_lag0);
 }
 
 void rf_signal_periodicity(float* pn_x, int32_t n_size, int32_t* p_last_periodicity, int32_t n_min_distance, int32_t n_max_distance, float min_aut_ratio, float aut_lag0, float* ratio)
 /**
  * \brief        Signal periodicity
  * \par          Details
- *               Finds periodicity of the IR signal which can be used to calculate heart rate.
- *               Makes use of the autocorrelation function. If peak autocorrelation is less
- *               than min_aut_ratio fraction of the autocorrelation at lag=0, then the input
- *               signal is insufficiently periodic and probably indicates motion artifacts.
- *               Robert Fraczkiewicz, 01/07/2018
+ *               Evaluates the autocorrelation lag by lag with rf_autocorrelation().
+ *               See rf_signal_periodicity_impl().
  * \retval       Average distance between peaks
  */
 {
-    int32_t n_lag;
-    float aut, aut_left, aut_right, aut_save;
-    bool left_limit_reached = false;
-    // Start from the last periodicity computing the corresponding autocorrelation
-    n_lag = *p_last_periodicity;
-    aut_save = aut = rf_autocorrelation(pn_x, n_size, n_lag);
-    // Is autocorrelation one lag to the left greater?
-    aut_left = aut;
-    do {
-        aut = aut_left;
-        n_lag--;
-        aut_left = rf_autocorrelation(pn_x, n_size, n_lag);
-    } while (aut_left > aut && n_lag >= n_min_distance);
-    // Restore lag of the highest aut
-    if (n_lag < n_min_distance) {
-        left_limit_reached = true;
-        n_lag = *p_last_periodicity;
-        aut = aut_save;
-    } else
-        n_lag++;
-    if (n_lag == *p_last_periodicity) {
-        // Trip to the left made no progress. Walk to the right.
-        aut_right = aut;
-        do {
-            aut = aut_right;
-            n_lag++;
-            aut_right = rf_autocorrelation(pn_x, n_size, n_lag);
-        } while (aut_right > aut && n_lag <= n_max_distance);
-        // Restore lag of the highest aut
-        if (n_lag > n_max_distance)
-            n_lag = 0; // Indicates failure
-        else
-            n_lag--;
-        if (n_lag == *p_last_periodicity && left_limit_reached)
-            n_lag = 0; // Indicates failure
-    }
-    *ratio = aut / aut_lag0;
-    if (*ratio < min_aut_ratio)
-        n_lag = 0; // Indicates failure
-    *p_last_periodicity = n_lag;
+    rf_signal_periodicity_impl(rf_aut_direct(pn_x, n_size), p_last_periodicity, n_min_distance, n_max_distance, min_aut_ratio, aut_lag0, ratio);
+}
+
+void rf_initialize_periodicity_search_table(const float* pn_aut, int32_t n_max_lag, int32_t* p_last_periodicity, int32_t n_max_distance, float min_aut_ratio, float aut_lag0)
+/**
+ * \brief        Search the range of true signal periodicity
+ * \par          Details
+ *               Same walk as rf_initialize_periodicity_search(), over an autocorrelation
+ *               sequence precomputed by rf_autocorrelation_all() for lags 0..n_max_lag.
+ * \retval       Average distance between peaks
+ */
+{
+    rf_initialize_periodicity_search_impl(rf_aut_table(pn_aut, n_max_lag), p_last_periodicity, n_max_distance, min_aut_ratio, aut_lag0);
+}
+
+void rf_signal_periodicity_table(const float* pn_aut, int32_t n_max_lag, int32_t* p_last_periodicity, int32_t n_min_distance, int32_t n_max_distance, float min_aut_ratio, float aut_lag0, float* ratio)
+/**
+ * \brief        Signal periodicity
+ * \par          Details
+ *               Same walk as rf_signal_periodicity(), over an autocorrelation sequence
+ *               precomputed by rf_autocorrelation_all() for lags 0..n_max_lag.
+ * \retval       Average distance between peaks
+ */
+{
+    rf_signal_periodicity_impl(rf_aut_table(pn_aut, n_max_lag), p_last_periodicity, n_min_distance, n_max_distance, min_aut_ratio, aut_lag0, ratio);
 }
 
 float rf_rms(float* pn_x, int32_t n_size, float* sumsq)
@@ -284,3 +574,183 @@ float rf_Pcorrelation(float* pn_x, float* pn_y, int32_t n_size)
     r /= n_size;
     return r;
 }
+
+// -----------------------------------
+// Fixed-point variant for targets without FPU (ESP8266 LX106)
+
+struct rf_aut_direct_fixed {
+    int32_t* pn_x;
+    int32_t n_size;
+    rf_aut_direct_fixed(int32_t* pn_x_, int32_t n_size_) : pn_x(pn_x_), n_size(n_size_) {}
+    int64_t operator()(int32_t n_lag) const { return rf_autocorrelation_fixed(pn_x, n_size, n_lag); }
+};
+
+void rf_heart_rate_and_oxygen_saturation_fixed(uint32_t* pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t* pun_red_buffer,
+    float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate, int8_t* pch_hr_valid, float* ratio, float* correl)
+/**
+ * \brief        Calculate the heart rate and SpO2 level, integer arithmetic only
+ * \par          Details
+ *               Single channel version of rf_heart_rate_and_oxygen_saturation_fixed_r(), not reentrant.
+ *
+ * \retval       None
+ */
+{
+    static rf_channel_state s_default_channel = { LOWEST_PERIOD, 0, 0, {}, {} };
+    rf_heart_rate_and_oxygen_saturation_fixed_r(&s_default_channel, pun_ir_buffer, n_ir_buffer_length, pun_red_buffer, pn_spo2, pch_spo2_valid,
+        pn_heart_rate, pch_hr_valid, ratio, correl);
+}
+
+void rf_heart_rate_and_oxygen_saturation_fixed_r(rf_channel_state* ps_state, uint32_t* pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t* pun_red_buffer,
+    float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate, int8_t* pch_hr_valid, float* ratio, float* correl)
+/**
+ * \brief        Calculate the heart rate and SpO2 level, integer arithmetic only
+ * \par          Details
+ *               Same method, signature and validity semantics as rf_heart_rate_and_oxygen_saturation().
+ *               DC removal and detrending work on integer samples (regression beta in Q16),
+ *               RMS, Pearson correlation and the autocorrelation use 64-bit accumulators and
+ *               ratios are Q15. Floats are only produced when writing the outputs.
+ *               n_ir_buffer_length must not exceed BUFFER_SIZE. Periodicity and warm-up status live
+ *               in *ps_state; the integer scratch buffers are on the stack. pun_red_buffer NULL
+ *               estimates the heart rate alone, as rf_heart_rate_and_oxygen_saturation_cfg().
+ *
+ * \retval       None
+ */
+{
+    int32_t k, n_t, n_ir_mean, n_red_mean;
+    uint32_t un_ir_sum = 0, un_red_sum = 0;
+    int64_t n_ir_tx = 0, n_red_tx = 0, n_ir_beta_q16, n_red_beta_q16, n_sum_t2;
+    int64_t n_ir_sumsq = 0, n_red_sumsq = 0, n_cross = 0;
+    rf_fixed_window s_window;
+    int32_t an_x[BUFFER_SIZE]; // ir
+    int32_t an_y[BUFFER_SIZE]; // red, all 0 without red
+    const bool b_red = pun_red_buffer != NULL;
+
+    // integer DC mean, rounded, and DC removal
+    for (k = 0; k < n_ir_buffer_length; ++k)
+        un_ir_sum += pun_ir_buffer[k];
+    if (b_red)
+        for (k = 0; k < n_ir_buffer_length; ++k)
+            un_red_sum += pun_red_buffer[k];
+    n_ir_mean = (un_ir_sum + n_ir_buffer_length / 2) / n_ir_buffer_length;
+    n_red_mean = (un_red_sum + n_ir_buffer_length / 2) / n_ir_buffer_length;
+    for (k = 0; k < n_ir_buffer_length; ++k) {
+        an_x[k] = (int32_t)pun_ir_buffer[k] - n_ir_mean;
+        an_y[k] = b_red ? (int32_t)pun_red_buffer[k] - n_red_mean : 0;
+    }
+
+    // Remove linear trend. With t = 2k-(N-1), twice the mean-centered index, beta*(k-mean_X) = sum(t*x)*t / sum(t*t)
+    for (k = 0, n_t = 1 - n_ir_buffer_length; k < n_ir_buffer_length; ++k, n_t += 2) {
+        n_ir_tx += (int64_t)n_t * an_x[k];
+        n_red_tx += (int64_t)n_t * an_y[k];
+    }
+    n_sum_t2 = (int64_t)n_ir_buffer_length * ((int64_t)n_ir_buffer_length * n_ir_buffer_length - 1) / 3;
+    n_ir_beta_q16 = n_ir_tx * 65536 / n_sum_t2;
+    n_red_beta_q16 = n_red_tx * 65536 / n_sum_t2;
+    for (k = 0, n_t = 1 - n_ir_buffer_length; k < n_ir_buffer_length; ++k, n_t += 2) {
+        an_x[k] -= (int32_t)((n_ir_beta_q16 * n_t + 32768) >> 16);
+        an_y[k] -= (int32_t)((n_red_beta_q16 * n_t + 32768) >> 16);
+        n_ir_sumsq += (int64_t)an_x[k] * an_x[k];
+        n_red_sumsq += (int64_t)an_y[k] * an_y[k];
+        n_cross += (int64_t)an_x[k] * an_y[k];
+    }
+
+    s_window.b_red = b_red;
+    s_window.n_ir_mean = n_ir_mean;
+    s_window.n_red_mean = n_red_mean;
+    s_window.n_ir_sumsq = n_ir_sumsq;
+    s_window.n_red_sumsq = n_red_sumsq;
+    s_window.n_cross = n_cross;
+    s_window.un_ir_rss = rf_isqrt64(n_ir_sumsq);
+    s_window.un_red_rss = rf_isqrt64(n_red_sumsq);
+    rf_heart_rate_and_oxygen_saturation_fixed_window(ps_state, rf_aut_direct_fixed(an_x, n_ir_buffer_length), n_ir_buffer_length, &s_window, pn_spo2,
+        pch_spo2_valid, pn_heart_rate, pch_hr_valid, ratio, correl);
+}
+
+int32_t rf_fixed_correl_q15(const rf_fixed_window* ps_window)
+/**
+ * \brief        Pearson correlation of the detrended red and IR samples of a window
+ * \retval       Correlation in Q15, RF_Q15_ONE without red: nothing for the IR signal to disagree with
+ */
+{
+    if (!ps_window->b_red)
+        return RF_Q15_ONE;
+    if (ps_window->un_ir_rss == 0 || ps_window->un_red_rss == 0)
+        return 0;
+    return (int32_t)(ps_window->n_cross * RF_Q15_ONE / ((int64_t)ps_window->un_ir_rss * ps_window->un_red_rss));
+}
+
+void rf_fixed_spo2(const rf_fixed_window* ps_window, float* pn_spo2, int8_t* pch_spo2_valid)
+/**
+ * \brief        SpO2 from the red/IR AC/DC ratio of a window
+ * \par          Details
+ *               Both channels have as many samples, so the ratio of their RMS is that of the
+ *               square roots of their sums of squares. Ratio and polynomial in Q15. -888 and
+ *               invalid without red or AC. Outside the range of the polynomial the SparkFun
+ *               formula is reported, invalid, as rf_heart_rate_and_oxygen_saturation() does.
+ *
+ * \retval       None
+ */
+{
+    int64_t n_xy_ratio_q15, n_spo2_q15;
+
+    // Ratio = (AC_red / DC_red) / (AC_ir/DC_ir) in Q15
+    if (ps_window->un_ir_rss == 0 || ps_window->n_red_mean <= 0) {
+        *pn_spo2 = -888;
+        *pch_spo2_valid = 0;
+        return;
+    }
+    n_xy_ratio_q15 = (int64_t)ps_window->un_red_rss * ps_window->n_ir_mean * RF_Q15_ONE / ((int64_t)ps_window->un_ir_rss * ps_window->n_red_mean);
+    if (n_xy_ratio_q15 > RF_Q15(0.02) && n_xy_ratio_q15 < RF_Q15(1.84)) { // Check boundaries of applicability
+        // spO2 calc from RF, Horner's scheme in Q15
+        n_spo2_q15 = ((RF_Q15(-45.060) * n_xy_ratio_q15 >> 15) + RF_Q15(30.354)) * n_xy_ratio_q15 >> 15;
+        n_spo2_q15 += RF_Q15(94.845);
+        *pch_spo2_valid = 1;
+    } else {
+        // spO2 calc from SparkFun
+        n_spo2_q15 = ((RF_Q15(-45.060) * n_xy_ratio_q15 >> 15) * n_xy_ratio_q15 >> 15) / 10000 + (RF_Q15(30.354) * n_xy_ratio_q15 >> 15) / 100
+            + RF_Q15(94.845);
+        *pch_spo2_valid = 0;
+    }
+    *pn_spo2 = (float)n_spo2_q15 / RF_Q15_ONE;
+}
+
+int64_t rf_autocorrelation_fixed(int32_t* pn_x, int32_t n_size, int32_t n_lag)
+/**
+ * \brief        Autocorrelation function, integer version
+ * \par          Details
+ *               Same as rf_autocorrelation() with a 64-bit accumulator
+ * \retval       Autocorrelation sum divided by the number of terms
+ */
+{
+    int32_t i, n_temp = n_size - n_lag;
+    int64_t sum = 0;
+    if (n_temp <= 0 || n_lag < 0)
+        return sum;
+    for (i = 0; i < n_temp; ++i)
+        sum += (int64_t)pn_x[i] * pn_x[i + n_lag];
+    return sum / n_temp;
+}
+
+uint32_t rf_isqrt64(uint64_t un_x)
+/**
+ * \brief        Integer square root
+ * \par          Details
+ *               Bit by bit, floor(sqrt(un_x)), from the highest bit of un_x down. Each bit of
+ *               the root is taken with a mask rather than a branch, which would be mispredicted
+ *               about every other bit.
+ * \retval       Square root
+ */
+{
+    uint64_t un_root = 0, un_bit, un_trial, un_take;
+    if (un_x == 0)
+        return 0;
+    un_bit = (uint64_t)1 << ((63 - __builtin_clzll(un_x)) & ~1);
+    while (un_bit != 0) {
+        un_trial = un_root + un_bit;
+        un_take = 0 - (uint64_t)(un_x >= un_trial); // all ones if this bit of the root is set
+        un_x -= un_trial & un_take;
+        un_root = (un_root >> 1) + (un_bit & un_take);
+        un_bit >>= 2;
+    }
+    return (uint32_t)un_root;
+}
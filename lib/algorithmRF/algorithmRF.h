@@ -33,7 +33,39 @@
 */
 #ifndef ALGORITHM_BY_RF_H_
 #define ALGORITHM_BY_RF_H_
+#ifdef ARDUINO
 #include <Arduino.h>
+#else
+#include <stdint.h>
+#endif
+
+/*
+ * Sampling configuration
+ * Everything that depends on the sampling rate, the window length and the heart rate
+ * range is derived at compile time, so several configurations (e.g. 50 Hz and 100 Hz)
+ * can be used side by side through rf_heart_rate_and_oxygen_saturation_cfg<>()
+ * in algorithmRF_template.h. The non-template API uses rf_default_config.
+ */
+template <int32_t FS_HZ, int32_t ST_S, int32_t MIN_HR_BPM = 40, int32_t MAX_HR_BPM = 180>
+struct rf_config {
+  static constexpr int32_t fs = FS_HZ;              // Sampling frequency in Hz
+  static constexpr int32_t st = ST_S;               // Sampling time in s
+  static constexpr int32_t min_hr = MIN_HR_BPM;     // To eliminate erroneous signals, calculated HR should never be lower than this number
+  static constexpr int32_t max_hr = MAX_HR_BPM;     // To eliminate erroneous signals, calculated HR should never be greater than this number
+  static constexpr int32_t buffer_size = fs * st;   // Number of samples in a single batch
+  static constexpr int32_t fs60 = fs * 60;          // Conversion factor for heart rate from bps to bpm
+  static constexpr int32_t lowest_period = fs60 / max_hr;  // Minimal distance between peaks
+  static constexpr int32_t highest_period = fs60 / min_hr; // Maximal distance between peaks
+  // Mean value of the set of integers from 0 to buffer_size-1
+  static constexpr float mean_x = (float)(buffer_size - 1) / 2.0f;
+  // Sum of squares of the mean-centered indices, (-mean_x)^2 + ... + (mean_x)^2 = N*(N^2-1)/12
+  static constexpr float sum_x2 = (float)buffer_size * ((float)buffer_size * buffer_size - 1.0f) / 12.0f;
+
+  static_assert(fs > 0 && st > 0, "sampling rate and time must be positive");
+  static_assert(min_hr > 0 && min_hr < max_hr, "heart rate range is empty");
+  static_assert(lowest_period >= 2, "sampling rate too low for MAX_HR");
+  static_assert(highest_period + 2 < buffer_size, "window too short for MIN_HR");
+};
 
 /*
  * Settable parameters 
@@ -41,13 +73,8 @@
  * described in this code's Instructable. Typically, different sampling rate
  * and/or sample length would require these paramteres to be adjusted.
  */
-#define ST 4      // Sampling time in s. WARNING: if you change ST, then you MUST recalcuate the sum_X2 parameter below!
-#define FS 25     // Sampling frequency in Hz. WARNING: if you change FS, then you MUST recalcuate the sum_X2 parameter below!
-// Sum of squares of ST*FS numbers from -mean_X (see below) to +mean_X incremented be one. For example, given ST=4 and FS=25,
-// the sum consists of 100 terms: (-49.5)^2 + (-48.5)^2 + (-47.5)^2 + ... + (47.5)^2 + (48.5)^2 + (49.5)^2
-// The sum is symmetrc, so you can evaluate it by multiplying its positive half by 2. It is precalcuated here for enhanced 
-// performance.
-const float sum_X2 = 83325; // WARNING: you MUST recalculate this sum if you changed either ST or FS above!
+#define ST 4      // Sampling time in s
+#define FS 25     // Sampling frequency in Hz
 // WARNING: The two parameters below are CRUCIAL! Proper HR evaluation depends on these.
 #define MAX_HR 180  // Maximal heart rate. To eliminate erroneous signals, calculated HR should never be greater than this number.
 #define MIN_HR 40   // Minimal heart rate. To eliminate erroneous signals, calculated HR should never be lower than this number.
@@ -63,20 +90,130 @@ const float min_pearson_correlation = 0.8;
  * Do not touch these! 
  * 
  */
-const int32_t BUFFER_SIZE = FS*ST; // Number of smaples in a single batch
-const int32_t FS60 = FS*60;  // Conversion factor for heart rate from bps to bpm
-const int32_t LOWEST_PERIOD = FS60/MAX_HR; // Minimal distance between peaks
-const int32_t HIGHEST_PERIOD = FS60/MIN_HR; // Maximal distance between peaks
-const float mean_X = (float)(BUFFER_SIZE-1)/2.0; // Mean value of the set of integers from 0 to BUFFER_SIZE-1. For ST=4 and FS=25 it's equal to 49.5.
+typedef rf_config<FS, ST, MIN_HR, MAX_HR> rf_default_config;
+const int32_t BUFFER_SIZE = rf_default_config::buffer_size; // Number of smaples in a single batch
+const int32_t FS60 = rf_default_config::fs60;  // Conversion factor for heart rate from bps to bpm
+const int32_t LOWEST_PERIOD = rf_default_config::lowest_period; // Minimal distance between peaks
+const int32_t HIGHEST_PERIOD = rf_default_config::highest_period; // Maximal distance between peaks
+const float mean_X = rf_default_config::mean_x; // Mean value of the set of integers from 0 to BUFFER_SIZE-1. For ST=4 and FS=25 it's equal to 49.5.
+const float sum_X2 = rf_default_config::sum_x2; // Sum of squares of the mean-centered indices, 83325 for ST=4 and FS=25
+constexpr int32_t rf_next_pow2(int32_t n, int32_t p = 1) { return p >= n ? p : rf_next_pow2(n, 2 * p); }
+const int32_t RF_FFT_SIZE = rf_next_pow2(2 * BUFFER_SIZE); // Zero-padded length for rf_autocorrelation_all(), no circular wrap-around
+
+#define RF_Q15_ONE 32768 // 1.0 in Q15, used by the fixed-point variant
+#define RF_Q15(x) ((int64_t)((x) * RF_Q15_ONE)) // constant to Q15, evaluated at compile time
+
+/*
+ * Build options
+ * RF_USE_FFT_AUTOCORRELATION - compute the autocorrelation for all lags with one FFT pass and run the
+ *                              periodicity walks over that table instead of evaluating it lag by lag
+ * RF_USE_SPO2_TABLE          - SpO2 from the ratio by interpolating the flash table of lib/algorithm
+ *                              (maxim_spo2_from_ratio()) instead of the polynomial in double precision
+ */
+
+/*
+ * Per-channel state
+ * Everything the estimator carries from one window to the next, plus its scratch
+ * buffers, so any number of sensors or recorded streams can be processed
+ * side by side (also from different threads) with one state object each.
+ */
+template <class CFG>
+struct rf_channel_state_t {
+  int32_t n_last_peak_interval;   // periodicity carried between windows, CFG::lowest_period restarts the initial search
+  uint32_t un_windows;            // windows processed since rf_channel_init()
+  uint32_t un_valid_windows;      // consecutive windows with a valid heart rate, 0 while warming up or after a dropout
+  float an_ir[CFG::buffer_size];  // scratch: detrended IR
+  float an_red[CFG::buffer_size]; // scratch: detrended red
+};
+typedef rf_channel_state_t<rf_default_config> rf_channel_state;
+
+// Running sums over a sliding window of raw samples, exact for 18-bit data
+typedef struct {
+  int64_t n_ir_sum, n_red_sum;    // sum of x
+  int64_t n_ir_ksum, n_red_ksum;  // sum of k*x, k = position of x in the window
+  int64_t n_ir_sumsq, n_red_sumsq; // sum of x*x
+  int64_t n_cross_sum;            // sum of ir*red
+} rf_window_sums;
+
+/*
+ * Sliding window (streaming) estimator
+ * Keeps the last BUFFER_SIZE samples and publishes a new estimate every n_hop samples.
+ * Sums needed for the DC mean, the regression numerator, RMS and Pearson correlation
+ * are kept as exact 64-bit integers and updated per sample, so only the periodicity
+ * search is evaluated over the whole window.
+ * Red samples of 0 (a sensor converting IR only) give heart rate alone, SpO2 invalid.
+ */
+typedef struct {
+  uint32_t aun_ir[BUFFER_SIZE];   // circular window of raw IR samples
+  uint32_t aun_red[BUFFER_SIZE];  // circular window of raw red samples
+  int32_t n_oldest;               // index of the oldest sample in the window
+  int32_t n_count;                // samples in the window, saturates at BUFFER_SIZE
+  int32_t n_hop;                  // samples between estimates
+  int32_t n_since_estimate;       // samples pushed since the last estimate
+  int32_t n_last_peak_interval;   // periodicity carried between estimates
+  rf_window_sums s_sums;          // sums over the window
+} rf_stream_state;
+
+void rf_stream_init(rf_stream_state *ps_state, int32_t n_hop);
+bool rf_stream_push(rf_stream_state *ps_state, uint32_t un_ir, uint32_t un_red, float *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate,
+                    int8_t *pch_hr_valid, float *ratio, float *correl);
+
+/*
+ * Low-RAM sliding window estimator
+ * Same estimates as rf_stream_push() for 18-bit samples in a bit over half the RAM. The
+ * window is a single ring of red/IR pairs packed into 36 bits, and the periodicity search
+ * detrends IR samples as it reads them from the ring instead of copying the window into a
+ * float scratch array, so the stack only holds scalars.
+ */
+const int32_t RF_PACKED_BYTES = (BUFFER_SIZE * 36 + 7) / 8; // 4.5 bytes per sample
+typedef struct {
+  uint8_t auch_window[RF_PACKED_BYTES]; // circular window, sample k at bit 36*k: red bits 0..17, IR bits 18..35
+  int32_t n_oldest;               // index of the oldest sample in the window
+  int32_t n_count;                // samples in the window, saturates at BUFFER_SIZE
+  int32_t n_hop;                  // samples between estimates
+  int32_t n_since_estimate;       // samples pushed since the last estimate
+  int32_t n_last_peak_interval;   // periodicity carried between estimates
+  rf_window_sums s_sums;          // sums over the window
+} rf_packed_state;
+
+void rf_packed_init(rf_packed_state *ps_state, int32_t n_hop);
+bool rf_packed_push(rf_packed_state *ps_state, uint32_t un_ir, uint32_t un_red, float *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate,
+                    int8_t *pch_hr_valid, float *ratio, float *correl);
 
+void rf_channel_init(rf_channel_state *ps_state);
+void rf_heart_rate_and_oxygen_saturation_r(rf_channel_state *ps_state, uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, float *pn_spo2,
+                                        int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid, float *ratio, float *correl);
 void rf_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, float *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, 
                                         int8_t *pch_hr_valid, float *ratio, float *correl);
+void rf_heart_rate_and_oxygen_saturation_fixed_r(rf_channel_state *ps_state, uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer,
+                                        float *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid, float *ratio, float *correl);
+// One window detrended in integer arithmetic, what the fixed-point path derives SpO2 and correlation from
+typedef struct {
+  bool b_red;                     // false: heart rate only, the red sums are 0
+  int32_t n_ir_mean, n_red_mean;  // DC, rounded
+  int64_t n_ir_sumsq, n_red_sumsq; // sums of squares of the detrended samples
+  uint32_t un_ir_rss, un_red_rss; // their square roots
+  int64_t n_cross;                // sum of detrended ir*red
+} rf_fixed_window;
+
+int32_t rf_fixed_correl_q15(const rf_fixed_window *ps_window);
+void rf_fixed_spo2(const rf_fixed_window *ps_window, float *pn_spo2, int8_t *pch_spo2_valid);
+void rf_heart_rate_and_oxygen_saturation_fixed(uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, float *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate,
+                                        int8_t *pch_hr_valid, float *ratio, float *correl);
+int64_t rf_autocorrelation_fixed(int32_t *pn_x, int32_t n_size, int32_t n_lag);
+uint32_t rf_isqrt64(uint64_t un_x);
 float rf_linear_regression_beta(float *pn_x, float xmean, float sum_x2);
 float rf_autocorrelation(float *pn_x, int32_t n_size, int32_t n_lag);
 float rf_rms(float *pn_x, int32_t n_size, float *sumsq);
 float rf_Pcorrelation(float *pn_x, float *pn_y, int32_t n_size);
+void rf_autocorrelation_all(float *pn_x, int32_t n_size, float *pn_aut, int32_t n_max_lag);
 void rf_initialize_periodicity_search(float *pn_x, int32_t n_size, int32_t *p_last_periodicity, int32_t n_max_distance, float min_aut_ratio, float aut_lag0);
 void rf_signal_periodicity(float *pn_x, int32_t n_size, int32_t *p_last_periodicity, int32_t n_min_distance, int32_t n_max_distance, float min_aut_ratio, float aut_lag0, float *ratio);
 
+void rf_initialize_periodicity_search_table(const float *pn_aut, int32_t n_max_lag, int32_t *p_last_periodicity, int32_t n_max_distance, float min_aut_ratio, float aut_lag0);
+void rf_signal_periodicity_table(const float *pn_aut, int32_t n_max_lag, int32_t *p_last_periodicity, int32_t n_min_distance, int32_t n_max_distance, float min_aut_ratio, float aut_lag0, float *ratio);
+
+#include "algorithmRF_template.h"
+
 #endif /* ALGORITHM_BY_RF_H_ */
 
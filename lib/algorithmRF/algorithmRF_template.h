@@ -0,0 +1,489 @@
+/*
+ * Template part of the RF algorithm, included by algorithmRF.h
+ * Periodicity walks shared by the float, table and fixed-point paths, and the
+ * estimator instantiated per sampling configuration (rf_config<>).
+ *
+ * Example, two sampling rates side by side:
+ *   typedef rf_config<50, 4> rf_config_50hz;
+ *   typedef rf_config<100, 4> rf_config_100hz;
+ *   rf_channel_state_t<rf_config_50hz> s_50;
+ *   rf_channel_state_t<rf_config_100hz> s_100;
+ *   rf_channel_init_cfg(&s_50);
+ *   rf_channel_init_cfg(&s_100);
+ *   rf_heart_rate_and_oxygen_saturation_cfg(&s_50, ir_50, red_50, ...);
+ *   rf_heart_rate_and_oxygen_saturation_cfg(&s_100, ir_100, red_100, ...);
+ */
+#ifndef ALGORITHM_BY_RF_TEMPLATE_H_
+#define ALGORITHM_BY_RF_TEMPLATE_H_
+
+#include <math.h>
+#include <profile.h>
+#ifdef RF_USE_SPO2_TABLE
+#include <algorithm.h>
+#endif
+
+// Autocorrelation sources for the periodicity walks below
+struct rf_aut_direct {
+    float* pn_x;
+    int32_t n_size;
+    rf_aut_direct(float* pn_x_, int32_t n_size_) : pn_x(pn_x_), n_size(n_size_) {}
+    float operator()(int32_t n_lag) const
+    {
+        PROFILE_COUNT(1);
+        return rf_autocorrelation(pn_x, n_size, n_lag);
+    }
+};
+
+struct rf_aut_table {
+    const float* pn_aut;
+    int32_t n_max_lag;
+    rf_aut_table(const float* pn_aut_, int32_t n_max_lag_) : pn_aut(pn_aut_), n_max_lag(n_max_lag_) {}
+    float operator()(int32_t n_lag) const
+    {
+        PROFILE_COUNT(1);
+        return (n_lag >= 0 && n_lag <= n_max_lag) ? pn_aut[n_lag] : 0.0;
+    }
+};
+
+// Fixed-size kernels: with N a compile-time constant the trip counts are known and the loops can be unrolled
+
+template <int32_t N>
+inline float rf_linear_regression_beta_n(const float* pn_x)
+/**
+ * \brief        Coefficient beta of linear regression, see rf_linear_regression_beta()
+ */
+{
+    const float xmean = (float)(N - 1) / 2.0f;
+    const float sum_x2 = (float)N * ((float)N * N - 1.0f) / 12.0f;
+    float beta = 0.0;
+    for (int32_t k = 0; k < N; ++k)
+        beta += (k - xmean) * pn_x[k];
+    return beta / sum_x2;
+}
+
+template <int32_t N>
+inline float rf_autocorrelation_n(const float* pn_x, int32_t n_lag)
+/**
+ * \brief        Autocorrelation function, see rf_autocorrelation()
+ */
+{
+    int32_t i, n_temp = N - n_lag;
+    float sum = 0.0;
+    if (n_temp <= 0)
+        return sum;
+    for (i = 0; i < n_temp; ++i)
+        sum += pn_x[i] * pn_x[i + n_lag];
+    return sum / n_temp;
+}
+
+template <int32_t N>
+inline float rf_rms_n(const float* pn_x, float* sumsq)
+/**
+ * \brief        Root-mean-square variation, see rf_rms()
+ */
+{
+    float r = 0.0;
+    for (int32_t i = 0; i < N; ++i)
+        r += pn_x[i] * pn_x[i];
+    *sumsq = r / N;
+    return sqrt(*sumsq);
+}
+
+template <int32_t N>
+inline float rf_Pcorrelation_n(const float* pn_x, const float* pn_y)
+/**
+ * \brief        Correlation product, see rf_Pcorrelation()
+ */
+{
+    float r = 0.0;
+    for (int32_t i = 0; i < N; ++i)
+        r += pn_x[i] * pn_y[i];
+    return r / N;
+}
+
+template <int32_t N>
+struct rf_aut_direct_n {
+    const float* pn_x;
+    explicit rf_aut_direct_n(const float* pn_x_) : pn_x(pn_x_) {}
+    float operator()(int32_t n_lag) const
+    {
+        PROFILE_COUNT(1);
+        return rf_autocorrelation_n<N>(pn_x, n_lag);
+    }
+};
+
+// Ratio of an autocorrelation element to the one at lag 0: plain for float, Q15 for the fixed-point path
+inline float rf_aut_ratio(float aut, float aut_lag0)
+{
+    return aut / aut_lag0;
+}
+
+inline int32_t rf_aut_ratio(int64_t aut, int64_t aut_lag0)
+{
+    return aut_lag0 > 0 ? (int32_t)(aut * RF_Q15_ONE / aut_lag0) : 0;
+}
+
+template <typename T, typename R, typename AUT>
+void rf_initialize_periodicity_search_impl(const AUT& aut_at, int32_t* p_last_periodicity, int32_t n_max_distance, R min_aut_ratio, T aut_lag0)
+/**
+ * \brief        Search the range of true signal periodicity
+ * \par          Details
+ *               Determine the range of current heart rate by locating neighborhood of
+ *               the _first_ peak of the autocorrelation function. If at all lags until
+ *               n_max_distance the autocorrelation is less than min_aut_ratio fraction
+ *               of the autocorrelation at lag=0, then the input signal is insufficiently
+ *               periodic and probably indicates motion artifacts.
+ *               Robert Fraczkiewicz, 04/25/2020
+ * \retval       Average distance between peaks
+ */
+{
+    int32_t n_lag;
+    T aut, aut_right;
+    // At this point, *p_last_periodicity = LOWEST_PERIOD. Start walking to the right,
+    // two steps at a time, until lag ratio fulfills quality criteria or HIGHEST_PERIOD
+    // is reached.
+    n_lag = *p_last_periodicity;
+    aut_right = aut = aut_at(n_lag);
+    // Check sanity
+    if (rf_aut_ratio(aut, aut_lag0) >= min_aut_ratio) {
+        // Either quality criterion, min_aut_ratio, is too low, or heart rate is too high.
+        // Are we on autocorrelation's downward slope? If yes, continue to a local minimum.
+        // If not, continue to the next block.
+        do {
+            aut = aut_right;
+            n_lag += 2;
+            aut_right = aut_at(n_lag);
+        } while (rf_aut_ratio(aut_right, aut_lag0) >= min_aut_ratio && aut_right < aut && n_lag <= n_max_distance);
+        if (n_lag > n_max_distance) {
+            // This should never happen, but if does return failure
+            *p_last_periodicity = 0;
+            return;
+        }
+        aut = aut_right;
+    }
+    // Walk to the right.
+    do {
+        aut = aut_right;
+        n_lag += 2;
+        aut_right = aut_at(n_lag);
+    } while (rf_aut_ratio(aut_right, aut_lag0) < min_aut_ratio && n_lag <= n_max_distance);
+    if (n_lag > n_max_distance) {
+        // This should never happen, but if does return failure
+        *p_last_periodicity = 0;
+    } else
+        *p_last_periodicity = n_lag;
+}
+
+template <typename T, typename R, typename AUT>
+void rf_signal_periodicity_impl(const AUT& aut_at, int32_t* p_last_periodicity, int32_t n_min_distance, int32_t n_max_distance, R min_aut_ratio, T aut_lag0, R* ratio)
+/**
+ * \brief        Signal periodicity
+ * \par          Details
+ *               Finds periodicity of the IR signal which can be used to calculate heart rate.
+ *               Makes use of the autocorrelation function. If peak autocorrelation is less
+ *               than min_aut_ratio fraction of the autocorrelation at lag=0, then the input
+ *               signal is insufficiently periodic and probably indicates motion artifacts.
+ *               Robert Fraczkiewicz, 01/07/2018
+ * \retval       Average distance between peaks
+ */
+{
+    int32_t n_lag;
+    T aut, aut_left, aut_right, aut_save;
+    bool left_limit_reached = false;
+    // Start from the last periodicity computing the corresponding autocorrelation
+    n_lag = *p_last_periodicity;
+    aut_save = aut = aut_at(n_lag);
+    // Is autocorrelation one lag to the left greater?
+    aut_left = aut;
+    do {
+        aut = aut_left;
+        n_lag--;
+        aut_left = aut_at(n_lag);
+    } while (aut_left > aut && n_lag >= n_min_distance);
+    // Restore lag of the highest aut
+    if (n_lag < n_min_distance) {
+        left_limit_reached = true;
+        n_lag = *p_last_periodicity;
+        aut = aut_save;
+    } else
+        n_lag++;
+    if (n_lag == *p_last_periodicity) {
+        // Trip to the left made no progress. Walk to the right.
+        aut_right = aut;
+        do {
+            aut = aut_right;
+            n_lag++;
+            aut_right = aut_at(n_lag);
+        } while (aut_right > aut && n_lag <= n_max_distance);
+        // Restore lag of the highest aut
+        if (n_lag > n_max_distance)
+            n_lag = 0; // Indicates failure
+        else
+            n_lag--;
+        if (n_lag == *p_last_periodicity && left_limit_reached)
+            n_lag = 0; // Indicates failure
+    }
+    *ratio = rf_aut_ratio(aut, aut_lag0);
+    if (*ratio < min_aut_ratio)
+        n_lag = 0; // Indicates failure
+    *p_last_periodicity = n_lag;
+}
+
+template <typename AUT>
+void rf_heart_rate_and_oxygen_saturation_fixed_window(rf_channel_state* ps_state, const AUT& aut_at, int32_t n_size, const rf_fixed_window* ps_window,
+    float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate, int8_t* pch_hr_valid, float* ratio, float* correl)
+/**
+ * \brief        Heart rate and SpO2 of a window already detrended in integer arithmetic
+ * \par          Details
+ *               Tail of rf_heart_rate_and_oxygen_saturation_fixed_r(): correlation gate, periodicity
+ *               walks on aut_at() (int64_t autocorrelation of the IR samples by lag, lag 0 being
+ *               the mean sum of squares) and SpO2 from *ps_window. Callers that hold the window in
+ *               another form supply their own autocorrelation source.
+ *
+ * \retval       None
+ */
+{
+    const int32_t n_min_aut_ratio_q15 = (int32_t)(min_autocorrelation_ratio * RF_Q15_ONE);
+    const int32_t n_min_correl_q15 = (int32_t)(min_pearson_correlation * RF_Q15_ONE);
+    int32_t& n_last_peak_interval = ps_state->n_last_peak_interval;
+    int32_t n_correl_q15, n_ratio_q15 = 0;
+    int64_t n_aut_lag0 = ps_window->n_ir_sumsq / n_size;
+
+    n_correl_q15 = rf_fixed_correl_q15(ps_window);
+    *correl = (float)n_correl_q15 / RF_Q15_ONE;
+
+    // Find signal periodicity
+    if (n_correl_q15 >= n_min_correl_q15) {
+        if (LOWEST_PERIOD == n_last_peak_interval)
+            rf_initialize_periodicity_search_impl(aut_at, &n_last_peak_interval, HIGHEST_PERIOD, n_min_aut_ratio_q15, n_aut_lag0);
+        if (n_last_peak_interval != 0)
+            rf_signal_periodicity_impl(aut_at, &n_last_peak_interval, LOWEST_PERIOD, HIGHEST_PERIOD, n_min_aut_ratio_q15, n_aut_lag0, &n_ratio_q15);
+    } else
+        n_last_peak_interval = 0;
+    *ratio = (float)n_ratio_q15 / RF_Q15_ONE;
+    ps_state->un_windows++;
+
+    if (n_last_peak_interval != 0) {
+        *pn_heart_rate = FS60 / n_last_peak_interval;
+        *pch_hr_valid = 1;
+        ps_state->un_valid_windows++;
+    } else {
+        ps_state->un_valid_windows = 0;
+        n_last_peak_interval = LOWEST_PERIOD;
+        *pn_heart_rate = -888; // unable to calculate because signal looks aperiodic
+        *pch_hr_valid = 0;
+        *pn_spo2 = -888; // do not use SPO2 from this corrupt signal
+        *pch_spo2_valid = 0;
+        return;
+    }
+    rf_fixed_spo2(ps_window, pn_spo2, pch_spo2_valid);
+}
+
+template <class CFG>
+void rf_heart_rate_and_spo2_from_period(int32_t* pn_last_peak_interval, float f_ir_ac, float f_red_ac, float f_ir_mean, float f_red_mean,
+    float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate, int8_t* pch_hr_valid)
+/**
+ * \brief        Heart rate and SpO2 once the periodicity search is done
+ * \par          Details
+ *               *pn_last_peak_interval is the period found, 0 if none: then it restarts at
+ *               CFG::lowest_period and both outputs are invalid. Otherwise converts the red/IR
+ *               AC/DC ratio into SpO2; without red light (f_red_mean 0, heart rate only) SpO2 is
+ *               reported invalid. Shared with the batched estimator of lib/rf_batch.
+ *
+ * \retval       None
+ */
+{
+    float xy_ratio;
+
+    // Calculate heart rate if periodicity detector was successful. Otherwise, reset peak interval to its initial value and report error.
+    if (*pn_last_peak_interval != 0) {
+        *pn_heart_rate = (int32_t)(CFG::fs60 / *pn_last_peak_interval);
+        *pch_hr_valid = 1;
+    } else {
+        *pn_last_peak_interval = CFG::lowest_period;
+        *pn_heart_rate = -888; // unable to calculate because signal looks aperiodic
+        *pch_hr_valid = 0;
+        *pn_spo2 = -888; // do not use SPO2 from this corrupt signal
+        *pch_spo2_valid = 0;
+        return;
+    }
+
+    if (f_red_mean <= 0.0f) { // heart rate only, no red channel
+        *pn_spo2 = -888;
+        *pch_spo2_valid = 0;
+        return;
+    }
+
+    // After trend removal, the mean represents DC level
+    // Ratio = (AC_red / DC_red) / (AC_ir/DC_ir) = (red_AC * ir_DC) / (red_DC * ir_AC)
+    xy_ratio = (f_red_ac * f_ir_mean) / (f_ir_ac * f_red_mean); // formula is (f_red_ac*f_ir_dc) / (f_ir_ac*f_red_dc) ;
+    // Serial.println(xy_ratio);
+    if ((xy_ratio > 0.02) && (xy_ratio < 1.84)) { // Check boundaries of applicability, 2.5
+        // spO2 calc from RF
+#ifdef RF_USE_SPO2_TABLE
+        *pn_spo2 = maxim_spo2_from_ratio(xy_ratio);
+#else
+        *pn_spo2 = (-45.060 * xy_ratio + 30.354) * xy_ratio + 94.845;
+#endif
+        *pch_spo2_valid = 1;
+    }else{
+        // spO2 calc from SparkFun
+        *pn_spo2 = (-45.060 * xy_ratio * xy_ratio / 10000) + (30.354 * xy_ratio / 100) + 94.845; // float_SPO2 =  -45.060*n_ratio_average* n_ratio_average/10000 + 30.354 *n_ratio_average/100 + 94.845 ;
+        *pch_spo2_valid = 0;
+    }
+}
+
+template <class CFG, typename AUT>
+void rf_periodicity_and_spo2_aut(const AUT& aut_at, float f_ir_sumsq, float f_ir_ac, float f_red_ac, float f_ir_mean, float f_red_mean,
+    float correl, int32_t* pn_last_peak_interval, float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate, int8_t* pch_hr_valid, float* ratio)
+/**
+ * \brief        Heart rate and SpO2 from the autocorrelation of a detrended window
+ * \par          Details
+ *               Common back end of all float estimators, for configuration CFG. Runs the periodicity
+ *               search over the IR autocorrelation aut_at(lag) and, if it succeeds, converts the
+ *               red/IR AC/DC ratio into SpO2. *pn_last_peak_interval carries the periodicity
+ *               from one call to the next. Without red light (f_red_mean 0, heart rate only)
+ *               SpO2 is reported invalid.
+ *
+ * \retval       None
+ */
+{
+    // Find signal periodicity
+    if (correl >= min_pearson_correlation) {
+        // At the beginning of oximetry run the exact range of heart rate is unknown. This may lead to wrong rate if the next call does not find the _first_
+        // peak of the autocorrelation function. E.g., second peak would yield only 50% of the true rate.
+        if (CFG::lowest_period == *pn_last_peak_interval)
+            rf_initialize_periodicity_search_impl(aut_at, pn_last_peak_interval, CFG::highest_period, min_autocorrelation_ratio, f_ir_sumsq);
+        // If correlation is good, then find average periodicity of the IR signal. If aperiodic, return periodicity of 0
+        if (*pn_last_peak_interval != 0)
+            rf_signal_periodicity_impl(aut_at, pn_last_peak_interval, CFG::lowest_period, CFG::highest_period, min_autocorrelation_ratio, f_ir_sumsq,
+                ratio);
+    } else
+        *pn_last_peak_interval = 0;
+
+    rf_heart_rate_and_spo2_from_period<CFG>(pn_last_peak_interval, f_ir_ac, f_red_ac, f_ir_mean, f_red_mean, pn_spo2, pch_spo2_valid, pn_heart_rate,
+        pch_hr_valid);
+}
+
+template <class CFG>
+void rf_periodicity_and_spo2_cfg(float* an_ir, float f_ir_sumsq, float f_ir_ac, float f_red_ac, float f_ir_mean, float f_red_mean,
+    float correl, int32_t* pn_last_peak_interval, float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate, int8_t* pch_hr_valid, float* ratio)
+/**
+ * \brief        Heart rate and SpO2 from a detrended window
+ * \par          Details
+ *               rf_periodicity_and_spo2_aut() over the detrended IR signal an_ir, CFG::buffer_size samples.
+ *
+ * \retval       None
+ */
+{
+#ifdef RF_USE_FFT_AUTOCORRELATION
+    if (CFG::buffer_size <= RF_FFT_SIZE / 2 && correl >= min_pearson_correlation) {
+        // All lags in one O(N log N) pass, the walks only look them up
+        float an_aut[CFG::buffer_size];
+        rf_autocorrelation_all(an_ir, CFG::buffer_size, an_aut, CFG::buffer_size - 1);
+        rf_periodicity_and_spo2_aut<CFG>(rf_aut_table(an_aut, CFG::buffer_size - 1), f_ir_sumsq, f_ir_ac, f_red_ac, f_ir_mean, f_red_mean, correl,
+            pn_last_peak_interval, pn_spo2, pch_spo2_valid, pn_heart_rate, pch_hr_valid, ratio);
+        return;
+    }
+#endif
+    rf_periodicity_and_spo2_aut<CFG>(rf_aut_direct_n<CFG::buffer_size>(an_ir), f_ir_sumsq, f_ir_ac, f_red_ac, f_ir_mean, f_red_mean, correl,
+        pn_last_peak_interval, pn_spo2, pch_spo2_valid, pn_heart_rate, pch_hr_valid, ratio);
+}
+
+template <class CFG>
+void rf_channel_init_cfg(rf_channel_state_t<CFG>* ps_state)
+/**
+ * \brief        Reset a channel to its cold-start state
+ */
+{
+    ps_state->n_last_peak_interval = CFG::lowest_period;
+    ps_state->un_windows = 0;
+    ps_state->un_valid_windows = 0;
+}
+
+template <class CFG>
+void rf_heart_rate_and_oxygen_saturation_cfg(rf_channel_state_t<CFG>* ps_state, const uint32_t* pun_ir_buffer, const uint32_t* pun_red_buffer,
+    float* pn_spo2, int8_t* pch_spo2_valid, int32_t* pn_heart_rate, int8_t* pch_hr_valid, float* ratio, float* correl)
+/**
+ * \brief        Calculate the heart rate and SpO2 level for sampling configuration CFG
+ * \par          Details
+ *               Same method as rf_heart_rate_and_oxygen_saturation(), instantiated per rf_config<>.
+ *               Both buffers hold CFG::buffer_size samples. All state and scratch lives in
+ *               *ps_state (see rf_channel_init_cfg()), so calls on different channels are independent.
+ *               pun_red_buffer NULL estimates the heart rate alone (MAX30102_MODE_HR or a single
+ *               multi-LED slot): the red channel and the red/IR correlation gate are skipped,
+ *               *correl is 1 and SpO2 is reported invalid.
+ *
+ * \retval       None
+ */
+{
+    const int32_t N = CFG::buffer_size;
+    int32_t k;
+    float f_ir_mean, f_red_mean, f_ir_sumsq, f_red_sumsq;
+    float f_red_ac, f_ir_ac;
+    float beta_ir, beta_red;
+    float* an_ir = ps_state->an_ir; // ir, x
+    float* an_red = ps_state->an_red; // red, y
+
+    const bool b_red = pun_red_buffer != NULL;
+    PROFILE_BEGIN(PROFILE_WINDOW);
+    PROFILE_COUNT_BEGIN();
+
+    // calculates DC mean and subtracts DC from ir and red
+    PROFILE_BEGIN(PROFILE_DC_REMOVAL);
+    f_ir_mean = 0.0;
+    f_red_mean = 0.0;
+    for (k = 0; k < N; ++k)
+        f_ir_mean += pun_ir_buffer[k];
+    f_ir_mean = f_ir_mean / N;
+    if (b_red) {
+        for (k = 0; k < N; ++k)
+            f_red_mean += pun_red_buffer[k];
+        f_red_mean = f_red_mean / N;
+    }
+
+    // remove DC
+    for (k = 0; k < N; ++k)
+        an_ir[k] = pun_ir_buffer[k] - f_ir_mean;
+    if (b_red)
+        for (k = 0; k < N; ++k)
+            an_red[k] = pun_red_buffer[k] - f_red_mean;
+    PROFILE_END(PROFILE_DC_REMOVAL);
+
+    // RF, remove linear trend (baseline leveling)
+    PROFILE_BEGIN(PROFILE_DETREND);
+    beta_ir = rf_linear_regression_beta_n<N>(an_ir);
+    for (k = 0; k < N; ++k)
+        an_ir[k] -= beta_ir * (k - CFG::mean_x);
+    if (b_red) {
+        beta_red = rf_linear_regression_beta_n<N>(an_red);
+        for (k = 0; k < N; ++k)
+            an_red[k] -= beta_red * (k - CFG::mean_x);
+    }
+    PROFILE_END(PROFILE_DETREND);
+
+    // For SpO2 calculate RMS of both AC signals. In addition, pulse detector needs raw sum of squares for IR
+    PROFILE_BEGIN(PROFILE_RMS);
+    f_ir_ac = rf_rms_n<N>(an_ir, &f_ir_sumsq);
+    f_red_ac = b_red ? rf_rms_n<N>(an_red, &f_red_sumsq) : 0.0f;
+    PROFILE_END(PROFILE_RMS);
+    if (b_red) {
+        // Calculate Pearson correlation between red and IR
+        PROFILE_BEGIN(PROFILE_PCORRELATION);
+        *correl = rf_Pcorrelation_n<N>(an_ir, an_red) / sqrt(f_red_sumsq * f_ir_sumsq);
+        PROFILE_END(PROFILE_PCORRELATION);
+    } else {
+        *correl = 1.0; // nothing for the IR signal to disagree with
+    }
+
+    PROFILE_BEGIN(PROFILE_PERIODICITY);
+    rf_periodicity_and_spo2_cfg<CFG>(an_ir, f_ir_sumsq, f_ir_ac, f_red_ac, f_ir_mean, f_red_mean, *correl, &ps_state->n_last_peak_interval,
+        pn_spo2, pch_spo2_valid, pn_heart_rate, pch_hr_valid, ratio);
+    PROFILE_END(PROFILE_PERIODICITY);
+    PROFILE_COUNT_END(PROFILE_LAGS);
+    PROFILE_END(PROFILE_WINDOW);
+    ps_state->un_windows++;
+    ps_state->un_valid_windows = *pch_hr_valid ? ps_state->un_valid_windows + 1 : 0;
+}
+
+#endif /* ALGORITHM_BY_RF_TEMPLATE_H_ */
@@ -0,0 +1,284 @@
+/** \file capture.cpp ******************************************************
+*
+* Description: Compact binary capture of raw MAX30102 samples, see capture.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "capture.h"
+#include <string.h>
+
+#define CAPTURE_MASK_18 0x3FFFF
+
+static const uint16_t auw_capture_sample_rate[8] = { 50, 100, 200, 400, 800, 1000, 1600, 3200 };
+
+static void capture_put16(uint8_t *puch, uint16_t uw_value)
+{
+  puch[0] = (uint8_t)uw_value;
+  puch[1] = (uint8_t)(uw_value >> 8);
+}
+
+static void capture_put32(uint8_t *puch, uint32_t un_value)
+{
+  puch[0] = (uint8_t)un_value;
+  puch[1] = (uint8_t)(un_value >> 8);
+  puch[2] = (uint8_t)(un_value >> 16);
+  puch[3] = (uint8_t)(un_value >> 24);
+}
+
+static uint16_t capture_get16(const uint8_t *puch)
+{
+  return (uint16_t)(puch[0] | (puch[1] << 8));
+}
+
+static uint32_t capture_get32(const uint8_t *puch)
+{
+  return (uint32_t)puch[0] | ((uint32_t)puch[1] << 8) | ((uint32_t)puch[2] << 16) | ((uint32_t)puch[3] << 24);
+}
+
+uint32_t capture_crc32(uint32_t un_crc, const uint8_t *puch_data, size_t un_len)
+/**
+* \brief        CRC-32 (IEEE 802.3, reflected, as zlib), nibble table
+* \par          Details
+*               Start with un_crc = 0 and feed the result back in to continue over more data.
+*/
+{
+  static const uint32_t aun_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  un_crc = ~un_crc;
+  while (un_len--) {
+    un_crc ^= *puch_data++;
+    un_crc = (un_crc >> 4) ^ aun_table[un_crc & 0x0F];
+    un_crc = (un_crc >> 4) ^ aun_table[un_crc & 0x0F];
+  }
+  return ~un_crc;
+}
+
+void capture_config_from_regs(capture_config *ps_config, const uint8_t *puch_regs_08_0d, uint8_t uch_multi_led1, uint8_t uch_multi_led2)
+/**
+* \brief        Fill a capture_config from the sensor registers
+*
+* \param[in]    puch_regs_08_0d   - registers 0x08..0x0D, e.g. from maxim_max30102_read_regs()
+* \param[in]    uch_multi_led1    - register 0x11
+* \param[in]    uch_multi_led2    - register 0x12
+*/
+{
+  uint8_t uch_fifo_config = puch_regs_08_0d[0x08 - 0x08];
+  uint8_t uch_spo2_config = puch_regs_08_0d[0x0A - 0x08];
+  uint8_t uch_ave = uch_fifo_config >> 5;
+  uint32_t un_average = uch_ave >= 5 ? 32 : 1u << uch_ave;
+  memcpy(ps_config->auch_regs, puch_regs_08_0d, 6);
+  ps_config->auch_regs[6] = uch_multi_led1;
+  ps_config->auch_regs[7] = uch_multi_led2;
+  ps_config->un_sample_period_us = un_average * 1000000u / auw_capture_sample_rate[(uch_spo2_config >> 2) & 0x07];
+}
+
+float capture_sample_rate(const capture_config *ps_config)
+{
+  return ps_config->un_sample_period_us ? 1e6f / ps_config->un_sample_period_us : 0.0f;
+}
+
+static bool capture_emit(capture_writer *ps_writer, uint8_t uch_type, uint16_t uw_payload)
+{
+  uint8_t *puch = ps_writer->auch_chunk;
+  size_t un_total = CAPTURE_HEADER_BYTES + uw_payload + CAPTURE_CRC_BYTES;
+  puch[0] = CAPTURE_SYNC0;
+  puch[1] = CAPTURE_SYNC1;
+  puch[2] = uch_type;
+  capture_put16(puch + 3, uw_payload);
+  capture_put32(puch + CAPTURE_HEADER_BYTES + uw_payload, capture_crc32(0, puch + 2, 3 + uw_payload));
+  ps_writer->un_chunks++;
+  ps_writer->un_bytes += un_total;
+  if (!ps_writer->sink(ps_writer->p_context, puch, un_total)) {
+    ps_writer->b_error = true;
+    return false;
+  }
+  return true;
+}
+
+void capture_writer_init(capture_writer *ps_writer, capture_sink sink, void *p_context)
+{
+  memset(ps_writer, 0, sizeof(*ps_writer));
+  ps_writer->sink = sink;
+  ps_writer->p_context = p_context;
+}
+
+void capture_put_config(uint8_t *puch_payload, const capture_config *ps_config)
+/**
+* \brief        CAPTURE_CHUNK_CONFIG payload, CAPTURE_CONFIG_PAYLOAD_BYTES long
+*/
+{
+  puch_payload[0] = CAPTURE_VERSION;
+  capture_put32(puch_payload + 1, ps_config->un_sample_period_us);
+  memcpy(puch_payload + 5, ps_config->auch_regs, CAPTURE_CONFIG_REGS);
+}
+
+bool capture_get_config(const uint8_t *puch_payload, uint16_t uw_len, capture_config *ps_config)
+/**
+* \retval       false if the payload is too short; newer versions may append fields
+*/
+{
+  if (uw_len < CAPTURE_CONFIG_PAYLOAD_BYTES)
+    return false;
+  ps_config->un_sample_period_us = capture_get32(puch_payload + 1);
+  memcpy(ps_config->auch_regs, puch_payload + 5, CAPTURE_CONFIG_REGS);
+  return true;
+}
+
+void capture_pack_sample(uint8_t *puch_packed, uint16_t uw_index, uint32_t un_red_led, uint32_t un_ir_led)
+/**
+* \brief        Store sample uw_index of a packed block, 18-bit red and IR in 36 bits
+* \par          Details
+*               Samples must be stored in order into a block that was zeroed first: an odd
+*               sample shares its first byte with the one before.
+*/
+{
+  uint8_t *puch = puch_packed + (uw_index * 36) / 8;
+  uint64_t ul_bits;
+  // 36 bits at a nibble boundary: 5 bytes, the first one shared with the previous sample if odd
+  ul_bits = ((uint64_t)(un_red_led & CAPTURE_MASK_18) | ((uint64_t)(un_ir_led & CAPTURE_MASK_18) << 18)) << ((uw_index & 1) * 4);
+  puch[0] |= (uint8_t)ul_bits;
+  puch[1] = (uint8_t)(ul_bits >> 8);
+  puch[2] = (uint8_t)(ul_bits >> 16);
+  puch[3] = (uint8_t)(ul_bits >> 24);
+  puch[4] = (uint8_t)(ul_bits >> 32);
+}
+
+void capture_unpack_sample(const uint8_t *puch_packed, uint16_t uw_index, uint32_t *pun_red_led, uint32_t *pun_ir_led)
+{
+  const uint8_t *puch = puch_packed + (uw_index * 36) / 8;
+  uint64_t ul_bits = (uint64_t)puch[0] | ((uint64_t)puch[1] << 8) | ((uint64_t)puch[2] << 16) | ((uint64_t)puch[3] << 24)
+      | ((uint64_t)puch[4] << 32);
+  ul_bits >>= (uw_index & 1) * 4;
+  *pun_red_led = (uint32_t)ul_bits & CAPTURE_MASK_18;
+  *pun_ir_led = (uint32_t)(ul_bits >> 18) & CAPTURE_MASK_18;
+}
+
+bool capture_write_config(capture_writer *ps_writer, const capture_config *ps_config)
+/**
+* \brief        Record the sensor configuration
+* \par          Details
+*               Buffered samples are flushed first, so the block applies to every sample
+*               written after it.
+*/
+{
+  if (!capture_flush(ps_writer))
+    return false;
+  capture_put_config(ps_writer->auch_chunk + CAPTURE_HEADER_BYTES, ps_config);
+  return capture_emit(ps_writer, CAPTURE_CHUNK_CONFIG, CAPTURE_CONFIG_PAYLOAD_BYTES);
+}
+
+bool capture_write_sample(capture_writer *ps_writer, uint32_t un_red_led, uint32_t un_ir_led, uint32_t un_time_ms)
+/**
+* \brief        Append one red/IR pair
+* \par          Details
+*               A chunk goes to the sink every CAPTURE_CHUNK_SAMPLES samples.
+*
+* \param[in]    un_time_ms    - device time of the sample; only the first of each chunk is stored
+*
+* \retval       false if a chunk could not be written
+*/
+{
+  uint8_t *puch_packed = ps_writer->auch_chunk + CAPTURE_HEADER_BYTES + CAPTURE_DATA_HEADER_BYTES;
+  uint16_t uw_count = ps_writer->uw_count;
+
+  if (uw_count == 0) {
+    ps_writer->un_first_time_ms = un_time_ms;
+    memset(puch_packed, 0, CAPTURE_PACKED_BYTES(CAPTURE_CHUNK_SAMPLES));
+  }
+  capture_pack_sample(puch_packed, uw_count, un_red_led, un_ir_led);
+  ps_writer->uw_count = uw_count + 1;
+  if (ps_writer->uw_count == CAPTURE_CHUNK_SAMPLES)
+    return capture_flush(ps_writer);
+  return true;
+}
+
+bool capture_flush(capture_writer *ps_writer)
+/**
+* \brief        Write the buffered samples as a (short) chunk now
+*/
+{
+  uint8_t *puch = ps_writer->auch_chunk + CAPTURE_HEADER_BYTES;
+  uint16_t uw_count = ps_writer->uw_count;
+  if (uw_count == 0)
+    return true;
+  capture_put32(puch, ps_writer->un_next_index);
+  capture_put32(puch + 4, ps_writer->un_first_time_ms);
+  capture_put16(puch + 8, uw_count);
+  ps_writer->un_next_index += uw_count;
+  ps_writer->uw_count = 0;
+  return capture_emit(ps_writer, CAPTURE_CHUNK_DATA, CAPTURE_DATA_HEADER_BYTES + CAPTURE_PACKED_BYTES(uw_count));
+}
+
+void capture_reader_init(capture_reader *ps_reader, const uint8_t *puch_data, size_t un_len)
+{
+  memset(ps_reader, 0, sizeof(*ps_reader));
+  ps_reader->puch_data = puch_data;
+  ps_reader->un_len = un_len;
+}
+
+static bool capture_parse(capture_reader *ps_reader, uint8_t uch_type, const uint8_t *puch, uint16_t uw_len, capture_record *ps_record)
+{
+  uint16_t i;
+
+  ps_record->uch_type = uch_type;
+  if (uch_type == CAPTURE_CHUNK_CONFIG)
+    return capture_get_config(puch, uw_len, &ps_record->s_config);
+  if (uch_type != CAPTURE_CHUNK_DATA || uw_len < CAPTURE_DATA_HEADER_BYTES)
+    return false;
+  ps_record->un_index = capture_get32(puch);
+  ps_record->un_time_ms = capture_get32(puch + 4);
+  ps_record->uw_count = capture_get16(puch + 8);
+  if (ps_record->uw_count > CAPTURE_CHUNK_SAMPLES || uw_len != CAPTURE_DATA_HEADER_BYTES + CAPTURE_PACKED_BYTES(ps_record->uw_count))
+    return false;
+  for (i = 0; i < ps_record->uw_count; i++)
+    capture_unpack_sample(puch + CAPTURE_DATA_HEADER_BYTES, i, &ps_record->aun_red[i], &ps_record->aun_ir[i]);
+  if (ps_reader->b_started && ps_record->un_index > ps_reader->un_next_index)
+    ps_reader->un_missing_samples += ps_record->un_index - ps_reader->un_next_index;
+  ps_reader->un_next_index = ps_record->un_index + ps_record->uw_count;
+  ps_reader->b_started = true;
+  return true;
+}
+
+bool capture_read(capture_reader *ps_reader, capture_record *ps_record)
+/**
+* \brief        Next intact chunk
+* \par          Details
+*               Bytes that do not form a chunk with a valid CRC are skipped and counted, so a
+*               capture with a damaged or truncated part still yields everything around it.
+*               Unknown chunk types are skipped.
+*
+* \retval       false at the end of the data
+*/
+{
+  const uint8_t *puch = ps_reader->puch_data;
+  size_t un_pos = ps_reader->un_pos, un_end = ps_reader->un_len;
+  uint16_t uw_len;
+  uint8_t uch_type;
+
+  while (un_pos + CAPTURE_HEADER_BYTES + CAPTURE_CRC_BYTES <= un_end) {
+    if (puch[un_pos] != CAPTURE_SYNC0 || puch[un_pos + 1] != CAPTURE_SYNC1) {
+      un_pos++;
+      ps_reader->un_skipped_bytes++;
+      continue;
+    }
+    uch_type = puch[un_pos + 2];
+    uw_len = capture_get16(puch + un_pos + 3);
+    if (uw_len > CAPTURE_MAX_PAYLOAD || un_pos + CAPTURE_HEADER_BYTES + uw_len + CAPTURE_CRC_BYTES > un_end
+        || capture_crc32(0, puch + un_pos + 2, 3 + uw_len) != capture_get32(puch + un_pos + CAPTURE_HEADER_BYTES + uw_len)) {
+      ps_reader->un_crc_errors++;
+      un_pos++;
+      ps_reader->un_skipped_bytes++;
+      continue;
+    }
+    un_pos += CAPTURE_HEADER_BYTES + uw_len + CAPTURE_CRC_BYTES;
+    if (capture_parse(ps_reader, uch_type, puch + un_pos - CAPTURE_CRC_BYTES - uw_len, uw_len, ps_record)) {
+      ps_reader->un_pos = un_pos;
+      return true;
+    }
+  }
+  ps_reader->un_skipped_bytes += un_end - un_pos;
+  ps_reader->un_pos = un_end;
+  return false;
+}
@@ -0,0 +1,111 @@
+/** \file capture.h ******************************************************
+*
+* Description: Compact binary capture of raw MAX30102 samples
+*
+* A capture is a sequence of chunks, each independently checksummed so a
+* reader can skip damaged data and resynchronize on the next chunk:
+*
+*   offset  size  field
+*   0       2     sync, 0xA5 0x5A
+*   2       1     type, CAPTURE_CHUNK_*
+*   3       2     payload length, little endian
+*   5       n     payload
+*   5+n     4     CRC-32 (IEEE) over type, length and payload, little endian
+*
+* CAPTURE_CHUNK_CONFIG  (capture_config, written at start and on every change)
+*   u8 version, u32 sample period in us, u8[CAPTURE_CONFIG_REGS] registers
+*   0x08..0x0D and 0x11..0x12 as read from the sensor
+* CAPTURE_CHUNK_DATA
+*   u32 index of the first sample since the capture began
+*   u32 timestamp of the first sample in ms (device clock)
+*   u16 sample count
+*   ceil(count * 36 / 8) bytes: 18-bit red and IR of each sample packed
+*   LSB first (red bits 0..17, IR bits 18..35, next sample at bit 36)
+*
+* All fields are little endian. Anything between chunks, such as text
+* printed on the same serial port, is skipped by the reader. The writer buffers one chunk of at most
+* CAPTURE_CHUNK_SAMPLES samples and hands finished chunks to a sink, so it
+* can stream to Serial, a file or a socket with ~300 bytes of RAM. At 64
+* samples per chunk a sample costs 4.8 bytes on the wire. The payload layouts
+* and the CRC are shared with the framed telemetry (lib/telemetry).
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_VERSION 1
+#define CAPTURE_SYNC0 0xA5
+#define CAPTURE_SYNC1 0x5A
+#define CAPTURE_CHUNK_CONFIG 'C'
+#define CAPTURE_CHUNK_DATA 'D'
+#define CAPTURE_CHUNK_SAMPLES 64
+#define CAPTURE_CONFIG_REGS 8 // 0x08..0x0D (FIFO, mode, SpO2, LED amplitudes), 0x11, 0x12
+#define CAPTURE_HEADER_BYTES 5
+#define CAPTURE_CRC_BYTES 4
+#define CAPTURE_DATA_HEADER_BYTES 10
+#define CAPTURE_CONFIG_PAYLOAD_BYTES (5 + CAPTURE_CONFIG_REGS)
+#define CAPTURE_PACKED_BYTES(n) (((n) * 36 + 7) / 8)
+#define CAPTURE_MAX_PAYLOAD (CAPTURE_DATA_HEADER_BYTES + CAPTURE_PACKED_BYTES(CAPTURE_CHUNK_SAMPLES))
+
+typedef struct {
+  uint32_t un_sample_period_us;                // time between FIFO samples
+  uint8_t auch_regs[CAPTURE_CONFIG_REGS];      // sensor configuration registers
+} capture_config;
+
+// Receives finished chunks; returns false if the bytes could not be written
+typedef bool (*capture_sink)(void *p_context, const uint8_t *puch_data, size_t un_len);
+
+typedef struct {
+  capture_sink sink;
+  void *p_context;
+  uint32_t un_next_index;      // index the next sample will get
+  uint32_t un_first_time_ms;   // timestamp of the first buffered sample
+  uint16_t uw_count;           // samples buffered
+  uint32_t un_chunks;
+  uint32_t un_bytes;
+  bool b_error;                // the sink failed at least once
+  uint8_t auch_chunk[CAPTURE_HEADER_BYTES + CAPTURE_MAX_PAYLOAD + CAPTURE_CRC_BYTES];
+} capture_writer;
+
+typedef struct {
+  uint8_t uch_type;            // CAPTURE_CHUNK_*
+  capture_config s_config;     // CAPTURE_CHUNK_CONFIG
+  uint32_t un_index;           // CAPTURE_CHUNK_DATA
+  uint32_t un_time_ms;
+  uint16_t uw_count;
+  uint32_t aun_red[CAPTURE_CHUNK_SAMPLES];
+  uint32_t aun_ir[CAPTURE_CHUNK_SAMPLES];
+} capture_record;
+
+typedef struct {
+  const uint8_t *puch_data;
+  size_t un_len;
+  size_t un_pos;
+  uint32_t un_next_index;      // index expected in the next data chunk
+  uint32_t un_crc_errors;      // damaged chunks skipped
+  uint32_t un_skipped_bytes;   // bytes skipped while looking for a chunk
+  uint32_t un_missing_samples; // gaps in the sample index
+  bool b_started;
+} capture_reader;
+
+uint32_t capture_crc32(uint32_t un_crc, const uint8_t *puch_data, size_t un_len);
+void capture_config_from_regs(capture_config *ps_config, const uint8_t *puch_regs_08_0d, uint8_t uch_multi_led1, uint8_t uch_multi_led2);
+float capture_sample_rate(const capture_config *ps_config);
+void capture_put_config(uint8_t *puch_payload, const capture_config *ps_config);
+bool capture_get_config(const uint8_t *puch_payload, uint16_t uw_len, capture_config *ps_config);
+void capture_pack_sample(uint8_t *puch_packed, uint16_t uw_index, uint32_t un_red_led, uint32_t un_ir_led);
+void capture_unpack_sample(const uint8_t *puch_packed, uint16_t uw_index, uint32_t *pun_red_led, uint32_t *pun_ir_led);
+
+void capture_writer_init(capture_writer *ps_writer, capture_sink sink, void *p_context);
+bool capture_write_config(capture_writer *ps_writer, const capture_config *ps_config);
+bool capture_write_sample(capture_writer *ps_writer, uint32_t un_red_led, uint32_t un_ir_led, uint32_t un_time_ms);
+bool capture_flush(capture_writer *ps_writer);
+
+void capture_reader_init(capture_reader *ps_reader, const uint8_t *puch_data, size_t un_len);
+bool capture_read(capture_reader *ps_reader, capture_record *ps_record);
+
+#endif /* CAPTURE_H_ */
@@ -0,0 +1,165 @@
+/** \file duty.cpp ******************************************************
+*
+* Description: Duty-cycled acquisition scheduler, see duty.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "duty.h"
+#include <string.h>
+
+#define DUTY_DECAY_SHIFT 4             // maxima lose 1/16 per wake
+
+void duty_default_config(duty_config *ps_config, uint32_t un_sample_period_us)
+/**
+* \brief        Defaults for the ESP8266 forced light sleep
+* \par          Details
+*               Waking takes a few ms, and acq_sleep() spends up to 10 ms in the delay() the
+*               SDK sleeps in; un_wake_us covers both. Two samples of margin.
+*/
+{
+  ps_config->un_sample_period_us = un_sample_period_us;
+  ps_config->un_wake_us = 12000;
+  ps_config->uch_margin = 2;
+}
+
+uint8_t duty_init(duty_scheduler *ps_sched, const duty_config *ps_config)
+/**
+* \brief        Start from the earliest interrupt the FIFO offers
+* \par          Details
+*               Before the first drain only the configured wake time is known, a guess. The
+*               threshold starts at DUTY_A_FULL_MAX, the most room there is, and duty_done()
+*               lowers it once DUTY_MEASURED_WAKES wakes have measured their lead.
+*
+* \retval       FIFO_A_FULL to program
+*/
+{
+  memset(ps_sched, 0, sizeof(*ps_sched));
+  ps_sched->s_config = *ps_config;
+  ps_sched->uch_a_full = DUTY_A_FULL_MAX;
+  return ps_sched->uch_a_full;
+}
+
+uint8_t duty_a_full_for(const duty_config *ps_config, uint32_t un_lead_us)
+/**
+* \retval       Empty FIFO slots needed when samples keep coming for un_lead_us after the
+*               interrupt, margin included; may exceed DUTY_A_FULL_MAX
+*/
+{
+  uint32_t un_period = ps_config->un_sample_period_us ? ps_config->un_sample_period_us : 1;
+  uint32_t un_slots = (un_lead_us + un_period - 1) / un_period + ps_config->uch_margin;
+  return un_slots > 255 ? 255 : (uint8_t)un_slots;
+}
+
+void duty_wake(duty_scheduler *ps_sched, uint32_t un_now_us, bool b_slept)
+/**
+* \brief        The MCU is awake
+* \par          Details
+*               b_slept: the interrupt or the poll timer ended a sleep. false when the
+*               interrupt was already pending at the end of the last wake, so the MCU
+*               carried on without sleeping.
+*/
+{
+  if (ps_sched->s_stats.un_wakeups > 0)
+    ps_sched->s_stats.ul_elapsed_us += un_now_us - ps_sched->un_wake_at_us;
+  ps_sched->un_wake_at_us = un_now_us;
+  ps_sched->un_awake_us = b_slept ? ps_sched->s_config.un_wake_us : 0;
+  ps_sched->b_measure_late = b_slept;
+  ps_sched->b_awake = true;
+  ps_sched->s_stats.un_wakeups++;
+}
+
+void duty_drained(duty_scheduler *ps_sched, uint32_t un_drain_us, uint8_t uch_samples)
+/**
+* \brief        One FIFO burst read: uch_samples in un_drain_us
+* \par          Details
+*               The first one after a sleep measures the wake: whatever exceeds the threshold
+*               arrived between the interrupt and the drain. A timed wake finds less.
+*/
+{
+  duty_stats *ps_stats = &ps_sched->s_stats;
+  uint32_t un_drain32;
+  uint16_t uw_late;
+
+  if (!ps_sched->b_awake)
+    return;
+  ps_sched->un_awake_us += un_drain_us;
+  ps_stats->un_samples += uch_samples;
+  if (un_drain_us > ps_stats->un_drain_max_us)
+    ps_stats->un_drain_max_us = un_drain_us;
+  if (uch_samples >= DUTY_FIFO_DEPTH - 1)
+    ps_stats->un_full_drains++; // a full FIFO reads as empty from its pointers
+  if (uch_samples == 0)
+    return;
+  if (ps_sched->b_measure_late) {
+    ps_sched->b_measure_late = false;
+    uw_late = uch_samples + ps_sched->uch_a_full > DUTY_FIFO_DEPTH ? (uch_samples + ps_sched->uch_a_full - DUTY_FIFO_DEPTH) << 4 : 0;
+    if (uw_late > ps_sched->uw_late_q4)
+      ps_sched->uw_late_q4 = uw_late;
+    if (ps_sched->uch_measured_wakes < DUTY_MEASURED_WAKES)
+      ps_sched->uch_measured_wakes++;
+  }
+  // a burst costs a fixed part plus one per sample: scaling the whole burst overestimates, which is safe
+  un_drain32 = (uint32_t)((uint64_t)un_drain_us * DUTY_FIFO_DEPTH / uch_samples);
+  if (un_drain32 > ps_sched->un_drain32_us)
+    ps_sched->un_drain32_us = un_drain32;
+}
+
+bool duty_done(duty_scheduler *ps_sched, uint32_t un_compute_us, uint8_t *puch_a_full)
+/**
+* \brief        End of a wake, before going back to sleep
+* \par          Details
+*               un_compute_us is everything the wake did but drain. Updates the threshold;
+*               call it with the FIFO nearly empty, as the new one only fires on being reached.
+*               It is not lowered before DUTY_MEASURED_WAKES wakes have measured their lead.
+*
+* \param[out]   *puch_a_full    - FIFO_A_FULL to program when the call returns true
+*
+* \retval       true if the threshold changed
+*/
+{
+  duty_stats *ps_stats = &ps_sched->s_stats;
+  uint8_t uch_want, uch_late;
+
+  if (!ps_sched->b_awake)
+    return false;
+  ps_sched->b_awake = false;
+  ps_stats->ul_awake_us += ps_sched->un_awake_us + un_compute_us;
+  if (un_compute_us > ps_stats->un_compute_max_us)
+    ps_stats->un_compute_max_us = un_compute_us;
+
+  uch_want = duty_a_full_for(&ps_sched->s_config, ps_sched->s_config.un_wake_us + ps_sched->un_drain32_us);
+  uch_late = (uint8_t)((ps_sched->uw_late_q4 + 15) >> 4) + ps_sched->s_config.uch_margin;
+  if (uch_late > uch_want)
+    uch_want = uch_late;
+  ps_sched->un_drain32_us -= ps_sched->un_drain32_us >> DUTY_DECAY_SHIFT;
+  ps_sched->uw_late_q4 -= ps_sched->uw_late_q4 >> DUTY_DECAY_SHIFT;
+  if (uch_want > DUTY_A_FULL_MAX) {
+    ps_stats->un_short_lead++;
+    uch_want = DUTY_A_FULL_MAX;
+  }
+  if (uch_want > ps_sched->uch_a_full || (uch_want + 2 <= ps_sched->uch_a_full && ps_sched->uch_measured_wakes >= DUTY_MEASURED_WAKES)) {
+    ps_sched->uch_a_full = uch_want;
+    ps_stats->un_threshold_changes++;
+    *puch_a_full = uch_want;
+    return true;
+  }
+  return false;
+}
+
+float duty_wakeups_per_s(const duty_scheduler *ps_sched)
+{
+  const duty_stats *ps_stats = &ps_sched->s_stats;
+  return ps_stats->ul_elapsed_us ? (ps_stats->un_wakeups - 1) * 1e6f / ps_stats->ul_elapsed_us : 0.0f;
+}
+
+float duty_awake_fraction(const duty_scheduler *ps_sched)
+/**
+* \retval       Share of the time awake: wake, drains and compute of the finished wakes
+*               over the time from the first wake to the last one
+*/
+{
+  const duty_stats *ps_stats = &ps_sched->s_stats;
+  if (ps_stats->ul_elapsed_us == 0)
+    return 0.0f;
+  return ps_stats->ul_awake_us >= ps_stats->ul_elapsed_us ? 1.0f : (float)ps_stats->ul_awake_us / ps_stats->ul_elapsed_us;
+}
@@ -0,0 +1,86 @@
+/** \file duty.h ******************************************************
+*
+* Description: Duty-cycled acquisition scheduler
+*
+* The MCU sleeps while the MAX30102 fills its 32 sample FIFO and wakes on the
+* FIFO almost full interrupt (REG_FIFO_CONFIG FIFO_A_FULL[3:0]: empty slots
+* left when it fires), drains the FIFO in one burst, runs whatever estimates
+* are due and sleeps again. The fewer empty slots, the fewer wakeups, but
+* samples keep arriving between the interrupt and the end of the drain:
+*
+*   lead = wake + drain32
+*
+* wake is the light sleep exit and drain32 the time to drain a full FIFO.
+* The wake cannot be timed from inside (the CPU clock stops), so it starts
+* as duty_config.un_wake_us and is then measured in samples: the first drain
+* after a sleep finds 32 - FIFO_A_FULL samples plus those that arrived while
+* waking. duty_done() keeps decaying maxima of both and picks the smallest
+* FIFO_A_FULL that leaves room for the larger lead + uch_margin samples, so
+* the FIFO never overflows. The threshold starts at DUTY_A_FULL_MAX, as the
+* configured wake is only a guess, and is lowered only once
+* DUTY_MEASURED_WAKES wakes have measured their lead. It is raised at once
+* and lowered only when the wanted value is two below, so it does not flap.
+*
+* The estimate and everything else a wake does (compute) runs right after a
+* drain, while the FIFO refills from nearly empty: an interrupt arriving
+* meanwhile just waits for it and no threshold can hurry it. Compute only
+* counts towards the awake time; a wake that overruns a whole FIFO shows up
+* in un_full_drains.
+*
+* Time is passed in, in microseconds: micros() on the ESP8266, the simulated
+* clock of lib/max30102_sim on the host. No bus access here; the caller
+* writes the threshold with maxim_max30102_set_fifo_a_full().
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef DUTY_H_
+#define DUTY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DUTY_FIFO_DEPTH 32
+#define DUTY_A_FULL_MAX 15             // FIFO_A_FULL is 4 bits: the interrupt fires at 17 unread samples at the earliest
+#define DUTY_MEASURED_WAKES 4          // wakes that measure their lead before the threshold may be lowered
+
+typedef struct {
+  uint32_t un_sample_period_us;        // FIFO fill rate, after SMP_AVE averaging
+  uint32_t un_wake_us;                 // light sleep exit until the drain can start, first guess
+  uint8_t uch_margin;                  // samples kept free on top of the lead
+} duty_config;
+
+typedef struct {
+  uint32_t un_wakeups;
+  uint32_t un_samples;                 // drained
+  uint64_t ul_awake_us;                // wake + drain + compute of the finished wakes
+  uint64_t ul_elapsed_us;              // first to last wake
+  uint32_t un_threshold_changes;
+  uint32_t un_short_lead;              // wakes that wanted more than DUTY_A_FULL_MAX
+  uint32_t un_full_drains;             // drains that found 31 or 32 samples: some may be lost
+  uint32_t un_drain_max_us;            // single burst, as measured
+  uint32_t un_compute_max_us;          // whole wake less its drains
+} duty_stats;
+
+typedef struct {
+  duty_config s_config;
+  uint8_t uch_a_full;                  // FIFO_A_FULL[3:0] in force
+  uint32_t un_drain32_us;              // decaying max, scaled to a full FIFO
+  uint16_t uw_late_q4;                 // decaying max of the samples that arrived while waking, 1/16ths
+  uint32_t un_wake_at_us;
+  uint32_t un_awake_us;                // this wake so far: its exit and drains
+  bool b_measure_late;                 // this wake ended a sleep and has not drained yet
+  uint8_t uch_measured_wakes;          // wakes that measured their lead, up to DUTY_MEASURED_WAKES
+  bool b_awake;
+  duty_stats s_stats;
+} duty_scheduler;
+
+void duty_default_config(duty_config *ps_config, uint32_t un_sample_period_us);
+uint8_t duty_init(duty_scheduler *ps_sched, const duty_config *ps_config);
+void duty_wake(duty_scheduler *ps_sched, uint32_t un_now_us, bool b_slept);
+void duty_drained(duty_scheduler *ps_sched, uint32_t un_drain_us, uint8_t uch_samples);
+bool duty_done(duty_scheduler *ps_sched, uint32_t un_compute_us, uint8_t *puch_a_full);
+uint8_t duty_a_full_for(const duty_config *ps_config, uint32_t un_lead_us);
+float duty_wakeups_per_s(const duty_scheduler *ps_sched);
+float duty_awake_fraction(const duty_scheduler *ps_sched);
+
+#endif /* DUTY_H_ */
@@ -0,0 +1,324 @@
+/** \file estimator.cpp ******************************************************
+*
+* Description: One interface over the heart rate / SpO2 estimators, see estimator.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "estimator.h"
+#include <string.h>
+#if !defined(ARDUINO) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#elif !defined(ARDUINO)
+#include <chrono>
+#endif
+
+static inline uint32_t estimator_cycles()
+{
+#if defined(ARDUINO_ARCH_ESP8266)
+  return ESP.getCycleCount();
+#elif defined(ARDUINO)
+  return micros();
+#elif defined(__x86_64__) || defined(__i386__)
+  return (uint32_t)__rdtsc();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void estimator_init(estimator_state *ps_state, estimator_kind e_kind)
+/**
+* \brief        Select an estimator and reset its channels and counters
+* \par          Details
+*               The cascade thresholds start at the ones the RF estimator applies to itself.
+*
+* \retval       None
+*/
+{
+  ps_state->e_kind = e_kind;
+  ps_state->f_min_ratio = min_autocorrelation_ratio;
+  ps_state->f_min_correl = min_pearson_correlation;
+  maxim_channel_init(&ps_state->s_maxim);
+  rf_channel_init(&ps_state->s_rf);
+  ps_state->un_windows = 0;
+  ps_state->un_escalations = 0;
+  ps_state->n_track_windows = 0;
+  ps_state->ul_cycles = 0;
+  memset(ps_state->aw_ir, 0, sizeof(ps_state->aw_ir)); // the padding past the window stays 0
+}
+
+static int32_t estimator_check_scale(const uint32_t *pun_buffer, int16_t *pw_out, int32_t *pn_mean)
+/**
+* \brief        Detrend one channel of a window into 16-bit samples for the cascade check
+* \par          Details
+*               Mean and regression slope as rf_heart_rate_and_oxygen_saturation_fixed_r() takes
+*               them, the slope in Q8. Raw sums fit 32 bits for 18-bit samples. The detrended
+*               samples are shifted right until they fit ESTIMATOR_CHECK_BITS and a sign, the
+*               padding up to ESTIMATOR_CHECK_SIZE is zeroed.
+*
+* \retval       The shift applied
+*/
+{
+  const int32_t n_sum_t2 = BUFFER_SIZE * (BUFFER_SIZE * BUFFER_SIZE - 1) / 3;
+  uint32_t aun_sum[4] = {}, aun_prefix[4] = {}, un_sum = 0, un_sum_kx = 0, un_bits = 0;
+  int32_t j, k, n_mean, n_beta_q8, n_trend_q8, n_shift;
+  int32_t an_v[BUFFER_SIZE]; // detrended, on the stack so the compiler knows it aliases nothing
+
+  // sum(k*x) without a multiply, in 4 independent lanes: the running sums of lane j add up to
+  // sum((B-b)*x[4b+j]) over the B = N/4 blocks, and N-k = 4(B-b)-j
+  static_assert(BUFFER_SIZE % 4 == 0, "whole blocks of 4 samples");
+  for (k = 0; k < BUFFER_SIZE; k += 4)
+    for (j = 0; j < 4; ++j) {
+      aun_sum[j] += pun_buffer[k + j];
+      aun_prefix[j] += aun_sum[j];
+    }
+  for (j = 0; j < 4; ++j) {
+    un_sum += aun_sum[j];
+    un_sum_kx -= 4 * aun_prefix[j] - j * aun_sum[j];
+  }
+  un_sum_kx += BUFFER_SIZE * un_sum;
+  n_mean = (int32_t)((un_sum + BUFFER_SIZE / 2) / BUFFER_SIZE);
+  // with t = 2k-(N-1): sum(t*x) = 2*sum(k*x) - (N-1)*sum(x), sum(t*t) = N(N^2-1)/3
+  n_beta_q8 = (int32_t)(((2 * (int64_t)un_sum_kx - (int64_t)(BUFFER_SIZE - 1) * un_sum) * 256) / n_sum_t2);
+  // |beta| is at most 1.5/N of the sample range, so the trend stays within 32 bits
+  n_trend_q8 = n_beta_q8 * (1 - BUFFER_SIZE) - 128;
+  for (k = 0; k < BUFFER_SIZE; ++k, n_trend_q8 += 2 * n_beta_q8) {
+    an_v[k] = (int32_t)pun_buffer[k] - n_mean + (-n_trend_q8 >> 8);
+    un_bits |= (uint32_t)(an_v[k] ^ (an_v[k] >> 31));
+  }
+  n_shift = un_bits ? 32 - __builtin_clz(un_bits) - ESTIMATOR_CHECK_BITS : 0;
+  if (n_shift < 0)
+    n_shift = 0;
+  // whole vectors of 8 samples first: a loop with a tail would be vectorized 4 samples wide
+  for (k = 0; k < BUFFER_SIZE / 8 * 8; ++k)
+    pw_out[k] = (int16_t)(an_v[k] >> n_shift);
+  for (; k < BUFFER_SIZE; ++k)
+    pw_out[k] = (int16_t)(an_v[k] >> n_shift);
+  for (; k < ESTIMATOR_CHECK_SIZE; ++k)
+    pw_out[k] = 0;
+  *pn_mean = n_mean;
+  return n_shift;
+}
+
+static inline int32_t estimator_check_dot(const int16_t *pw_x, const int16_t *pw_y)
+/**
+* \brief        Sum of products over ESTIMATOR_CHECK_SIZE samples, a constant trip count the compiler vectorizes
+*/
+{
+  int32_t n_sum = 0;
+  for (int32_t k = 0; k < ESTIMATOR_CHECK_SIZE; ++k)
+    n_sum += (int32_t)pw_x[k] * pw_y[k];
+  return n_sum;
+}
+
+// Autocorrelation source of the RF periodicity walks over the scaled IR of the cascade check
+struct estimator_aut_check {
+  const estimator_state *ps_state;
+  estimator_aut_check(const estimator_state *ps_state_) : ps_state(ps_state_) {}
+  int64_t operator()(int32_t n_lag) const
+  {
+    if (n_lag < 0 || n_lag > HIGHEST_PERIOD + 2)
+      return 0;
+    return ((int64_t)estimator_check_dot(ps_state->aw_ir, ps_state->aw_ir + n_lag) << (2 * ps_state->n_ir_shift)) / (BUFFER_SIZE - n_lag);
+  }
+};
+
+static void estimator_check_window(estimator_state *ps_state, uint32_t *pun_ir_buffer, uint32_t *pun_red_buffer, rf_fixed_window *ps_window)
+/**
+* \brief        Detrend and scale a window for the cascade check, with the sums SpO2 and correlation need
+* \par          Details
+*               Sums are scaled back to the unshifted samples, square roots are taken of the
+*               32-bit sums before. Without red the red sums are 0.
+*
+* \retval       None
+*/
+{
+  int32_t n_red_shift, n_ir_sumsq, n_red_sumsq, n_cross;
+
+  ps_state->n_ir_shift = estimator_check_scale(pun_ir_buffer, ps_state->aw_ir, &ps_window->n_ir_mean);
+  n_ir_sumsq = estimator_check_dot(ps_state->aw_ir, ps_state->aw_ir);
+  ps_window->n_ir_sumsq = (int64_t)n_ir_sumsq << (2 * ps_state->n_ir_shift);
+  ps_window->un_ir_rss = rf_isqrt64(n_ir_sumsq) << ps_state->n_ir_shift;
+  ps_window->b_red = pun_red_buffer != NULL;
+  if (!ps_window->b_red) {
+    ps_window->n_red_mean = 0;
+    ps_window->n_red_sumsq = 0;
+    ps_window->un_red_rss = 0;
+    ps_window->n_cross = 0;
+    return;
+  }
+  n_red_shift = estimator_check_scale(pun_red_buffer, ps_state->aw_red, &ps_window->n_red_mean);
+  n_red_sumsq = n_cross = 0;
+  for (int32_t k = 0; k < ESTIMATOR_CHECK_SIZE; ++k) {
+    n_red_sumsq += (int32_t)ps_state->aw_red[k] * ps_state->aw_red[k];
+    n_cross += (int32_t)ps_state->aw_ir[k] * ps_state->aw_red[k];
+  }
+  ps_window->n_red_sumsq = (int64_t)n_red_sumsq << (2 * n_red_shift);
+  ps_window->un_red_rss = rf_isqrt64(n_red_sumsq) << n_red_shift;
+  ps_window->n_cross = (int64_t)n_cross << (ps_state->n_ir_shift + n_red_shift);
+}
+
+static inline bool estimator_check_aut_below(int32_t n_dot_a, int32_t n_lag_a, int32_t n_dot_b, int32_t n_lag_b)
+/**
+* \retval       true if the autocorrelation at n_lag_a is below the one at n_lag_b, from their sums of products
+*/
+{
+  return (int64_t)n_dot_a * (BUFFER_SIZE - n_lag_b) < (int64_t)n_dot_b * (BUFFER_SIZE - n_lag_a);
+}
+
+static bool estimator_window_backs_period(estimator_state *ps_state, const rf_fixed_window *ps_window, int32_t *pn_period, float *pf_ratio,
+    float *pf_correl)
+/**
+* \brief        Check a period against the window estimator_check_window() prepared
+* \par          Details
+*               The red/IR correlation gate of the RF estimators, then the autocorrelation
+*               around *pn_period instead of a periodicity walk. A peak one lag off, Maxim's
+*               average interval rounding the other way, still backs it and moves *pn_period
+*               onto the peak. Lags are compared on the scaled sums, without a division.
+*
+* \retval       true if the red/IR correlation and the autocorrelation peak pass
+*/
+{
+  const int16_t *aw_ir = ps_state->aw_ir;
+  int32_t n_period = *pn_period, n_dot0, n_dot, n_dot_left, n_dot_right;
+
+  *pf_correl = (float)rf_fixed_correl_q15(ps_window) / RF_Q15_ONE;
+  *pf_ratio = 0.0f;
+  n_dot0 = (int32_t)(ps_window->n_ir_sumsq >> (2 * ps_state->n_ir_shift));
+  if (n_period < LOWEST_PERIOD || n_period > HIGHEST_PERIOD || *pf_correl < ps_state->f_min_correl || n_dot0 == 0)
+    return false;
+
+  n_dot_left = estimator_check_dot(aw_ir, aw_ir + n_period - 1);
+  n_dot = estimator_check_dot(aw_ir, aw_ir + n_period);
+  n_dot_right = estimator_check_dot(aw_ir, aw_ir + n_period + 1);
+  if (n_period > LOWEST_PERIOD && estimator_check_aut_below(n_dot, n_period, n_dot_left, n_period - 1)) {
+    n_dot_right = n_dot;
+    n_dot = n_dot_left;
+    n_period--;
+    n_dot_left = estimator_check_dot(aw_ir, aw_ir + n_period - 1);
+  } else if (n_period < HIGHEST_PERIOD && estimator_check_aut_below(n_dot, n_period, n_dot_right, n_period + 1)) {
+    n_dot_left = n_dot;
+    n_dot = n_dot_right;
+    n_period++;
+    n_dot_right = estimator_check_dot(aw_ir, aw_ir + n_period + 1);
+  }
+  *pf_ratio = (float)n_dot * BUFFER_SIZE / ((float)n_dot0 * (BUFFER_SIZE - n_period));
+  *pn_period = n_period;
+  return *pf_ratio >= ps_state->f_min_ratio && !estimator_check_aut_below(n_dot, n_period, n_dot_left, n_period - 1)
+      && !estimator_check_aut_below(n_dot, n_period, n_dot_right, n_period + 1);
+}
+
+static void estimator_run_cascade(estimator_state *ps_state, uint32_t *pun_ir_buffer, uint32_t *pun_red_buffer, estimator_result *ps_result)
+/**
+* \brief        The confirmed period or Maxim's heart rate if the window backs it, the fixed-point
+*               RF periodicity walk otherwise
+* \par          Details
+*               A period the previous window backed is checked first and, if this window backs
+*               it too, answers as the RF estimators do (FS60 / period), for at most
+*               ESTIMATOR_TRACK_WINDOWS windows before Maxim confirms it again. Otherwise Maxim
+*               runs for the heart rate alone. SpO2 comes from the AC/DC ratio of the window the
+*               check detrended, so Maxim's per-beat ratios are not computed. An escalation walks
+*               that same window, integer arithmetic throughout. Once a period is confirmed, Maxim
+*               counts valleys less than half of it apart once: those are the dicrotic wave or noise.
+*
+* \retval       None
+*/
+{
+  maxim_channel_state *ps_maxim = &ps_state->s_maxim;
+  rf_fixed_window s_window;
+  int32_t n_period = ps_state->s_rf.n_last_peak_interval;
+
+  estimator_check_window(ps_state, pun_ir_buffer, pun_red_buffer, &s_window);
+  if (ps_state->n_track_windows > 0 && estimator_window_backs_period(ps_state, &s_window, &n_period, &ps_result->f_ratio, &ps_result->f_correl)) {
+    ps_result->n_heart_rate = FS60 / n_period;
+    ps_result->ch_hr_valid = 1;
+    ps_state->n_track_windows--;
+  } else {
+    maxim_heart_rate_and_oxygen_saturation_r(ps_maxim, pun_ir_buffer, BUFFER_SIZE, NULL, &ps_result->f_spo2, &ps_result->ch_spo2_valid,
+        &ps_result->n_heart_rate, &ps_result->ch_hr_valid);
+    n_period = 0;
+    if (ps_result->ch_hr_valid && ps_result->n_heart_rate > 0)
+      n_period = (FS60 + ps_result->n_heart_rate / 2) / ps_result->n_heart_rate;
+    ps_state->n_track_windows = 0;
+    if (estimator_window_backs_period(ps_state, &s_window, &n_period, &ps_result->f_ratio, &ps_result->f_correl)) {
+      ps_state->n_track_windows = ESTIMATOR_TRACK_WINDOWS;
+    } else {
+      rf_heart_rate_and_oxygen_saturation_fixed_window(&ps_state->s_rf, estimator_aut_check(ps_state), BUFFER_SIZE, &s_window, &ps_result->f_spo2,
+          &ps_result->ch_spo2_valid, &ps_result->n_heart_rate, &ps_result->ch_hr_valid, &ps_result->f_ratio, &ps_result->f_correl);
+      ps_result->b_escalated = true;
+      ps_state->un_escalations++;
+    }
+  }
+  if (!ps_result->b_escalated) {
+    rf_fixed_spo2(&s_window, &ps_result->f_spo2, &ps_result->ch_spo2_valid);
+    ps_state->s_rf.n_last_peak_interval = n_period; // tracked from here, and the next escalation walks on from here
+  }
+  // LOWEST_PERIOD: no period confirmed, the RF walk restarts its search
+  ps_maxim->n_min_peak_distance = ps_state->s_rf.n_last_peak_interval > LOWEST_PERIOD ? ps_state->s_rf.n_last_peak_interval / 2 : MAXIM_MIN_PEAK_DISTANCE;
+}
+
+void estimator_run(estimator_state *ps_state, uint32_t *pun_ir_buffer, uint32_t *pun_red_buffer, estimator_result *ps_result)
+/**
+* \brief        Estimate heart rate and SpO2 of one window of BUFFER_SIZE samples
+* \par          Details
+*               Outputs that are not valid follow the convention of the estimator that produced
+*               them (-999 from Maxim, -888 from RF). Reentrant per estimator_state.
+*
+* \retval       None
+*/
+{
+  uint32_t un_start = estimator_cycles();
+
+  ps_result->f_ratio = 0.0f;
+  ps_result->f_correl = 0.0f;
+  ps_result->b_escalated = false;
+  switch (ps_state->e_kind) {
+  case ESTIMATOR_MAXIM:
+    maxim_heart_rate_and_oxygen_saturation_r(&ps_state->s_maxim, pun_ir_buffer, BUFFER_SIZE, pun_red_buffer, &ps_result->f_spo2,
+        &ps_result->ch_spo2_valid, &ps_result->n_heart_rate, &ps_result->ch_hr_valid);
+    break;
+  case ESTIMATOR_RF:
+    rf_heart_rate_and_oxygen_saturation_r(&ps_state->s_rf, pun_ir_buffer, BUFFER_SIZE, pun_red_buffer, &ps_result->f_spo2,
+        &ps_result->ch_spo2_valid, &ps_result->n_heart_rate, &ps_result->ch_hr_valid, &ps_result->f_ratio, &ps_result->f_correl);
+    break;
+  case ESTIMATOR_RF_FIXED:
+    rf_heart_rate_and_oxygen_saturation_fixed_r(&ps_state->s_rf, pun_ir_buffer, BUFFER_SIZE, pun_red_buffer, &ps_result->f_spo2,
+        &ps_result->ch_spo2_valid, &ps_result->n_heart_rate, &ps_result->ch_hr_valid, &ps_result->f_ratio, &ps_result->f_correl);
+    break;
+  case ESTIMATOR_CASCADE:
+    estimator_run_cascade(ps_state, pun_ir_buffer, pun_red_buffer, ps_result);
+    break;
+  }
+  ps_state->un_windows++;
+  ps_state->ul_cycles += (uint32_t)(estimator_cycles() - un_start);
+}
+
+float estimator_escalation_rate(const estimator_state *ps_state)
+/**
+* \retval       Fraction of windows the cascade escalated to the RF estimator, 0 for the others
+*/
+{
+  return ps_state->un_windows ? (float)ps_state->un_escalations / ps_state->un_windows : 0.0f;
+}
+
+float estimator_cycles_per_window(const estimator_state *ps_state)
+/**
+* \retval       Average cycles per window since estimator_init()
+*/
+{
+  return ps_state->un_windows ? (float)ps_state->ul_cycles / ps_state->un_windows : 0.0f;
+}
+
+const char *estimator_name(estimator_kind e_kind)
+{
+  switch (e_kind) {
+  case ESTIMATOR_MAXIM:
+    return "maxim";
+  case ESTIMATOR_RF:
+    return "rf";
+  case ESTIMATOR_RF_FIXED:
+    return "rf_fixed";
+  case ESTIMATOR_CASCADE:
+    return "cascade";
+  }
+  return "?";
+}
@@ -0,0 +1,91 @@
+/** \file estimator.h ******************************************************
+*
+* Description: One interface over the heart rate / SpO2 estimators
+*
+* estimator_run() takes a window of BUFFER_SIZE raw samples and fills an
+* estimator_result whichever method is selected, so callers can switch
+* between them, or compare them, without knowing their signatures:
+*
+*   ESTIMATOR_MAXIM     maxim_heart_rate_and_oxygen_saturation_r(), integer peak
+*                       detection; no quality indicators of its own
+*   ESTIMATOR_RF        rf_heart_rate_and_oxygen_saturation_r(), autocorrelation
+*   ESTIMATOR_RF_FIXED  rf_heart_rate_and_oxygen_saturation_fixed_r()
+*   ESTIMATOR_CASCADE   Maxim first, for the heart rate alone. Its answer is
+*                       kept when the window backs it: red and IR correlate
+*                       by at least f_min_correl, and the IR autocorrelation
+*                       peaks within one lag of the period Maxim found, at no
+*                       less than f_min_ratio of lag 0. SpO2 then comes from
+*                       the AC/DC ratio of the window the check detrended.
+*                       Otherwise the window escalates to the fixed-point RF
+*                       periodicity walk, on that same detrended window.
+*                       A backed period is checked first on the next windows
+*                       and answers without Maxim while they back it, for
+*                       ESTIMATOR_TRACK_WINDOWS windows at most.
+*
+* The check holds the detrended window as 16-bit samples scaled to
+* ESTIMATOR_CHECK_BITS, so every sum of products fits 32 bits: MUL16S on the
+* LX106, pmaddwd on x86. Once a period is confirmed, Maxim counts valleys
+* less than half of it apart once, so the dicrotic wave stops doubling the
+* heart rate.
+*
+* For the cascade, ratio and correl are those of the check, or of the RF
+* walk after an escalation. Every estimator counts its windows and the
+* cycles spent in them, the cascade also its escalations:
+* estimator_escalation_rate() and estimator_cycles_per_window() publish them.
+* Cycles are CPU cycles on the ESP8266 (ESP.getCycleCount()), the TSC on x86
+* hosts and nanoseconds elsewhere.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef ESTIMATOR_H_
+#define ESTIMATOR_H_
+
+#include <algorithmRF.h>
+#include <algorithm.h>
+
+static_assert(BUFFER_SIZE == MAXIM_BUFFER_SIZE, "the estimators must share the window length");
+
+#define ESTIMATOR_CHECK_BITS 12 // detrended samples of the cascade check are scaled into this many bits and a sign
+#define ESTIMATOR_TRACK_WINDOWS 8 // cascade: windows a confirmed period answers before Maxim confirms it again
+#define ESTIMATOR_CHECK_SIZE ((BUFFER_SIZE + 7) / 8 * 8) // window zero-padded to whole vectors of 8 samples
+static_assert(((int64_t)ESTIMATOR_CHECK_SIZE << (2 * ESTIMATOR_CHECK_BITS)) <= INT32_MAX, "the check sums products in 32 bits");
+
+typedef enum {
+  ESTIMATOR_MAXIM,
+  ESTIMATOR_RF,
+  ESTIMATOR_RF_FIXED,
+  ESTIMATOR_CASCADE,
+} estimator_kind;
+
+typedef struct {
+  float f_spo2;
+  int32_t n_heart_rate;
+  int8_t ch_spo2_valid;
+  int8_t ch_hr_valid;
+  float f_ratio;       // autocorrelation ratio at the reported period, 0 if not computed
+  float f_correl;      // Pearson correlation of red and IR, 0 if not computed
+  bool b_escalated;    // the cascade handed this window to the RF estimator
+} estimator_result;
+
+typedef struct {
+  estimator_kind e_kind;
+  float f_min_ratio;           // cascade: escalate below this autocorrelation ratio
+  float f_min_correl;          // cascade: escalate below this red/IR correlation
+  maxim_channel_state s_maxim;
+  rf_channel_state s_rf;
+  int16_t aw_ir[ESTIMATOR_CHECK_SIZE + HIGHEST_PERIOD + 2]; // cascade check: scaled detrended IR, zeros past the window so every lag sums as many terms
+  int16_t aw_red[ESTIMATOR_CHECK_SIZE];                    // cascade check: scaled detrended red
+  int32_t n_ir_shift;          // cascade check: aw_ir is the detrended IR shifted right by this
+  int32_t n_track_windows;     // cascade: windows the confirmed period may still answer without Maxim
+  uint32_t un_windows;         // windows since estimator_init()
+  uint32_t un_escalations;     // cascade windows the RF estimator had to answer
+  uint64_t ul_cycles;          // cycles spent in estimator_run()
+} estimator_state;
+
+void estimator_init(estimator_state *ps_state, estimator_kind e_kind);
+void estimator_run(estimator_state *ps_state, uint32_t *pun_ir_buffer, uint32_t *pun_red_buffer, estimator_result *ps_result);
+float estimator_escalation_rate(const estimator_state *ps_state);
+float estimator_cycles_per_window(const estimator_state *ps_state);
+const char *estimator_name(estimator_kind e_kind);
+
+#endif /* ESTIMATOR_H_ */
@@ -0,0 +1,570 @@
+/** \file ingest.cpp ******************************************************
+*
+* Description: Multi-device telemetry ingest for a Linux host, see ingest.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "ingest.h"
+#include <algorithmRF.h>
+#include <capture.h>
+#include <rf_batch.h>
+#include <telemetry.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+#include <memory>
+
+#define INGEST_EVENTS 64
+
+typedef struct {
+  uint32_t aun_ir[BUFFER_SIZE];  // oldest sample first
+  uint32_t aun_red[BUFFER_SIZE];
+  uint32_t un_sample_index;
+  uint32_t un_time_ms;
+  uint64_t ul_ready_ns;          // read() that completed the window
+  bool b_reset;                  // first window after a gap: restart the estimator
+} ingest_window;
+
+struct ingest_stream {
+  ingest_server *ps_server;
+  int32_t n_id;
+  int n_fd;
+  // I/O thread only
+  telemetry_decoder s_decoder;
+  capture_record s_record;
+  uint32_t un_restarts_seen, un_missing_seen;
+  uint32_t aun_ir[BUFFER_SIZE];  // sliding window
+  uint32_t aun_red[BUFFER_SIZE];
+  int32_t n_oldest, n_count, n_since_estimate;
+  bool b_reset_next;
+  uint64_t ul_read_ns;
+  uint64_t ul_samples;
+  // worker owning the stream only
+  rf_channel_state s_channel;
+  // under ps_server->s_lock
+  ingest_window as_pending[INGEST_PENDING_WINDOWS];
+  uint32_t un_head, un_tail;     // pending windows are [un_tail, un_head)
+  bool b_queued;                 // in the ready queue or with a worker
+  bool b_paused;                 // removed from epoll until the workers catch up
+  bool b_resume;                 // a worker asked the I/O thread to read it again
+  ingest_stream_stats s_stats;
+};
+
+static uint64_t ingest_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void ingest_worker(ingest_server *ps_server)
+{
+  std::unique_lock<std::mutex> s_guard(ps_server->s_lock);
+  std::unique_ptr<rf_batch_scratch> ps_scratch(new rf_batch_scratch);
+  ingest_stream *aps_streams[RF_BATCH_LANES];
+  ingest_window *aps_windows[RF_BATCH_LANES];
+  rf_channel_state *aps_channels[RF_BATCH_LANES];
+  const uint32_t *apun_ir[RF_BATCH_LANES], *apun_red[RF_BATCH_LANES];
+  rf_batch_result as_estimates[RF_BATCH_LANES];
+  uint64_t aul_latency_ns[RF_BATCH_LANES];
+  ingest_result s_result;
+  ingest_stream *ps_stream;
+  uint64_t ul_us;
+  int32_t n_windows, n_share, n_lanes, i;
+  uint32_t k;
+
+  for (;;) {
+    ps_server->un_waiting++;
+    ps_server->s_ready_cv.wait(s_guard, [ps_server] { return ps_server->b_stop || !ps_server->aps_ready.empty(); });
+    ps_server->un_waiting--;
+    if (ps_server->b_stop)
+      return;
+    // one window from each of up to RF_BATCH_LANES streams, leaving the waiting workers their share; the
+    // portable kernels are slower than the scalar estimator, so without SIMD a worker takes one window
+    n_lanes = rf_batch_get_isa() != RF_BATCH_PORTABLE ? RF_BATCH_LANES : 1;
+    n_share = (int32_t)((ps_server->aps_ready.size() + ps_server->un_waiting) / (ps_server->un_waiting + 1));
+    for (n_windows = 0; n_windows < n_share && n_windows < n_lanes; n_windows++) {
+      ps_stream = ps_server->aps_ready.front();
+      ps_server->aps_ready.pop_front();
+      aps_streams[n_windows] = ps_stream;
+      aps_windows[n_windows] = &ps_stream->as_pending[ps_stream->un_tail % INGEST_PENDING_WINDOWS];
+    }
+    if (!ps_server->aps_ready.empty())
+      ps_server->s_ready_cv.notify_one();
+    s_guard.unlock();
+
+    // the slots stay ours until un_tail moves, and no other worker has these streams
+    for (i = 0; i < n_windows; i++) {
+      if (aps_windows[i]->b_reset)
+        rf_channel_init(&aps_streams[i]->s_channel);
+      aps_channels[i] = &aps_streams[i]->s_channel;
+      apun_ir[i] = aps_windows[i]->aun_ir;
+      apun_red[i] = aps_windows[i]->aun_red;
+    }
+    if (n_windows == 1)
+      rf_heart_rate_and_oxygen_saturation_r(aps_channels[0], aps_windows[0]->aun_ir, BUFFER_SIZE, aps_windows[0]->aun_red, &as_estimates[0].f_spo2,
+          &as_estimates[0].ch_spo2_valid, &as_estimates[0].n_heart_rate, &as_estimates[0].ch_hr_valid, &as_estimates[0].f_ratio,
+          &as_estimates[0].f_correl);
+    else
+      rf_batch_heart_rate_and_oxygen_saturation(ps_scratch.get(), aps_channels, apun_ir, apun_red, n_windows, as_estimates);
+    for (i = 0; i < n_windows; i++) {
+      s_result.n_stream = aps_streams[i]->n_id;
+      s_result.s_name = aps_streams[i]->s_stats.s_name;
+      s_result.un_sample_index = aps_windows[i]->un_sample_index;
+      s_result.un_time_ms = aps_windows[i]->un_time_ms;
+      s_result.f_spo2 = as_estimates[i].f_spo2;
+      s_result.ch_spo2_valid = as_estimates[i].ch_spo2_valid;
+      s_result.n_heart_rate = as_estimates[i].n_heart_rate;
+      s_result.ch_hr_valid = as_estimates[i].ch_hr_valid;
+      s_result.f_ratio = as_estimates[i].f_ratio;
+      s_result.f_correl = as_estimates[i].f_correl;
+      s_result.ul_latency_ns = ingest_ns() - aps_windows[i]->ul_ready_ns;
+      if (ps_server->s_config.handler != NULL)
+        ps_server->s_config.handler(ps_server->s_config.p_context, &s_result);
+      aul_latency_ns[i] = s_result.ul_latency_ns;
+    }
+
+    s_guard.lock();
+    for (i = 0; i < n_windows; i++) {
+      ps_stream = aps_streams[i];
+      ingest_stream_stats *ps_stats = &ps_stream->s_stats;
+      uint64_t ul_latency_ns = aul_latency_ns[i];
+      ps_stats->un_windows++;
+      ps_stats->un_hr_valid += as_estimates[i].ch_hr_valid != 0;
+      ps_stats->un_batched += n_windows > 1;
+      ps_stats->ul_latency_sum_ns += ul_latency_ns;
+      if (ul_latency_ns > ps_stats->ul_latency_max_ns)
+        ps_stats->ul_latency_max_ns = ul_latency_ns;
+      ul_us = ul_latency_ns / 1000;
+      k = ul_us == 0 ? 0 : 64 - __builtin_clzll(ul_us);
+      ps_stats->aun_latency_hist[k < INGEST_LATENCY_BUCKETS ? k : INGEST_LATENCY_BUCKETS - 1]++;
+
+      ps_stream->un_tail++;
+      if (ps_stream->un_head != ps_stream->un_tail)
+        ps_server->aps_ready.push_back(ps_stream); // behind the other streams: one window per turn
+      else
+        ps_stream->b_queued = false;
+      if (ps_stream->b_paused && !ps_stream->b_resume && ps_stream->un_head - ps_stream->un_tail <= INGEST_PAUSE_WINDOWS / 2) {
+        uint64_t ul_wake = 1;
+        ps_stream->b_resume = true;
+        if (write(ps_server->n_wake, &ul_wake, sizeof(ul_wake)) < 0)
+          perror("ingest: eventfd");
+      }
+    }
+    ps_server->un_busy -= n_windows;
+    if (ps_server->un_busy == 0)
+      ps_server->s_idle_cv.notify_all();
+  }
+}
+
+void ingest_default_config(ingest_config *ps_config)
+{
+  ps_config->n_workers = 0;
+  ps_config->n_hop = FS;
+  ps_config->handler = NULL;
+  ps_config->p_context = NULL;
+}
+
+bool ingest_init(ingest_server *ps_server, const ingest_config *ps_config)
+/**
+* \brief        Create the epoll set and start the worker threads
+*
+* \retval       false if epoll or the eventfd could not be created
+*/
+{
+  struct epoll_event s_event;
+  int32_t n_workers = ps_config->n_workers > 0 ? ps_config->n_workers : (int32_t)std::thread::hardware_concurrency();
+
+  ps_server->s_config = *ps_config;
+  ps_server->n_listen = -1;
+  ps_server->un_busy = 0;
+  ps_server->un_waiting = 0;
+  ps_server->b_stop = false;
+  ps_server->n_epoll = epoll_create1(EPOLL_CLOEXEC);
+  ps_server->n_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (ps_server->n_epoll < 0 || ps_server->n_wake < 0)
+    return false;
+  s_event.events = EPOLLIN;
+  s_event.data.ptr = &ps_server->n_wake;
+  if (epoll_ctl(ps_server->n_epoll, EPOLL_CTL_ADD, ps_server->n_wake, &s_event) != 0)
+    return false;
+  for (int32_t i = 0; i < (n_workers > 0 ? n_workers : 1); i++)
+    ps_server->a_workers.emplace_back(ingest_worker, ps_server);
+  return true;
+}
+
+int32_t ingest_add_fd(ingest_server *ps_server, int n_fd, const char *s_name)
+/**
+* \brief        Ingest telemetry from an open descriptor, which the server now owns
+*
+* \retval       Stream id, -1 if the descriptor could not be watched (it is closed)
+*/
+{
+  ingest_stream *ps_stream = new ingest_stream();
+  struct epoll_event s_event;
+
+  fcntl(n_fd, F_SETFL, fcntl(n_fd, F_GETFL) | O_NONBLOCK);
+  ps_stream->ps_server = ps_server;
+  ps_stream->n_fd = n_fd;
+  ps_stream->b_reset_next = true;
+  telemetry_decoder_init(&ps_stream->s_decoder);
+  rf_channel_init(&ps_stream->s_channel);
+  snprintf(ps_stream->s_stats.s_name, INGEST_NAME_CHARS, "%s", s_name);
+  ps_stream->s_stats.b_open = true;
+
+  s_event.events = EPOLLIN;
+  s_event.data.ptr = ps_stream;
+  if (epoll_ctl(ps_server->n_epoll, EPOLL_CTL_ADD, n_fd, &s_event) != 0) {
+    close(n_fd);
+    delete ps_stream;
+    return -1;
+  }
+  std::lock_guard<std::mutex> s_guard(ps_server->s_lock);
+  ps_stream->n_id = (int32_t)ps_server->aps_streams.size();
+  ps_server->aps_streams.push_back(ps_stream);
+  return ps_stream->n_id;
+}
+
+static speed_t ingest_speed(int32_t n_baud)
+{
+  switch (n_baud) {
+  case 115200: return B115200;
+  case 230400: return B230400;
+  case 460800: return B460800;
+  case 921600: return B921600;
+  case 1000000: return B1000000;
+  case 2000000: return B2000000;
+  default: return B0;
+  }
+}
+
+int32_t ingest_add_serial(ingest_server *ps_server, const char *s_path, int32_t n_baud)
+/**
+* \brief        Ingest from a serial port or PTY, switched to raw mode at n_baud
+*
+* \retval       Stream id, -1 if the port could not be opened or configured
+*/
+{
+  struct termios s_tio;
+  speed_t e_speed = ingest_speed(n_baud);
+  int n_fd = open(s_path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+  if (n_fd < 0)
+    return -1;
+  if (isatty(n_fd)) {
+    if (e_speed == B0 || tcgetattr(n_fd, &s_tio) != 0) {
+      close(n_fd);
+      return -1;
+    }
+    cfmakeraw(&s_tio);
+    s_tio.c_cflag |= CLOCAL | CREAD;
+    cfsetispeed(&s_tio, e_speed);
+    cfsetospeed(&s_tio, e_speed);
+    if (tcsetattr(n_fd, TCSANOW, &s_tio) != 0) {
+      close(n_fd);
+      return -1;
+    }
+  }
+  return ingest_add_fd(ps_server, n_fd, s_path);
+}
+
+bool ingest_listen_tcp(ingest_server *ps_server, const char *s_address, uint16_t uw_port)
+/**
+* \brief        Accept devices on a TCP port, uw_port 0 picks a free one (ingest_tcp_port())
+*/
+{
+  struct sockaddr_in s_addr;
+  struct epoll_event s_event;
+  int n_one = 1;
+  int n_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (n_fd < 0)
+    return false;
+  memset(&s_addr, 0, sizeof(s_addr));
+  s_addr.sin_family = AF_INET;
+  s_addr.sin_port = htons(uw_port);
+  setsockopt(n_fd, SOL_SOCKET, SO_REUSEADDR, &n_one, sizeof(n_one));
+  s_event.events = EPOLLIN;
+  s_event.data.ptr = &ps_server->n_listen;
+  if (inet_pton(AF_INET, s_address, &s_addr.sin_addr) != 1 || bind(n_fd, (struct sockaddr *)&s_addr, sizeof(s_addr)) != 0
+      || listen(n_fd, SOMAXCONN) != 0 || epoll_ctl(ps_server->n_epoll, EPOLL_CTL_ADD, n_fd, &s_event) != 0) {
+    close(n_fd);
+    return false;
+  }
+  ps_server->n_listen = n_fd;
+  return true;
+}
+
+uint16_t ingest_tcp_port(const ingest_server *ps_server)
+{
+  struct sockaddr_in s_addr;
+  socklen_t un_len = sizeof(s_addr);
+  if (ps_server->n_listen < 0 || getsockname(ps_server->n_listen, (struct sockaddr *)&s_addr, &un_len) != 0)
+    return 0;
+  return ntohs(s_addr.sin_port);
+}
+
+static void ingest_accept(ingest_server *ps_server)
+{
+  struct sockaddr_in s_addr;
+  socklen_t un_len = sizeof(s_addr);
+  char s_name[INGEST_NAME_CHARS], s_ip[INET_ADDRSTRLEN];
+  int n_fd;
+
+  while ((n_fd = accept4(ps_server->n_listen, (struct sockaddr *)&s_addr, &un_len, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    inet_ntop(AF_INET, &s_addr.sin_addr, s_ip, sizeof(s_ip));
+    snprintf(s_name, sizeof(s_name), "tcp:%s:%u", s_ip, ntohs(s_addr.sin_port));
+    ingest_add_fd(ps_server, n_fd, s_name);
+    un_len = sizeof(s_addr);
+  }
+}
+
+// Queues a copy of the window, oldest sample first
+static void ingest_enqueue(ingest_stream *ps_stream, uint32_t un_sample_index, uint32_t un_time_ms)
+{
+  ingest_server *ps_server = ps_stream->ps_server;
+  std::lock_guard<std::mutex> s_guard(ps_server->s_lock);
+  ingest_window *ps_window;
+  int32_t n_first = BUFFER_SIZE - ps_stream->n_oldest;
+
+  if (ps_stream->un_head - ps_stream->un_tail == INGEST_PENDING_WINDOWS) {
+    ps_stream->s_stats.un_dropped_windows++;
+    return;
+  }
+  ps_window = &ps_stream->as_pending[ps_stream->un_head % INGEST_PENDING_WINDOWS];
+  memcpy(ps_window->aun_ir, ps_stream->aun_ir + ps_stream->n_oldest, n_first * sizeof(uint32_t));
+  memcpy(ps_window->aun_ir + n_first, ps_stream->aun_ir, ps_stream->n_oldest * sizeof(uint32_t));
+  memcpy(ps_window->aun_red, ps_stream->aun_red + ps_stream->n_oldest, n_first * sizeof(uint32_t));
+  memcpy(ps_window->aun_red + n_first, ps_stream->aun_red, ps_stream->n_oldest * sizeof(uint32_t));
+  ps_window->un_sample_index = un_sample_index;
+  ps_window->un_time_ms = un_time_ms;
+  ps_window->ul_ready_ns = ps_stream->ul_read_ns;
+  ps_window->b_reset = ps_stream->b_reset_next;
+  ps_stream->b_reset_next = false;
+  ps_stream->un_head++;
+  ps_server->un_busy++;
+  if (!ps_stream->b_queued) {
+    ps_stream->b_queued = true;
+    ps_server->aps_ready.push_back(ps_stream);
+    ps_server->s_ready_cv.notify_one();
+  }
+}
+
+static void ingest_frame(void *p_context, const telemetry_frame *ps_frame)
+{
+  ingest_stream *ps_stream = (ingest_stream *)p_context;
+  capture_config s_config;
+  uint16_t i;
+
+  if (ps_stream->s_decoder.un_restarts != ps_stream->un_restarts_seen || ps_stream->s_decoder.un_missing_samples != ps_stream->un_missing_seen) {
+    // windows would straddle the gap
+    ps_stream->un_restarts_seen = ps_stream->s_decoder.un_restarts;
+    ps_stream->un_missing_seen = ps_stream->s_decoder.un_missing_samples;
+    ps_stream->n_count = ps_stream->n_oldest = ps_stream->n_since_estimate = 0;
+    ps_stream->b_reset_next = true;
+    std::lock_guard<std::mutex> s_guard(ps_stream->ps_server->s_lock);
+    ps_stream->s_stats.un_restarts++;
+  }
+
+  if (telemetry_parse_config(ps_frame, &s_config)) {
+    std::lock_guard<std::mutex> s_guard(ps_stream->ps_server->s_lock);
+    ps_stream->s_stats.f_sample_rate = capture_sample_rate(&s_config);
+    return;
+  }
+  if (!telemetry_parse_samples(ps_frame, &ps_stream->s_record))
+    return;
+  ps_stream->ul_samples += ps_stream->s_record.uw_count;
+  for (i = 0; i < ps_stream->s_record.uw_count; i++) {
+    if (ps_stream->n_count < BUFFER_SIZE) {
+      ps_stream->aun_ir[ps_stream->n_count] = ps_stream->s_record.aun_ir[i];
+      ps_stream->aun_red[ps_stream->n_count] = ps_stream->s_record.aun_red[i];
+      ps_stream->n_count++;
+    } else {
+      ps_stream->aun_ir[ps_stream->n_oldest] = ps_stream->s_record.aun_ir[i];
+      ps_stream->aun_red[ps_stream->n_oldest] = ps_stream->s_record.aun_red[i];
+      ps_stream->n_oldest = ps_stream->n_oldest + 1 < BUFFER_SIZE ? ps_stream->n_oldest + 1 : 0;
+    }
+    ps_stream->n_since_estimate++;
+    if (ps_stream->n_count == BUFFER_SIZE && ps_stream->n_since_estimate >= ps_stream->ps_server->s_config.n_hop) {
+      ps_stream->n_since_estimate = 0;
+      ingest_enqueue(ps_stream, ps_stream->s_record.un_index + i, ps_stream->s_record.un_time_ms);
+    }
+  }
+}
+
+static void ingest_close(ingest_server *ps_server, ingest_stream *ps_stream)
+{
+  epoll_ctl(ps_server->n_epoll, EPOLL_CTL_DEL, ps_stream->n_fd, NULL);
+  close(ps_stream->n_fd);
+  ps_stream->n_fd = -1;
+  std::lock_guard<std::mutex> s_guard(ps_server->s_lock);
+  ps_stream->s_stats.b_open = false;
+}
+
+static void ingest_read(ingest_server *ps_server, ingest_stream *ps_stream)
+{
+  uint8_t auch_block[INGEST_READ_BYTES];
+  const telemetry_decoder *ps_decoder = &ps_stream->s_decoder;
+  ssize_t n_read = read(ps_stream->n_fd, auch_block, sizeof(auch_block));
+  struct epoll_event s_event;
+
+  if (n_read < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (n_read <= 0) { // end of stream, or EIO from a PTY whose other side closed
+    ingest_close(ps_server, ps_stream);
+    return;
+  }
+  ps_stream->ul_read_ns = ingest_ns();
+  telemetry_decoder_push(&ps_stream->s_decoder, auch_block, (size_t)n_read, ingest_frame, ps_stream);
+
+  std::lock_guard<std::mutex> s_guard(ps_server->s_lock);
+  ingest_stream_stats *ps_stats = &ps_stream->s_stats;
+  ps_stats->ul_bytes = ps_decoder->ul_bytes;
+  ps_stats->ul_samples = ps_stream->ul_samples;
+  ps_stats->un_frames = ps_decoder->un_frames;
+  ps_stats->un_crc_errors = ps_decoder->un_crc_errors + ps_decoder->un_framing_errors;
+  ps_stats->un_lost_frames = ps_decoder->un_lost_frames;
+  ps_stats->un_missing_samples = ps_decoder->un_missing_samples;
+  if (ps_stream->un_head - ps_stream->un_tail >= INGEST_PAUSE_WINDOWS) {
+    s_event.events = 0;
+    s_event.data.ptr = ps_stream;
+    epoll_ctl(ps_server->n_epoll, EPOLL_CTL_MOD, ps_stream->n_fd, &s_event);
+    ps_stream->b_paused = true;
+    ps_stream->b_resume = false;
+    ps_stats->un_pauses++;
+  }
+}
+
+// Workers freed room in paused streams: read them again
+static void ingest_resume(ingest_server *ps_server)
+{
+  struct epoll_event s_event;
+  uint64_t ul_count;
+  if (read(ps_server->n_wake, &ul_count, sizeof(ul_count)) < 0)
+    return;
+  std::lock_guard<std::mutex> s_guard(ps_server->s_lock);
+  for (ingest_stream *ps_stream : ps_server->aps_streams) {
+    if (!ps_stream->b_paused || !ps_stream->b_resume)
+      continue;
+    s_event.events = EPOLLIN;
+    s_event.data.ptr = ps_stream;
+    epoll_ctl(ps_server->n_epoll, EPOLL_CTL_MOD, ps_stream->n_fd, &s_event);
+    ps_stream->b_paused = ps_stream->b_resume = false;
+  }
+}
+
+int32_t ingest_poll(ingest_server *ps_server, int32_t n_timeout_ms)
+/**
+* \brief        Wait for input, up to n_timeout_ms (-1: no limit), and process it
+* \par          Details
+*               The I/O thread: call it in a loop. Each ready stream gets one read() of at most
+*               INGEST_READ_BYTES per call, so a fast device cannot starve the others.
+*
+* \retval       Events handled, -1 if epoll failed
+*/
+{
+  struct epoll_event as_events[INGEST_EVENTS];
+  int n_events = epoll_wait(ps_server->n_epoll, as_events, INGEST_EVENTS, n_timeout_ms);
+
+  if (n_events < 0)
+    return errno == EINTR ? 0 : -1;
+  for (int i = 0; i < n_events; i++) {
+    if (as_events[i].data.ptr == &ps_server->n_wake)
+      ingest_resume(ps_server);
+    else if (as_events[i].data.ptr == &ps_server->n_listen)
+      ingest_accept(ps_server);
+    else if (((ingest_stream *)as_events[i].data.ptr)->n_fd >= 0)
+      ingest_read(ps_server, (ingest_stream *)as_events[i].data.ptr);
+  }
+  return n_events;
+}
+
+int32_t ingest_open_streams(ingest_server *ps_server)
+{
+  std::lock_guard<std::mutex> s_guard(ps_server->s_lock);
+  int32_t n_open = 0;
+  for (ingest_stream *ps_stream : ps_server->aps_streams)
+    n_open += ps_stream->s_stats.b_open;
+  return n_open;
+}
+
+void ingest_drain(ingest_server *ps_server)
+/**
+* \brief        Wait until every queued window has been estimated
+*/
+{
+  std::unique_lock<std::mutex> s_guard(ps_server->s_lock);
+  ps_server->s_idle_cv.wait(s_guard, [ps_server] { return ps_server->un_busy == 0; });
+}
+
+int32_t ingest_stream_count(ingest_server *ps_server)
+{
+  std::lock_guard<std::mutex> s_guard(ps_server->s_lock);
+  return (int32_t)ps_server->aps_streams.size();
+}
+
+bool ingest_stream_stats_get(ingest_server *ps_server, int32_t n_stream, ingest_stream_stats *ps_stats)
+/**
+* \brief        Consistent copy of a stream's statistics
+*/
+{
+  std::lock_guard<std::mutex> s_guard(ps_server->s_lock);
+  if (n_stream < 0 || n_stream >= (int32_t)ps_server->aps_streams.size())
+    return false;
+  *ps_stats = ps_server->aps_streams[n_stream]->s_stats;
+  return true;
+}
+
+uint64_t ingest_latency_percentile_us(const ingest_stream_stats *ps_stats, float f_fraction)
+/**
+* \retval       Upper bound of the latency bucket holding the f_fraction quantile, in us,
+*               at most the largest latency seen
+*/
+{
+  uint64_t ul_total = 0, ul_seen = 0, ul_max_us = (ps_stats->ul_latency_max_ns + 999) / 1000;
+  uint32_t k;
+  for (k = 0; k < INGEST_LATENCY_BUCKETS; k++)
+    ul_total += ps_stats->aun_latency_hist[k];
+  for (k = 0; k < INGEST_LATENCY_BUCKETS; k++) {
+    ul_seen += ps_stats->aun_latency_hist[k];
+    if (ul_seen > 0 && ul_seen >= f_fraction * ul_total)
+      return (1ull << k) < ul_max_us ? 1ull << k : ul_max_us;
+  }
+  return 0;
+}
+
+void ingest_shutdown(ingest_server *ps_server)
+/**
+* \brief        Stop the workers and close every descriptor; queued windows are discarded
+*/
+{
+  {
+    std::lock_guard<std::mutex> s_guard(ps_server->s_lock);
+    ps_server->b_stop = true;
+  }
+  ps_server->s_ready_cv.notify_all();
+  for (std::thread &s_worker : ps_server->a_workers)
+    s_worker.join();
+  ps_server->a_workers.clear();
+  for (ingest_stream *ps_stream : ps_server->aps_streams) {
+    if (ps_stream->n_fd >= 0)
+      close(ps_stream->n_fd);
+    delete ps_stream;
+  }
+  ps_server->aps_streams.clear();
+  ps_server->aps_ready.clear();
+  if (ps_server->n_listen >= 0)
+    close(ps_server->n_listen);
+  if (ps_server->n_wake >= 0)
+    close(ps_server->n_wake);
+  if (ps_server->n_epoll >= 0)
+    close(ps_server->n_epoll);
+  ps_server->n_listen = ps_server->n_wake = ps_server->n_epoll = -1;
+}
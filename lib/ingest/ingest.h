@@ -0,0 +1,126 @@
+/** \file ingest.h ******************************************************
+*
+* Description: Multi-device telemetry ingest for a Linux host
+*
+* Many sensor nodes report to one machine, each over its own serial port (or
+* PTY) or TCP connection, speaking the framed telemetry of lib/telemetry. One
+* I/O thread waits on all of them with epoll, decodes the frames and keeps a
+* sliding window of samples per device. Every n_hop samples a copy of the
+* window is queued, and a pool of worker threads estimates it with the
+* device's own rf_channel_state, so the estimates match a single device
+* running the estimator alone.
+*
+* Windows of one stream are processed in order, one at a time; windows of
+* different streams in parallel. A worker takes one window from each of up
+* to RF_BATCH_LANES ready streams, fewer when other workers are idle, and
+* runs them together through rf_batch_heart_rate_and_oxygen_saturation()
+* (lib/rf_batch), whose results are bit for bit the scalar ones. A lone
+* window, and every window when rf_batch has only its portable kernels
+* (slower than scalar, e.g. on ARM), goes to
+* rf_heart_rate_and_oxygen_saturation_r(). A stream with INGEST_PAUSE_WINDOWS windows
+* waiting is not read until the workers catch up, so a slow host pushes back
+* on the devices (through the kernel buffers) instead of dropping data.
+* Sample gaps and device restarts start the window, and the estimator, over.
+*
+* Latency is measured per stream from the read() that completed a window to
+* the estimate, queueing included.
+*
+* Linux only; not part of the firmware.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef INGEST_H_
+#define INGEST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define INGEST_PENDING_WINDOWS 32      // queued windows per stream
+#define INGEST_READ_BYTES 1024         // per read(): at most ~200 samples, 9 windows at a hop of 25
+#define INGEST_PAUSE_WINDOWS 16        // stop reading a stream with this many windows queued
+#define INGEST_LATENCY_BUCKETS 32      // log2 of microseconds
+#define INGEST_NAME_CHARS 48
+
+typedef struct {
+  int32_t n_stream;            // ingest_add_*() id
+  const char *s_name;          // device path or peer address
+  uint32_t un_sample_index;    // device index of the last sample in the window
+  uint32_t un_time_ms;         // device time of the sample block that completed the window
+  float f_spo2;
+  int8_t ch_spo2_valid;
+  int32_t n_heart_rate;
+  int8_t ch_hr_valid;
+  float f_ratio;
+  float f_correl;
+  uint64_t ul_latency_ns;
+} ingest_result;
+
+// Called from the worker threads, possibly concurrently for different streams
+typedef void (*ingest_handler)(void *p_context, const ingest_result *ps_result);
+
+typedef struct {
+  int32_t n_workers;           // estimator threads, 0 for one per hardware thread
+  int32_t n_hop;               // samples between estimates
+  ingest_handler handler;
+  void *p_context;
+} ingest_config;
+
+typedef struct {
+  char s_name[INGEST_NAME_CHARS];
+  bool b_open;                 // still connected
+  float f_sample_rate;         // from the last configuration frame, 0 if none was seen
+  uint64_t ul_bytes;
+  uint64_t ul_samples;
+  uint32_t un_frames;
+  uint32_t un_crc_errors;      // and framing errors
+  uint32_t un_lost_frames;
+  uint32_t un_missing_samples;
+  uint32_t un_restarts;        // windows started over for a gap or a device restart
+  uint32_t un_pauses;          // times reading stopped for the workers to catch up
+  uint32_t un_dropped_windows; // should stay 0, see INGEST_PAUSE_WINDOWS
+  uint32_t un_windows;         // estimates
+  uint32_t un_hr_valid;
+  uint32_t un_batched;         // estimates made through rf_batch with other streams' windows
+  uint64_t ul_latency_sum_ns;
+  uint64_t ul_latency_max_ns;
+  uint32_t aun_latency_hist[INGEST_LATENCY_BUCKETS]; // [k]: latency below 2^k us
+} ingest_stream_stats;
+
+struct ingest_stream;          // per connection, see ingest.cpp
+
+typedef struct {
+  ingest_config s_config;
+  int n_epoll;
+  int n_listen;                // TCP listening socket, -1 if none
+  int n_wake;                  // eventfd: resume a paused stream, or stop
+  std::vector<ingest_stream *> aps_streams;
+  std::vector<std::thread> a_workers;
+  std::mutex s_lock;           // the ready queue, per-stream queues and statistics
+  std::condition_variable s_ready_cv;
+  std::condition_variable s_idle_cv;
+  std::deque<ingest_stream *> aps_ready; // streams with a window waiting and no worker on them
+  uint32_t un_busy;            // windows queued or being processed, over all streams
+  uint32_t un_waiting;         // workers idle on s_ready_cv
+  bool b_stop;
+} ingest_server;
+
+void ingest_default_config(ingest_config *ps_config);
+bool ingest_init(ingest_server *ps_server, const ingest_config *ps_config);
+int32_t ingest_add_fd(ingest_server *ps_server, int n_fd, const char *s_name);
+int32_t ingest_add_serial(ingest_server *ps_server, const char *s_path, int32_t n_baud);
+bool ingest_listen_tcp(ingest_server *ps_server, const char *s_address, uint16_t uw_port);
+uint16_t ingest_tcp_port(const ingest_server *ps_server);
+int32_t ingest_poll(ingest_server *ps_server, int32_t n_timeout_ms);
+int32_t ingest_open_streams(ingest_server *ps_server);
+void ingest_drain(ingest_server *ps_server);
+int32_t ingest_stream_count(ingest_server *ps_server);
+bool ingest_stream_stats_get(ingest_server *ps_server, int32_t n_stream, ingest_stream_stats *ps_stats);
+uint64_t ingest_latency_percentile_us(const ingest_stream_stats *ps_stats, float f_fraction);
+void ingest_shutdown(ingest_server *ps_server);
+
+#endif /* INGEST_H_ */
@@ -0,0 +1,226 @@
+/** \file ingest_fleet.cpp ******************************************************
+*
+* Description: Fake device fleet for the ingest server, see ingest_fleet.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "ingest_fleet.h"
+#include <algorithmRF.h>
+#include <ppg_synth.h>
+#include <telemetry.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pty.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+
+#define INGEST_FLEET_TICK_MS 5
+#define INGEST_FLEET_BURST (4 * TELEMETRY_BLOCK_SAMPLES) // per device and turn when not paced
+
+struct ingest_fleet_device {
+  int n_fd;                    // PTY master or connected socket
+  int n_slave;                 // kept open so the PTY does not hang up before the server opens it
+  char s_name[INGEST_NAME_CHARS]; // PTY slave path, or the address the server sees
+  float f_hr_bpm;
+  ppg_synth_state s_synth;
+  telemetry_writer s_writer;
+  uint32_t un_sent;
+};
+
+static bool ingest_fleet_write(void *p_context, const uint8_t *puch_data, size_t un_len)
+{
+  ingest_fleet_device *ps_device = (ingest_fleet_device *)p_context;
+  ssize_t n_written;
+  while (un_len > 0) {
+    n_written = write(ps_device->n_fd, puch_data, un_len);
+    if (n_written < 0 && errno == EINTR)
+      continue;
+    if (n_written <= 0)
+      return false;
+    puch_data += n_written;
+    un_len -= (size_t)n_written;
+  }
+  return true;
+}
+
+static bool ingest_fleet_open_pty(ingest_fleet_device *ps_device)
+{
+  struct termios s_tio;
+  if (openpty(&ps_device->n_fd, &ps_device->n_slave, ps_device->s_name, NULL, NULL) != 0)
+    return false;
+  // raw before the first byte: no echo, no line buffering, 0x0D stays 0x0D
+  if (tcgetattr(ps_device->n_slave, &s_tio) != 0)
+    return false;
+  cfmakeraw(&s_tio);
+  return tcsetattr(ps_device->n_slave, TCSANOW, &s_tio) == 0;
+}
+
+static bool ingest_fleet_connect(ingest_fleet_device *ps_device, uint16_t uw_port)
+{
+  struct sockaddr_in s_addr;
+  socklen_t un_len = sizeof(s_addr);
+  int n_one = 1;
+
+  ps_device->n_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (ps_device->n_fd < 0)
+    return false;
+  memset(&s_addr, 0, sizeof(s_addr));
+  s_addr.sin_family = AF_INET;
+  s_addr.sin_port = htons(uw_port);
+  s_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(ps_device->n_fd, (struct sockaddr *)&s_addr, sizeof(s_addr)) != 0
+      || getsockname(ps_device->n_fd, (struct sockaddr *)&s_addr, &un_len) != 0)
+    return false;
+  setsockopt(ps_device->n_fd, IPPROTO_TCP, TCP_NODELAY, &n_one, sizeof(n_one)); // a node sends each block as it fills
+  snprintf(ps_device->s_name, INGEST_NAME_CHARS, "tcp:127.0.0.1:%u", ntohs(s_addr.sin_port));
+  return true;
+}
+
+void ingest_fleet_default_config(ingest_fleet_config *ps_config)
+{
+  ps_config->n_pty_devices = 16;
+  ps_config->n_tcp_devices = 0;
+  ps_config->uw_tcp_port = 0;
+  ps_config->f_speed = 1.0f;
+  ps_config->un_seconds = 60;
+  ps_config->un_seed = 1;
+}
+
+bool ingest_fleet_open(ingest_fleet *ps_fleet, const ingest_fleet_config *ps_config)
+/**
+* \brief        Create the PTYs and connect the TCP devices; nothing is sent yet
+* \par          Details
+*               Device n simulates a heart rate between 55 and 125 bpm, see
+*               ingest_fleet_heart_rate(). The configuration frame goes out first.
+*
+* \retval       false if a PTY or a connection could not be opened
+*/
+{
+  static const uint8_t auch_regs_08_0d[6] = { 0x4F, 0x03, 0x27, 0x00, 0x24, 0x24 }; // maxim_max30102_init(): 25 sps into the FIFO
+  int32_t n_devices = ps_config->n_pty_devices + ps_config->n_tcp_devices;
+  ppg_synth_config s_synth;
+  capture_config s_config;
+  char s_text[64];
+
+  ps_fleet->s_config = *ps_config;
+  ps_fleet->b_stop = false;
+  ps_fleet->b_done = false;
+  ps_fleet->b_write_error = false;
+  capture_config_from_regs(&s_config, auch_regs_08_0d, 0x00, 0x00);
+  for (int32_t i = 0; i < n_devices; i++) {
+    ingest_fleet_device *ps_device = new ingest_fleet_device();
+    ps_device->n_fd = ps_device->n_slave = -1;
+    ps_fleet->aps_devices.push_back(ps_device);
+    if (i < ps_config->n_pty_devices ? !ingest_fleet_open_pty(ps_device) : !ingest_fleet_connect(ps_device, ps_config->uw_tcp_port))
+      return false;
+
+    ppg_synth_default_config(&s_synth);
+    s_synth.f_fs = FS;
+    s_synth.f_hr_bpm = 55.0f + (float)((i * 37 + ps_config->un_seed) % 71);
+    s_synth.f_motion_per_s = 0.0f;
+    s_synth.f_dropout_per_s = 0.0f;
+    s_synth.un_seed = ps_config->un_seed * 7919u + (uint32_t)i;
+    ppg_synth_init(&ps_device->s_synth, &s_synth);
+    ps_device->f_hr_bpm = s_synth.f_hr_bpm;
+    telemetry_writer_init(&ps_device->s_writer, ingest_fleet_write, ps_device);
+    snprintf(s_text, sizeof(s_text), "fleet device %d, %.0f bpm", (int)i, s_synth.f_hr_bpm);
+    telemetry_write_text(&ps_device->s_writer, s_text);
+    telemetry_write_config(&ps_device->s_writer, &s_config);
+  }
+  return true;
+}
+
+int32_t ingest_fleet_size(const ingest_fleet *ps_fleet)
+{
+  return (int32_t)ps_fleet->aps_devices.size();
+}
+
+const char *ingest_fleet_name(const ingest_fleet *ps_fleet, int32_t n_device)
+/**
+* \retval       The PTY slave path to open, or for TCP the name the server gives the connection
+*/
+{
+  return ps_fleet->aps_devices[n_device]->s_name;
+}
+
+bool ingest_fleet_is_pty(const ingest_fleet *ps_fleet, int32_t n_device)
+{
+  return ps_fleet->aps_devices[n_device]->n_slave >= 0;
+}
+
+float ingest_fleet_heart_rate(const ingest_fleet *ps_fleet, int32_t n_device)
+{
+  return ps_fleet->aps_devices[n_device]->f_hr_bpm;
+}
+
+static void ingest_fleet_run(ingest_fleet *ps_fleet)
+{
+  const uint32_t un_total = ps_fleet->s_config.un_seconds * FS;
+  const float f_speed = ps_fleet->s_config.f_speed;
+  auto s_start = std::chrono::steady_clock::now();
+  uint32_t un_due, un_red, un_ir;
+  bool b_all_sent = false;
+
+  while (!b_all_sent && !ps_fleet->b_stop) {
+    if (f_speed > 0.0f) {
+      double f_elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - s_start).count();
+      un_due = (uint32_t)(f_elapsed * f_speed * FS);
+    } else
+      un_due = ~0u;
+    b_all_sent = true;
+    for (ingest_fleet_device *ps_device : ps_fleet->aps_devices) {
+      uint32_t un_limit = f_speed > 0.0f ? un_due : ps_device->un_sent + INGEST_FLEET_BURST;
+      if (un_limit > un_total)
+        un_limit = un_total;
+      while (ps_device->un_sent < un_limit) {
+        ppg_synth_next(&ps_device->s_synth, &un_red, &un_ir); // no dropouts configured
+        ps_fleet->b_write_error |= !telemetry_write_sample(&ps_device->s_writer, un_red, un_ir, ps_device->un_sent * (1000 / FS));
+        ps_device->un_sent++;
+      }
+      if (ps_device->un_sent == un_total)
+        ps_fleet->b_write_error |= !telemetry_flush_samples(&ps_device->s_writer);
+      else
+        b_all_sent = false;
+    }
+    if (f_speed > 0.0f && !b_all_sent)
+      std::this_thread::sleep_for(std::chrono::milliseconds(INGEST_FLEET_TICK_MS));
+  }
+  ps_fleet->b_done = true;
+}
+
+void ingest_fleet_start(ingest_fleet *ps_fleet)
+/**
+* \brief        Start sending; the server should already watch every device
+*/
+{
+  ps_fleet->s_thread = std::thread(ingest_fleet_run, ps_fleet);
+}
+
+bool ingest_fleet_done(const ingest_fleet *ps_fleet)
+{
+  return ps_fleet->b_done;
+}
+
+void ingest_fleet_close(ingest_fleet *ps_fleet)
+/**
+* \brief        Stop sending and hang up every device
+*/
+{
+  ps_fleet->b_stop = true;
+  if (ps_fleet->s_thread.joinable())
+    ps_fleet->s_thread.join();
+  for (ingest_fleet_device *ps_device : ps_fleet->aps_devices) {
+    if (ps_device->n_fd >= 0)
+      close(ps_device->n_fd);
+    if (ps_device->n_slave >= 0)
+      close(ps_device->n_slave);
+    delete ps_device;
+  }
+  ps_fleet->aps_devices.clear();
+}
@@ -0,0 +1,55 @@
+/** \file ingest_fleet.h ******************************************************
+*
+* Description: Fake device fleet for the ingest server
+*
+* Each device is a ppg_synth signal sent as framed telemetry, exactly what an
+* esp01_telemetry node writes, either into a PTY (the ingest side opens the
+* slave path like a USB serial port) or over a TCP connection to the server.
+* One thread paces all devices at f_speed times real time, or sends as fast as
+* the receiver takes the data. Closing the fleet closes every connection, which
+* the server sees as the devices going away.
+*
+* Linux only; used by bench ingest and the ingestd --fleet demo.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef INGEST_FLEET_H_
+#define INGEST_FLEET_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <ingest.h>
+
+typedef struct {
+  int32_t n_pty_devices;
+  int32_t n_tcp_devices;
+  uint16_t uw_tcp_port;        // the server's loopback port, for n_tcp_devices
+  float f_speed;               // device seconds per second, 0 for as fast as possible
+  uint32_t un_seconds;         // device time each device sends
+  uint32_t un_seed;
+} ingest_fleet_config;
+
+struct ingest_fleet_device;    // see ingest_fleet.cpp
+
+typedef struct {
+  ingest_fleet_config s_config;
+  std::vector<ingest_fleet_device *> aps_devices;
+  std::thread s_thread;
+  std::atomic<bool> b_stop;
+  std::atomic<bool> b_done;
+  bool b_write_error;
+} ingest_fleet;
+
+void ingest_fleet_default_config(ingest_fleet_config *ps_config);
+bool ingest_fleet_open(ingest_fleet *ps_fleet, const ingest_fleet_config *ps_config);
+int32_t ingest_fleet_size(const ingest_fleet *ps_fleet);
+const char *ingest_fleet_name(const ingest_fleet *ps_fleet, int32_t n_device);
+bool ingest_fleet_is_pty(const ingest_fleet *ps_fleet, int32_t n_device);
+float ingest_fleet_heart_rate(const ingest_fleet *ps_fleet, int32_t n_device);
+void ingest_fleet_start(ingest_fleet *ps_fleet);
+bool ingest_fleet_done(const ingest_fleet *ps_fleet);
+void ingest_fleet_close(ingest_fleet *ps_fleet);
+
+#endif /* INGEST_FLEET_H_ */
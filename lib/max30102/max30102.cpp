@@ -62,10 +62,64 @@
 *******************************************************************************
 */
 #include "max30102.h"
-#include <Wire.h>
-#include <algorithm.h>
+#include <profile.h>
+#include <string.h>
 
+#ifndef PROGMEM // Arduino cores keep PROGMEM data in flash, the host in memory
+#define PROGMEM
+#define memcpy_P memcpy
+#endif
 
+#ifdef ARDUINO
+static const max30102_hal *p_hal = &max30102_wire_hal;
+#else
+static const max30102_hal *p_hal = NULL; // host builds must call maxim_max30102_set_hal()
+#endif
+
+// FIFO layout of the active mode: one 3-byte slot per LED, in conversion order
+static uint8_t uch_active_mode = MAX30102_MODE_SPO2;
+static uint8_t uch_active_slots = 2;
+static uint8_t auch_active_leds[MAX30102_MAX_SLOTS] = { MAX30102_SLOT_RED, MAX30102_SLOT_IR };
+// REG_INTR_STATUS_2 bits cleared by the FIFO reads, kept for maxim_max30102_take_intr_status_2()
+static uint8_t uch_intr_status_2 = 0;
+
+static void maxim_max30102_decode_sample(const uint8_t *puch_sample, uint32_t *pun_red_led, uint32_t *pun_ir_led)
+/**
+* \brief        Split one FIFO sample of the active mode into red and IR
+* \par          Details
+*               Slots are 3 bytes, MSB first, 18 bits left justified. An LED the mode does not
+*               convert reads as 0.
+*/
+{
+  uint32_t un_value;
+  uint8_t i;
+  *pun_red_led = 0;
+  *pun_ir_led = 0;
+  for (i = 0; i < uch_active_slots; i++, puch_sample += MAX30102_BYTES_PER_SLOT) {
+    un_value = (((uint32_t)puch_sample[0] << 16) | ((uint32_t)puch_sample[1] << 8) | puch_sample[2]) & 0x3FFFF; // 18 bit
+    if (auch_active_leds[i] == MAX30102_SLOT_RED)
+      *pun_red_led = un_value;
+    else
+      *pun_ir_led = un_value;
+  }
+}
+
+void maxim_max30102_set_hal(const max30102_hal *p_new_hal)
+/**
+* \brief        Select the bus the driver talks to
+* \par          Details
+*               Defaults to max30102_wire_hal on Arduino. Call before maxim_max30102_init().
+*
+* \param[in]    p_new_hal    - HAL to use, must stay valid while the driver is in use
+*/
+{
+  p_hal = p_new_hal;
+}
+
+const max30102_hal *maxim_max30102_get_hal(void)
+{
+  return p_hal;
+}
 
 bool maxim_max30102_write_reg(uint8_t uch_addr, uint8_t uch_data)
 /**
@@ -79,11 +133,10 @@ bool maxim_max30102_write_reg(uint8_t uch_addr, uint8_t uch_data)
 * \retval       true on success
 */
 {
-  Wire.beginTransmission(I2C_WRITE_ADDR);
-  Wire.write(uch_addr);
-  Wire.write(uch_data);
-  Wire.endTransmission();
-  return true;
+  if (p_hal == NULL)
+    return false;
+  PROFILE_SCOPE(PROFILE_I2C_WRITE);
+  return p_hal->write(p_hal->p_context, uch_addr, &uch_data, 1);
 }
 
 bool maxim_max30102_read_reg(uint8_t uch_addr, uint8_t *puch_data)
@@ -98,79 +151,271 @@ bool maxim_max30102_read_reg(uint8_t uch_addr, uint8_t *puch_data)
 * \retval       true on success
 */
 {
-  Wire.beginTransmission(I2C_WRITE_ADDR);
-  Wire.write(uch_addr);
-  Wire.endTransmission();
-  Wire.beginTransmission(I2C_READ_ADDR);
-  Wire.requestFrom(I2C_READ_ADDR,1);
-  *puch_data=Wire.read();
-  Wire.endTransmission();
-  return true;
+  return maxim_max30102_read_regs(uch_addr, puch_data, 1);
 }
 
-bool maxim_max30102_init() // ------------------------- INIT --------------------------
+bool maxim_max30102_read_regs(uint8_t uch_addr, uint8_t *puch_data, uint8_t uch_len)
 /**
-* \brief        Initialize the MAX30102
+* \brief        Read consecutive MAX30102 registers
 * \par          Details
-*               This function initializes the MAX30102
+*               This function reads uch_len registers starting at uch_addr in a single
+*               auto-incrementing I2C read. uch_len must not exceed the HAL's uw_max_read.
 *
-* \param        None
+* \param[in]    uch_addr    - first register address
+* \param[out]   puch_data   - buffer that stores uch_len register values
+* \param[in]    uch_len     - number of registers to read
 *
 * \retval       true on success
 */
 {
+  if (p_hal == NULL)
+    return false;
+  PROFILE_SCOPE(PROFILE_I2C_READ);
+  return p_hal->read(p_hal->p_context, uch_addr, puch_data, uch_len);
+}
 
-  // ------------------------
-#define sda_pin 5 // D1 -> pin 5
-#define scl_pin 4 // D2 -> pin 4
- // ----------------------------
-    Wire.begin(sda_pin, scl_pin);
-    Wire.setClock(400000L);
+// Register image written by maxim_max30102_init(), REG_INTR_ENABLE_1 to REG_LED2_PULSE_AMPLITUDE.
+// REG_FIFO_DATA does not auto-increment, so it goes out as two bursts around it.
+static const uint8_t auch_init_regs[REG_LED2_PULSE_AMPLITUDE - REG_INTR_ENABLE_1 + 1] PROGMEM = {
+    0b1'0'0'00000, // 0x02 INTR_ENABLE_1: fifo almost full int on, new sample int off (FIFO is drained in bursts), ambient light cancellation int off
+    0b000000'0'0,  // 0x03 INTR_ENABLE_2: die temperature ready int off
+    0x00,          // 0x04 FIFO_WR_PTR[4:0]
+    0x00,          // 0x05 OVF_COUNTER[4:0]
+    0x00,          // 0x06 FIFO_RD_PTR[4:0]
+    0x00,          // 0x07 FIFO_DATA, not written
+    0b0100'0'010,  // 0x08 FIFO_CONFIG: fifo almost full = 0100 => 28 unread data samples, fifo rollover=false, sample avg = 4
+    0b00000'011,   // 0x09 MODE_CONFIG: 010 for Red only(heart rate), 011 for SpO2 mode, 111 multimode LED
+    0b0'01'001'11, // 0x0A SPO2_CONFIG: SPO2_ADC range = 4096, SPO2 sample rate (100 Hz), LED pulseWidth (411uS)
+    0x00,          // 0x0B reserved, power-on value
+    60,            // 0x0C LED1_PA: led pulse amplitude 36 => 7mA
+    60,            // 0x0D LED2_PA: led2 amplitude
+};
 
-    maxim_max30102_reset(); // resets the MAX30102
-    delay(1000);
+static max30102_status maxim_max30102_wait(uint8_t uch_addr, uint8_t uch_mask, uint8_t uch_value, max30102_status e_timeout)
+/**
+* \brief        Poll a register until (value & uch_mask) == uch_value
+* \par          Details
+*               Reads back to back first, then once per millisecond, for at most
+*               MAX30102_INIT_TIMEOUT_MS. A bus error counts as not yet: a part still below its
+*               UVLO threshold does not acknowledge.
+*
+* \retval       MAX30102_OK, or e_timeout if the register never matched (MAX30102_ERR_BUS if it
+*               never answered)
+*/
+{
+  uint32_t un_start = p_hal->millis(p_hal->p_context);
+  bool b_answered = false;
+  uint8_t uch_data;
+  for (;;) {
+    if (maxim_max30102_read_reg(uch_addr, &uch_data)) {
+      if ((uch_data & uch_mask) == uch_value)
+        return MAX30102_OK;
+      b_answered = true;
+    }
+    if (p_hal->millis(p_hal->p_context) - un_start >= MAX30102_INIT_TIMEOUT_MS)
+      return b_answered ? e_timeout : MAX30102_ERR_BUS;
+    p_hal->delay_ms(p_hal->p_context, 1);
+  }
+}
 
-    uint8_t uch_dummy;
-    maxim_max30102_read_reg(REG_INTR_STATUS_1, &uch_dummy); // Reads/clears the interrupt status register
+max30102_status maxim_max30102_configure()
+/**
+* \brief        Reset and configure the MAX30102, telling why it failed
+* \par          Details
+*               Waits for the part to answer with its part ID (power ready), soft resets it and
+*               polls MODE_CONFIG.RESET until it clears, about 1 ms, instead of sleeping. Then writes
+*               REG_INTR_ENABLE_1 to REG_LED2_PULSE_AMPLITUDE from a flash table in two auto-increment
+*               bursts, clears the pending interrupts (PWR_RDY included) and reads the configuration
+*               back. Takes a few milliseconds of bus time and polling.
+*
+* \param        None
+*
+* \retval       MAX30102_OK, or the first failure, see maxim_max30102_status_name()
+*/
+{
+    uint8_t auch_regs[sizeof(auch_init_regs)], auch_read[sizeof(auch_init_regs)];
+    const uint8_t uch_fifo = REG_FIFO_DATA - REG_INTR_ENABLE_1;
+    const uint8_t uch_config = REG_FIFO_CONFIG - REG_INTR_ENABLE_1;
+    max30102_status e_status;
+
+    if (p_hal == NULL)
+        return MAX30102_ERR_NO_HAL;
+    PROFILE_SCOPE(PROFILE_INIT);
+    if (p_hal->begin != NULL && !p_hal->begin(p_hal->p_context))
+        return MAX30102_ERR_BUS;
     /*
     for register values and meaning: https://datasheets.maximintegrated.com/en/ds/MAX30102.pdf
     */
+    e_status = maxim_max30102_wait(REG_PART_ID, 0xFF, MAX30102_PART_ID, MAX30102_ERR_PART_ID);
+    if (e_status != MAX30102_OK)
+        return e_status;
+    if (!maxim_max30102_reset()) // resets the MAX30102
+        return MAX30102_ERR_BUS;
+    e_status = maxim_max30102_wait(REG_MODE_CONFIG, 0x40, 0x00, MAX30102_ERR_RESET_TIMEOUT);
+    if (e_status != MAX30102_OK)
+        return e_status;
 
-    if (!maxim_max30102_write_reg(REG_INTR_ENABLE_1, 0b1'1'0'00000)) // fifo almost full int on, new sample int, ambient light cancellation int
-        return false;
-    if (!maxim_max30102_write_reg(REG_INTR_ENABLE_2, 0x000000'0'0)) // 0
-        return false;
-    if (!maxim_max30102_write_reg(REG_FIFO_WRITE_POINTER, 0x0)) // 0, FIFO_WR_PTR[4:0]
-        return false;
-    if (!maxim_max30102_write_reg(REG_OVERFLOW_COUNTER, 0x0)) // 0, OVF_COUNTER[4:0]
-        return false;
-    if (!maxim_max30102_write_reg(REG_FIFO_READ_POINTER, 0x0)) // 0, FIFO_RD_PTR[4:0]
-        return false;
-    if (!maxim_max30102_write_reg(REG_FIFO_CONFIG, 0b0100'0'010)) // fifo almost full = 0100 => 28 unread data samples, fifo rollover=false, sample avg = 4
-        return false;
-    if (!maxim_max30102_write_reg(REG_MODE_CONFIG, 0b00000'011)) // 010 for Red only(heart rate), 011 for SpO2 mode, 111 multimode LED
-        return false;
-    if (!maxim_max30102_write_reg(REG_SPO2_CONFIG, 0b0'01'001'11)) // SPO2_ADC range = 4096, SPO2 sample rate (100 Hz), LED pulseWidth (411uS)
-        return false;
-    if (!maxim_max30102_write_reg(REG_LED1_PULSE_AMPLITUDE, 60)) // led pulse amplitude 36 => 7mA
-        return false;
-    if (!maxim_max30102_write_reg(REG_LED2_PULSE_AMPLITUDE, 60)) // led2 amplitude
-        return false;
-    /*
-    if (!maxim_max30102_write_reg(0x11, 0b0'010'0'001)) // multimode led control, red then ir
-        return false;
-    if (!maxim_max30102_write_reg(0x12, 0b0'010'0'001)) // multimode led control, red then ir
+    memcpy_P(auch_regs, auch_init_regs, sizeof(auch_regs));
+    if (!p_hal->write(p_hal->p_context, REG_INTR_ENABLE_1, auch_regs, uch_fifo) // up to FIFO_RD_PTR
+        || !p_hal->write(p_hal->p_context, REG_FIFO_CONFIG, auch_regs + uch_config, sizeof(auch_regs) - uch_config))
+        return MAX30102_ERR_BUS;
+    uch_active_mode = MAX30102_MODE_SPO2;
+    uch_active_slots = 2;
+    auch_active_leds[0] = MAX30102_SLOT_RED;
+    auch_active_leds[1] = MAX30102_SLOT_IR;
+    uch_intr_status_2 = 0;
+    if (!maxim_max30102_read_regs(REG_INTR_STATUS_1, auch_read, 2)) // Reads/clears the interrupt status registers
+        return MAX30102_ERR_BUS;
+
+    // the FIFO pointers move as soon as the part converts, the rest must read back as written
+    if (!maxim_max30102_read_regs(REG_INTR_ENABLE_1, auch_read, REG_INTR_ENABLE_2 - REG_INTR_ENABLE_1 + 1)
+        || !maxim_max30102_read_regs(REG_FIFO_CONFIG, auch_read + uch_config, sizeof(auch_read) - uch_config))
+        return MAX30102_ERR_BUS;
+    if (memcmp(auch_read, auch_regs, REG_INTR_ENABLE_2 - REG_INTR_ENABLE_1 + 1) != 0
+        || memcmp(auch_read + uch_config, auch_regs + uch_config, sizeof(auch_regs) - uch_config) != 0)
+        return MAX30102_ERR_VERIFY;
+    return MAX30102_OK;
+}
+
+bool maxim_max30102_init() // ------------------------- INIT --------------------------
+/**
+* \brief        Initialize the MAX30102
+* \par          Details
+*               maxim_max30102_configure() without the reason for a failure
+*
+* \param        None
+*
+* \retval       true on success
+*/
+{
+    return maxim_max30102_configure() == MAX30102_OK;
+}
+
+const char *maxim_max30102_status_name(max30102_status e_status)
+/**
+* \retval       Short description of e_status, for a log line
+*/
+{
+  switch (e_status) {
+  case MAX30102_OK:
+    return "ok";
+  case MAX30102_ERR_NO_HAL:
+    return "no HAL";
+  case MAX30102_ERR_BUS:
+    return "no answer on the bus";
+  case MAX30102_ERR_PART_ID:
+    return "not a MAX30102";
+  case MAX30102_ERR_RESET_TIMEOUT:
+    return "reset did not complete";
+  case MAX30102_ERR_VERIFY:
+    return "configuration did not read back";
+  }
+  return "?";
+}
+
+bool maxim_max30102_set_mode(uint8_t uch_mode, const uint8_t *puch_slots)
+/**
+* \brief        Switch between heart rate, SpO2 and multi-LED mode while running
+* \par          Details
+*               Programs the slots (multi-LED mode only) and MODE[2:0], keeping the shutdown bit
+*               and every other setting, then empties the FIFO: samples of the old mode have a
+*               different width and would be decoded wrongly. No reset, no settling delay.
+*               Heart rate mode converts the red LED only. puch_slots lists up to
+*               MAX30102_MAX_SLOTS MAX30102_SLOT_RED/IR entries ending at the first
+*               MAX30102_SLOT_NONE, each LED at most once; it is ignored in the other modes.
+*
+* \param[in]    uch_mode      - MAX30102_MODE_HR, MAX30102_MODE_SPO2 or MAX30102_MODE_MULTI_LED
+* \param[in]    puch_slots    - multi-LED slot order, e.g. { MAX30102_SLOT_IR, MAX30102_SLOT_NONE } for IR only
+*
+* \retval       true on success, false for an invalid mode or slot list or a bus error
+*/
+{
+  uint8_t auch_leds[MAX30102_MAX_SLOTS] = { MAX30102_SLOT_NONE };
+  uint8_t uch_slots = 0, uch_mode_config, i;
+  switch (uch_mode) {
+  case MAX30102_MODE_HR:
+    auch_leds[uch_slots++] = MAX30102_SLOT_RED;
+    break;
+  case MAX30102_MODE_SPO2:
+    auch_leds[uch_slots++] = MAX30102_SLOT_RED;
+    auch_leds[uch_slots++] = MAX30102_SLOT_IR;
+    break;
+  case MAX30102_MODE_MULTI_LED:
+    if (puch_slots == NULL)
+      return false;
+    for (; uch_slots < MAX30102_MAX_SLOTS && puch_slots[uch_slots] != MAX30102_SLOT_NONE; uch_slots++) {
+      if (puch_slots[uch_slots] != MAX30102_SLOT_RED && puch_slots[uch_slots] != MAX30102_SLOT_IR)
         return false;
-    */
+      for (i = 0; i < uch_slots; i++)
+        if (auch_leds[i] == puch_slots[uch_slots])
+          return false;
+      auch_leds[uch_slots] = puch_slots[uch_slots];
+    }
+    if (uch_slots == 0)
+      return false;
+    if (!maxim_max30102_write_reg(REG_MULTI_LED_CONTROL1, auch_leds[1] << 4 | auch_leds[0]) // SLOT2[6:4], SLOT1[2:0]
+        || !maxim_max30102_write_reg(REG_MULTI_LED_CONTROL2, auch_leds[3] << 4 | auch_leds[2])) // SLOT4[6:4], SLOT3[2:0]
+      return false;
+    break;
+  default:
+    return false;
+  }
+  if (!maxim_max30102_read_reg(REG_MODE_CONFIG, &uch_mode_config))
+    return false;
+  if (!maxim_max30102_write_reg(REG_MODE_CONFIG, (uch_mode_config & 0x80) | uch_mode)) // SHDN kept, RESET clear
+    return false;
+  uch_active_mode = uch_mode;
+  uch_active_slots = uch_slots;
+  memcpy(auch_active_leds, auch_leds, sizeof(auch_active_leds));
+  return maxim_max30102_write_reg(REG_FIFO_WRITE_POINTER, 0x0) && maxim_max30102_write_reg(REG_OVERFLOW_COUNTER, 0x0)
+      && maxim_max30102_write_reg(REG_FIFO_READ_POINTER, 0x0) && maxim_max30102_read_reg(REG_INTR_STATUS_1, &uch_mode_config);
+}
 
-    return true;  
+uint8_t maxim_max30102_mode(void)
+/**
+* \retval       MODE[2:0] the driver decodes the FIFO for
+*/
+{
+  return uch_active_mode;
+}
+
+uint8_t maxim_max30102_bytes_per_sample(void)
+/**
+* \retval       FIFO bytes per sample in the active mode: 3 per slot
+*/
+{
+  return uch_active_slots * MAX30102_BYTES_PER_SLOT;
+}
+
+bool maxim_max30102_set_fifo_a_full(uint8_t uch_free_slots)
+/**
+* \brief        Move the FIFO almost full interrupt
+* \par          Details
+*               Sets FIFO_A_FULL[3:0], keeping averaging and rollover: the interrupt fires when
+*               uch_free_slots of the 32 FIFO entries are left. It fires on reaching that count
+*               only, so change it right after draining the FIFO.
+*
+* \param[in]    uch_free_slots    - 0 to 15
+*
+* \retval       true on success, false if out of range or on a bus error
+*/
+{
+  uint8_t uch_fifo_config;
+  if (uch_free_slots > 0x0F)
+    return false;
+  if (!maxim_max30102_read_reg(REG_FIFO_CONFIG, &uch_fifo_config))
+    return false;
+  if ((uch_fifo_config & 0x0F) == uch_free_slots)
+    return true;
+  return maxim_max30102_write_reg(REG_FIFO_CONFIG, (uch_fifo_config & 0xF0) | uch_free_slots);
 }
 
 bool maxim_max30102_read_fifo(uint32_t* pointer_red_led_data, uint32_t* pointer_ir_led_data)
 /**
  * \brief        Read a set of samples from the MAX30102 FIFO register
  * \par          Details
- *               This function reads a set of samples from the MAX30102 FIFO register
+ *               This function reads one sample of the active mode from the MAX30102 FIFO register.
+ *               An LED the mode does not convert reads as 0.
  *
  * \param[out]   *pointer_red_led_data   - pointer that stores the red LED reading data
  * \param[out]   *pointer_ir_led_data    - pointer that stores the IR LED reading data
@@ -178,43 +423,144 @@ bool maxim_max30102_read_fifo(uint32_t* pointer_red_led_data, uint32_t* pointer_
  * \retval       true on success
  */
 {
-    uint32_t un_temp;
+    PROFILE_SCOPE(PROFILE_FIFO_READ);
+    uint8_t auch_fifo[MAX30102_BYTES_PER_SAMPLE];
     uint8_t uch_temp;
     *pointer_ir_led_data = 0;
     *pointer_red_led_data = 0;
     maxim_max30102_read_reg(REG_INTR_STATUS_1, &uch_temp);
-    maxim_max30102_read_reg(REG_INTR_STATUS_2, &uch_temp);
-    Wire.beginTransmission(I2C_WRITE_ADDR); // 57
-    Wire.write(REG_FIFO_DATA); // 7
-    Wire.endTransmission();
-    Wire.beginTransmission(I2C_READ_ADDR);
-    Wire.requestFrom(I2C_READ_ADDR, 0b0110); // 6
-    // red
-    // data is read 1 Byte (8 bits) at a time from sensor
-    un_temp = Wire.read(); // read 8 bits
-    un_temp <<= 16; // shift bits left 16
-    *pointer_red_led_data += un_temp; // data = data + un_temp
-    un_temp = Wire.read(); // read 8 bits
-    un_temp <<= 8; // shift left 8
-    *pointer_red_led_data += un_temp;
-    un_temp = Wire.read(); // read last 8 bits
-    *pointer_red_led_data += un_temp;
-    // ir
-    un_temp = Wire.read(); // read 8 bits
-    un_temp <<= 16; // shift 16 bits
-    *pointer_ir_led_data += un_temp; // add them
-    un_temp = Wire.read(); // read next 8 bits
-    un_temp <<= 8; // shift data left by 8 bits
-    *pointer_ir_led_data += un_temp;
-    un_temp = Wire.read();
-    *pointer_ir_led_data += un_temp;
-    //
-    Wire.endTransmission();
-    *pointer_red_led_data &= 0b000000111111111111111111; // Mask MSB [23:18], zero out [23:18]
-    *pointer_ir_led_data &= 0b000000111111111111111111; // Mask MSB [23:18], zero out bits 23 -> 18
+    if (maxim_max30102_read_reg(REG_INTR_STATUS_2, &uch_temp))
+        uch_intr_status_2 |= uch_temp;
+    // data is read 1 Byte (8 bits) at a time from sensor, MSB first, one slot per LED: red[23:16..7:0], ir[23:16..7:0] in SpO2 mode
+    if (!maxim_max30102_read_regs(REG_FIFO_DATA, auch_fifo, maxim_max30102_bytes_per_sample()))
+        return false;
+    maxim_max30102_decode_sample(auch_fifo, pointer_red_led_data, pointer_ir_led_data); // bits 23 -> 18 masked
     return true;
 }
 
+static bool maxim_max30102_read_fifo_into(uint32_t* pun_red_led, uint32_t* pun_ir_led, uint16_t uw_mask, uint16_t uw_start, uint8_t uch_max_samples,
+    uint8_t* puch_num_samples)
+/**
+ * \brief        Read every sample waiting in the MAX30102 FIFO
+ * \par          Details
+ *               This function reads the interrupt status and FIFO pointer registers (0x00-0x06)
+ *               in one burst, which also clears the interrupt, works out how many samples are
+ *               waiting and then drains them from REG_FIFO_DATA. The FIFO data register does not
+ *               auto-increment, so the samples are read back to back in as few I2C reads as the
+ *               HAL allows (two transactions plus one per 21 samples with the ESP8266 Wire in SpO2
+ *               mode, one per 42 with a single slot). Samples are decoded for the active mode.
+ *
+ *               Sample n goes to index (uw_start + n) & uw_mask of the buffers.
+ *
+ * \param[out]   *pun_red_led         - buffer that receives up to uch_max_samples red readings
+ * \param[out]   *pun_ir_led          - buffer that receives up to uch_max_samples IR readings
+ * \param[in]    uw_mask              - buffer size - 1 for a ring of a power of two, else 0xFFFF
+ * \param[in]    uw_start             - index of the first sample
+ * \param[in]    uch_max_samples      - samples the buffers have room for
+ * \param[out]   *puch_num_samples    - number of samples actually read
+ *
+ * \retval       true on success
+ */
+{
+    uint8_t auch_regs[REG_FIFO_READ_POINTER - REG_INTR_STATUS_1 + 1];
+    uint8_t auch_fifo[MAX30102_FIFO_DEPTH * MAX30102_BYTES_PER_SAMPLE];
+    uint8_t uch_bytes = maxim_max30102_bytes_per_sample();
+    uint8_t uch_available, uch_chunk, uch_chunk_max, i;
+    uint16_t uw_index;
+    uint8_t uch_read = 0;
+    const uint8_t *puch_sample;
+    PROFILE_SCOPE(PROFILE_FIFO_READ);
+    *puch_num_samples = 0;
+    // status 1/2, interrupt enables, FIFO_WR_PTR, OVF_COUNTER, FIFO_RD_PTR
+    if (!maxim_max30102_read_regs(REG_INTR_STATUS_1, auch_regs, sizeof(auch_regs)))
+        return false;
+    uch_intr_status_2 |= auch_regs[REG_INTR_STATUS_2];
+    uch_available = (auch_regs[REG_FIFO_WRITE_POINTER] - auch_regs[REG_FIFO_READ_POINTER]) & (MAX30102_FIFO_DEPTH - 1);
+    // equal pointers are empty or full: full once samples were lost, or exactly full when A_FULL
+    // fired since the last read (it only fires with samples waiting)
+    if (uch_available == 0 && (auch_regs[REG_OVERFLOW_COUNTER] != 0 || (auch_regs[REG_INTR_STATUS_1] & MAX30102_INT_A_FULL)))
+        uch_available = MAX30102_FIFO_DEPTH;
+    if (uch_available > uch_max_samples)
+        uch_available = uch_max_samples;
+    if (uch_available == 0)
+        return true;
+
+    // whole samples per read
+    uch_chunk_max = MAX30102_FIFO_DEPTH;
+    if (p_hal->uw_max_read != 0 && p_hal->uw_max_read / uch_bytes < uch_chunk_max)
+        uch_chunk_max = p_hal->uw_max_read / uch_bytes;
+    while (uch_read < uch_available) {
+        uch_chunk = uch_available - uch_read;
+        if (uch_chunk > uch_chunk_max)
+            uch_chunk = uch_chunk_max;
+        PROFILE_BEGIN(PROFILE_I2C_READ);
+        bool b_read = p_hal->read(p_hal->p_context, REG_FIFO_DATA, auch_fifo, uch_chunk * uch_bytes);
+        PROFILE_END(PROFILE_I2C_READ);
+        if (!b_read)
+            break;
+        for (i = 0, puch_sample = auch_fifo; i < uch_chunk; i++, uch_read++, puch_sample += uch_bytes) {
+            uw_index = (uw_start + uch_read) & uw_mask;
+            maxim_max30102_decode_sample(puch_sample, &pun_red_led[uw_index], &pun_ir_led[uw_index]);
+        }
+    }
+    *puch_num_samples = uch_read;
+    return uch_read == uch_available;
+}
+
+bool maxim_max30102_read_fifo_burst(uint32_t* pun_red_led, uint32_t* pun_ir_led, uint8_t uch_max_samples, uint8_t* puch_num_samples)
+/**
+ * \brief        Read every sample waiting in the MAX30102 FIFO, see maxim_max30102_read_fifo_into()
+ *
+ * \param[out]   *pun_red_led         - buffer that receives up to uch_max_samples red readings
+ * \param[out]   *pun_ir_led          - buffer that receives up to uch_max_samples IR readings
+ * \param[in]    uch_max_samples      - capacity of both buffers
+ * \param[out]   *puch_num_samples    - number of samples actually read
+ *
+ * \retval       true on success
+ */
+{
+    return maxim_max30102_read_fifo_into(pun_red_led, pun_ir_led, 0xFFFF, 0, uch_max_samples, puch_num_samples);
+}
+
+bool maxim_max30102_read_fifo_ring(uint32_t* pun_red_ring, uint32_t* pun_ir_ring, uint16_t uw_ring_size, uint16_t uw_head, uint8_t uch_max_samples,
+    uint8_t* puch_num_samples)
+/**
+ * \brief        Read every sample waiting in the MAX30102 FIFO into a ring buffer
+ * \par          Details
+ *               As maxim_max30102_read_fifo_burst(), but the samples go to the ring from index
+ *               uw_head on and wrap around its end. One status read for the whole FIFO: a read
+ *               stopped at the ring end would leave samples behind with A_FULL already cleared,
+ *               and no further interrupt if they are still above the threshold.
+ *
+ * \param[out]   *pun_red_ring        - red ring, uw_ring_size samples
+ * \param[out]   *pun_ir_ring         - IR ring, uw_ring_size samples
+ * \param[in]    uw_ring_size         - ring size, a power of two
+ * \param[in]    uw_head              - where the first sample goes, taken modulo uw_ring_size
+ * \param[in]    uch_max_samples      - free slots in the ring from uw_head on
+ * \param[out]   *puch_num_samples    - number of samples actually read
+ *
+ * \retval       true on success
+ */
+{
+    return maxim_max30102_read_fifo_into(pun_red_ring, pun_ir_ring, uw_ring_size - 1, uw_head, uch_max_samples, puch_num_samples);
+}
+
+uint8_t maxim_max30102_take_intr_status_2(void)
+/**
+* \brief        Interrupt status 2 bits the FIFO reads have cleared since the last call
+* \par          Details
+*               Reading REG_INTR_STATUS_2 clears it, and every FIFO read does so in passing.
+*               The bits are collected here instead of being lost, so e.g. DIE_TEMP_RDY can be
+*               picked up without another bus transaction. No bus access.
+*
+* \retval       REG_INTR_STATUS_2 bits seen, cleared by this call
+*/
+{
+  uint8_t uch_status = uch_intr_status_2;
+  uch_intr_status_2 = 0;
+  return uch_status;
+}
+
 bool maxim_max30102_reset()
 /**
 * \brief        Reset the MAX30102
@@ -233,13 +579,20 @@ bool maxim_max30102_reset()
 }
 
 bool maxim_max30102_read_temperature(int8_t *integer_part, uint8_t *fractional_part)
+/**
+* \brief        Blocking die temperature read
+* \par          Details
+*               Waits 1 ms, well short of the ~29 ms conversion, so the result is usually the
+*               previous conversion's. max30102_temp does the same without blocking.
+*/
 {
-  maxim_max30102_write_reg(REG_TEMP_CONFIG,0b0000000'1); // Enabling TEMP_EN
-  delay(1); // Let the processor do its work
+  if (!maxim_max30102_write_reg(REG_TEMP_CONFIG,0b0000000'1)) // Enabling TEMP_EN
+    return false;
+  p_hal->delay_ms(p_hal->p_context, 1); // Let the processor do its work
   // For proper conversion, read the integer part as uint8_t
   uint8_t temp;
-  maxim_max30102_read_reg(REG_TEMP_INTEGER, &temp); // 2's complement integer part of the temperature in degrees Celsius
+  if (!maxim_max30102_read_reg(REG_TEMP_INTEGER, &temp)) // 2's complement integer part of the temperature in degrees Celsius
+    return false;
   *integer_part = temp;
-  maxim_max30102_read_reg(REG_TEMP_FRACTION, fractional_part); // Fractional part of the temperature in 1/16-th degree Celsius
-  return true;
+  return maxim_max30102_read_reg(REG_TEMP_FRACTION, fractional_part); // Fractional part of the temperature in 1/16-th degree Celsius
 }
@@ -24,7 +24,7 @@
 #ifndef MAX30102_H_
 #define MAX30102_H_
 
-#include <Arduino.h>
+#include "max30102_hal.h"
 
 //
 //#define I2C_WRITE_ADDR 0xAE
@@ -56,13 +56,59 @@
 #define REG_REV_ID 0xFE
 #define REG_PART_ID 0xFF
 //
+#define MAX30102_FIFO_DEPTH 32 // samples held by the on-chip FIFO
+#define MAX30102_BYTES_PER_SAMPLE 6 // 3 bytes red + 3 bytes IR in SpO2 mode, the most any mode needs with two LEDs
+#define MAX30102_BYTES_PER_SLOT 3
+//
+// REG_MODE_CONFIG MODE[2:0]
+#define MAX30102_MODE_HR 0x02 // heart rate: red LED only
+#define MAX30102_MODE_SPO2 0x03 // SpO2: red then IR
+#define MAX30102_MODE_MULTI_LED 0x07 // slots from REG_MULTI_LED_CONTROL1/2
+// REG_MULTI_LED_CONTROL1/2 SLOTx[2:0]
+#define MAX30102_SLOT_NONE 0x00
+#define MAX30102_SLOT_RED 0x01
+#define MAX30102_SLOT_IR 0x02
+#define MAX30102_MAX_SLOTS 4
+//
+// REG_INTR_STATUS_1 / REG_INTR_ENABLE_1
+#define MAX30102_INT_A_FULL 0x80
+//
+// REG_INTR_STATUS_2 / REG_INTR_ENABLE_2
+#define MAX30102_INT_DIE_TEMP_RDY 0x02
+//
+#define MAX30102_PART_ID 0x15 // REG_PART_ID
+#define MAX30102_INIT_TIMEOUT_MS 20 // for the part to answer, and again for its reset to complete
+//
+
+// Why maxim_max30102_configure() failed
+typedef enum {
+  MAX30102_OK = 0,
+  MAX30102_ERR_NO_HAL,        // maxim_max30102_set_hal() not called
+  MAX30102_ERR_BUS,           // begin() failed, or no acknowledge / short read
+  MAX30102_ERR_PART_ID,       // something else answers at I2C_WRITE_ADDR
+  MAX30102_ERR_RESET_TIMEOUT, // MODE_CONFIG.RESET never cleared
+  MAX30102_ERR_VERIFY,        // the configuration read back differs
+} max30102_status;
 
+void maxim_max30102_set_hal(const max30102_hal *p_hal);
+const max30102_hal *maxim_max30102_get_hal(void);
 bool maxim_max30102_init();
+max30102_status maxim_max30102_configure();
+const char *maxim_max30102_status_name(max30102_status e_status);
+bool maxim_max30102_set_mode(uint8_t uch_mode, const uint8_t *puch_slots);
+uint8_t maxim_max30102_mode(void);
+uint8_t maxim_max30102_bytes_per_sample(void);
+bool maxim_max30102_set_fifo_a_full(uint8_t uch_free_slots);
 
 bool maxim_max30102_read_fifo(uint32_t *pun_red_led, uint32_t *pun_ir_led); 
+bool maxim_max30102_read_fifo_burst(uint32_t *pun_red_led, uint32_t *pun_ir_led, uint8_t uch_max_samples, uint8_t *puch_num_samples);
+bool maxim_max30102_read_fifo_ring(uint32_t *pun_red_ring, uint32_t *pun_ir_ring, uint16_t uw_ring_size, uint16_t uw_head, uint8_t uch_max_samples,
+                                   uint8_t *puch_num_samples);
 
 bool maxim_max30102_write_reg(uint8_t uch_addr, uint8_t uch_data);
 bool maxim_max30102_read_reg(uint8_t uch_addr, uint8_t *puch_data);
+bool maxim_max30102_read_regs(uint8_t uch_addr, uint8_t *puch_data, uint8_t uch_len);
+uint8_t maxim_max30102_take_intr_status_2(void);
 bool maxim_max30102_reset(void);
 bool maxim_max30102_read_temperature(int8_t *integer_part, uint8_t *fractional_part);
 #endif /*  MAX30102_H_ */
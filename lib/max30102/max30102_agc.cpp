@@ -0,0 +1,250 @@
+/** \file max30102_agc.cpp ******************************************************
+*
+* Description: Closed-loop LED current, ADC range and pulse width control, see max30102_agc.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "max30102_agc.h"
+#include "max30102.h"
+#include <math.h>
+#include <string.h>
+
+#define AGC_STEP_DOWN 0.85f          // outer loop, target factor per step down
+#define AGC_STEP_UP 1.4f             // outer loop, target factor per step up
+#define AGC_MAX_GOOD_WINDOWS 256     // step-down patience never grows beyond this
+#define AGC_AC_LSBS 64               // IR AC rms must span at least this many ADC steps
+#define AGC_SATURATED (MAX30102_AGC_FULL_SCALE - 16)
+
+static const float af_agc_range_na[4] = { 2048.0f, 4096.0f, 8192.0f, 16384.0f };
+static const uint16_t auw_agc_pulse_us[4] = { 69, 118, 215, 411 };
+static const uint16_t auw_agc_rate_hz[8] = { 50, 100, 200, 400, 800, 1000, 1600, 3200 };
+
+void max30102_agc_default_config(max30102_agc_config *ps_cfg)
+/**
+* \brief        Quality gates of algorithmRF, targets for an 18-bit ADC
+*/
+{
+  ps_cfg->f_min_correl = 0.8f;
+  ps_cfg->f_min_ratio = 0.5f;
+  ps_cfg->f_target = 0.4f;
+  ps_cfg->f_target_min = 0.03f;
+  ps_cfg->f_target_max = 0.6f;
+  ps_cfg->f_dead_band = 0.25f;
+  ps_cfg->uch_good_windows = 8;
+  ps_cfg->uch_bad_windows = 2;
+  ps_cfg->un_finger_counts = 2000;
+  ps_cfg->uch_park_amplitude = 20;
+}
+
+static void agc_clear_window(max30102_agc *ps_agc)
+{
+  ps_agc->un_samples = 0;
+  ps_agc->ul_red_sum = ps_agc->ul_ir_sum = ps_agc->ul_ir_sumsq = 0;
+  ps_agc->un_red_max = ps_agc->un_ir_max = 0;
+}
+
+bool max30102_agc_init(max30102_agc *ps_agc, const max30102_agc_config *ps_cfg)
+/**
+* \brief        Start controlling the sensor from the settings it has now
+* \par          Details
+*               Call after maxim_max30102_init(), and again after every reinitialization.
+*
+* \retval       false if the registers could not be read
+*/
+{
+  uint8_t auch_regs[REG_LED2_PULSE_AMPLITUDE - REG_SPO2_CONFIG + 1];
+
+  memset(ps_agc, 0, sizeof(*ps_agc));
+  ps_agc->s_cfg = *ps_cfg;
+  ps_agc->f_target = ps_cfg->f_target;
+  ps_agc->uw_good_needed = ps_cfg->uch_good_windows;
+  if (!maxim_max30102_read_regs(REG_SPO2_CONFIG, auch_regs, sizeof(auch_regs)))
+    return false;
+  ps_agc->uch_spo2_config = auch_regs[0];
+  ps_agc->uch_led_red = auch_regs[REG_LED1_PULSE_AMPLITUDE - REG_SPO2_CONFIG];
+  ps_agc->uch_led_ir = auch_regs[REG_LED2_PULSE_AMPLITUDE - REG_SPO2_CONFIG];
+  return true;
+}
+
+void max30102_agc_sample(max30102_agc *ps_agc, uint32_t un_red_led, uint32_t un_ir_led)
+/**
+* \brief        Account one sample towards the next update
+*/
+{
+  ps_agc->un_samples++;
+  ps_agc->ul_red_sum += un_red_led;
+  ps_agc->ul_ir_sum += un_ir_led;
+  ps_agc->ul_ir_sumsq += (uint64_t)un_ir_led * un_ir_led;
+  if (un_red_led > ps_agc->un_red_max)
+    ps_agc->un_red_max = un_red_led;
+  if (un_ir_led > ps_agc->un_ir_max)
+    ps_agc->un_ir_max = un_ir_led;
+}
+
+static float agc_amplitude_for(uint8_t uch_amplitude, float f_dc, uint32_t un_max, float f_desired, float f_dead_band)
+/**
+* \brief        Inner loop for one LED
+* \retval       New amplitude, unclamped; uch_amplitude itself inside the dead band
+*/
+{
+  float f_scale = f_dc > 0.0f ? f_desired / f_dc : 2.0f;
+  if (f_scale > 2.0f) // light is not linear in the amplitude near the bottom, approach in steps
+    f_scale = 2.0f;
+  if (un_max >= AGC_SATURATED && f_scale > 0.5f)
+    f_scale = 0.5f; // clipped: the mean understates the light
+  else if (fabsf(f_scale - 1.0f) <= f_dead_band)
+    return uch_amplitude;
+  return uch_amplitude * f_scale;
+}
+
+bool max30102_agc_update(max30102_agc *ps_agc, int8_t ch_hr_valid, float f_ratio, float f_correl, bool *pb_changed)
+/**
+* \brief        Retune the sensor after an estimate
+* \par          Details
+*               Uses the samples passed to max30102_agc_sample() since the last update and the
+*               quality of the estimate made from them. Register writes happen here; *pb_changed
+*               tells the caller to restart its estimator.
+*
+* \retval       false if a register write failed
+*/
+{
+  const max30102_agc_config *ps_cfg = &ps_agc->s_cfg;
+  uint8_t uch_range = (ps_agc->uch_spo2_config >> 5) & 0x03, uch_pulse = ps_agc->uch_spo2_config & 0x03, uch_spo2_config;
+  float f_red_dc, f_ir_dc, f_ir_ac, f_red_amp, f_ir_amp, f_desired, f_lsb;
+  uint8_t uch_led_red, uch_led_ir;
+  bool b_pass;
+
+  *pb_changed = false;
+  if (ps_agc->un_samples == 0)
+    return true;
+  f_red_dc = (float)ps_agc->ul_red_sum / ps_agc->un_samples;
+  f_ir_dc = (float)ps_agc->ul_ir_sum / ps_agc->un_samples;
+  f_ir_ac = (float)ps_agc->ul_ir_sumsq / ps_agc->un_samples - f_ir_dc * f_ir_dc;
+  f_ir_ac = f_ir_ac > 0.0f ? sqrtf(f_ir_ac) : 0.0f;
+  if (ps_agc->un_red_max >= AGC_SATURATED || ps_agc->un_ir_max >= AGC_SATURATED)
+    ps_agc->un_saturated_windows++;
+  ps_agc->un_updates++;
+  if (ps_agc->uch_hold != 0) {
+    ps_agc->uch_hold--;
+    agc_clear_window(ps_agc);
+    return true;
+  }
+
+  // finger detection: at full drive on the most sensitive range almost nothing comes back
+  if (ps_agc->uch_led_ir == 255 && uch_range == 0 && f_ir_dc < ps_cfg->un_finger_counts) {
+    ps_agc->b_parked = true;
+    f_red_amp = f_ir_amp = ps_cfg->uch_park_amplitude;
+  } else if (ps_agc->b_parked && f_ir_dc < ps_cfg->un_finger_counts * (float)ps_agc->uch_led_ir / 255.0f) {
+    f_red_amp = ps_agc->uch_led_red; // still nothing there
+    f_ir_amp = ps_agc->uch_led_ir;
+  } else {
+    if (ps_agc->b_parked) { // finger back, start over
+      ps_agc->b_parked = false;
+      ps_agc->f_target = ps_cfg->f_target;
+      ps_agc->uw_good_needed = ps_cfg->uch_good_windows;
+      ps_agc->uw_good = ps_agc->uch_bad = 0;
+    }
+
+    // outer loop: lowest target that keeps the estimates passing
+    b_pass = ch_hr_valid && f_correl >= ps_cfg->f_min_correl && f_ratio >= ps_cfg->f_min_ratio;
+    if (b_pass) {
+      ps_agc->uch_bad = 0;
+      if (++ps_agc->uw_good >= ps_agc->uw_good_needed) {
+        ps_agc->uw_good = 0;
+        ps_agc->f_target *= AGC_STEP_DOWN;
+        if (ps_agc->f_target < ps_cfg->f_target_min)
+          ps_agc->f_target = ps_cfg->f_target_min;
+      }
+    } else {
+      ps_agc->uw_good = 0;
+      if (++ps_agc->uch_bad >= ps_cfg->uch_bad_windows) {
+        ps_agc->uch_bad = 0;
+        if (ps_agc->f_target < ps_cfg->f_target_max) {
+          ps_agc->f_target *= AGC_STEP_UP;
+          if (ps_agc->f_target > ps_cfg->f_target_max)
+            ps_agc->f_target = ps_cfg->f_target_max;
+          if (ps_agc->uw_good_needed < AGC_MAX_GOOD_WINDOWS)
+            ps_agc->uw_good_needed *= 2;
+        }
+      }
+    }
+
+    // inner loop, then the range if an amplitude cannot get there
+    f_desired = ps_agc->f_target * MAX30102_AGC_FULL_SCALE;
+    f_red_amp = agc_amplitude_for(ps_agc->uch_led_red, f_red_dc, ps_agc->un_red_max, f_desired, ps_cfg->f_dead_band);
+    f_ir_amp = agc_amplitude_for(ps_agc->uch_led_ir, f_ir_dc, ps_agc->un_ir_max, f_desired, ps_cfg->f_dead_band);
+    while (uch_range > 0 && (f_red_amp > 255.0f || f_ir_amp > 255.0f) && f_red_amp >= 2.0f && f_ir_amp >= 2.0f) {
+      uch_range--; // half the full scale, twice the counts for the same light
+      f_red_amp *= 0.5f;
+      f_ir_amp *= 0.5f;
+    }
+    while (uch_range < 3 && (f_red_amp < 1.0f || f_ir_amp < 1.0f) && f_red_amp <= 127.0f && f_ir_amp <= 127.0f) {
+      uch_range++;
+      f_red_amp *= 2.0f;
+      f_ir_amp *= 2.0f;
+    }
+    // keep the ADC steps small against the pulse, but no finer than needed
+    f_lsb = (float)(1 << (3 - uch_pulse)) * af_agc_range_na[uch_range] / af_agc_range_na[(ps_agc->uch_spo2_config >> 5) & 0x03];
+    if (uch_pulse < 3 && f_ir_ac < f_lsb * AGC_AC_LSBS)
+      uch_pulse++;
+    else if (uch_pulse > 0 && f_ir_ac >= 2.0f * f_lsb * 2.0f * AGC_AC_LSBS)
+      uch_pulse--;
+  }
+  uch_led_red = f_red_amp < 1.0f ? 1 : f_red_amp > 255.0f ? 255 : (uint8_t)(f_red_amp + 0.5f);
+  uch_led_ir = f_ir_amp < 1.0f ? 1 : f_ir_amp > 255.0f ? 255 : (uint8_t)(f_ir_amp + 0.5f);
+  if (ps_agc->b_parked)
+    uch_range = 0;
+  uch_spo2_config = (ps_agc->uch_spo2_config & 0x1C) | (uch_range << 5) | uch_pulse;
+  agc_clear_window(ps_agc);
+
+  if (uch_led_red != ps_agc->uch_led_red) {
+    if (!maxim_max30102_write_reg(REG_LED1_PULSE_AMPLITUDE, uch_led_red))
+      return false;
+    ps_agc->uch_led_red = uch_led_red;
+    *pb_changed = true;
+  }
+  if (uch_led_ir != ps_agc->uch_led_ir) {
+    if (!maxim_max30102_write_reg(REG_LED2_PULSE_AMPLITUDE, uch_led_ir))
+      return false;
+    ps_agc->uch_led_ir = uch_led_ir;
+    *pb_changed = true;
+  }
+  if (uch_spo2_config != ps_agc->uch_spo2_config) {
+    if (!maxim_max30102_write_reg(REG_SPO2_CONFIG, uch_spo2_config))
+      return false;
+    ps_agc->uch_spo2_config = uch_spo2_config;
+    *pb_changed = true;
+  }
+  if (*pb_changed) {
+    ps_agc->un_changes++;
+    ps_agc->uch_hold = 1; // the next update still sees samples converted before the change
+  }
+  return true;
+}
+
+float max30102_agc_led_ma(uint8_t uch_amplitude)
+{
+  return uch_amplitude * MAX30102_LED_MA_PER_STEP;
+}
+
+float max30102_agc_range_na(const max30102_agc *ps_agc)
+{
+  return af_agc_range_na[(ps_agc->uch_spo2_config >> 5) & 0x03];
+}
+
+uint16_t max30102_agc_pulse_us(const max30102_agc *ps_agc)
+{
+  return auw_agc_pulse_us[ps_agc->uch_spo2_config & 0x03];
+}
+
+float max30102_agc_average_led_ua(const max30102_agc *ps_agc)
+/**
+* \brief        Average current drawn by both LEDs with the present settings
+* \par          Details
+*               Pulse amplitude times duty cycle: pulse width times conversion rate (before
+*               sample averaging, which does not reduce the number of pulses).
+*/
+{
+  return (max30102_agc_led_ma(ps_agc->uch_led_red) + max30102_agc_led_ma(ps_agc->uch_led_ir)) * 1000.0f
+      * max30102_agc_pulse_us(ps_agc) * 1e-6f * auw_agc_rate_hz[(ps_agc->uch_spo2_config >> 2) & 0x07];
+}
@@ -0,0 +1,80 @@
+/** \file max30102_agc.h ******************************************************
+*
+* Description: Closed-loop LED current, ADC range and pulse width control
+*
+* maxim_max30102_init() starts with fixed settings (12 mA, 4096 nA, 411 us)
+* that saturate on thin fingers and waste LED current on most others. The
+* controller watches the samples the driver delivers and retunes the sensor
+* between estimates:
+*
+*  - inner loop: each LED amplitude is scaled so that its DC level sits at a
+*    target fraction of full scale, with a dead band. If an amplitude would
+*    leave 1..255, the ADC range is switched instead; the smallest range that
+*    works is used, since it needs the least LED current for the same counts.
+*    A window that touches full scale halves the amplitude right away.
+*  - outer loop: the target is lowered step by step while the estimates pass
+*    the quality gates (HR valid, correl >= f_min_correl, ratio >= f_min_ratio)
+*    and raised again after consecutive failures. Every raise doubles the
+*    number of good windows needed before the next step down, so the loop
+*    settles just above the lowest LED current that still passes.
+*  - pulse width: the shortest one whose ADC resolution is still fine against
+*    the IR AC amplitude, with a factor of two hysteresis. LED charge per
+*    sample scales with it.
+*
+* Usage: max30102_agc_sample() for every sample, max30102_agc_update() for
+* every estimate. When it reports a change, the samples before it no longer
+* match the ones after it: restart the estimator.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef MAX30102_AGC_H_
+#define MAX30102_AGC_H_
+
+#include <stdint.h>
+
+#define MAX30102_AGC_FULL_SCALE 262144 // 18-bit samples, left justified at lower resolutions
+#define MAX30102_LED_MA_PER_STEP 0.2f  // REG_LED1/2_PULSE_AMPLITUDE LSB
+
+typedef struct {
+  float f_min_correl;           // quality gates the estimates must pass, those of the estimator
+  float f_min_ratio;
+  float f_target;               // initial DC target, fraction of full scale
+  float f_target_min;           // the outer loop stays within these
+  float f_target_max;
+  float f_dead_band;            // relative DC error the inner loop tolerates
+  uint8_t uch_good_windows;     // passing estimates before the first step down
+  uint8_t uch_bad_windows;      // consecutive failing estimates before a step up
+  uint32_t un_finger_counts;    // IR DC below this at full drive: no finger, LEDs parked
+  uint8_t uch_park_amplitude;   // LED amplitude while no finger is detected
+} max30102_agc_config;
+
+typedef struct {
+  max30102_agc_config s_cfg;
+  uint8_t uch_led_red;          // REG_LED1_PULSE_AMPLITUDE
+  uint8_t uch_led_ir;           // REG_LED2_PULSE_AMPLITUDE
+  uint8_t uch_spo2_config;      // REG_SPO2_CONFIG: ADC range [6:5], sample rate [4:2], pulse width [1:0]
+  float f_target;
+  uint16_t uw_good, uw_good_needed;
+  uint8_t uch_bad;
+  uint8_t uch_hold;             // updates to skip while old samples drain out of the FIFO
+  bool b_parked;
+  // samples since the last update
+  uint32_t un_samples;
+  uint64_t ul_red_sum, ul_ir_sum, ul_ir_sumsq;
+  uint32_t un_red_max, un_ir_max;
+  // statistics
+  uint32_t un_updates;
+  uint32_t un_changes;
+  uint32_t un_saturated_windows;
+} max30102_agc;
+
+void max30102_agc_default_config(max30102_agc_config *ps_cfg);
+bool max30102_agc_init(max30102_agc *ps_agc, const max30102_agc_config *ps_cfg);
+void max30102_agc_sample(max30102_agc *ps_agc, uint32_t un_red_led, uint32_t un_ir_led);
+bool max30102_agc_update(max30102_agc *ps_agc, int8_t ch_hr_valid, float f_ratio, float f_correl, bool *pb_changed);
+float max30102_agc_led_ma(uint8_t uch_amplitude);
+float max30102_agc_range_na(const max30102_agc *ps_agc);
+uint16_t max30102_agc_pulse_us(const max30102_agc *ps_agc);
+float max30102_agc_average_led_ua(const max30102_agc *ps_agc);
+
+#endif /* MAX30102_AGC_H_ */
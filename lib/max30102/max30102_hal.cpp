@@ -0,0 +1,70 @@
+/** \file max30102_hal.cpp ******************************************************
+*
+* Description: Default MAX30102 HAL on top of the Arduino Wire library
+*
+* ------------------------------------------------------------------------- */
+
+#ifdef ARDUINO
+
+#include "max30102.h"
+#include <Wire.h>
+
+#define sda_pin 5 // D1 -> pin 5
+#define scl_pin 4 // D2 -> pin 4
+
+static bool max30102_wire_begin(void *p_context)
+{
+  (void)p_context;
+  Wire.begin(sda_pin, scl_pin);
+  Wire.setClock(400000L);
+  return true;
+}
+
+static bool max30102_wire_write(void *p_context, uint8_t uch_addr, const uint8_t *puch_data, uint8_t uch_len)
+{
+  (void)p_context;
+  Wire.beginTransmission(I2C_WRITE_ADDR);
+  Wire.write(uch_addr);
+  Wire.write(puch_data, uch_len);
+  return Wire.endTransmission() == 0;
+}
+
+static bool max30102_wire_read(void *p_context, uint8_t uch_addr, uint8_t *puch_data, uint16_t uw_len)
+{
+  uint16_t i;
+  (void)p_context;
+  Wire.beginTransmission(I2C_WRITE_ADDR);
+  Wire.write(uch_addr);
+  if (Wire.endTransmission(false) != 0) // repeated start, keep the register pointer
+    return false;
+  if (Wire.requestFrom(I2C_READ_ADDR, (int)uw_len) != uw_len)
+    return false;
+  for (i = 0; i < uw_len; i++)
+    puch_data[i] = Wire.read();
+  return true;
+}
+
+static void max30102_wire_delay_ms(void *p_context, uint32_t un_ms)
+{
+  (void)p_context;
+  delay(un_ms);
+}
+
+static uint32_t max30102_wire_millis(void *p_context)
+{
+  (void)p_context;
+  return millis();
+}
+
+const max30102_hal max30102_wire_hal = {
+  NULL,
+  BUFFER_LENGTH,
+  max30102_wire_begin,
+  max30102_wire_write,
+  max30102_wire_read,
+  max30102_wire_delay_ms,
+  max30102_wire_millis,
+  NULL, // INT is serviced by lib/acquisition
+};
+
+#endif /* ARDUINO */
@@ -0,0 +1,46 @@
+/** \file max30102_hal.h ******************************************************
+*
+* Description: Bus and GPIO abstraction used by the MAX30102 driver
+*
+* The driver never touches Wire or the INT pin directly. On Arduino the
+* default HAL (max30102_wire_hal) drives Wire; host builds plug in the
+* simulated device from lib/max30102_sim or any other implementation.
+*
+* Register transfers follow the MAX30102 protocol: the register pointer
+* auto-increments after every byte, except on REG_FIFO_DATA which stays put
+* so consecutive bytes drain the FIFO.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef MAX30102_HAL_H_
+#define MAX30102_HAL_H_
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+typedef struct {
+  void *p_context; // passed to every callback
+  uint16_t uw_max_read; // largest read the backend does in one transaction, 0 = no limit
+  // bring up the bus, may be NULL
+  bool (*begin)(void *p_context);
+  // write uch_len bytes starting at register uch_addr, one I2C transaction
+  bool (*write)(void *p_context, uint8_t uch_addr, const uint8_t *puch_data, uint8_t uch_len);
+  // read uw_len (<= uw_max_read) bytes starting at register uch_addr, one I2C transaction
+  bool (*read)(void *p_context, uint8_t uch_addr, uint8_t *puch_data, uint16_t uw_len);
+  // block for un_ms milliseconds
+  void (*delay_ms)(void *p_context, uint32_t un_ms);
+  // milliseconds since start, for timeouts
+  uint32_t (*millis)(void *p_context);
+  // true while the active-low INT pin is asserted, may be NULL
+  bool (*int_asserted)(void *p_context);
+} max30102_hal;
+
+#ifdef ARDUINO
+extern const max30102_hal max30102_wire_hal;
+#endif
+
+#endif /* MAX30102_HAL_H_ */
@@ -0,0 +1,112 @@
+/** \file max30102_temp.cpp ******************************************************
+*
+* Description: Non-blocking, cached die temperature, see max30102_temp.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "max30102_temp.h"
+#include "max30102.h"
+#include <string.h>
+
+static uint32_t temp_now_ms(void)
+{
+  const max30102_hal *p_hal = maxim_max30102_get_hal();
+  return p_hal != NULL ? p_hal->millis(p_hal->p_context) : 0;
+}
+
+bool max30102_temp_init(max30102_temp *ps_temp, uint32_t un_refresh_ms, bool b_interrupt)
+/**
+* \brief        Start the temperature service
+* \par          Details
+*               Sets or clears DIE_TEMP_RDY_EN in REG_INTR_ENABLE_2, keeping the other enables.
+*               The first conversion starts on the next max30102_temp_service().
+*
+* \param[in]    un_refresh_ms    - conversion interval
+* \param[in]    b_interrupt      - complete on DIE_TEMP_RDY (the FIFO reader must run on the INT pin)
+*
+* \retval       false if REG_INTR_ENABLE_2 could not be updated
+*/
+{
+  uint8_t uch_enable;
+
+  memset(ps_temp, 0, sizeof(*ps_temp));
+  ps_temp->un_refresh_ms = un_refresh_ms;
+  ps_temp->b_interrupt = b_interrupt;
+  if (!maxim_max30102_read_reg(REG_INTR_ENABLE_2, &uch_enable))
+    return false;
+  uch_enable = b_interrupt ? uch_enable | MAX30102_INT_DIE_TEMP_RDY : uch_enable & ~MAX30102_INT_DIE_TEMP_RDY;
+  return maxim_max30102_write_reg(REG_INTR_ENABLE_2, uch_enable);
+}
+
+bool max30102_temp_service(max30102_temp *ps_temp)
+/**
+* \brief        Advance the conversion, never blocks
+* \par          Details
+*               Starts a conversion when the cache is due, and collects it once DIE_TEMP_RDY
+*               was seen or a poll finds TEMP_EN cleared. Between those points it costs no
+*               bus traffic in interrupt mode and one TEMP_EN read per MAX30102_TEMP_POLL_MS
+*               in polled mode.
+*
+* \retval       true if the cache was updated by this call
+*/
+{
+  uint8_t auch_temp[REG_TEMP_FRACTION - REG_TEMP_INTEGER + 1], uch_config;
+  uint32_t un_now = temp_now_ms();
+
+  if (!ps_temp->b_busy) {
+    if (ps_temp->b_valid && un_now - ps_temp->un_started_ms < ps_temp->un_refresh_ms)
+      return false;
+    maxim_max30102_take_intr_status_2(); // a DIE_TEMP_RDY from before belongs to an older conversion
+    if (!maxim_max30102_write_reg(REG_TEMP_CONFIG, 0b0000000'1)) // TEMP_EN
+      return false;
+    ps_temp->b_busy = true;
+    ps_temp->b_timed_out = false;
+    ps_temp->un_started_ms = un_now;
+    ps_temp->un_next_poll_ms = un_now + (ps_temp->b_interrupt ? MAX30102_TEMP_TIMEOUT_MS : MAX30102_TEMP_CONVERSION_MS);
+    ps_temp->un_conversions++;
+    return false;
+  }
+
+  if (!ps_temp->b_interrupt || !(maxim_max30102_take_intr_status_2() & MAX30102_INT_DIE_TEMP_RDY)) {
+    if ((int32_t)(un_now - ps_temp->un_next_poll_ms) < 0)
+      return false;
+    if (ps_temp->b_interrupt && !ps_temp->b_timed_out) {
+      ps_temp->b_timed_out = true;
+      ps_temp->un_timeouts++;
+    }
+    ps_temp->un_next_poll_ms = un_now + MAX30102_TEMP_POLL_MS;
+    ps_temp->un_polls++;
+    if (!maxim_max30102_read_reg(REG_TEMP_CONFIG, &uch_config) || (uch_config & 0x01)) // TEMP_EN clears itself when done
+      return false;
+  }
+
+  if (!maxim_max30102_read_regs(REG_TEMP_INTEGER, auch_temp, sizeof(auch_temp)))
+    return false; // collected by the next poll
+  ps_temp->ch_integer = (int8_t)auch_temp[0];
+  ps_temp->uch_fraction = auch_temp[1] & 0x0F;
+  ps_temp->b_busy = false;
+  ps_temp->b_valid = true;
+  ps_temp->un_updated_ms = un_now;
+  return true;
+}
+
+bool max30102_temp_read(const max30102_temp *ps_temp, float *pf_celsius)
+/**
+* \brief        Cached die temperature, no bus access
+*
+* \retval       false until the first conversion completed
+*/
+{
+  if (!ps_temp->b_valid)
+    return false;
+  *pf_celsius = ps_temp->ch_integer + ps_temp->uch_fraction / 16.0f;
+  return true;
+}
+
+uint32_t max30102_temp_age_ms(const max30102_temp *ps_temp)
+/**
+* \retval       Time since the cached reading was collected
+*/
+{
+  return temp_now_ms() - ps_temp->un_updated_ms;
+}
@@ -0,0 +1,55 @@
+/** \file max30102_temp.h ******************************************************
+*
+* Description: Non-blocking, cached die temperature
+*
+* maxim_max30102_read_temperature() costs a register write, a 1 ms delay and
+* two reads, and still returns the previous conversion: the die takes ~29 ms.
+* The die temperature changes over minutes, so this service starts a
+* conversion every un_refresh_ms and keeps the result:
+*
+*  - interrupt: DIE_TEMP_RDY is enabled on the INT pin. The FIFO read that
+*    the pin triggers clears the status, the driver keeps the bit for
+*    maxim_max30102_take_intr_status_2(), and the service sees it without
+*    another bus transaction. If it does not arrive within
+*    MAX30102_TEMP_TIMEOUT_MS, TEMP_EN is polled instead.
+*  - polled: TEMP_EN, which clears itself when the conversion is done, is
+*    read once the conversion time has passed.
+*
+* Usage: max30102_temp_service() from loop(), max30102_temp_read() wherever
+* the temperature is needed; it never touches the bus. Call max30102_temp_init()
+* again after every maxim_max30102_init(), which clears REG_INTR_ENABLE_2.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef MAX30102_TEMP_H_
+#define MAX30102_TEMP_H_
+
+#include <stdint.h>
+
+#define MAX30102_TEMP_CONVERSION_MS 29 // TEMP_EN to DIE_TEMP_RDY, typical
+#define MAX30102_TEMP_TIMEOUT_MS 100   // no DIE_TEMP_RDY by then: poll
+#define MAX30102_TEMP_POLL_MS 5        // between TEMP_EN reads while polling
+
+typedef struct {
+  uint32_t un_refresh_ms;       // from one conversion start to the next
+  bool b_interrupt;             // completion from DIE_TEMP_RDY, else TEMP_EN is polled
+  bool b_busy;                  // conversion running
+  bool b_valid;                 // the cache holds a reading
+  bool b_timed_out;             // DIE_TEMP_RDY missed, polling this conversion
+  uint32_t un_started_ms;       // last TEMP_EN write
+  uint32_t un_next_poll_ms;
+  uint32_t un_updated_ms;       // when the cache was written
+  int8_t ch_integer;            // REG_TEMP_INTEGER, degrees C, two's complement
+  uint8_t uch_fraction;         // REG_TEMP_FRACTION, 1/16 degree C
+  // statistics
+  uint32_t un_conversions;
+  uint32_t un_polls;            // TEMP_EN reads
+  uint32_t un_timeouts;         // conversions DIE_TEMP_RDY did not report in time
+} max30102_temp;
+
+bool max30102_temp_init(max30102_temp *ps_temp, uint32_t un_refresh_ms, bool b_interrupt);
+bool max30102_temp_service(max30102_temp *ps_temp);
+bool max30102_temp_read(const max30102_temp *ps_temp, float *pf_celsius);
+uint32_t max30102_temp_age_ms(const max30102_temp *ps_temp);
+
+#endif /* MAX30102_TEMP_H_ */
@@ -0,0 +1,392 @@
+/** \file max30102_sim.cpp ******************************************************
+*
+* Description: Register level MAX30102 simulator, see max30102_sim.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "max30102_sim.h"
+#include <max30102.h>
+#include <math.h>
+#include <string.h>
+
+#define SIM_FIFO_MASK (MAX30102_SIM_FIFO_DEPTH - 1)
+#define SIM_INT_A_FULL 0x80
+#define SIM_INT_PPG_RDY 0x40
+#define SIM_INT_PWR_RDY 0x01
+#define SIM_INT_DIE_TEMP_RDY 0x02
+#define SIM_PART_ID 0x15
+#define SIM_REV_ID 0x03
+
+static const uint16_t auw_sim_sample_rate[8] = { 50, 100, 200, 400, 800, 1000, 1600, 3200 };
+static const float af_sim_full_scale_na[4] = { 2048.0f, 4096.0f, 8192.0f, 16384.0f };
+
+static uint8_t sim_mode(const max30102_sim *ps_sim)
+{
+  uint8_t uch_mode = ps_sim->auch_regs[REG_MODE_CONFIG];
+  if (uch_mode & 0xC0) // shutdown or reset in progress
+    return 0;
+  return uch_mode & 0x07;
+}
+
+static uint8_t sim_slots(const max30102_sim *ps_sim, uint8_t *puch_leds)
+/**
+* \brief        LEDs converted per sample, in FIFO order
+* \retval       Number of active slots (0 when not converting)
+*/
+{
+  uint8_t i, uch_slot, uch_count = 0;
+  switch (sim_mode(ps_sim)) {
+    case 2: // heart rate: red only
+      puch_leds[0] = MAX30102_SIM_LED_RED;
+      return 1;
+    case 3: // SpO2: red then IR
+      puch_leds[0] = MAX30102_SIM_LED_RED;
+      puch_leds[1] = MAX30102_SIM_LED_IR;
+      return 2;
+    case 7: // multi-LED: slots are taken in order up to the first disabled one
+      for (i = 0; i < MAX30102_SIM_SLOTS; i++) {
+        uch_slot = ps_sim->auch_regs[REG_MULTI_LED_CONTROL1 + i / 2] >> ((i & 1) * 4) & 0x07;
+        if (uch_slot != 1 && uch_slot != 2)
+          break;
+        puch_leds[uch_count++] = uch_slot == 1 ? MAX30102_SIM_LED_RED : MAX30102_SIM_LED_IR;
+      }
+      return uch_count;
+    default:
+      return 0;
+  }
+}
+
+static uint32_t sim_conversion_period_us(const max30102_sim *ps_sim)
+{
+  return 1000000u / auw_sim_sample_rate[(ps_sim->auch_regs[REG_SPO2_CONFIG] >> 2) & 0x07];
+}
+
+static uint8_t sim_average(const max30102_sim *ps_sim)
+{
+  uint8_t uch_ave = ps_sim->auch_regs[REG_FIFO_CONFIG] >> 5;
+  return uch_ave >= 5 ? 32 : 1 << uch_ave;
+}
+
+uint8_t max30102_sim_bytes_per_sample(const max30102_sim *ps_sim)
+{
+  uint8_t auch_leds[MAX30102_SIM_SLOTS];
+  return 3 * sim_slots(ps_sim, auch_leds);
+}
+
+uint32_t max30102_sim_sample_period_us(const max30102_sim *ps_sim)
+{
+  return sim_conversion_period_us(ps_sim) * sim_average(ps_sim);
+}
+
+static void sim_restart_conversions(max30102_sim *ps_sim)
+{
+  ps_sim->uch_average_count = 0;
+  memset(ps_sim->af_average, 0, sizeof(ps_sim->af_average));
+  ps_sim->ul_next_conversion_us = ps_sim->ul_now_us + sim_conversion_period_us(ps_sim);
+}
+
+static void sim_reset_registers(max30102_sim *ps_sim)
+{
+  memset(ps_sim->auch_regs, 0, sizeof(ps_sim->auch_regs));
+  ps_sim->auch_regs[REG_PART_ID] = SIM_PART_ID;
+  ps_sim->auch_regs[REG_REV_ID] = SIM_REV_ID;
+  ps_sim->uch_fifo_count = 0;
+  ps_sim->uch_byte_index = 0;
+  ps_sim->b_temp_busy = false;
+  sim_restart_conversions(ps_sim);
+}
+
+static void sim_push_sample(max30102_sim *ps_sim, const uint32_t *pun_values, uint8_t uch_slots)
+{
+  uint8_t *puch_regs = ps_sim->auch_regs;
+  uint8_t uch_wr, uch_a_full;
+
+  if (ps_sim->uch_fifo_count == MAX30102_SIM_FIFO_DEPTH) {
+    ps_sim->s_stats.un_samples_dropped++;
+    if (puch_regs[REG_OVERFLOW_COUNTER] < 0x1F)
+      puch_regs[REG_OVERFLOW_COUNTER]++;
+    if (!(puch_regs[REG_FIFO_CONFIG] & 0x10))
+      return; // no rollover: the new sample is lost
+    // rollover: the oldest sample is overwritten
+    puch_regs[REG_FIFO_READ_POINTER] = (puch_regs[REG_FIFO_READ_POINTER] + 1) & SIM_FIFO_MASK;
+    ps_sim->uch_fifo_count--;
+    ps_sim->uch_byte_index = 0;
+  }
+  uch_wr = puch_regs[REG_FIFO_WRITE_POINTER];
+  memcpy(ps_sim->aun_fifo[uch_wr], pun_values, uch_slots * sizeof(uint32_t));
+  ps_sim->aul_fifo_time_us[uch_wr] = ps_sim->ul_now_us;
+  puch_regs[REG_FIFO_WRITE_POINTER] = (uch_wr + 1) & SIM_FIFO_MASK;
+  ps_sim->uch_fifo_count++;
+  ps_sim->s_stats.un_samples_generated++;
+
+  puch_regs[REG_INTR_STATUS_1] |= SIM_INT_PPG_RDY;
+  uch_a_full = puch_regs[REG_FIFO_CONFIG] & 0x0F; // empty slots left when A_FULL fires
+  if (ps_sim->uch_fifo_count == MAX30102_SIM_FIFO_DEPTH - uch_a_full)
+    puch_regs[REG_INTR_STATUS_1] |= SIM_INT_A_FULL;
+}
+
+static void sim_convert(max30102_sim *ps_sim)
+{
+  uint8_t auch_leds[MAX30102_SIM_SLOTS];
+  uint32_t aun_values[MAX30102_SIM_SLOTS];
+  uint8_t uch_slots = sim_slots(ps_sim, auch_leds), uch_shift, i;
+  uint8_t uch_spo2 = ps_sim->auch_regs[REG_SPO2_CONFIG];
+  float f_full_scale = af_sim_full_scale_na[(uch_spo2 >> 5) & 0x03];
+  float f_current, f_ma, f_counts;
+  int32_t n_counts;
+
+  if (uch_slots == 0)
+    return;
+  uch_shift = 3 - (uch_spo2 & 0x03); // 15..18 bit resolution, left justified in 18 bits
+  for (i = 0; i < uch_slots; i++) {
+    f_ma = 0.2f * ps_sim->auch_regs[auch_leds[i] == MAX30102_SIM_LED_RED ? REG_LED1_PULSE_AMPLITUDE : REG_LED2_PULSE_AMPLITUDE];
+    f_current = ps_sim->source ? ps_sim->source(ps_sim->p_source_context, auch_leds[i], f_ma, ps_sim->ul_now_us) : 0.0f;
+    f_counts = f_current / f_full_scale * 262144.0f;
+    n_counts = f_counts < 0.0f ? 0 : f_counts > 262143.0f ? 262143 : (int32_t)f_counts;
+    ps_sim->af_average[i] += (float)(n_counts >> uch_shift << uch_shift);
+  }
+  if (++ps_sim->uch_average_count < sim_average(ps_sim))
+    return;
+  for (i = 0; i < uch_slots; i++) {
+    aun_values[i] = (uint32_t)(ps_sim->af_average[i] / ps_sim->uch_average_count) >> uch_shift << uch_shift;
+    ps_sim->af_average[i] = 0.0f;
+  }
+  ps_sim->uch_average_count = 0;
+  sim_push_sample(ps_sim, aun_values, uch_slots);
+}
+
+static void sim_finish_temperature(max30102_sim *ps_sim)
+{
+  float f_floor = floorf(ps_sim->f_die_temp_c);
+  ps_sim->auch_regs[REG_TEMP_INTEGER] = (uint8_t)(int8_t)f_floor; // two's complement
+  ps_sim->auch_regs[REG_TEMP_FRACTION] = (uint8_t)((ps_sim->f_die_temp_c - f_floor) * 16.0f) & 0x0F;
+  ps_sim->auch_regs[REG_TEMP_CONFIG] &= ~0x01; // TEMP_EN self clears
+  ps_sim->auch_regs[REG_INTR_STATUS_2] |= SIM_INT_DIE_TEMP_RDY;
+  ps_sim->b_temp_busy = false;
+}
+
+void max30102_sim_advance_us(max30102_sim *ps_sim, uint64_t ul_us)
+/**
+* \brief        Let simulated time pass
+* \par          Details
+*               Runs every conversion, reset and temperature event that falls inside the
+*               interval, in time order.
+*/
+{
+  uint64_t ul_end = ps_sim->ul_now_us + ul_us;
+  uint64_t ul_next;
+
+  for (;;) {
+    ul_next = ul_end;
+    if (sim_mode(ps_sim) != 0 && ps_sim->ul_next_conversion_us < ul_next)
+      ul_next = ps_sim->ul_next_conversion_us;
+    if ((ps_sim->auch_regs[REG_MODE_CONFIG] & 0x40) && ps_sim->ul_reset_done_us < ul_next)
+      ul_next = ps_sim->ul_reset_done_us;
+    if (ps_sim->b_temp_busy && ps_sim->ul_temp_done_us < ul_next)
+      ul_next = ps_sim->ul_temp_done_us;
+    if (ul_next >= ul_end)
+      break;
+    ps_sim->ul_now_us = ul_next;
+    if ((ps_sim->auch_regs[REG_MODE_CONFIG] & 0x40) && ps_sim->ul_reset_done_us == ul_next) {
+      ps_sim->auch_regs[REG_MODE_CONFIG] &= ~0x40;
+      sim_restart_conversions(ps_sim);
+    }
+    if (ps_sim->b_temp_busy && ps_sim->ul_temp_done_us == ul_next)
+      sim_finish_temperature(ps_sim);
+    if (sim_mode(ps_sim) != 0 && ps_sim->ul_next_conversion_us == ul_next) {
+      sim_convert(ps_sim);
+      ps_sim->ul_next_conversion_us += sim_conversion_period_us(ps_sim);
+    }
+  }
+  ps_sim->ul_now_us = ul_end;
+}
+
+bool max30102_sim_int_asserted(const max30102_sim *ps_sim)
+/**
+* \retval       true while the active-low INT pin is pulled low
+*/
+{
+  const uint8_t *puch_regs = ps_sim->auch_regs;
+  // PWR_RDY cannot be masked
+  return (puch_regs[REG_INTR_STATUS_1] & (puch_regs[REG_INTR_ENABLE_1] | SIM_INT_PWR_RDY))
+      || (puch_regs[REG_INTR_STATUS_2] & puch_regs[REG_INTR_ENABLE_2] & SIM_INT_DIE_TEMP_RDY);
+}
+
+static uint8_t sim_read_fifo_byte(max30102_sim *ps_sim, uint64_t ul_done_us)
+{
+  uint8_t *puch_regs = ps_sim->auch_regs;
+  uint8_t uch_rd = puch_regs[REG_FIFO_READ_POINTER];
+  uint8_t uch_bytes = max30102_sim_bytes_per_sample(ps_sim);
+  uint32_t un_value, un_latency;
+  uint8_t uch_byte;
+
+  puch_regs[REG_INTR_STATUS_1] &= ~(SIM_INT_A_FULL | SIM_INT_PPG_RDY);
+  if (ps_sim->uch_fifo_count == 0 || uch_bytes == 0) {
+    ps_sim->s_stats.un_fifo_underflows++;
+    return 0;
+  }
+  un_value = ps_sim->aun_fifo[uch_rd][ps_sim->uch_byte_index / 3];
+  uch_byte = (uint8_t)(un_value >> (8 * (2 - ps_sim->uch_byte_index % 3)));
+  if (++ps_sim->uch_byte_index == uch_bytes) {
+    // sample popped
+    ps_sim->uch_byte_index = 0;
+    ps_sim->uch_fifo_count--;
+    puch_regs[REG_FIFO_READ_POINTER] = (uch_rd + 1) & SIM_FIFO_MASK;
+    puch_regs[REG_OVERFLOW_COUNTER] = 0;
+    un_latency = (uint32_t)(ul_done_us - ps_sim->aul_fifo_time_us[uch_rd]);
+    ps_sim->s_stats.un_samples_read++;
+    ps_sim->s_stats.ul_latency_sum_us += un_latency;
+    if (un_latency > ps_sim->s_stats.un_latency_max_us)
+      ps_sim->s_stats.un_latency_max_us = un_latency;
+  }
+  return uch_byte;
+}
+
+static uint8_t sim_read_reg(max30102_sim *ps_sim, uint8_t uch_addr, uint64_t ul_done_us)
+{
+  uint8_t uch_value;
+  if (uch_addr == REG_FIFO_DATA)
+    return sim_read_fifo_byte(ps_sim, ul_done_us);
+  uch_value = ps_sim->auch_regs[uch_addr];
+  if (uch_addr == REG_INTR_STATUS_1 || uch_addr == REG_INTR_STATUS_2)
+    ps_sim->auch_regs[uch_addr] = 0; // cleared on read
+  return uch_value;
+}
+
+static void sim_write_reg(max30102_sim *ps_sim, uint8_t uch_addr, uint8_t uch_value)
+{
+  uint8_t *puch_regs = ps_sim->auch_regs;
+  switch (uch_addr) {
+    case REG_INTR_STATUS_1:
+    case REG_INTR_STATUS_2:
+    case REG_FIFO_DATA:
+    case REG_TEMP_INTEGER:
+    case REG_TEMP_FRACTION:
+    case REG_REV_ID:
+    case REG_PART_ID:
+      return; // read only
+    case REG_FIFO_WRITE_POINTER:
+    case REG_OVERFLOW_COUNTER:
+    case REG_FIFO_READ_POINTER:
+      puch_regs[uch_addr] = uch_value & SIM_FIFO_MASK;
+      ps_sim->uch_fifo_count = (puch_regs[REG_FIFO_WRITE_POINTER] - puch_regs[REG_FIFO_READ_POINTER]) & SIM_FIFO_MASK;
+      ps_sim->uch_byte_index = 0;
+      return;
+    case REG_MODE_CONFIG:
+      if (uch_value & 0x40) {
+        sim_reset_registers(ps_sim);
+        puch_regs[REG_MODE_CONFIG] = 0x40;
+        ps_sim->ul_reset_done_us = ps_sim->ul_now_us + MAX30102_SIM_RESET_US;
+        return;
+      }
+      puch_regs[uch_addr] = uch_value;
+      sim_restart_conversions(ps_sim);
+      return;
+    case REG_FIFO_CONFIG:
+    case REG_SPO2_CONFIG:
+      puch_regs[uch_addr] = uch_value;
+      sim_restart_conversions(ps_sim);
+      return;
+    case REG_TEMP_CONFIG:
+      puch_regs[uch_addr] = uch_value & 0x01;
+      if ((uch_value & 0x01) && !ps_sim->b_temp_busy) {
+        ps_sim->b_temp_busy = true;
+        ps_sim->ul_temp_done_us = ps_sim->ul_now_us + MAX30102_SIM_TEMP_US;
+      }
+      return;
+    default:
+      puch_regs[uch_addr] = uch_value;
+  }
+}
+
+static uint64_t sim_bus_us(const max30102_sim *ps_sim, uint32_t un_bytes, uint32_t un_starts)
+{
+  // 9 clocks per byte plus START/STOP
+  return ((uint64_t)(un_bytes * 9 + un_starts * 2) * 1000000u + ps_sim->un_i2c_hz - 1) / ps_sim->un_i2c_hz;
+}
+
+static bool sim_hal_write(void *p_context, uint8_t uch_addr, const uint8_t *puch_data, uint8_t uch_len)
+{
+  max30102_sim *ps_sim = (max30102_sim *)p_context;
+  uint64_t ul_bus = sim_bus_us(ps_sim, 2 + uch_len, 1); // address, register, data
+  uint8_t i;
+  ps_sim->s_stats.un_transactions++;
+  ps_sim->s_stats.un_bytes += 2 + uch_len;
+  max30102_sim_advance_us(ps_sim, ul_bus);
+  ps_sim->uch_reg_pointer = uch_addr;
+  for (i = 0; i < uch_len; i++) {
+    sim_write_reg(ps_sim, ps_sim->uch_reg_pointer, puch_data[i]);
+    if (ps_sim->uch_reg_pointer != REG_FIFO_DATA)
+      ps_sim->uch_reg_pointer++;
+  }
+  return true;
+}
+
+static bool sim_hal_read(void *p_context, uint8_t uch_addr, uint8_t *puch_data, uint16_t uw_len)
+{
+  max30102_sim *ps_sim = (max30102_sim *)p_context;
+  uint64_t ul_bus = sim_bus_us(ps_sim, 3 + uw_len, 2); // address, register, repeated start, address, data
+  uint16_t i;
+  ps_sim->s_stats.un_transactions += 2;
+  ps_sim->s_stats.un_bytes += 3 + uw_len;
+  // the register pointer is set during the first phase, data is clocked out after it
+  max30102_sim_advance_us(ps_sim, sim_bus_us(ps_sim, 2, 1));
+  ps_sim->uch_reg_pointer = uch_addr;
+  for (i = 0; i < uw_len; i++) {
+    puch_data[i] = sim_read_reg(ps_sim, ps_sim->uch_reg_pointer, ps_sim->ul_now_us + ul_bus);
+    if (ps_sim->uch_reg_pointer != REG_FIFO_DATA)
+      ps_sim->uch_reg_pointer++;
+  }
+  max30102_sim_advance_us(ps_sim, ul_bus - sim_bus_us(ps_sim, 2, 1));
+  return true;
+}
+
+static void sim_hal_delay_ms(void *p_context, uint32_t un_ms)
+{
+  max30102_sim_advance_us((max30102_sim *)p_context, (uint64_t)un_ms * 1000u);
+}
+
+static uint32_t sim_hal_millis(void *p_context)
+{
+  return (uint32_t)(((max30102_sim *)p_context)->ul_now_us / 1000u);
+}
+
+static bool sim_hal_int_asserted(void *p_context)
+{
+  return max30102_sim_int_asserted((const max30102_sim *)p_context);
+}
+
+void max30102_sim_init(max30102_sim *ps_sim, max30102_sim_source source, void *p_source_context)
+/**
+* \brief        Power up the simulated part
+* \par          Details
+*               Registers take their power-on values and PWR_RDY is raised.
+*
+* \param[out]   ps_sim             - simulator state
+* \param[in]    source             - optical front end, NULL reads zero photocurrent
+* \param[in]    p_source_context   - passed to source
+*/
+{
+  memset(ps_sim, 0, sizeof(*ps_sim));
+  ps_sim->un_i2c_hz = MAX30102_SIM_I2C_HZ;
+  ps_sim->f_die_temp_c = 30.0f;
+  ps_sim->source = source;
+  ps_sim->p_source_context = p_source_context;
+  sim_reset_registers(ps_sim);
+  ps_sim->auch_regs[REG_INTR_STATUS_1] = SIM_INT_PWR_RDY;
+}
+
+void max30102_sim_hal(max30102_sim *ps_sim, max30102_hal *ps_hal)
+/**
+* \brief        HAL that routes the driver to the simulator
+*/
+{
+  ps_hal->p_context = ps_sim;
+  ps_hal->uw_max_read = 0;
+  ps_hal->begin = NULL;
+  ps_hal->write = sim_hal_write;
+  ps_hal->read = sim_hal_read;
+  ps_hal->delay_ms = sim_hal_delay_ms;
+  ps_hal->millis = sim_hal_millis;
+  ps_hal->int_asserted = sim_hal_int_asserted;
+}
@@ -0,0 +1,78 @@
+/** \file max30102_sim.h ******************************************************
+*
+* Description: Register level MAX30102 simulator
+*
+* Models the parts of the MAX30102 the driver depends on:
+*  - register file with auto-increment (except REG_FIFO_DATA), PART_ID 0x15
+*  - soft reset (MODE_CONFIG bit 6) and PWR_RDY
+*  - 32 sample FIFO: write/read pointers, OVF_COUNTER, FIFO_ROLLOVER_EN, FIFO_A_FULL
+*  - SpO2 sample rate, SMP_AVE averaging, ADC range and pulse width (resolution)
+*  - heart rate, SpO2 and multi-LED modes with the matching bytes per sample
+*  - A_FULL, PPG_RDY, PWR_RDY and DIE_TEMP_RDY interrupts, cleared on status read;
+*    reading REG_FIFO_DATA also clears A_FULL and PPG_RDY
+*  - die temperature conversion (~29 ms)
+*
+* Time is simulated: I2C transactions advance the clock by their bus time and
+* delay_ms() by its argument, so a driver run against max30102_sim_hal() sees
+* the same FIFO fill levels it would on hardware. The optical front end is a
+* callback returning the photocurrent seen by each LED.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef MAX30102_SIM_H_
+#define MAX30102_SIM_H_
+
+#include <max30102_hal.h>
+
+#define MAX30102_SIM_FIFO_DEPTH 32
+#define MAX30102_SIM_SLOTS 4
+#define MAX30102_SIM_RESET_US 1000 // time until MODE_CONFIG.RESET reads back 0
+#define MAX30102_SIM_TEMP_US 29000 // die temperature conversion time
+#define MAX30102_SIM_I2C_HZ 400000
+
+#define MAX30102_SIM_LED_RED 0
+#define MAX30102_SIM_LED_IR 1
+
+// Photocurrent in nA seen when uch_led (MAX30102_SIM_LED_*) is pulsed with f_led_ma at ul_time_us
+typedef float (*max30102_sim_source)(void *p_context, uint8_t uch_led, float f_led_ma, uint64_t ul_time_us);
+
+typedef struct {
+  uint32_t un_transactions;      // I2C START conditions, repeated starts included
+  uint32_t un_bytes;             // bytes on the bus, address and register bytes included
+  uint32_t un_samples_generated; // samples pushed into the FIFO
+  uint32_t un_samples_read;      // samples completely read out of the FIFO
+  uint32_t un_samples_dropped;   // samples lost to a full FIFO (overwritten or discarded)
+  uint32_t un_fifo_underflows;   // FIFO_DATA bytes read while the FIFO was empty
+  uint64_t ul_latency_sum_us;    // sample pushed -> last byte read
+  uint32_t un_latency_max_us;
+} max30102_sim_stats;
+
+typedef struct {
+  uint8_t auch_regs[256];
+  uint32_t aun_fifo[MAX30102_SIM_FIFO_DEPTH][MAX30102_SIM_SLOTS];
+  uint64_t aul_fifo_time_us[MAX30102_SIM_FIFO_DEPTH];
+  uint8_t uch_fifo_count;
+  uint8_t uch_byte_index;        // next byte of the sample at FIFO_RD_PTR
+  uint8_t uch_reg_pointer;
+  uint64_t ul_now_us;
+  uint64_t ul_next_conversion_us;
+  uint64_t ul_reset_done_us;
+  uint64_t ul_temp_done_us;
+  bool b_temp_busy;
+  uint8_t uch_average_count;     // conversions accumulated towards the next FIFO sample
+  float af_average[MAX30102_SIM_SLOTS];
+  uint32_t un_i2c_hz;
+  float f_die_temp_c;
+  max30102_sim_source source;
+  void *p_source_context;
+  max30102_sim_stats s_stats;
+} max30102_sim;
+
+void max30102_sim_init(max30102_sim *ps_sim, max30102_sim_source source, void *p_source_context);
+void max30102_sim_hal(max30102_sim *ps_sim, max30102_hal *ps_hal);
+void max30102_sim_advance_us(max30102_sim *ps_sim, uint64_t ul_us);
+bool max30102_sim_int_asserted(const max30102_sim *ps_sim);
+uint8_t max30102_sim_bytes_per_sample(const max30102_sim *ps_sim);
+uint32_t max30102_sim_sample_period_us(const max30102_sim *ps_sim);
+
+#endif /* MAX30102_SIM_H_ */
@@ -0,0 +1,246 @@
+/** \file ppg_synth.cpp ******************************************************
+*
+* Description: Seeded synthetic PPG generator, see ppg_synth.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "ppg_synth.h"
+#include <math.h>
+#include <string.h>
+
+#define SYNTH_TWO_PI 6.28318531f
+#define SYNTH_MIN_RR_S 0.25f // 240 bpm
+#define SYNTH_MOTION_TAU_S 0.4f
+
+static uint32_t synth_rand(ppg_synth_state *ps_state) // xorshift32
+{
+  uint32_t x = ps_state->un_rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return ps_state->un_rng = x;
+}
+
+static float synth_uniform(ppg_synth_state *ps_state) // [-1, 1)
+{
+  return (int32_t)synth_rand(ps_state) * (1.0f / 2147483648.0f);
+}
+
+static float synth_gauss(ppg_synth_state *ps_state) // ~N(0, 1), Irwin-Hall with 4 terms
+{
+  return 0.8660254f * (synth_uniform(ps_state) + synth_uniform(ps_state) + synth_uniform(ps_state) + synth_uniform(ps_state));
+}
+
+static uint32_t synth_probability(float f_per_s, float f_fs) // per sample, scaled to 2^32
+{
+  float p = f_per_s / f_fs;
+  return p <= 0.0f ? 0 : p >= 1.0f ? 0xFFFFFFFFu : (uint32_t)(p * 4294967296.0f);
+}
+
+static void synth_next_beat(ppg_synth_state *ps_state)
+{
+  float f_rr = 60.0f / ps_state->s_cfg.f_hr_bpm + 0.001f * ps_state->s_cfg.f_hrv_ms * synth_gauss(ps_state);
+  if (f_rr < SYNTH_MIN_RR_S)
+    f_rr = SYNTH_MIN_RR_S;
+  ps_state->f_rr_s = f_rr;
+  ps_state->f_phase_step = 1.0f / (f_rr * ps_state->s_cfg.f_fs);
+  ps_state->ul_beats++;
+}
+
+static void synth_rotate(float *pf_c, float *pf_s, float f_rot_c, float f_rot_s)
+{
+  float f_c = *pf_c * f_rot_c - *pf_s * f_rot_s;
+  *pf_s = *pf_c * f_rot_s + *pf_s * f_rot_c;
+  *pf_c = f_c;
+}
+
+float ppg_synth_ratio_for_spo2(float f_spo2)
+/**
+* \brief        Red/IR ratio R that the RF calibration curve maps to f_spo2
+* \par          Details
+*               Root of -45.060 R^2 + 30.354 R + 94.845 = SpO2 on the falling branch. Targets
+*               above the top of the curve (~99.96 %) return its vertex.
+*/
+{
+  float f_disc = 30.354f * 30.354f + 4.0f * 45.060f * (94.845f - f_spo2);
+  if (f_disc < 0.0f)
+    f_disc = 0.0f;
+  return (30.354f + sqrtf(f_disc)) / (2.0f * 45.060f);
+}
+
+void ppg_synth_default_config(ppg_synth_config *ps_cfg)
+/**
+* \brief        Resting adult, finger on the sensor, as configured by maxim_max30102_init()
+*/
+{
+  memset(ps_cfg, 0, sizeof(*ps_cfg));
+  ps_cfg->un_seed = 1;
+  ps_cfg->f_fs = 25.0f;
+  ps_cfg->f_hr_bpm = 72.0f;
+  ps_cfg->f_hrv_ms = 30.0f;
+  ps_cfg->f_spo2 = 97.0f;
+  ps_cfg->f_ir_dc = 120000.0f;
+  ps_cfg->f_red_dc = 90000.0f;
+  ps_cfg->f_ir_perfusion = 0.02f;
+  ps_cfg->f_dicrotic = 0.35f;
+  ps_cfg->f_wander = 0.003f;
+  ps_cfg->f_wander_hz = 0.25f;
+  ps_cfg->f_noise = 30.0f;
+  ps_cfg->f_dropout_s = 0.2f;
+  ps_cfg->f_motion = 0.02f;
+  ps_cfg->un_adc_max = PPG_SYNTH_ADC_MAX;
+}
+
+void ppg_synth_init(ppg_synth_state *ps_state, const ppg_synth_config *ps_cfg)
+/**
+* \brief        Start a stream
+* \par          Details
+*               The configuration is copied; the stream depends only on it.
+*/
+{
+  int32_t i;
+  float f_phase, f_rot;
+
+  memset(ps_state, 0, sizeof(*ps_state));
+  ps_state->s_cfg = *ps_cfg;
+  ps_state->un_rng = ps_cfg->un_seed ? ps_cfg->un_seed : 0x9E3779B9u; // xorshift state must not be 0
+  ps_state->f_red_perfusion = ps_cfg->f_ir_perfusion * ppg_synth_ratio_for_spo2(ps_cfg->f_spo2);
+
+  // one beat: fast systolic upstroke, slower decay, dicrotic wave; 0 at the beat boundary
+  for (i = 0; i <= PPG_SYNTH_PULSE_TABLE; i++) {
+    f_phase = (float)i / PPG_SYNTH_PULSE_TABLE;
+    ps_state->af_pulse[i] = expf(-(f_phase - 0.18f) * (f_phase - 0.18f) / (2 * 0.07f * 0.07f))
+        + ps_cfg->f_dicrotic * expf(-(f_phase - 0.48f) * (f_phase - 0.48f) / (2 * 0.09f * 0.09f));
+  }
+  for (i = PPG_SYNTH_PULSE_TABLE; i >= 0; i--)
+    ps_state->af_pulse[i] -= ps_state->af_pulse[0];
+
+  f_rot = SYNTH_TWO_PI * ps_cfg->f_wander_hz / ps_cfg->f_fs;
+  ps_state->f_wander_rot_c = cosf(f_rot);
+  ps_state->f_wander_rot_s = sinf(f_rot);
+  ps_state->f_wander_c = 1.0f;
+  ps_state->f_motion_decay = expf(-1.0f / (SYNTH_MOTION_TAU_S * ps_cfg->f_fs));
+  ps_state->f_motion_c = 1.0f;
+  ps_state->f_motion_rot_c = 1.0f;
+  ps_state->un_motion_threshold = synth_probability(ps_cfg->f_motion_per_s, ps_cfg->f_fs);
+  ps_state->un_dropout_threshold = synth_probability(ps_cfg->f_dropout_per_s, ps_cfg->f_fs);
+  ps_state->f_phase = 0.5f * (synth_uniform(ps_state) + 1.0f);
+  synth_next_beat(ps_state);
+}
+
+bool ppg_synth_next(ppg_synth_state *ps_state, uint32_t *pun_red_led, uint32_t *pun_ir_led)
+/**
+* \brief        Generate one sample slot
+*
+* \param[out]   *pun_red_led    - red reading, 18 bit
+* \param[out]   *pun_ir_led     - IR reading, 18 bit
+*
+* \retval       false if the slot falls into a dropout; the outputs are not written
+*/
+{
+  const ppg_synth_config *ps_cfg = &ps_state->s_cfg;
+  float f_table, f_pulse, f_scale, f_red, f_ir, f_rot;
+  int32_t n_index;
+  bool b_saturated = false;
+
+  ps_state->ul_samples++;
+  // beat
+  ps_state->f_phase += ps_state->f_phase_step;
+  if (ps_state->f_phase >= 1.0f) {
+    ps_state->f_phase -= 1.0f;
+    synth_next_beat(ps_state);
+  }
+  f_table = ps_state->f_phase * PPG_SYNTH_PULSE_TABLE;
+  n_index = (int32_t)f_table;
+  f_pulse = ps_state->af_pulse[n_index] + (f_table - n_index) * (ps_state->af_pulse[n_index + 1] - ps_state->af_pulse[n_index]);
+
+  // baseline wander
+  synth_rotate(&ps_state->f_wander_c, &ps_state->f_wander_s, ps_state->f_wander_rot_c, ps_state->f_wander_rot_s);
+  if ((ps_state->ul_samples & 1023) == 0) { // keep the phasor on the unit circle
+    f_scale = 1.0f / sqrtf(ps_state->f_wander_c * ps_state->f_wander_c + ps_state->f_wander_s * ps_state->f_wander_s);
+    ps_state->f_wander_c *= f_scale;
+    ps_state->f_wander_s *= f_scale;
+  }
+  f_scale = 1.0f + ps_cfg->f_wander * ps_state->f_wander_s;
+
+  // motion: damped 0.5..3 Hz oscillation starting at random times
+  if (ps_state->un_motion_threshold && synth_rand(ps_state) < ps_state->un_motion_threshold) {
+    f_rot = SYNTH_TWO_PI * (1.75f + 1.25f * synth_uniform(ps_state)) / ps_cfg->f_fs;
+    ps_state->f_motion_rot_c = cosf(f_rot);
+    ps_state->f_motion_rot_s = sinf(f_rot);
+    ps_state->f_motion_c = 1.0f;
+    ps_state->f_motion_s = 0.0f;
+    ps_state->f_motion_amp = ps_cfg->f_motion * (0.5f + 0.5f * (synth_uniform(ps_state) + 1.0f));
+  }
+  if (ps_state->f_motion_amp != 0.0f) {
+    synth_rotate(&ps_state->f_motion_c, &ps_state->f_motion_s, ps_state->f_motion_rot_c, ps_state->f_motion_rot_s);
+    f_scale *= 1.0f + ps_state->f_motion_amp * ps_state->f_motion_s;
+    ps_state->f_motion_amp *= ps_state->f_motion_decay;
+    if (ps_state->f_motion_amp < 1e-6f)
+      ps_state->f_motion_amp = 0.0f;
+  }
+
+  // dropouts: the slot passes without a sample
+  if (ps_state->un_dropout_left == 0 && ps_state->un_dropout_threshold && synth_rand(ps_state) < ps_state->un_dropout_threshold)
+    ps_state->un_dropout_left = (uint32_t)(ps_cfg->f_dropout_s * ps_cfg->f_fs + 0.5f);
+  if (ps_state->un_dropout_left != 0) {
+    ps_state->un_dropout_left--;
+    ps_state->ul_dropped++;
+    return false;
+  }
+
+  f_red = ps_cfg->f_red_dc * (1.0f - ps_state->f_red_perfusion * f_pulse) * f_scale;
+  f_ir = ps_cfg->f_ir_dc * (1.0f - ps_cfg->f_ir_perfusion * f_pulse) * f_scale;
+  if (ps_cfg->f_noise != 0.0f) {
+    f_red += ps_cfg->f_noise * synth_gauss(ps_state);
+    f_ir += ps_cfg->f_noise * synth_gauss(ps_state);
+  }
+  if (f_red >= (float)ps_cfg->un_adc_max) {
+    f_red = (float)ps_cfg->un_adc_max;
+    b_saturated = true;
+  } else if (f_red <= 0.0f) {
+    f_red = 0.0f;
+    b_saturated = true;
+  }
+  if (f_ir >= (float)ps_cfg->un_adc_max) {
+    f_ir = (float)ps_cfg->un_adc_max;
+    b_saturated = true;
+  } else if (f_ir <= 0.0f) {
+    f_ir = 0.0f;
+    b_saturated = true;
+  }
+  if (b_saturated)
+    ps_state->ul_saturated++;
+  *pun_red_led = (uint32_t)(f_red + 0.5f) & PPG_SYNTH_ADC_MAX;
+  *pun_ir_led = (uint32_t)(f_ir + 0.5f) & PPG_SYNTH_ADC_MAX;
+  return true;
+}
+
+uint32_t ppg_synth_fill(ppg_synth_state *ps_state, uint32_t *pun_red_led, uint32_t *pun_ir_led, int32_t n_samples)
+/**
+* \brief        Fill both buffers with n_samples delivered samples
+* \par          Details
+*               Slots lost to dropouts are skipped, so the buffers hold a contiguous stream
+*               the way a reader that never saw the lost samples would.
+*
+* \retval       Number of slots skipped
+*/
+{
+  uint32_t un_skipped = 0;
+  int32_t k = 0;
+  while (k < n_samples) {
+    if (ppg_synth_next(ps_state, &pun_red_led[k], &pun_ir_led[k]))
+      k++;
+    else
+      un_skipped++;
+  }
+  return un_skipped;
+}
+
+float ppg_synth_heart_rate(const ppg_synth_state *ps_state)
+/**
+* \retval       Instantaneous heart rate of the current beat in bpm, the ground truth
+*/
+{
+  return 60.0f / ps_state->f_rr_s;
+}
@@ -0,0 +1,77 @@
+/** \file ppg_synth.h ******************************************************
+*
+* Description: Seeded synthetic PPG generator
+*
+* Produces 18-bit red/IR pairs as maxim_max30102_read_fifo() returns them.
+* Every sample is
+*
+*   dc * (1 - pi * pulse(phase)) * (1 + wander) * (1 + motion) + white noise
+*
+* clamped to un_adc_max, where pulse() is a systolic peak with a dicrotic
+* wave (0..1), pi the perfusion index (AC/DC) of each channel and phase
+* advances one beat per RR interval. RR intervals are 60/f_hr_bpm with
+* gaussian jitter of f_hrv_ms. The red perfusion index is the IR one times
+* the ratio R that the RF calibration curve
+*   SpO2 = -45.060 * R^2 + 30.354 * R + 94.845
+* maps to f_spo2, so an exact estimator reads back f_spo2.
+*
+* The same seed always gives the same stream. No libm calls per sample:
+* the pulse is tabulated and the wander and motion oscillators are rotated
+* phasors, so hours of data take well under a second.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef PPG_SYNTH_H_
+#define PPG_SYNTH_H_
+
+#include <stdint.h>
+
+#define PPG_SYNTH_ADC_MAX 0x3FFFF // 18 bit
+#define PPG_SYNTH_PULSE_TABLE 256
+
+typedef struct {
+  uint32_t un_seed;
+  float f_fs;                 // samples per second
+  float f_hr_bpm;             // mean heart rate
+  float f_hrv_ms;             // standard deviation of the RR interval
+  float f_spo2;               // target SpO2 in %, sets the red/IR AC/DC ratio
+  float f_ir_dc;              // IR DC level in ADC counts
+  float f_red_dc;             // red DC level in ADC counts
+  float f_ir_perfusion;       // IR AC/DC, 0.005 .. 0.05 on a finger
+  float f_dicrotic;           // dicrotic wave relative to the systolic peak, 0 for none
+  float f_wander;             // baseline wander amplitude, fraction of DC
+  float f_wander_hz;          // baseline wander frequency (respiration ~0.25 Hz)
+  float f_noise;              // white noise, ADC counts rms
+  float f_motion_per_s;       // mean motion artifacts per second (Poisson)
+  float f_motion;             // motion artifact amplitude, fraction of DC
+  float f_dropout_per_s;      // mean dropouts per second (Poisson)
+  float f_dropout_s;          // samples are not delivered for this long
+  uint32_t un_adc_max;        // values are clamped here, lower it to force saturation
+} ppg_synth_config;
+
+typedef struct {
+  ppg_synth_config s_cfg;
+  uint32_t un_rng;
+  float f_phase;              // position in the current beat, 0..1
+  float f_phase_step;         // per sample, 1 / (RR * fs)
+  float f_rr_s;               // current RR interval
+  float f_red_perfusion;
+  float f_wander_c, f_wander_s, f_wander_rot_c, f_wander_rot_s;
+  float f_motion_amp, f_motion_decay, f_motion_c, f_motion_s, f_motion_rot_c, f_motion_rot_s;
+  uint32_t un_dropout_left;   // samples still to drop
+  uint32_t un_motion_threshold, un_dropout_threshold; // event probability per sample, scaled to 2^32
+  float af_pulse[PPG_SYNTH_PULSE_TABLE + 1];
+  uint64_t ul_samples;        // sample slots generated, delivered or not
+  uint64_t ul_dropped;
+  uint64_t ul_saturated;      // samples where either channel hit un_adc_max or 0
+  uint64_t ul_beats;
+} ppg_synth_state;
+
+void ppg_synth_default_config(ppg_synth_config *ps_cfg);
+void ppg_synth_init(ppg_synth_state *ps_state, const ppg_synth_config *ps_cfg);
+bool ppg_synth_next(ppg_synth_state *ps_state, uint32_t *pun_red_led, uint32_t *pun_ir_led);
+uint32_t ppg_synth_fill(ppg_synth_state *ps_state, uint32_t *pun_red_led, uint32_t *pun_ir_led, int32_t n_samples);
+float ppg_synth_heart_rate(const ppg_synth_state *ps_state);
+float ppg_synth_ratio_for_spo2(float f_spo2);
+
+#endif /* PPG_SYNTH_H_ */
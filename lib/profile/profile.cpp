@@ -0,0 +1,102 @@
+/** \file profile.cpp ******************************************************
+*
+* Description: Opt-in hot-path timing, see profile.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include <stdio.h>
+#include <string.h>
+
+uint32_t un_profile_counter = 0;
+static profile_histogram as_profile[PROFILE_STAGES];
+
+static const char *const as_profile_names[PROFILE_STAGES] = {
+  "window", "dc_removal", "detrend", "rms", "pcorrelation", "moments", "periodicity", "lags", "fifo_read", "i2c_read", "i2c_write", "init",
+};
+
+void profile_record(profile_stage e_stage, uint32_t un_ticks)
+/**
+* \brief        Add one duration (or count) to a stage
+*/
+{
+  profile_histogram *ps_hist = &as_profile[e_stage];
+  uint32_t k = un_ticks == 0 ? 0 : 32 - __builtin_clz(un_ticks);
+  ps_hist->un_count++;
+  ps_hist->ul_sum += un_ticks;
+  if (un_ticks > ps_hist->un_max)
+    ps_hist->un_max = un_ticks;
+  ps_hist->aun_buckets[k < PROFILE_BUCKETS ? k : PROFILE_BUCKETS - 1]++;
+}
+
+void profile_reset(void)
+{
+  memset(as_profile, 0, sizeof(as_profile));
+  un_profile_counter = 0;
+}
+
+const profile_histogram *profile_get(profile_stage e_stage)
+{
+  return &as_profile[e_stage];
+}
+
+uint32_t profile_percentile(profile_stage e_stage, float f_fraction)
+/**
+* \retval       Upper bound of the bucket holding the f_fraction quantile, in ticks,
+*               at most the largest value seen; 0 for a stage never recorded
+*/
+{
+  const profile_histogram *ps_hist = &as_profile[e_stage];
+  uint32_t un_seen = 0, k;
+  for (k = 0; k < PROFILE_BUCKETS; k++) {
+    un_seen += ps_hist->aun_buckets[k];
+    if (un_seen > 0 && un_seen >= f_fraction * ps_hist->un_count)
+      return k + 1 < PROFILE_BUCKETS && (1ul << k) < ps_hist->un_max ? (uint32_t)(1ul << k) : ps_hist->un_max;
+  }
+  return 0;
+}
+
+const char *profile_name(profile_stage e_stage)
+{
+  return e_stage < PROFILE_STAGES ? as_profile_names[e_stage] : "?";
+}
+
+const char *profile_unit(void)
+/**
+* \retval       What a tick is on this build
+*/
+{
+#if defined(ARDUINO_ARCH_ESP8266)
+  return "cycles";
+#elif defined(ARDUINO)
+  return "us";
+#else
+  return "ns";
+#endif
+}
+
+size_t profile_format(profile_stage e_stage, char *s_line, size_t un_len)
+/**
+* \brief        One report line: name, count, mean, p50, p99, max, tab separated
+* \par          Details
+*               Ticks, see profile_unit(), or lags for PROFILE_LAGS. Stages never recorded
+*               give an empty line.
+*
+* \retval       Characters written, as snprintf()
+*/
+{
+  const profile_histogram *ps_hist = &as_profile[e_stage];
+  if (ps_hist->un_count == 0) {
+    if (un_len > 0)
+      s_line[0] = '\0';
+    return 0;
+  }
+  return snprintf(s_line, un_len, "%s\t%lu\t%lu\t%lu\t%lu\t%lu", profile_name(e_stage), (unsigned long)ps_hist->un_count,
+      (unsigned long)(ps_hist->ul_sum / ps_hist->un_count), (unsigned long)profile_percentile(e_stage, 0.5f),
+      (unsigned long)profile_percentile(e_stage, 0.99f), (unsigned long)ps_hist->un_max);
+}
+
+#endif /* PROFILE */
@@ -0,0 +1,122 @@
+/** \file profile.h ******************************************************
+*
+* Description: Opt-in hot-path timing, per stage histograms
+*
+* Build with -DPROFILE to time the stages of an RF estimate and the driver's
+* bus calls. Without it every PROFILE_ macro expands to nothing: no clock
+* reads, no counters, no tables.
+*
+*   PROFILE_WINDOW        one estimate, whole: rf_heart_rate_and_oxygen_saturation_cfg(),
+*                         or rf_stream_push() / rf_packed_push() when they estimate
+*   PROFILE_DC_REMOVAL    means and their subtraction
+*   PROFILE_DETREND       rf_linear_regression_beta_n() and the subtraction
+*   PROFILE_RMS           rf_rms_n(), IR and red
+*   PROFILE_PCORRELATION  rf_Pcorrelation_n()
+*   PROFILE_MOMENTS       rf_sums_moments(): the stream paths get means, trend, RMS
+*                         and correlation from running sums instead of the four above
+*                         (rf_stream_push() still detrends IR, timed as PROFILE_DETREND)
+*   PROFILE_PERIODICITY   periodicity walks and SpO2, autocorrelations included
+*   PROFILE_LAGS          autocorrelation lags evaluated per window (a count)
+*   PROFILE_FIFO_READ     maxim_max30102_read_fifo() / _read_fifo_burst()
+*   PROFILE_I2C_READ      one register or FIFO read transaction
+*   PROFILE_I2C_WRITE     one register write transaction
+*   PROFILE_INIT          maxim_max30102_init()
+*
+* Stages nest: PROFILE_FIFO_READ contains its PROFILE_I2C_READs, the window
+* contains the rest. Ticks are CPU cycles on the ESP8266 (ESP.getCycleCount(),
+* 80 or 160 per us), microseconds on other Arduino cores and nanoseconds of
+* the steady clock on the host. A stage is a histogram of 32 log2 buckets,
+* bucket k counting durations below 2^k ticks, plus count, sum and max; that
+* is 144 bytes per stage and no allocation.
+*
+* The tables are global and not locked: profile one estimator thread.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+  PROFILE_WINDOW,
+  PROFILE_DC_REMOVAL,
+  PROFILE_DETREND,
+  PROFILE_RMS,
+  PROFILE_PCORRELATION,
+  PROFILE_MOMENTS,
+  PROFILE_PERIODICITY,
+  PROFILE_LAGS,
+  PROFILE_FIFO_READ,
+  PROFILE_I2C_READ,
+  PROFILE_I2C_WRITE,
+  PROFILE_INIT,
+  PROFILE_STAGES
+} profile_stage;
+
+#ifdef PROFILE
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+#define PROFILE_BUCKETS 32
+
+typedef struct {
+  uint32_t un_count;
+  uint32_t un_max;
+  uint64_t ul_sum;
+  uint32_t aun_buckets[PROFILE_BUCKETS]; // [k]: below 2^k ticks
+} profile_histogram;
+
+extern uint32_t un_profile_counter;
+
+static inline uint32_t profile_ticks()
+{
+#if defined(ARDUINO_ARCH_ESP8266)
+  return ESP.getCycleCount();
+#elif defined(ARDUINO)
+  return micros();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void profile_record(profile_stage e_stage, uint32_t un_ticks);
+void profile_reset(void);
+const profile_histogram *profile_get(profile_stage e_stage);
+uint32_t profile_percentile(profile_stage e_stage, float f_fraction);
+const char *profile_name(profile_stage e_stage);
+const char *profile_unit(void);
+size_t profile_format(profile_stage e_stage, char *s_line, size_t un_len);
+
+// Records the time from its construction to the end of the scope, for functions with several returns
+struct profile_scope {
+  profile_stage e_stage;
+  uint32_t un_start;
+  explicit profile_scope(profile_stage e_stage_) : e_stage(e_stage_), un_start(profile_ticks()) {}
+  ~profile_scope() { profile_record(e_stage, profile_ticks() - un_start); }
+};
+
+#define PROFILE_BEGIN(stage) const uint32_t un_profile_start_##stage = profile_ticks()
+#define PROFILE_END(stage) profile_record(stage, profile_ticks() - un_profile_start_##stage)
+#define PROFILE_SCOPE(stage) profile_scope s_profile_scope_##stage(stage)
+#define PROFILE_COUNT_BEGIN() (un_profile_counter = 0)
+#define PROFILE_COUNT(n) (un_profile_counter += (n))
+#define PROFILE_COUNT_END(stage) profile_record(stage, un_profile_counter)
+
+#else
+
+#define PROFILE_BEGIN(stage)
+#define PROFILE_END(stage)
+#define PROFILE_SCOPE(stage)
+#define PROFILE_COUNT_BEGIN()
+#define PROFILE_COUNT(n)
+#define PROFILE_COUNT_END(stage)
+
+#endif /* PROFILE */
+
+#endif /* PROFILE_H_ */
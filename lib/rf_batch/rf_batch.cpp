@@ -0,0 +1,919 @@
+/** \file rf_batch.cpp ******************************************************
+*
+* Description: Batched RF estimator for many streams on a host, see rf_batch.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "rf_batch.h"
+#include <math.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RF_BATCH_X86
+#define RF_BATCH_TARGET_AVX2 __attribute__((target("avx2")))
+#define RF_BATCH_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+#define RF_BATCH_ALL_LANES ((1u << RF_BATCH_LANES) - 1)
+#define RF_BATCH_MAX_JOBS 8            // accumulators in flight per kernel call
+#define RF_BATCH_UNROLL _Pragma("GCC unroll 8")
+
+typedef float rf_batch_lanes[RF_BATCH_LANES];
+
+/*
+ * A job is one vector of lanes: a column of the scratch arrays, row stride
+ * RF_BATCH_LANES, and where its results go. A kernel call runs up to
+ * RF_BATCH_MAX_JOBS jobs in one loop, so their sums are independent chains
+ * the CPU overlaps; each chain still adds in the scalar order.
+ */
+typedef struct {
+  float *pf_x;                         // lane 0 of the vector in sample 0
+  const float *pf_y;                   // the same for the second operand of rf_Pcorrelation()
+  float *pf_a;                         // per kernel: mean, beta, rms, Pearson sum
+  float *pf_b;                         // sum of squares of rf_rms()
+} rf_batch_job;
+
+typedef struct {
+  int32_t n_width;                     // lanes per job
+  void (*load)(float *pf_x, const uint32_t *const *apun_x, int32_t n_size);
+  void (*remove_dc)(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size);
+  void (*beta)(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size, float xmean, float sum_x2);
+  void (*detrend)(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size, float xmean);
+  void (*rms)(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size);
+  void (*pcorrelation)(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size);
+  // one vector, several lags: lag pn_lag[j] goes to apf_aut[j]
+  void (*autocorrelation)(const float *pf_x, const int32_t *pn_lag, int32_t n_lags, int32_t n_size, float *const *apf_aut);
+} rf_batch_kernels;
+
+static const uint32_t aun_batch_zero[BUFFER_SIZE] = { 0 };
+
+// -----------------------------------
+// Portable: the scalar loops of algorithmRF.cpp over 8 lanes at a time
+
+#define RF_BATCH_PORTABLE_WIDTH 8
+
+static void rf_batch_load_portable(float *pf_x, const uint32_t *const *apun_x, int32_t n_size)
+{
+  for (int32_t k = 0; k < n_size; ++k)
+    for (int32_t l = 0; l < RF_BATCH_LANES; ++l)
+      pf_x[k * RF_BATCH_LANES + l] = apun_x[l][k];
+}
+
+static void rf_batch_remove_dc_portable(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size)
+{
+  for (int32_t j = 0; j < n_jobs; j++) {
+    float *pf_x = ps_jobs[j].pf_x, af_mean[RF_BATCH_PORTABLE_WIDTH] = { 0.0f };
+    int32_t k, l;
+    for (k = 0; k < n_size; ++k)
+      for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+        af_mean[l] += pf_x[k * RF_BATCH_LANES + l];
+    for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+      ps_jobs[j].pf_a[l] = af_mean[l] = af_mean[l] / n_size;
+    for (k = 0; k < n_size; ++k)
+      for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+        pf_x[k * RF_BATCH_LANES + l] = pf_x[k * RF_BATCH_LANES + l] - af_mean[l];
+  }
+}
+
+static void rf_batch_beta_portable(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size, float xmean, float sum_x2)
+{
+  for (int32_t j = 0; j < n_jobs; j++) {
+    float af_beta[RF_BATCH_PORTABLE_WIDTH] = { 0.0f };
+    int32_t k, l;
+    for (k = 0; k < n_size; ++k)
+      for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+        af_beta[l] += (k - xmean) * ps_jobs[j].pf_x[k * RF_BATCH_LANES + l];
+    for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+      ps_jobs[j].pf_a[l] = af_beta[l] / sum_x2;
+  }
+}
+
+static void rf_batch_detrend_portable(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size, float xmean)
+{
+  for (int32_t j = 0; j < n_jobs; j++)
+    for (int32_t k = 0; k < n_size; ++k)
+      for (int32_t l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+        ps_jobs[j].pf_x[k * RF_BATCH_LANES + l] -= ps_jobs[j].pf_a[l] * (k - xmean);
+}
+
+static void rf_batch_rms_portable(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size)
+{
+  for (int32_t j = 0; j < n_jobs; j++) {
+    const float *pf_x = ps_jobs[j].pf_x;
+    float r[RF_BATCH_PORTABLE_WIDTH] = { 0.0f };
+    int32_t i, l;
+    for (i = 0; i < n_size; ++i)
+      for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+        r[l] += pf_x[i * RF_BATCH_LANES + l] * pf_x[i * RF_BATCH_LANES + l];
+    for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l) {
+      ps_jobs[j].pf_b[l] = r[l] / n_size;
+      ps_jobs[j].pf_a[l] = sqrtf(ps_jobs[j].pf_b[l]);
+    }
+  }
+}
+
+static void rf_batch_pcorrelation_portable(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size)
+{
+  for (int32_t j = 0; j < n_jobs; j++) {
+    float r[RF_BATCH_PORTABLE_WIDTH] = { 0.0f };
+    int32_t i, l;
+    for (i = 0; i < n_size; ++i)
+      for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+        r[l] += ps_jobs[j].pf_x[i * RF_BATCH_LANES + l] * ps_jobs[j].pf_y[i * RF_BATCH_LANES + l];
+    for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+      ps_jobs[j].pf_a[l] = r[l] / n_size;
+  }
+}
+
+static void rf_batch_autocorrelation_portable(const float *pf_x, const int32_t *pn_lag, int32_t n_lags, int32_t n_size, float *const *apf_aut)
+{
+  for (int32_t j = 0; j < n_lags; j++) {
+    int32_t i, l, n_temp = n_size - pn_lag[j], n_offset = pn_lag[j] * RF_BATCH_LANES;
+    float sum[RF_BATCH_PORTABLE_WIDTH] = { 0.0f };
+    for (i = 0; i < n_temp; ++i)
+      for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+        sum[l] += pf_x[i * RF_BATCH_LANES + l] * pf_x[i * RF_BATCH_LANES + n_offset + l];
+    for (l = 0; l < RF_BATCH_PORTABLE_WIDTH; ++l)
+      apf_aut[j][l] = n_temp <= 0 ? 0.0f : sum[l] / n_temp;
+  }
+}
+
+static const rf_batch_kernels s_portable = {
+  RF_BATCH_PORTABLE_WIDTH, rf_batch_load_portable, rf_batch_remove_dc_portable, rf_batch_beta_portable, rf_batch_detrend_portable,
+  rf_batch_rms_portable, rf_batch_pcorrelation_portable, rf_batch_autocorrelation_portable,
+};
+
+#ifdef RF_BATCH_X86
+// kernel<n>(...) for n = 1 .. RF_BATCH_MAX_JOBS
+#define RF_BATCH_SWITCH(n, kernel, ...)                                                  \
+  switch (n) {                                                                           \
+  case 1: kernel<1>(__VA_ARGS__); break;                                                 \
+  case 2: kernel<2>(__VA_ARGS__); break;                                                 \
+  case 3: kernel<3>(__VA_ARGS__); break;                                                 \
+  case 4: kernel<4>(__VA_ARGS__); break;                                                 \
+  case 5: kernel<5>(__VA_ARGS__); break;                                                 \
+  case 6: kernel<6>(__VA_ARGS__); break;                                                 \
+  case 7: kernel<7>(__VA_ARGS__); break;                                                 \
+  default: kernel<8>(__VA_ARGS__); break;                                                \
+  }
+
+// Runs the jobs in chunks of up to RF_BATCH_MAX_JOBS through kernel<J>
+#define RF_BATCH_CHUNKS(kernel, ps_jobs, n_jobs, ...)                                    \
+  for (int32_t n_chunk; n_jobs > 0; ps_jobs += n_chunk, n_jobs -= n_chunk) {             \
+    n_chunk = n_jobs < RF_BATCH_MAX_JOBS ? n_jobs : RF_BATCH_MAX_JOBS;                    \
+    RF_BATCH_SWITCH(n_chunk, kernel, ps_jobs, __VA_ARGS__)                                \
+  }
+
+// The same for the lags of rf_batch_kernels.autocorrelation
+#define RF_BATCH_LAG_CHUNKS(kernel, pf_x, pn_lag, n_lags, n_size, apf_aut)               \
+  for (int32_t n_chunk; n_lags > 0; pn_lag += n_chunk, apf_aut += n_chunk, n_lags -= n_chunk) { \
+    n_chunk = n_lags < RF_BATCH_MAX_JOBS ? n_lags : RF_BATCH_MAX_JOBS;                    \
+    RF_BATCH_SWITCH(n_chunk, kernel, pf_x, pn_lag, n_size, apf_aut)                       \
+  }
+
+// -----------------------------------
+// SSE2: 4 lanes per vector
+
+// uint32 to float as the scalar conversion rounds it: both halves are exact, the sum rounds once
+RF_BATCH_TARGET_SSE2 static inline __m128 rf_batch_u32_to_ps_sse2(__m128i v_u)
+{
+  __m128 v_hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v_u, 16)), _mm_set1_ps(65536.0f));
+  return _mm_add_ps(v_hi, _mm_cvtepi32_ps(_mm_and_si128(v_u, _mm_set1_epi32(0xFFFF))));
+}
+
+RF_BATCH_TARGET_SSE2 static void rf_batch_load_sse2(float *pf_x, const uint32_t *const *apun_x, int32_t n_size)
+{
+  for (int32_t g = 0; g < RF_BATCH_LANES; g += 4) {
+    const uint32_t *const *apun = apun_x + g;
+    int32_t k = 0;
+    for (; k + 4 <= n_size; k += 4) {
+      __m128 v0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(apun[0] + k)));
+      __m128 v1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(apun[1] + k)));
+      __m128 v2 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(apun[2] + k)));
+      __m128 v3 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(apun[3] + k)));
+      _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+      _mm_store_ps(pf_x + (k + 0) * RF_BATCH_LANES + g, rf_batch_u32_to_ps_sse2(_mm_castps_si128(v0)));
+      _mm_store_ps(pf_x + (k + 1) * RF_BATCH_LANES + g, rf_batch_u32_to_ps_sse2(_mm_castps_si128(v1)));
+      _mm_store_ps(pf_x + (k + 2) * RF_BATCH_LANES + g, rf_batch_u32_to_ps_sse2(_mm_castps_si128(v2)));
+      _mm_store_ps(pf_x + (k + 3) * RF_BATCH_LANES + g, rf_batch_u32_to_ps_sse2(_mm_castps_si128(v3)));
+    }
+    for (; k < n_size; ++k)
+      for (int32_t l = 0; l < 4; ++l)
+        pf_x[k * RF_BATCH_LANES + g + l] = apun[l][k];
+  }
+}
+
+template <int J>
+RF_BATCH_TARGET_SSE2 static void rf_batch_remove_dc_sse2_j(const rf_batch_job *ps_jobs, int32_t n_size)
+{
+  __m128 v_mean[J];
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    v_mean[j] = _mm_setzero_ps();
+  for (int32_t k = 0; k < n_size; ++k)
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+      v_mean[j] = _mm_add_ps(v_mean[j], _mm_load_ps(ps_jobs[j].pf_x + k * RF_BATCH_LANES));
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+    v_mean[j] = _mm_div_ps(v_mean[j], _mm_set1_ps((float)n_size));
+    _mm_storeu_ps(ps_jobs[j].pf_a, v_mean[j]);
+  }
+  for (int32_t k = 0; k < n_size; ++k)
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+      float *pf = ps_jobs[j].pf_x + k * RF_BATCH_LANES;
+      _mm_store_ps(pf, _mm_sub_ps(_mm_load_ps(pf), v_mean[j]));
+    }
+}
+
+template <int J>
+RF_BATCH_TARGET_SSE2 static void rf_batch_beta_sse2_j(const rf_batch_job *ps_jobs, int32_t n_size, float xmean, float sum_x2)
+{
+  __m128 v_beta[J], v_k;
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    v_beta[j] = _mm_setzero_ps();
+  for (int32_t k = 0; k < n_size; ++k) {
+    v_k = _mm_set1_ps(k - xmean);
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+      v_beta[j] = _mm_add_ps(v_beta[j], _mm_mul_ps(v_k, _mm_load_ps(ps_jobs[j].pf_x + k * RF_BATCH_LANES)));
+  }
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    _mm_storeu_ps(ps_jobs[j].pf_a, _mm_div_ps(v_beta[j], _mm_set1_ps(sum_x2)));
+}
+
+template <int J>
+RF_BATCH_TARGET_SSE2 static void rf_batch_detrend_sse2_j(const rf_batch_job *ps_jobs, int32_t n_size, float xmean)
+{
+  __m128 v_beta[J], v_k;
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    v_beta[j] = _mm_loadu_ps(ps_jobs[j].pf_a);
+  for (int32_t k = 0; k < n_size; ++k) {
+    v_k = _mm_set1_ps(k - xmean);
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+      float *pf = ps_jobs[j].pf_x + k * RF_BATCH_LANES;
+      _mm_store_ps(pf, _mm_sub_ps(_mm_load_ps(pf), _mm_mul_ps(v_beta[j], v_k)));
+    }
+  }
+}
+
+template <int J>
+RF_BATCH_TARGET_SSE2 static void rf_batch_rms_sse2_j(const rf_batch_job *ps_jobs, int32_t n_size)
+{
+  __m128 v_r[J], v_x;
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    v_r[j] = _mm_setzero_ps();
+  for (int32_t i = 0; i < n_size; ++i)
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+      v_x = _mm_load_ps(ps_jobs[j].pf_x + i * RF_BATCH_LANES);
+      v_r[j] = _mm_add_ps(v_r[j], _mm_mul_ps(v_x, v_x));
+    }
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+    v_r[j] = _mm_div_ps(v_r[j], _mm_set1_ps((float)n_size));
+    _mm_storeu_ps(ps_jobs[j].pf_b, v_r[j]);
+    _mm_storeu_ps(ps_jobs[j].pf_a, _mm_sqrt_ps(v_r[j]));
+  }
+}
+
+template <int J>
+RF_BATCH_TARGET_SSE2 static void rf_batch_pcorrelation_sse2_j(const rf_batch_job *ps_jobs, int32_t n_size)
+{
+  __m128 v_r[J];
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    v_r[j] = _mm_setzero_ps();
+  for (int32_t i = 0; i < n_size; ++i)
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+      v_r[j] = _mm_add_ps(v_r[j], _mm_mul_ps(_mm_load_ps(ps_jobs[j].pf_x + i * RF_BATCH_LANES), _mm_load_ps(ps_jobs[j].pf_y + i * RF_BATCH_LANES)));
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    _mm_storeu_ps(ps_jobs[j].pf_a, _mm_div_ps(v_r[j], _mm_set1_ps((float)n_size)));
+}
+
+template <int J>
+RF_BATCH_TARGET_SSE2 static void rf_batch_autocorrelation_sse2_j(const float *pf_x, const int32_t *pn_lag, int32_t n_size, float *const *apf_aut)
+{
+  __m128 v_sum[J], v_x;
+  int32_t an_temp[J], an_offset[J], n_common = n_size, i;
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+    v_sum[j] = _mm_setzero_ps();
+    an_temp[j] = n_size - pn_lag[j];
+    an_offset[j] = pn_lag[j] * RF_BATCH_LANES;
+    n_common = an_temp[j] < n_common ? an_temp[j] : n_common;
+  }
+  // all lags together as far as the largest one goes, then each on its own
+  for (i = 0; i < n_common; ++i) {
+    const float *pf = pf_x + i * RF_BATCH_LANES;
+    v_x = _mm_load_ps(pf);
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+      v_sum[j] = _mm_add_ps(v_sum[j], _mm_mul_ps(v_x, _mm_load_ps(pf + an_offset[j])));
+  }
+  for (int32_t j = 0; j < J; j++) {
+    for (i = n_common > 0 ? n_common : 0; i < an_temp[j]; ++i) {
+      const float *pf = pf_x + i * RF_BATCH_LANES;
+      v_sum[j] = _mm_add_ps(v_sum[j], _mm_mul_ps(_mm_load_ps(pf), _mm_load_ps(pf + an_offset[j])));
+    }
+    _mm_storeu_ps(apf_aut[j], an_temp[j] <= 0 ? _mm_setzero_ps() : _mm_div_ps(v_sum[j], _mm_set1_ps((float)an_temp[j])));
+  }
+}
+
+static void rf_batch_remove_dc_sse2(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size)
+{
+  RF_BATCH_CHUNKS(rf_batch_remove_dc_sse2_j, ps_jobs, n_jobs, n_size)
+}
+
+static void rf_batch_beta_sse2(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size, float xmean, float sum_x2)
+{
+  RF_BATCH_CHUNKS(rf_batch_beta_sse2_j, ps_jobs, n_jobs, n_size, xmean, sum_x2)
+}
+
+static void rf_batch_detrend_sse2(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size, float xmean)
+{
+  RF_BATCH_CHUNKS(rf_batch_detrend_sse2_j, ps_jobs, n_jobs, n_size, xmean)
+}
+
+static void rf_batch_rms_sse2(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size)
+{
+  RF_BATCH_CHUNKS(rf_batch_rms_sse2_j, ps_jobs, n_jobs, n_size)
+}
+
+static void rf_batch_pcorrelation_sse2(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size)
+{
+  RF_BATCH_CHUNKS(rf_batch_pcorrelation_sse2_j, ps_jobs, n_jobs, n_size)
+}
+
+static void rf_batch_autocorrelation_sse2(const float *pf_x, const int32_t *pn_lag, int32_t n_lags, int32_t n_size, float *const *apf_aut)
+{
+  RF_BATCH_LAG_CHUNKS(rf_batch_autocorrelation_sse2_j, pf_x, pn_lag, n_lags, n_size, apf_aut)
+}
+
+static const rf_batch_kernels s_sse2 = {
+  4, rf_batch_load_sse2, rf_batch_remove_dc_sse2, rf_batch_beta_sse2, rf_batch_detrend_sse2,
+  rf_batch_rms_sse2, rf_batch_pcorrelation_sse2, rf_batch_autocorrelation_sse2,
+};
+
+// -----------------------------------
+// AVX2: 8 lanes per vector
+
+RF_BATCH_TARGET_AVX2 static inline __m256 rf_batch_u32_to_ps_avx2(__m256i v_u)
+{
+  __m256 v_hi = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(v_u, 16)), _mm256_set1_ps(65536.0f));
+  return _mm256_add_ps(v_hi, _mm256_cvtepi32_ps(_mm256_and_si256(v_u, _mm256_set1_epi32(0xFFFF))));
+}
+
+RF_BATCH_TARGET_AVX2 static void rf_batch_load_avx2(float *pf_x, const uint32_t *const *apun_x, int32_t n_size)
+{
+  __m256i v[8], t[8];
+  int32_t r;
+  for (int32_t g = 0; g < RF_BATCH_LANES; g += 8) {
+    const uint32_t *const *apun = apun_x + g;
+    int32_t k = 0;
+    for (; k + 8 <= n_size; k += 8) {
+      // 8x8 transpose: rows are windows, columns samples k..k+7
+      RF_BATCH_UNROLL for (r = 0; r < 8; r++)
+        v[r] = _mm256_loadu_si256((const __m256i *)(apun[r] + k));
+      RF_BATCH_UNROLL for (r = 0; r < 8; r += 2) {
+        t[r] = _mm256_unpacklo_epi32(v[r], v[r + 1]);
+        t[r + 1] = _mm256_unpackhi_epi32(v[r], v[r + 1]);
+      }
+      RF_BATCH_UNROLL for (r = 0; r < 8; r += 4) {
+        v[r] = _mm256_unpacklo_epi64(t[r], t[r + 2]);
+        v[r + 1] = _mm256_unpackhi_epi64(t[r], t[r + 2]);
+        v[r + 2] = _mm256_unpacklo_epi64(t[r + 1], t[r + 3]);
+        v[r + 3] = _mm256_unpackhi_epi64(t[r + 1], t[r + 3]);
+      }
+      RF_BATCH_UNROLL for (r = 0; r < 4; r++) {
+        t[r] = _mm256_permute2x128_si256(v[r], v[r + 4], 0x20);
+        t[r + 4] = _mm256_permute2x128_si256(v[r], v[r + 4], 0x31);
+      }
+      RF_BATCH_UNROLL for (r = 0; r < 8; r++)
+        _mm256_store_ps(pf_x + (k + r) * RF_BATCH_LANES + g, rf_batch_u32_to_ps_avx2(t[r]));
+    }
+    for (; k < n_size; ++k)
+      for (int32_t l = 0; l < 8; ++l)
+        pf_x[k * RF_BATCH_LANES + g + l] = apun[l][k];
+  }
+}
+
+template <int J>
+RF_BATCH_TARGET_AVX2 static void rf_batch_remove_dc_avx2_j(const rf_batch_job *ps_jobs, int32_t n_size)
+{
+  __m256 v_mean[J];
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    v_mean[j] = _mm256_setzero_ps();
+  for (int32_t k = 0; k < n_size; ++k)
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+      v_mean[j] = _mm256_add_ps(v_mean[j], _mm256_load_ps(ps_jobs[j].pf_x + k * RF_BATCH_LANES));
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+    v_mean[j] = _mm256_div_ps(v_mean[j], _mm256_set1_ps((float)n_size));
+    _mm256_storeu_ps(ps_jobs[j].pf_a, v_mean[j]);
+  }
+  for (int32_t k = 0; k < n_size; ++k)
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+      float *pf = ps_jobs[j].pf_x + k * RF_BATCH_LANES;
+      _mm256_store_ps(pf, _mm256_sub_ps(_mm256_load_ps(pf), v_mean[j]));
+    }
+}
+
+template <int J>
+RF_BATCH_TARGET_AVX2 static void rf_batch_beta_avx2_j(const rf_batch_job *ps_jobs, int32_t n_size, float xmean, float sum_x2)
+{
+  __m256 v_beta[J], v_k;
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    v_beta[j] = _mm256_setzero_ps();
+  for (int32_t k = 0; k < n_size; ++k) {
+    v_k = _mm256_set1_ps(k - xmean);
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+      v_beta[j] = _mm256_add_ps(v_beta[j], _mm256_mul_ps(v_k, _mm256_load_ps(ps_jobs[j].pf_x + k * RF_BATCH_LANES)));
+  }
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    _mm256_storeu_ps(ps_jobs[j].pf_a, _mm256_div_ps(v_beta[j], _mm256_set1_ps(sum_x2)));
+}
+
+template <int J>
+RF_BATCH_TARGET_AVX2 static void rf_batch_detrend_avx2_j(const rf_batch_job *ps_jobs, int32_t n_size, float xmean)
+{
+  __m256 v_beta[J], v_k;
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    v_beta[j] = _mm256_loadu_ps(ps_jobs[j].pf_a);
+  for (int32_t k = 0; k < n_size; ++k) {
+    v_k = _mm256_set1_ps(k - xmean);
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+      float *pf = ps_jobs[j].pf_x + k * RF_BATCH_LANES;
+      _mm256_store_ps(pf, _mm256_sub_ps(_mm256_load_ps(pf), _mm256_mul_ps(v_beta[j], v_k)));
+    }
+  }
+}
+
+template <int J>
+RF_BATCH_TARGET_AVX2 static void rf_batch_rms_avx2_j(const rf_batch_job *ps_jobs, int32_t n_size)
+{
+  __m256 v_r[J], v_x;
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    v_r[j] = _mm256_setzero_ps();
+  for (int32_t i = 0; i < n_size; ++i)
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+      v_x = _mm256_load_ps(ps_jobs[j].pf_x + i * RF_BATCH_LANES);
+      v_r[j] = _mm256_add_ps(v_r[j], _mm256_mul_ps(v_x, v_x));
+    }
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+    v_r[j] = _mm256_div_ps(v_r[j], _mm256_set1_ps((float)n_size));
+    _mm256_storeu_ps(ps_jobs[j].pf_b, v_r[j]);
+    _mm256_storeu_ps(ps_jobs[j].pf_a, _mm256_sqrt_ps(v_r[j]));
+  }
+}
+
+template <int J>
+RF_BATCH_TARGET_AVX2 static void rf_batch_pcorrelation_avx2_j(const rf_batch_job *ps_jobs, int32_t n_size)
+{
+  __m256 v_r[J];
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    v_r[j] = _mm256_setzero_ps();
+  for (int32_t i = 0; i < n_size; ++i)
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+      v_r[j] = _mm256_add_ps(v_r[j],
+          _mm256_mul_ps(_mm256_load_ps(ps_jobs[j].pf_x + i * RF_BATCH_LANES), _mm256_load_ps(ps_jobs[j].pf_y + i * RF_BATCH_LANES)));
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+    _mm256_storeu_ps(ps_jobs[j].pf_a, _mm256_div_ps(v_r[j], _mm256_set1_ps((float)n_size)));
+}
+
+template <int J>
+RF_BATCH_TARGET_AVX2 static void rf_batch_autocorrelation_avx2_j(const float *pf_x, const int32_t *pn_lag, int32_t n_size, float *const *apf_aut)
+{
+  __m256 v_sum[J], v_x;
+  int32_t an_temp[J], an_offset[J], n_common = n_size, i;
+  RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++) {
+    v_sum[j] = _mm256_setzero_ps();
+    an_temp[j] = n_size - pn_lag[j];
+    an_offset[j] = pn_lag[j] * RF_BATCH_LANES;
+    n_common = an_temp[j] < n_common ? an_temp[j] : n_common;
+  }
+  // all lags together as far as the largest one goes, then each on its own
+  for (i = 0; i < n_common; ++i) {
+    const float *pf = pf_x + i * RF_BATCH_LANES;
+    v_x = _mm256_load_ps(pf);
+    RF_BATCH_UNROLL for (int32_t j = 0; j < J; j++)
+      v_sum[j] = _mm256_add_ps(v_sum[j], _mm256_mul_ps(v_x, _mm256_load_ps(pf + an_offset[j])));
+  }
+  for (int32_t j = 0; j < J; j++) {
+    for (i = n_common > 0 ? n_common : 0; i < an_temp[j]; ++i) {
+      const float *pf = pf_x + i * RF_BATCH_LANES;
+      v_sum[j] = _mm256_add_ps(v_sum[j], _mm256_mul_ps(_mm256_load_ps(pf), _mm256_load_ps(pf + an_offset[j])));
+    }
+    _mm256_storeu_ps(apf_aut[j], an_temp[j] <= 0 ? _mm256_setzero_ps() : _mm256_div_ps(v_sum[j], _mm256_set1_ps((float)an_temp[j])));
+  }
+}
+
+static void rf_batch_remove_dc_avx2(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size)
+{
+  RF_BATCH_CHUNKS(rf_batch_remove_dc_avx2_j, ps_jobs, n_jobs, n_size)
+}
+
+static void rf_batch_beta_avx2(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size, float xmean, float sum_x2)
+{
+  RF_BATCH_CHUNKS(rf_batch_beta_avx2_j, ps_jobs, n_jobs, n_size, xmean, sum_x2)
+}
+
+static void rf_batch_detrend_avx2(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size, float xmean)
+{
+  RF_BATCH_CHUNKS(rf_batch_detrend_avx2_j, ps_jobs, n_jobs, n_size, xmean)
+}
+
+static void rf_batch_rms_avx2(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size)
+{
+  RF_BATCH_CHUNKS(rf_batch_rms_avx2_j, ps_jobs, n_jobs, n_size)
+}
+
+static void rf_batch_pcorrelation_avx2(const rf_batch_job *ps_jobs, int32_t n_jobs, int32_t n_size)
+{
+  RF_BATCH_CHUNKS(rf_batch_pcorrelation_avx2_j, ps_jobs, n_jobs, n_size)
+}
+
+static void rf_batch_autocorrelation_avx2(const float *pf_x, const int32_t *pn_lag, int32_t n_lags, int32_t n_size, float *const *apf_aut)
+{
+  RF_BATCH_LAG_CHUNKS(rf_batch_autocorrelation_avx2_j, pf_x, pn_lag, n_lags, n_size, apf_aut)
+}
+
+static const rf_batch_kernels s_avx2 = {
+  8, rf_batch_load_avx2, rf_batch_remove_dc_avx2, rf_batch_beta_avx2, rf_batch_detrend_avx2,
+  rf_batch_rms_avx2, rf_batch_pcorrelation_avx2, rf_batch_autocorrelation_avx2,
+};
+#endif
+
+// -----------------------------------
+// Dispatch
+
+static rf_batch_isa e_batch_isa = rf_batch_best_isa();
+
+static const rf_batch_kernels *rf_batch_kernels_for(rf_batch_isa e_isa)
+{
+  switch (e_isa) {
+#ifdef RF_BATCH_X86
+  case RF_BATCH_AVX2:
+    return &s_avx2;
+  case RF_BATCH_SSE2:
+    return &s_sse2;
+#endif
+  default:
+    return &s_portable;
+  }
+}
+
+rf_batch_isa rf_batch_best_isa()
+/**
+ * \brief        Widest instruction set this CPU runs
+ */
+{
+#ifdef RF_BATCH_X86
+  __builtin_cpu_init(); // may run before the libgcc constructor, see e_batch_isa
+  if (__builtin_cpu_supports("avx2"))
+    return RF_BATCH_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return RF_BATCH_SSE2;
+#endif
+  return RF_BATCH_PORTABLE;
+}
+
+bool rf_batch_set_isa(rf_batch_isa e_isa)
+/**
+ * \brief        Pick the kernels, rf_batch_best_isa() by default
+ * \par          Details
+ *               For comparisons; call it before any batch is running.
+ *
+ * \retval       false if the CPU cannot run them, the choice is unchanged
+ */
+{
+  if (e_isa > rf_batch_best_isa())
+    return false;
+  e_batch_isa = e_isa;
+  return true;
+}
+
+rf_batch_isa rf_batch_get_isa()
+{
+  return e_batch_isa;
+}
+
+const char *rf_batch_isa_name(rf_batch_isa e_isa)
+{
+  switch (e_isa) {
+  case RF_BATCH_AVX2:
+    return "avx2";
+  case RF_BATCH_SSE2:
+    return "sse2";
+  default:
+    return "portable";
+  }
+}
+
+static int32_t rf_batch_jobs(const rf_batch_kernels *ps_k, float (*paf_x)[RF_BATCH_LANES], const float (*paf_y)[RF_BATCH_LANES], uint32_t un_lanes,
+                             float *pf_a, float *pf_b, rf_batch_job *ps_jobs)
+/**
+ * \brief        One job per vector of lanes with any lane in un_lanes
+ * \retval       Number of jobs
+ */
+{
+  const uint32_t un_vector = (1u << ps_k->n_width) - 1;
+  int32_t n_jobs = 0;
+  for (int32_t g = 0; g < RF_BATCH_LANES; g += ps_k->n_width) {
+    if (!(un_lanes >> g & un_vector))
+      continue;
+    ps_jobs[n_jobs].pf_x = &paf_x[0][g];
+    ps_jobs[n_jobs].pf_y = paf_y != NULL ? &paf_y[0][g] : NULL;
+    ps_jobs[n_jobs].pf_a = pf_a != NULL ? pf_a + g : NULL;
+    ps_jobs[n_jobs].pf_b = pf_b != NULL ? pf_b + g : NULL;
+    n_jobs++;
+  }
+  return n_jobs;
+}
+
+// The kernels below read and write whole vectors: lanes outside un_lanes are left undefined
+
+void rf_batch_linear_regression_beta(const float (*paf_x)[RF_BATCH_LANES], int32_t n_size, float xmean, float sum_x2, uint32_t un_lanes,
+                                     float *pf_beta)
+{
+  const rf_batch_kernels *ps_k = rf_batch_kernels_for(e_batch_isa);
+  rf_batch_job as_jobs[RF_BATCH_LANES];
+  int32_t n_jobs = rf_batch_jobs(ps_k, (float(*)[RF_BATCH_LANES])paf_x, NULL, un_lanes, pf_beta, NULL, as_jobs);
+  ps_k->beta(as_jobs, n_jobs, n_size, xmean, sum_x2);
+}
+
+void rf_batch_autocorrelation(const float (*paf_x)[RF_BATCH_LANES], int32_t n_size, int32_t n_lag, uint32_t un_lanes, float *pf_aut)
+{
+  const rf_batch_kernels *ps_k = rf_batch_kernels_for(e_batch_isa);
+  const uint32_t un_vector = (1u << ps_k->n_width) - 1;
+  for (int32_t g = 0; g < RF_BATCH_LANES; g += ps_k->n_width) {
+    float *pf_out = pf_aut + g;
+    if (un_lanes >> g & un_vector)
+      ps_k->autocorrelation(&paf_x[0][g], &n_lag, 1, n_size, &pf_out);
+  }
+}
+
+void rf_batch_rms(const float (*paf_x)[RF_BATCH_LANES], int32_t n_size, uint32_t un_lanes, float *pf_rms, float *pf_sumsq)
+{
+  const rf_batch_kernels *ps_k = rf_batch_kernels_for(e_batch_isa);
+  rf_batch_job as_jobs[RF_BATCH_LANES];
+  int32_t n_jobs = rf_batch_jobs(ps_k, (float(*)[RF_BATCH_LANES])paf_x, NULL, un_lanes, pf_rms, pf_sumsq, as_jobs);
+  ps_k->rms(as_jobs, n_jobs, n_size);
+}
+
+void rf_batch_Pcorrelation(const float (*paf_x)[RF_BATCH_LANES], const float (*paf_y)[RF_BATCH_LANES], int32_t n_size, uint32_t un_lanes, float *pf_r)
+{
+  const rf_batch_kernels *ps_k = rf_batch_kernels_for(e_batch_isa);
+  rf_batch_job as_jobs[RF_BATCH_LANES];
+  int32_t n_jobs = rf_batch_jobs(ps_k, (float(*)[RF_BATCH_LANES])paf_x, paf_y, un_lanes, pf_r, NULL, as_jobs);
+  ps_k->pcorrelation(as_jobs, n_jobs, n_size);
+}
+
+// -----------------------------------
+// Periodicity walks, one state machine per lane
+
+typedef enum {
+  RF_WALK_INIT_FIRST,  // rf_initialize_periodicity_search_impl(): lag LOWEST_PERIOD
+  RF_WALK_INIT_DOWN,   // down to a local minimum while above min_autocorrelation_ratio
+  RF_WALK_INIT_UP,     // on until the ratio is reached again
+  RF_WALK_FIRST,       // rf_signal_periodicity_impl(): the last periodicity
+  RF_WALK_LEFT,
+  RF_WALK_RIGHT,
+  RF_WALK_DONE,
+} rf_walk_step;
+
+enum { RF_LAG_MISSING, RF_LAG_QUEUED, RF_LAG_READY };
+
+typedef struct {
+  rf_walk_step e_step;
+  int32_t n_lag;                       // the autocorrelation wanted next
+  float aut, aut_left, aut_right, aut_save;
+  bool b_left_limit;
+} rf_walk;
+
+static void rf_walk_start(rf_walk *ps_walk, int32_t n_last_peak_interval)
+{
+  ps_walk->n_lag = n_last_peak_interval;
+  ps_walk->e_step = n_last_peak_interval == LOWEST_PERIOD ? RF_WALK_INIT_FIRST : n_last_peak_interval != 0 ? RF_WALK_FIRST : RF_WALK_DONE;
+  ps_walk->b_left_limit = false;
+}
+
+static void rf_walk_end(rf_walk *ps_walk, int32_t *pn_last_peak_interval, float aut_lag0, float *pf_ratio)
+{
+  *pf_ratio = rf_aut_ratio(ps_walk->aut, aut_lag0);
+  if (*pf_ratio < min_autocorrelation_ratio)
+    ps_walk->n_lag = 0; // Indicates failure
+  *pn_last_peak_interval = ps_walk->n_lag;
+  ps_walk->e_step = RF_WALK_DONE;
+}
+
+static void rf_walk_next(rf_walk *ps_walk, float aut, int32_t *pn_last_peak_interval, float aut_lag0, float *pf_ratio)
+/**
+ * \brief        Feed the autocorrelation at ps_walk->n_lag, as the do-while loops of the walks would
+ * \par          Details
+ *               Leaves the next lag to evaluate in ps_walk->n_lag, or RF_WALK_DONE with
+ *               *pn_last_peak_interval set as the two scalar walks leave it.
+ */
+{
+  rf_walk *w = ps_walk;
+  switch (w->e_step) {
+  case RF_WALK_INIT_FIRST:
+    w->aut_right = w->aut = aut;
+    w->e_step = rf_aut_ratio(aut, aut_lag0) >= min_autocorrelation_ratio ? RF_WALK_INIT_DOWN : RF_WALK_INIT_UP;
+    w->aut = w->aut_right;
+    w->n_lag += 2;
+    return;
+  case RF_WALK_INIT_DOWN:
+    w->aut_right = aut;
+    if (rf_aut_ratio(w->aut_right, aut_lag0) >= min_autocorrelation_ratio && w->aut_right < w->aut && w->n_lag <= HIGHEST_PERIOD) {
+      w->aut = w->aut_right;
+      w->n_lag += 2;
+    } else if (w->n_lag > HIGHEST_PERIOD) {
+      *pn_last_peak_interval = 0;
+      w->e_step = RF_WALK_DONE;
+    } else {
+      w->aut = w->aut_right;
+      w->e_step = RF_WALK_INIT_UP;
+      w->n_lag += 2;
+    }
+    return;
+  case RF_WALK_INIT_UP:
+    w->aut_right = aut;
+    if (rf_aut_ratio(w->aut_right, aut_lag0) < min_autocorrelation_ratio && w->n_lag <= HIGHEST_PERIOD) {
+      w->aut = w->aut_right;
+      w->n_lag += 2;
+    } else if (w->n_lag > HIGHEST_PERIOD) {
+      *pn_last_peak_interval = 0;
+      w->e_step = RF_WALK_DONE;
+    } else {
+      *pn_last_peak_interval = w->n_lag;
+      w->e_step = RF_WALK_FIRST; // same lag
+    }
+    return;
+  case RF_WALK_FIRST:
+    w->aut_save = w->aut = aut;
+    w->aut_left = w->aut;
+    w->e_step = RF_WALK_LEFT;
+    w->aut = w->aut_left;
+    w->n_lag--;
+    return;
+  case RF_WALK_LEFT:
+    w->aut_left = aut;
+    if (w->aut_left > w->aut && w->n_lag >= LOWEST_PERIOD) {
+      w->aut = w->aut_left;
+      w->n_lag--;
+      return;
+    }
+    // Restore lag of the highest aut
+    if (w->n_lag < LOWEST_PERIOD) {
+      w->b_left_limit = true;
+      w->n_lag = *pn_last_peak_interval;
+      w->aut = w->aut_save;
+    } else
+      w->n_lag++;
+    if (w->n_lag != *pn_last_peak_interval) {
+      rf_walk_end(w, pn_last_peak_interval, aut_lag0, pf_ratio);
+      return;
+    }
+    // Trip to the left made no progress. Walk to the right.
+    w->aut_right = w->aut;
+    w->e_step = RF_WALK_RIGHT;
+    w->aut = w->aut_right;
+    w->n_lag++;
+    return;
+  case RF_WALK_RIGHT:
+    w->aut_right = aut;
+    if (w->aut_right > w->aut && w->n_lag <= HIGHEST_PERIOD) {
+      w->aut = w->aut_right;
+      w->n_lag++;
+      return;
+    }
+    if (w->n_lag > HIGHEST_PERIOD)
+      w->n_lag = 0; // Indicates failure
+    else
+      w->n_lag--;
+    if (w->n_lag == *pn_last_peak_interval && w->b_left_limit)
+      w->n_lag = 0; // Indicates failure
+    rf_walk_end(w, pn_last_peak_interval, aut_lag0, pf_ratio);
+    return;
+  default:
+    return;
+  }
+}
+
+void rf_batch_heart_rate_and_oxygen_saturation(rf_batch_scratch *ps_scratch, rf_channel_state *const *aps_channels, const uint32_t *const *apun_ir,
+                                               const uint32_t *const *apun_red, int32_t n_windows, rf_batch_result *as_results)
+/**
+ * \brief        rf_heart_rate_and_oxygen_saturation_r() for up to RF_BATCH_LANES windows
+ * \par          Details
+ *               Window l is apun_ir[l] and apun_red[l] (NULL for heart rate only), BUFFER_SIZE
+ *               samples each, estimated with the state *aps_channels[l]; the channels must be
+ *               different. Results and channel states are those of n_windows scalar calls;
+ *               as_results[l].f_ratio is 0 where the scalar call leaves *ratio alone.
+ *
+ * \retval       None
+ */
+{
+  const rf_batch_kernels *ps_k = rf_batch_kernels_for(e_batch_isa);
+  rf_batch_lanes *af_ir = ps_scratch->af_ir, *af_red = ps_scratch->af_red, *af_aut = ps_scratch->af_aut;
+  alignas(32) float af_ir_mean[RF_BATCH_LANES], af_red_mean[RF_BATCH_LANES], af_ir_beta[RF_BATCH_LANES], af_red_beta[RF_BATCH_LANES];
+  alignas(32) float af_ir_ac[RF_BATCH_LANES], af_red_ac[RF_BATCH_LANES], af_ir_sumsq[RF_BATCH_LANES], af_red_sumsq[RF_BATCH_LANES];
+  alignas(32) float af_r[RF_BATCH_LANES];
+  const uint32_t *apun_x[RF_BATCH_LANES];
+  rf_batch_job as_jobs[RF_BATCH_LANES / 2]; // IR and red vectors
+  rf_walk as_walk[RF_BATCH_LANES];
+  uint8_t auch_lag[BUFFER_SIZE];      // RF_LAG_* of each table row
+  int32_t an_lags[RF_BATCH_LANES];    // the lags of a pass, one per lane at most
+  float *apf_aut[RF_BATCH_LANES];
+  const uint32_t un_vector = (1u << ps_k->n_width) - 1;
+  uint32_t un_lanes, un_red = 0, un_walking = 0;
+  int32_t k, l, n_jobs, n_ir_jobs, n_lags;
+
+  if (n_windows <= 0)
+    return;
+  if (n_windows > RF_BATCH_LANES)
+    n_windows = RF_BATCH_LANES;
+  un_lanes = n_windows == RF_BATCH_LANES ? RF_BATCH_ALL_LANES : (1u << n_windows) - 1;
+
+  // transpose, lanes without a window or red samples read 0
+  for (l = 0; l < RF_BATCH_LANES; ++l)
+    apun_x[l] = l < n_windows ? apun_ir[l] : aun_batch_zero;
+  ps_k->load(&af_ir[0][0], apun_x, BUFFER_SIZE);
+  for (l = 0; l < RF_BATCH_LANES; ++l) {
+    apun_x[l] = l < n_windows && apun_red[l] != NULL ? apun_red[l] : aun_batch_zero;
+    un_red |= (apun_x[l] != aun_batch_zero) << l;
+  }
+  if (un_red != 0)
+    ps_k->load(&af_red[0][0], apun_x, BUFFER_SIZE);
+
+  // IR and red vectors run together: calculates DC mean and subtracts DC, removes the linear trend
+  n_ir_jobs = rf_batch_jobs(ps_k, af_ir, NULL, un_lanes, af_ir_mean, NULL, as_jobs);
+  n_jobs = n_ir_jobs + rf_batch_jobs(ps_k, af_red, NULL, un_red, af_red_mean, NULL, as_jobs + n_ir_jobs);
+  ps_k->remove_dc(as_jobs, n_jobs, BUFFER_SIZE);
+  rf_batch_jobs(ps_k, af_ir, NULL, un_lanes, af_ir_beta, NULL, as_jobs);
+  rf_batch_jobs(ps_k, af_red, NULL, un_red, af_red_beta, NULL, as_jobs + n_ir_jobs);
+  ps_k->beta(as_jobs, n_jobs, BUFFER_SIZE, mean_X, sum_X2);
+  ps_k->detrend(as_jobs, n_jobs, BUFFER_SIZE, mean_X);
+
+  // RMS of both AC signals, the raw sum of squares of IR for the pulse detector, Pearson correlation
+  rf_batch_jobs(ps_k, af_ir, NULL, un_lanes, af_ir_ac, af_ir_sumsq, as_jobs);
+  rf_batch_jobs(ps_k, af_red, NULL, un_red, af_red_ac, af_red_sumsq, as_jobs + n_ir_jobs);
+  ps_k->rms(as_jobs, n_jobs, BUFFER_SIZE);
+  n_jobs = rf_batch_jobs(ps_k, af_ir, af_red, un_red, af_r, NULL, as_jobs);
+  ps_k->pcorrelation(as_jobs, n_jobs, BUFFER_SIZE);
+
+  for (l = 0; l < n_windows; ++l) {
+    rf_batch_result *ps_result = &as_results[l];
+    if (un_red >> l & 1) {
+      ps_result->f_correl = af_r[l] / sqrtf(af_red_sumsq[l] * af_ir_sumsq[l]);
+    } else {
+      ps_result->f_correl = 1.0; // nothing for the IR signal to disagree with
+      af_red_mean[l] = 0.0f;
+      af_red_ac[l] = 0.0f;
+    }
+    ps_result->f_ratio = 0.0f;
+    if (ps_result->f_correl >= min_pearson_correlation)
+      rf_walk_start(&as_walk[l], aps_channels[l]->n_last_peak_interval);
+    else {
+      aps_channels[l]->n_last_peak_interval = 0;
+      as_walk[l].e_step = RF_WALK_DONE;
+    }
+    un_walking |= (as_walk[l].e_step != RF_WALK_DONE) << l;
+  }
+
+  // Periodicity: the lanes walk on while their lags are in the table, then every lag
+  // some lane waits for is added for all lanes in one pass per vector
+  memset(auch_lag, RF_LAG_MISSING, sizeof(auch_lag));
+  for (;;) {
+    n_lags = 0;
+    for (l = 0; l < n_windows; ++l) {
+      rf_walk *ps_walk = &as_walk[l];
+      if (!(un_walking >> l & 1))
+        continue;
+      while (ps_walk->e_step != RF_WALK_DONE && (ps_walk->n_lag < 0 || ps_walk->n_lag >= BUFFER_SIZE || auch_lag[ps_walk->n_lag] == RF_LAG_READY))
+        rf_walk_next(ps_walk, ps_walk->n_lag < 0 || ps_walk->n_lag >= BUFFER_SIZE ? 0.0f : af_aut[ps_walk->n_lag][l],
+            &aps_channels[l]->n_last_peak_interval, af_ir_sumsq[l], &as_results[l].f_ratio);
+      if (ps_walk->e_step == RF_WALK_DONE) {
+        un_walking &= ~(1u << l);
+        continue;
+      }
+      if (auch_lag[ps_walk->n_lag] == RF_LAG_QUEUED)
+        continue;
+      auch_lag[ps_walk->n_lag] = RF_LAG_QUEUED;
+      // ascending, so that the lags of a pass share the most samples
+      for (k = n_lags++; k > 0 && an_lags[k - 1] > ps_walk->n_lag; --k)
+        an_lags[k] = an_lags[k - 1];
+      an_lags[k] = ps_walk->n_lag;
+    }
+    if (n_lags == 0)
+      break;
+    for (int32_t g = 0; g < RF_BATCH_LANES; g += ps_k->n_width) {
+      if (!(un_walking >> g & un_vector))
+        continue;
+      for (k = 0; k < n_lags; ++k)
+        apf_aut[k] = &af_aut[an_lags[k]][g];
+      ps_k->autocorrelation(&af_ir[0][g], an_lags, n_lags, BUFFER_SIZE, apf_aut);
+    }
+    for (k = 0; k < n_lags; ++k)
+      auch_lag[an_lags[k]] = RF_LAG_READY;
+  }
+
+  for (l = 0; l < n_windows; ++l) {
+    rf_channel_state *ps_channel = aps_channels[l];
+    rf_batch_result *ps_result = &as_results[l];
+    rf_heart_rate_and_spo2_from_period<rf_default_config>(&ps_channel->n_last_peak_interval, af_ir_ac[l], af_red_ac[l], af_ir_mean[l],
+        af_red_mean[l], &ps_result->f_spo2, &ps_result->ch_spo2_valid, &ps_result->n_heart_rate, &ps_result->ch_hr_valid);
+    ps_channel->un_windows++;
+    ps_channel->un_valid_windows = ps_result->ch_hr_valid ? ps_channel->un_valid_windows + 1 : 0;
+  }
+}
@@ -0,0 +1,84 @@
+/** \file rf_batch.h ******************************************************
+*
+* Description: Batched RF estimator for many streams on a host
+*
+* Runs rf_heart_rate_and_oxygen_saturation_r() on up to RF_BATCH_LANES
+* windows of different streams at once. The windows are transposed into a
+* structure of arrays, sample k of window l at af_x[k][l], so one vector
+* instruction does the same step for 8 (AVX2) or 4 (SSE2) windows: a lane
+* is a window, not a run of samples of one window. Every lane therefore
+* performs exactly the scalar operation sequence, in the same order, and the
+* results are bit for bit those of the scalar estimator with the same
+* rf_channel_state.
+*
+* The DC removal, detrending, RMS and red/IR correlation are straight
+* vertical loops, IR and red vectors interleaved so that several sums are
+* in flight. The periodicity walks differ per window: each lane is a small
+* state machine mirroring rf_initialize_periodicity_search_impl() and
+* rf_signal_periodicity_impl(). The lanes still walking (a lane mask) take
+* their autocorrelations from a table by lag; each round adds every lag one
+* of them waits for, for all lanes at once, several lags per pass. Loading
+* the lagged samples of each lane's own lag instead takes a gather per
+* sample, which costs more than the lags the lanes share. Vectors without a
+* lane still walking are skipped.
+*
+* The kernels are picked at run time: AVX2 where the CPU has it, else SSE2,
+* else plain loops (also the only choice off x86). None of them contracts a
+* multiply and an add, so the match holds as long as the scalar build does
+* not either (no -mfma / -march=native with -ffp-contract=fast). The
+* RF_USE_FFT_AUTOCORRELATION build option is not mirrored: its walks read a
+* table with different rounding, compare against rf_heart_rate_and_oxygen_saturation_r()
+* built without it.
+*
+* Linux only; not part of the firmware.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef RF_BATCH_H_
+#define RF_BATCH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithmRF.h>
+
+#define RF_BATCH_LANES 16              // windows per call at most, two AVX2 vectors
+
+typedef enum {
+  RF_BATCH_PORTABLE,                   // plain loops over the lanes
+  RF_BATCH_SSE2,                       // 4 lanes per vector
+  RF_BATCH_AVX2,                       // 8 lanes per vector
+} rf_batch_isa;
+
+// Windows transposed, sample k of lane l at [k][l]; detrended in place
+typedef struct {
+  alignas(32) float af_ir[BUFFER_SIZE][RF_BATCH_LANES];
+  alignas(32) float af_red[BUFFER_SIZE][RF_BATCH_LANES];
+  alignas(32) float af_aut[BUFFER_SIZE][RF_BATCH_LANES]; // IR autocorrelation by lag, as the walks need it
+} rf_batch_scratch;
+
+typedef struct {
+  float f_spo2;
+  int8_t ch_spo2_valid;
+  int32_t n_heart_rate;
+  int8_t ch_hr_valid;
+  float f_ratio;                       // 0 when the periodicity walk did not run
+  float f_correl;
+} rf_batch_result;
+
+rf_batch_isa rf_batch_best_isa();
+bool rf_batch_set_isa(rf_batch_isa e_isa);
+rf_batch_isa rf_batch_get_isa();
+const char *rf_batch_isa_name(rf_batch_isa e_isa);
+
+void rf_batch_heart_rate_and_oxygen_saturation(rf_batch_scratch *ps_scratch, rf_channel_state *const *aps_channels, const uint32_t *const *apun_ir,
+                                               const uint32_t *const *apun_red, int32_t n_windows, rf_batch_result *as_results);
+
+// Kernels: the scalar ones of algorithmRF.cpp for every lane set in un_lanes, bit 0 = lane 0. They
+// work on whole vectors, so other lanes of the outputs are left undefined.
+void rf_batch_linear_regression_beta(const float (*paf_x)[RF_BATCH_LANES], int32_t n_size, float xmean, float sum_x2, uint32_t un_lanes,
+                                     float *pf_beta);
+void rf_batch_autocorrelation(const float (*paf_x)[RF_BATCH_LANES], int32_t n_size, int32_t n_lag, uint32_t un_lanes, float *pf_aut);
+void rf_batch_rms(const float (*paf_x)[RF_BATCH_LANES], int32_t n_size, uint32_t un_lanes, float *pf_rms, float *pf_sumsq);
+void rf_batch_Pcorrelation(const float (*paf_x)[RF_BATCH_LANES], const float (*paf_y)[RF_BATCH_LANES], int32_t n_size, uint32_t un_lanes, float *pf_r);
+
+#endif /* RF_BATCH_H_ */
@@ -0,0 +1,449 @@
+/** \file telemetry.cpp ******************************************************
+*
+* Description: Framed binary telemetry, see telemetry.h
+*
+* ------------------------------------------------------------------------- */
+
+#include "telemetry.h"
+#include <string.h>
+
+typedef struct {
+  uint8_t *puch_out;
+  size_t un_pos;
+  size_t un_code_pos;          // where the length code of the open block goes
+  uint8_t uch_code;
+} telemetry_cobs;
+
+static void telemetry_put16(uint8_t *puch, uint16_t uw_value)
+{
+  puch[0] = (uint8_t)uw_value;
+  puch[1] = (uint8_t)(uw_value >> 8);
+}
+
+static void telemetry_put32(uint8_t *puch, uint32_t un_value)
+{
+  puch[0] = (uint8_t)un_value;
+  puch[1] = (uint8_t)(un_value >> 8);
+  puch[2] = (uint8_t)(un_value >> 16);
+  puch[3] = (uint8_t)(un_value >> 24);
+}
+
+static uint16_t telemetry_get16(const uint8_t *puch)
+{
+  return (uint16_t)(puch[0] | (puch[1] << 8));
+}
+
+static uint32_t telemetry_get32(const uint8_t *puch)
+{
+  return (uint32_t)puch[0] | ((uint32_t)puch[1] << 8) | ((uint32_t)puch[2] << 16) | ((uint32_t)puch[3] << 24);
+}
+
+static int16_t telemetry_sat16(float f_value)
+{
+  if (f_value >= 32767.0f)
+    return 32767;
+  if (f_value <= -32768.0f)
+    return -32768;
+  return (int16_t)(f_value < 0.0f ? f_value - 0.5f : f_value + 0.5f);
+}
+
+static void telemetry_cobs_begin(telemetry_cobs *ps_cobs, uint8_t *puch_out)
+{
+  ps_cobs->puch_out = puch_out;
+  ps_cobs->un_code_pos = 0;
+  ps_cobs->un_pos = 1;
+  ps_cobs->uch_code = 1;
+}
+
+static void telemetry_cobs_put(telemetry_cobs *ps_cobs, const uint8_t *puch_in, size_t un_len)
+{
+  uint8_t *puch_out = ps_cobs->puch_out;
+  while (un_len--) {
+    uint8_t uch = *puch_in++;
+    if (uch != 0) {
+      puch_out[ps_cobs->un_pos++] = uch;
+      if (++ps_cobs->uch_code != 0xFF)
+        continue;
+    }
+    // a zero, or 254 bytes without one: close the block
+    puch_out[ps_cobs->un_code_pos] = ps_cobs->uch_code;
+    ps_cobs->un_code_pos = ps_cobs->un_pos++;
+    ps_cobs->uch_code = 1;
+  }
+}
+
+static size_t telemetry_cobs_end(telemetry_cobs *ps_cobs)
+{
+  ps_cobs->puch_out[ps_cobs->un_code_pos] = ps_cobs->uch_code;
+  return ps_cobs->un_pos;
+}
+
+size_t telemetry_cobs_encode(const uint8_t *puch_in, size_t un_len, uint8_t *puch_out)
+/**
+* \brief        Consistent overhead byte stuffing
+* \par          Details
+*               The output holds no 0x00 and is at most un_len + un_len / 254 + 1 bytes long.
+*               The delimiter is not appended.
+*/
+{
+  telemetry_cobs s_cobs;
+  telemetry_cobs_begin(&s_cobs, puch_out);
+  telemetry_cobs_put(&s_cobs, puch_in, un_len);
+  return telemetry_cobs_end(&s_cobs);
+}
+
+size_t telemetry_cobs_decode(const uint8_t *puch_in, size_t un_len, uint8_t *puch_out)
+/**
+* \brief        Undo telemetry_cobs_encode(), puch_out may be puch_in
+*
+* \retval       Decoded length, 0 if the input is not valid COBS
+*/
+{
+  size_t un_in = 0, un_out = 0;
+  uint8_t uch_code;
+
+  while (un_in < un_len) {
+    uch_code = puch_in[un_in++];
+    if (uch_code == 0 || un_in + uch_code - 1 > un_len)
+      return 0;
+    memmove(puch_out + un_out, puch_in + un_in, uch_code - 1);
+    un_in += uch_code - 1;
+    un_out += uch_code - 1;
+    if (uch_code != 0xFF && un_in < un_len)
+      puch_out[un_out++] = 0;
+  }
+  return un_out;
+}
+
+void telemetry_writer_init(telemetry_writer *ps_writer, telemetry_sink sink, void *p_context)
+{
+  memset(ps_writer, 0, sizeof(*ps_writer));
+  ps_writer->sink = sink;
+  ps_writer->p_context = p_context;
+}
+
+bool telemetry_write_frame(telemetry_writer *ps_writer, uint8_t uch_stream, const uint8_t *puch_payload, uint16_t uw_len)
+/**
+* \brief        Frame, encode and send one payload
+* \par          Details
+*               The very first frame is preceded by a delimiter, so anything the receiver
+*               saw before (boot messages, line noise) does not spoil it.
+*
+* \retval       false if the payload is too long or the sink failed
+*/
+{
+  uint8_t auch_header[TELEMETRY_HEADER_BYTES], auch_crc[TELEMETRY_CRC_BYTES];
+  uint16_t uw_sequence = 0;
+  uint32_t un_crc;
+  telemetry_cobs s_cobs;
+  size_t un_len;
+  bool b_ok;
+
+  if (uw_len > TELEMETRY_MAX_PAYLOAD)
+    return false;
+  if (uch_stream < TELEMETRY_STREAMS)
+    uw_sequence = ps_writer->auw_sequence[uch_stream]++;
+  auch_header[0] = uch_stream;
+  telemetry_put16(auch_header + 1, uw_sequence);
+  un_crc = capture_crc32(0, auch_header, sizeof(auch_header));
+  telemetry_put32(auch_crc, capture_crc32(un_crc, puch_payload, uw_len));
+
+  un_len = ps_writer->un_frames == 0 ? 1 : 0;
+  ps_writer->auch_encoded[0] = 0;
+  telemetry_cobs_begin(&s_cobs, ps_writer->auch_encoded + un_len);
+  telemetry_cobs_put(&s_cobs, auch_header, sizeof(auch_header));
+  telemetry_cobs_put(&s_cobs, puch_payload, uw_len);
+  telemetry_cobs_put(&s_cobs, auch_crc, sizeof(auch_crc));
+  un_len += telemetry_cobs_end(&s_cobs);
+  ps_writer->auch_encoded[un_len++] = 0;
+
+  b_ok = ps_writer->sink(ps_writer->p_context, ps_writer->auch_encoded, un_len);
+  ps_writer->un_frames++;
+  ps_writer->un_bytes += un_len;
+  ps_writer->b_error |= !b_ok;
+  return b_ok;
+}
+
+bool telemetry_write_config(telemetry_writer *ps_writer, const capture_config *ps_config)
+/**
+* \brief        Send the sensor configuration
+* \par          Details
+*               Buffered samples are flushed first, so the configuration applies to every
+*               sample sent after it.
+*/
+{
+  uint8_t auch_payload[CAPTURE_CONFIG_PAYLOAD_BYTES];
+  if (!telemetry_flush_samples(ps_writer))
+    return false;
+  capture_put_config(auch_payload, ps_config);
+  return telemetry_write_frame(ps_writer, TELEMETRY_STREAM_CONFIG, auch_payload, sizeof(auch_payload));
+}
+
+bool telemetry_write_sample(telemetry_writer *ps_writer, uint32_t un_red_led, uint32_t un_ir_led, uint32_t un_time_ms)
+/**
+* \brief        Append one red/IR pair
+* \par          Details
+*               A frame goes out every TELEMETRY_BLOCK_SAMPLES samples; other streams may be
+*               written in between.
+*
+* \param[in]    un_time_ms    - device time of the sample; only the first of each block is sent
+*
+* \retval       false if a frame could not be written
+*/
+{
+  uint8_t *puch_packed = ps_writer->auch_block + CAPTURE_DATA_HEADER_BYTES;
+  uint16_t uw_count = ps_writer->uw_count;
+
+  if (uw_count == 0) {
+    ps_writer->un_first_time_ms = un_time_ms;
+    memset(puch_packed, 0, CAPTURE_PACKED_BYTES(TELEMETRY_BLOCK_SAMPLES));
+  }
+  capture_pack_sample(puch_packed, uw_count, un_red_led, un_ir_led);
+  ps_writer->uw_count = uw_count + 1;
+  if (ps_writer->uw_count == TELEMETRY_BLOCK_SAMPLES)
+    return telemetry_flush_samples(ps_writer);
+  return true;
+}
+
+bool telemetry_flush_samples(telemetry_writer *ps_writer)
+/**
+* \brief        Send the buffered samples as a (short) block now
+*/
+{
+  uint8_t *puch = ps_writer->auch_block;
+  uint16_t uw_count = ps_writer->uw_count;
+  if (uw_count == 0)
+    return true;
+  telemetry_put32(puch, ps_writer->un_next_index);
+  telemetry_put32(puch + 4, ps_writer->un_first_time_ms);
+  telemetry_put16(puch + 8, uw_count);
+  ps_writer->un_next_index += uw_count;
+  ps_writer->uw_count = 0;
+  return telemetry_write_frame(ps_writer, TELEMETRY_STREAM_SAMPLES, puch, CAPTURE_DATA_HEADER_BYTES + CAPTURE_PACKED_BYTES(uw_count));
+}
+
+bool telemetry_write_result(telemetry_writer *ps_writer, const telemetry_result *ps_result)
+{
+  uint8_t auch_payload[TELEMETRY_RESULT_BYTES];
+  telemetry_put32(auch_payload, ps_result->un_time_ms);
+  telemetry_put32(auch_payload + 4, ps_result->un_sample_index);
+  telemetry_put16(auch_payload + 8, (uint16_t)ps_result->w_heart_rate);
+  telemetry_put16(auch_payload + 10, (uint16_t)ps_result->w_spo2_centi);
+  auch_payload[12] = ps_result->uch_flags;
+  telemetry_put16(auch_payload + 13, (uint16_t)ps_result->w_ratio_q15);
+  telemetry_put16(auch_payload + 15, (uint16_t)ps_result->w_correl_q15);
+  return telemetry_write_frame(ps_writer, TELEMETRY_STREAM_RESULT, auch_payload, sizeof(auch_payload));
+}
+
+bool telemetry_write_quality(telemetry_writer *ps_writer, const telemetry_quality *ps_quality)
+{
+  uint8_t auch_payload[TELEMETRY_QUALITY_BYTES];
+  telemetry_put32(auch_payload, ps_quality->un_time_ms);
+  auch_payload[4] = ps_quality->uch_led_red;
+  auch_payload[5] = ps_quality->uch_led_ir;
+  auch_payload[6] = ps_quality->uch_spo2_config;
+  auch_payload[7] = ps_quality->uch_mode;
+  telemetry_put32(auch_payload + 8, ps_quality->un_missed_interrupts);
+  telemetry_put32(auch_payload + 12, ps_quality->un_overruns);
+  return telemetry_write_frame(ps_writer, TELEMETRY_STREAM_QUALITY, auch_payload, sizeof(auch_payload));
+}
+
+bool telemetry_write_temperature(telemetry_writer *ps_writer, uint32_t un_time_ms, int8_t ch_integer, uint8_t uch_fraction)
+{
+  uint8_t auch_payload[TELEMETRY_TEMPERATURE_BYTES];
+  telemetry_put32(auch_payload, un_time_ms);
+  auch_payload[4] = (uint8_t)ch_integer;
+  auch_payload[5] = uch_fraction;
+  return telemetry_write_frame(ps_writer, TELEMETRY_STREAM_TEMPERATURE, auch_payload, sizeof(auch_payload));
+}
+
+bool telemetry_write_text(telemetry_writer *ps_writer, const char *s_text)
+/**
+* \brief        Send a message, truncated to TELEMETRY_MAX_PAYLOAD bytes
+*/
+{
+  size_t un_len = strlen(s_text);
+  if (un_len > TELEMETRY_MAX_PAYLOAD)
+    un_len = TELEMETRY_MAX_PAYLOAD;
+  return telemetry_write_frame(ps_writer, TELEMETRY_STREAM_TEXT, (const uint8_t *)s_text, (uint16_t)un_len);
+}
+
+void telemetry_result_from_estimate(telemetry_result *ps_result, uint32_t un_time_ms, uint32_t un_sample_index, float f_spo2, int8_t ch_spo2_valid,
+    int32_t n_heart_rate, int8_t ch_hr_valid, float f_ratio, float f_correl)
+/**
+* \brief        Fill a telemetry_result from the outputs of an estimator
+*/
+{
+  ps_result->un_time_ms = un_time_ms;
+  ps_result->un_sample_index = un_sample_index;
+  ps_result->w_heart_rate = telemetry_sat16((float)n_heart_rate);
+  ps_result->w_spo2_centi = telemetry_sat16(f_spo2 * 100.0f);
+  ps_result->uch_flags = (ch_hr_valid ? TELEMETRY_RESULT_HR_VALID : 0) | (ch_spo2_valid ? TELEMETRY_RESULT_SPO2_VALID : 0);
+  ps_result->w_ratio_q15 = telemetry_sat16(f_ratio * 32768.0f);
+  ps_result->w_correl_q15 = telemetry_sat16(f_correl * 32768.0f);
+}
+
+void telemetry_decoder_init(telemetry_decoder *ps_decoder)
+{
+  memset(ps_decoder, 0, sizeof(*ps_decoder));
+}
+
+static void telemetry_decode_frame(telemetry_decoder *ps_decoder, telemetry_handler handler, void *p_context)
+{
+  uint8_t *puch = ps_decoder->auch_buffer;
+  size_t un_len = telemetry_cobs_decode(puch, ps_decoder->uw_fill, puch);
+  telemetry_frame s_frame;
+  uint16_t uw_expected;
+  uint32_t un_index;
+
+  if (un_len < TELEMETRY_HEADER_BYTES + TELEMETRY_CRC_BYTES) {
+    ps_decoder->un_framing_errors++;
+    return;
+  }
+  un_len -= TELEMETRY_CRC_BYTES;
+  if (capture_crc32(0, puch, un_len) != telemetry_get32(puch + un_len)) {
+    ps_decoder->un_crc_errors++;
+    return;
+  }
+  s_frame.uch_stream = puch[0];
+  s_frame.uw_sequence = telemetry_get16(puch + 1);
+  s_frame.puch_payload = puch + TELEMETRY_HEADER_BYTES;
+  s_frame.uw_len = (uint16_t)(un_len - TELEMETRY_HEADER_BYTES);
+  ps_decoder->un_frames++;
+
+  if (s_frame.uch_stream < TELEMETRY_STREAMS) {
+    uw_expected = ps_decoder->auw_next_sequence[s_frame.uch_stream];
+    if (ps_decoder->auch_seen[s_frame.uch_stream] && s_frame.uw_sequence != uw_expected) {
+      if (s_frame.uw_sequence == 0 || (uint16_t)(s_frame.uw_sequence - uw_expected) >= 0x8000) {
+        // the device started over: so did its sample indices
+        ps_decoder->un_restarts++;
+        memset(ps_decoder->auch_seen, 0, sizeof(ps_decoder->auch_seen));
+        ps_decoder->b_samples_started = false;
+      } else
+        ps_decoder->un_lost_frames += (uint16_t)(s_frame.uw_sequence - uw_expected);
+    }
+    ps_decoder->auch_seen[s_frame.uch_stream] = 1;
+    ps_decoder->auw_next_sequence[s_frame.uch_stream] = s_frame.uw_sequence + 1;
+  }
+
+  if (s_frame.uch_stream == TELEMETRY_STREAM_SAMPLES && s_frame.uw_len >= CAPTURE_DATA_HEADER_BYTES) {
+    un_index = telemetry_get32(s_frame.puch_payload);
+    if (ps_decoder->b_samples_started && (int32_t)(un_index - ps_decoder->un_next_index) > 0)
+      ps_decoder->un_missing_samples += un_index - ps_decoder->un_next_index;
+    ps_decoder->un_next_index = un_index + telemetry_get16(s_frame.puch_payload + 8);
+    ps_decoder->b_samples_started = true;
+  }
+
+  if (handler != NULL)
+    handler(p_context, &s_frame);
+}
+
+void telemetry_decoder_push(telemetry_decoder *ps_decoder, const uint8_t *puch_data, size_t un_len, telemetry_handler handler, void *p_context)
+/**
+* \brief        Feed received bytes, in chunks of any size
+* \par          Details
+*               Calls the handler for every intact frame completed by these bytes. Damaged
+*               frames are counted and dropped; decoding continues at the next delimiter.
+*/
+{
+  const uint8_t *puch_end = puch_data + un_len;
+  const uint8_t *puch_zero;
+  size_t un_run;
+
+  ps_decoder->ul_bytes += un_len;
+  while (puch_data < puch_end) {
+    puch_zero = (const uint8_t *)memchr(puch_data, 0, puch_end - puch_data);
+    un_run = (puch_zero != NULL ? puch_zero : puch_end) - puch_data;
+    if (!ps_decoder->b_discard) {
+      if (ps_decoder->uw_fill + un_run > sizeof(ps_decoder->auch_buffer)) {
+        ps_decoder->un_framing_errors++;
+        ps_decoder->b_discard = true;
+        ps_decoder->uw_fill = 0;
+      } else {
+        memcpy(ps_decoder->auch_buffer + ps_decoder->uw_fill, puch_data, un_run);
+        ps_decoder->uw_fill += (uint16_t)un_run;
+      }
+    }
+    if (puch_zero == NULL)
+      return;
+    if (!ps_decoder->b_discard && ps_decoder->uw_fill > 0)
+      telemetry_decode_frame(ps_decoder, handler, p_context);
+    ps_decoder->uw_fill = 0;
+    ps_decoder->b_discard = false;
+    puch_data = puch_zero + 1;
+  }
+}
+
+bool telemetry_parse_samples(const telemetry_frame *ps_frame, capture_record *ps_record)
+/**
+* \brief        Unpack a TELEMETRY_STREAM_SAMPLES payload
+*
+* \retval       false for another stream or a payload that does not hold its sample count
+*/
+{
+  const uint8_t *puch = ps_frame->puch_payload;
+  uint16_t uw_count, i;
+
+  if (ps_frame->uch_stream != TELEMETRY_STREAM_SAMPLES || ps_frame->uw_len < CAPTURE_DATA_HEADER_BYTES)
+    return false;
+  uw_count = telemetry_get16(puch + 8);
+  if (uw_count > CAPTURE_CHUNK_SAMPLES || ps_frame->uw_len < CAPTURE_DATA_HEADER_BYTES + CAPTURE_PACKED_BYTES(uw_count))
+    return false;
+  ps_record->uch_type = CAPTURE_CHUNK_DATA;
+  ps_record->un_index = telemetry_get32(puch);
+  ps_record->un_time_ms = telemetry_get32(puch + 4);
+  ps_record->uw_count = uw_count;
+  for (i = 0; i < uw_count; i++)
+    capture_unpack_sample(puch + CAPTURE_DATA_HEADER_BYTES, i, &ps_record->aun_red[i], &ps_record->aun_ir[i]);
+  return true;
+}
+
+bool telemetry_parse_config(const telemetry_frame *ps_frame, capture_config *ps_config)
+{
+  if (ps_frame->uch_stream != TELEMETRY_STREAM_CONFIG)
+    return false;
+  return capture_get_config(ps_frame->puch_payload, ps_frame->uw_len, ps_config);
+}
+
+bool telemetry_parse_result(const telemetry_frame *ps_frame, telemetry_result *ps_result)
+/**
+* \retval       false for another stream or a short payload; newer versions may append fields
+*/
+{
+  const uint8_t *puch = ps_frame->puch_payload;
+  if (ps_frame->uch_stream != TELEMETRY_STREAM_RESULT || ps_frame->uw_len < TELEMETRY_RESULT_BYTES)
+    return false;
+  ps_result->un_time_ms = telemetry_get32(puch);
+  ps_result->un_sample_index = telemetry_get32(puch + 4);
+  ps_result->w_heart_rate = (int16_t)telemetry_get16(puch + 8);
+  ps_result->w_spo2_centi = (int16_t)telemetry_get16(puch + 10);
+  ps_result->uch_flags = puch[12];
+  ps_result->w_ratio_q15 = (int16_t)telemetry_get16(puch + 13);
+  ps_result->w_correl_q15 = (int16_t)telemetry_get16(puch + 15);
+  return true;
+}
+
+bool telemetry_parse_quality(const telemetry_frame *ps_frame, telemetry_quality *ps_quality)
+{
+  const uint8_t *puch = ps_frame->puch_payload;
+  if (ps_frame->uch_stream != TELEMETRY_STREAM_QUALITY || ps_frame->uw_len < TELEMETRY_QUALITY_BYTES)
+    return false;
+  ps_quality->un_time_ms = telemetry_get32(puch);
+  ps_quality->uch_led_red = puch[4];
+  ps_quality->uch_led_ir = puch[5];
+  ps_quality->uch_spo2_config = puch[6];
+  ps_quality->uch_mode = puch[7];
+  ps_quality->un_missed_interrupts = telemetry_get32(puch + 8);
+  ps_quality->un_overruns = telemetry_get32(puch + 12);
+  return true;
+}
+
+bool telemetry_parse_temperature(const telemetry_frame *ps_frame, uint32_t *pun_time_ms, float *pf_celsius)
+{
+  const uint8_t *puch = ps_frame->puch_payload;
+  if (ps_frame->uch_stream != TELEMETRY_STREAM_TEMPERATURE || ps_frame->uw_len < TELEMETRY_TEMPERATURE_BYTES)
+    return false;
+  *pun_time_ms = telemetry_get32(puch);
+  *pf_celsius = (int8_t)puch[4] + (puch[5] & 0x0F) / 16.0f;
+  return true;
+}
@@ -0,0 +1,148 @@
+/** \file telemetry.h ******************************************************
+*
+* Description: Framed binary telemetry, several streams on one UART
+*
+* Every frame is COBS encoded and ends with a 0x00 byte, so a receiver that
+* starts in the middle, or loses bytes, picks up again at the next frame:
+*
+*   offset  size  field (before COBS)
+*   0       1     stream, TELEMETRY_STREAM_*
+*   1       2     sequence number, per stream, little endian
+*   3       n     payload, n <= TELEMETRY_MAX_PAYLOAD
+*   3+n     4     CRC-32 (capture_crc32) over stream, sequence and payload
+*
+* Streams and their payloads, all fields little endian:
+*   TELEMETRY_STREAM_SAMPLES      the CAPTURE_CHUNK_DATA payload: u32 index of the
+*                                 first sample, u32 time ms, u16 count, 36-bit
+*                                 packed red/IR, at most TELEMETRY_BLOCK_SAMPLES
+*   TELEMETRY_STREAM_CONFIG       the CAPTURE_CHUNK_CONFIG payload
+*   TELEMETRY_STREAM_RESULT       telemetry_result, one per estimate
+*   TELEMETRY_STREAM_QUALITY      telemetry_quality, LED drive and acquisition health
+*   TELEMETRY_STREAM_TEMPERATURE  u32 time ms, i8 degrees C, u8 1/16 degree C
+*   TELEMETRY_STREAM_TEXT         free text, e.g. messages that used to be printed
+*
+* Sequence numbers show lost frames per stream, sample indices lost samples.
+* A sequence number of 0 on a stream that was further along means the device
+* restarted. Unknown streams are passed on, so newer devices still decode.
+*
+* The writer keeps one sample block plus one encoded frame (~370 bytes) and
+* hands each finished frame to a sink. The decoder takes bytes in chunks of any size.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <capture.h>
+
+#define TELEMETRY_STREAM_SAMPLES 1
+#define TELEMETRY_STREAM_CONFIG 2
+#define TELEMETRY_STREAM_RESULT 3
+#define TELEMETRY_STREAM_QUALITY 4
+#define TELEMETRY_STREAM_TEMPERATURE 5
+#define TELEMETRY_STREAM_TEXT 6
+#define TELEMETRY_STREAMS 8                // sequence numbers are tracked for streams below this
+
+#define TELEMETRY_BLOCK_SAMPLES 32         // one FIFO's worth per frame
+#define TELEMETRY_HEADER_BYTES 3
+#define TELEMETRY_CRC_BYTES 4
+#define TELEMETRY_MAX_PAYLOAD (CAPTURE_DATA_HEADER_BYTES + CAPTURE_PACKED_BYTES(TELEMETRY_BLOCK_SAMPLES))
+#define TELEMETRY_MAX_FRAME (TELEMETRY_HEADER_BYTES + TELEMETRY_MAX_PAYLOAD + TELEMETRY_CRC_BYTES)
+#define TELEMETRY_MAX_ENCODED (TELEMETRY_MAX_FRAME + TELEMETRY_MAX_FRAME / 254 + 3) // COBS overhead, delimiters
+#define TELEMETRY_RESULT_BYTES 17
+#define TELEMETRY_QUALITY_BYTES 16
+#define TELEMETRY_TEMPERATURE_BYTES 6
+
+#define TELEMETRY_RESULT_HR_VALID 0x01
+#define TELEMETRY_RESULT_SPO2_VALID 0x02
+
+typedef struct {
+  uint32_t un_time_ms;
+  uint32_t un_sample_index;    // index of the last sample in the window
+  int16_t w_heart_rate;        // bpm
+  int16_t w_spo2_centi;        // SpO2 in 0.01 %
+  uint8_t uch_flags;           // TELEMETRY_RESULT_*
+  int16_t w_ratio_q15;         // autocorrelation ratio, Q15, saturated
+  int16_t w_correl_q15;        // red/IR correlation, Q15, saturated
+} telemetry_result;
+
+typedef struct {
+  uint32_t un_time_ms;
+  uint8_t uch_led_red;         // REG_LED1_PULSE_AMPLITUDE
+  uint8_t uch_led_ir;          // REG_LED2_PULSE_AMPLITUDE
+  uint8_t uch_spo2_config;     // REG_SPO2_CONFIG
+  uint8_t uch_mode;            // MODE[2:0]
+  uint32_t un_missed_interrupts;
+  uint32_t un_overruns;
+} telemetry_quality;
+
+// Receives finished frames, delimiter included; returns false if the bytes could not be written
+typedef bool (*telemetry_sink)(void *p_context, const uint8_t *puch_data, size_t un_len);
+
+typedef struct {
+  telemetry_sink sink;
+  void *p_context;
+  uint16_t auw_sequence[TELEMETRY_STREAMS]; // next sequence number per stream
+  uint32_t un_next_index;      // index the next sample will get
+  uint32_t un_first_time_ms;   // timestamp of the first buffered sample
+  uint16_t uw_count;           // samples buffered
+  uint32_t un_frames;
+  uint32_t un_bytes;           // on the wire
+  bool b_error;                // the sink failed at least once
+  uint8_t auch_block[TELEMETRY_MAX_PAYLOAD];  // samples being collected
+  uint8_t auch_encoded[TELEMETRY_MAX_ENCODED]; // frame being sent
+} telemetry_writer;
+
+typedef struct {
+  uint8_t uch_stream;
+  uint16_t uw_sequence;
+  const uint8_t *puch_payload; // valid during the handler call only
+  uint16_t uw_len;
+} telemetry_frame;
+
+// Called for every intact frame, in order
+typedef void (*telemetry_handler)(void *p_context, const telemetry_frame *ps_frame);
+
+typedef struct {
+  uint32_t un_frames;          // intact frames
+  uint64_t ul_bytes;           // bytes pushed
+  uint32_t un_crc_errors;      // frames with a bad CRC
+  uint32_t un_framing_errors;  // invalid COBS, oversized or too short to be a frame
+  uint32_t un_lost_frames;     // sequence gaps over all streams
+  uint32_t un_missing_samples; // sample index gaps
+  uint32_t un_restarts;        // sequence numbers that started over
+  uint16_t auw_next_sequence[TELEMETRY_STREAMS];
+  uint8_t auch_seen[TELEMETRY_STREAMS];
+  uint32_t un_next_index;      // sample index expected next
+  bool b_samples_started;
+  bool b_discard;              // skipping to the next delimiter after an oversized frame
+  uint16_t uw_fill;
+  uint8_t auch_buffer[TELEMETRY_MAX_ENCODED];
+} telemetry_decoder;
+
+size_t telemetry_cobs_encode(const uint8_t *puch_in, size_t un_len, uint8_t *puch_out);
+size_t telemetry_cobs_decode(const uint8_t *puch_in, size_t un_len, uint8_t *puch_out);
+
+void telemetry_writer_init(telemetry_writer *ps_writer, telemetry_sink sink, void *p_context);
+bool telemetry_write_frame(telemetry_writer *ps_writer, uint8_t uch_stream, const uint8_t *puch_payload, uint16_t uw_len);
+bool telemetry_write_config(telemetry_writer *ps_writer, const capture_config *ps_config);
+bool telemetry_write_sample(telemetry_writer *ps_writer, uint32_t un_red_led, uint32_t un_ir_led, uint32_t un_time_ms);
+bool telemetry_flush_samples(telemetry_writer *ps_writer);
+bool telemetry_write_result(telemetry_writer *ps_writer, const telemetry_result *ps_result);
+bool telemetry_write_quality(telemetry_writer *ps_writer, const telemetry_quality *ps_quality);
+bool telemetry_write_temperature(telemetry_writer *ps_writer, uint32_t un_time_ms, int8_t ch_integer, uint8_t uch_fraction);
+bool telemetry_write_text(telemetry_writer *ps_writer, const char *s_text);
+void telemetry_result_from_estimate(telemetry_result *ps_result, uint32_t un_time_ms, uint32_t un_sample_index, float f_spo2, int8_t ch_spo2_valid,
+    int32_t n_heart_rate, int8_t ch_hr_valid, float f_ratio, float f_correl);
+
+void telemetry_decoder_init(telemetry_decoder *ps_decoder);
+void telemetry_decoder_push(telemetry_decoder *ps_decoder, const uint8_t *puch_data, size_t un_len, telemetry_handler handler, void *p_context);
+bool telemetry_parse_samples(const telemetry_frame *ps_frame, capture_record *ps_record);
+bool telemetry_parse_config(const telemetry_frame *ps_frame, capture_config *ps_config);
+bool telemetry_parse_result(const telemetry_frame *ps_frame, telemetry_result *ps_result);
+bool telemetry_parse_quality(const telemetry_frame *ps_frame, telemetry_quality *ps_quality);
+bool telemetry_parse_temperature(const telemetry_frame *ps_frame, uint32_t *pun_time_ms, float *pf_celsius);
+
+#endif /* TELEMETRY_H_ */
@@ -0,0 +1,524 @@
+/** \file uplink.cpp ******************************************************
+*
+* Description: Store-and-forward batched uplink, see uplink.h
+*
+* Store layout: UPLINK_RING_HEADER bytes of header, then a ring of records,
+* each a u16 batch length followed by the batch. Records wrap at the end of
+* the store. Header, all little endian:
+*
+*   0   4  UPLINK_RING_MAGIC
+*   4   4  head, 8 tail, 12 used bytes, 16 stored batches
+*   20  4  sequence numbers below this may have been used
+*   24  4  CRC-32 over bytes 0..23
+*
+* ------------------------------------------------------------------------- */
+
+#include "uplink.h"
+#include <string.h>
+
+#define UPLINK_RING_MAGIC 0x51504C55u  // "ULPQ"
+#define UPLINK_RING_HEADER_USED 28
+#define UPLINK_SEQUENCE_RESERVE 256    // batch sequence numbers claimed per header write
+
+static void uplink_put16(uint8_t *puch, uint16_t uw_value)
+{
+  puch[0] = (uint8_t)uw_value;
+  puch[1] = (uint8_t)(uw_value >> 8);
+}
+
+static void uplink_put32(uint8_t *puch, uint32_t un_value)
+{
+  puch[0] = (uint8_t)un_value;
+  puch[1] = (uint8_t)(un_value >> 8);
+  puch[2] = (uint8_t)(un_value >> 16);
+  puch[3] = (uint8_t)(un_value >> 24);
+}
+
+static uint16_t uplink_get16(const uint8_t *puch)
+{
+  return (uint16_t)(puch[0] | (puch[1] << 8));
+}
+
+static uint32_t uplink_get32(const uint8_t *puch)
+{
+  return (uint32_t)puch[0] | ((uint32_t)puch[1] << 8) | ((uint32_t)puch[2] << 16) | ((uint32_t)puch[3] << 24);
+}
+
+static uint32_t uplink_ring_size(const uplink_publisher *ps_pub)
+{
+  return ps_pub->s_store.un_size - UPLINK_RING_HEADER;
+}
+
+static bool uplink_ring_io(uplink_publisher *ps_pub, uint32_t un_offset, uint8_t *puch_data, uint16_t uw_len, bool b_write)
+// un_offset within the ring; splits at the wrap
+{
+  const uint32_t un_size = uplink_ring_size(ps_pub);
+  uint16_t uw_part;
+  bool b_ok = true;
+
+  while (uw_len > 0 && b_ok) {
+    uw_part = un_size - un_offset < uw_len ? (uint16_t)(un_size - un_offset) : uw_len;
+    if (b_write)
+      b_ok = ps_pub->s_store.write(ps_pub->s_store.p_context, UPLINK_RING_HEADER + un_offset, puch_data, uw_part);
+    else
+      b_ok = ps_pub->s_store.read(ps_pub->s_store.p_context, UPLINK_RING_HEADER + un_offset, puch_data, uw_part);
+    puch_data += uw_part;
+    uw_len -= uw_part;
+    un_offset = (un_offset + uw_part) % un_size;
+  }
+  ps_pub->s_stats.un_store_errors += !b_ok;
+  return b_ok;
+}
+
+static bool uplink_ring_commit(uplink_publisher *ps_pub)
+// the header is the commit point: record data is written before it
+{
+  uint8_t auch_header[UPLINK_RING_HEADER_USED];
+  bool b_ok;
+
+  uplink_put32(auch_header, UPLINK_RING_MAGIC);
+  uplink_put32(auch_header + 4, ps_pub->un_head);
+  uplink_put32(auch_header + 8, ps_pub->un_tail);
+  uplink_put32(auch_header + 12, ps_pub->un_used);
+  uplink_put32(auch_header + 16, ps_pub->un_count);
+  uplink_put32(auch_header + 20, ps_pub->un_sequence_limit);
+  uplink_put32(auch_header + 24, capture_crc32(0, auch_header, 24));
+  b_ok = ps_pub->s_store.write(ps_pub->s_store.p_context, 0, auch_header, sizeof(auch_header)) && ps_pub->s_store.sync(ps_pub->s_store.p_context);
+  ps_pub->s_stats.un_store_errors += !b_ok;
+  return b_ok;
+}
+
+static bool uplink_ring_load(uplink_publisher *ps_pub)
+{
+  uint8_t auch_header[UPLINK_RING_HEADER_USED];
+  const uint32_t un_size = uplink_ring_size(ps_pub);
+
+  ps_pub->un_head = ps_pub->un_tail = ps_pub->un_used = ps_pub->un_count = 0;
+  ps_pub->un_next_sequence = ps_pub->un_sequence_limit = 0;
+  if (!ps_pub->s_store.read(ps_pub->s_store.p_context, 0, auch_header, sizeof(auch_header)))
+    return false;
+  if (uplink_get32(auch_header) != UPLINK_RING_MAGIC || capture_crc32(0, auch_header, 24) != uplink_get32(auch_header + 24))
+    return true; // new or foreign file: start empty
+  ps_pub->un_head = uplink_get32(auch_header + 4);
+  ps_pub->un_tail = uplink_get32(auch_header + 8);
+  ps_pub->un_used = uplink_get32(auch_header + 12);
+  ps_pub->un_count = uplink_get32(auch_header + 16);
+  ps_pub->un_next_sequence = ps_pub->un_sequence_limit = uplink_get32(auch_header + 20);
+  if (ps_pub->un_head >= un_size || ps_pub->un_tail >= un_size || ps_pub->un_used > un_size
+      || (ps_pub->un_tail + ps_pub->un_used) % un_size != ps_pub->un_head || (ps_pub->un_count == 0) != (ps_pub->un_used == 0))
+    ps_pub->un_head = ps_pub->un_tail = ps_pub->un_used = ps_pub->un_count = 0; // written by a different store size
+  return true;
+}
+
+static uint16_t uplink_ring_front(uplink_publisher *ps_pub)
+// length of the oldest stored batch, 0 if it cannot be read
+{
+  uint8_t auch_len[UPLINK_RING_RECORD];
+  uint16_t uw_len;
+  if (!uplink_ring_io(ps_pub, ps_pub->un_tail, auch_len, sizeof(auch_len), false))
+    return 0;
+  uw_len = uplink_get16(auch_len);
+  return uw_len > UPLINK_BATCH_HEADER && uw_len <= UPLINK_BATCH_BYTES ? uw_len : 0;
+}
+
+static void uplink_ring_pop(uplink_publisher *ps_pub, uint16_t uw_len)
+// uw_len 0: the record is unreadable, give up the whole backlog. A batch in flight from the ring is gone with it.
+{
+  if (ps_pub->b_inflight_stored) {
+    ps_pub->uw_inflight = 0;
+    ps_pub->b_inflight_stored = false;
+  }
+  if (uw_len == 0) {
+    ps_pub->s_stats.un_dropped += ps_pub->un_count;
+    ps_pub->un_head = ps_pub->un_tail = ps_pub->un_used = ps_pub->un_count = 0;
+    return;
+  }
+  ps_pub->un_tail = (ps_pub->un_tail + UPLINK_RING_RECORD + uw_len) % uplink_ring_size(ps_pub);
+  ps_pub->un_used -= UPLINK_RING_RECORD + uw_len;
+  ps_pub->un_count--;
+  if (ps_pub->un_count == 0)
+    ps_pub->un_head = ps_pub->un_tail = ps_pub->un_used = 0;
+}
+
+static void uplink_ring_push(uplink_publisher *ps_pub, const uint8_t *puch_batch, uint16_t uw_len)
+{
+  const uint32_t un_need = UPLINK_RING_RECORD + uw_len;
+  uint8_t auch_len[UPLINK_RING_RECORD];
+  uint16_t uw_front;
+
+  if (un_need > uplink_ring_size(ps_pub)) {
+    ps_pub->s_stats.un_dropped++;
+    return;
+  }
+  while (uplink_ring_size(ps_pub) - ps_pub->un_used < un_need) {
+    uw_front = uplink_ring_front(ps_pub);
+    ps_pub->s_stats.un_dropped += uw_front != 0; // uplink_ring_pop() counts the rest
+    uplink_ring_pop(ps_pub, uw_front);
+  }
+  uplink_put16(auch_len, uw_len);
+  if (!uplink_ring_io(ps_pub, ps_pub->un_head, auch_len, sizeof(auch_len), true)
+      || !uplink_ring_io(ps_pub, (ps_pub->un_head + UPLINK_RING_RECORD) % uplink_ring_size(ps_pub), (uint8_t *)puch_batch, uw_len, true)) {
+    ps_pub->s_stats.un_dropped++;
+    return;
+  }
+  ps_pub->un_head = (ps_pub->un_head + un_need) % uplink_ring_size(ps_pub);
+  ps_pub->un_used += un_need;
+  ps_pub->un_count++;
+  ps_pub->s_stats.un_stored++;
+  if (ps_pub->un_count > ps_pub->s_stats.un_peak_depth)
+    ps_pub->s_stats.un_peak_depth = ps_pub->un_count;
+  if (ps_pub->un_used > ps_pub->s_stats.un_peak_depth_bytes)
+    ps_pub->s_stats.un_peak_depth_bytes = ps_pub->un_used;
+}
+
+static bool uplink_link_up(uplink_publisher *ps_pub)
+{
+  return ps_pub->s_link.up(ps_pub->s_link.p_context);
+}
+
+static bool uplink_send(uplink_publisher *ps_pub, uint8_t *puch_batch, uint16_t uw_len, uint8_t uch_flags, uint32_t un_depth)
+// flags and depth are filled in at send time
+{
+  puch_batch[1] = uch_flags;
+  uplink_put16(puch_batch + 8, un_depth > 0xFFFF ? 0xFFFF : (uint16_t)un_depth);
+  if (!ps_pub->s_link.send(ps_pub->s_link.p_context, puch_batch, uw_len)) {
+    ps_pub->s_stats.un_send_failures++;
+    return false;
+  }
+  ps_pub->s_stats.ul_bytes_sent += uw_len;
+  return true;
+}
+
+static void uplink_await_ack(uplink_publisher *ps_pub, const uint8_t *puch_batch, uint16_t uw_len, bool b_stored)
+// the batch just sent, kept in auch_drain; without receive() it is delivered already
+{
+  if (ps_pub->s_link.receive == NULL)
+    return;
+  if (puch_batch != ps_pub->auch_drain)
+    memcpy(ps_pub->auch_drain, puch_batch, uw_len);
+  ps_pub->uw_inflight = uw_len;
+  ps_pub->b_inflight_stored = b_stored;
+  ps_pub->un_inflight_sequence = uplink_get32(ps_pub->auch_drain + 4);
+  ps_pub->un_inflight_ms = ps_pub->un_now_ms;
+}
+
+static bool uplink_store_inflight(uplink_publisher *ps_pub)
+// a live batch still waiting for its ack: stored, ahead of anything closed after it. The ring was empty when it was sent.
+{
+  if (ps_pub->uw_inflight == 0 || ps_pub->b_inflight_stored)
+    return false;
+  uplink_ring_push(ps_pub, ps_pub->auch_drain, ps_pub->uw_inflight);
+  ps_pub->b_inflight_stored = ps_pub->un_count > 0;
+  if (!ps_pub->b_inflight_stored)
+    ps_pub->uw_inflight = 0;
+  return true;
+}
+
+static void uplink_receive_acks(uplink_publisher *ps_pub)
+// an ack for anything but the batch in flight is late: that batch was acknowledged before
+{
+  uint8_t auch_ack[UPLINK_ACK_BYTES + 1];
+  uint16_t uw_len;
+
+  if (ps_pub->s_link.receive == NULL)
+    return;
+  while ((uw_len = ps_pub->s_link.receive(ps_pub->s_link.p_context, auch_ack, sizeof(auch_ack))) > 0) {
+    if (uw_len != UPLINK_ACK_BYTES || auch_ack[0] != UPLINK_VERSION || auch_ack[1] != UPLINK_BATCH_ACK
+        || uplink_get16(auch_ack + 2) != ps_pub->s_config.uw_device_id || ps_pub->uw_inflight == 0
+        || uplink_get32(auch_ack + 4) != ps_pub->un_inflight_sequence)
+      continue;
+    ps_pub->s_stats.un_acked++;
+    if (ps_pub->b_inflight_stored) {
+      uplink_ring_pop(ps_pub, ps_pub->uw_inflight);
+      uplink_ring_commit(ps_pub);
+    }
+    ps_pub->uw_inflight = 0;
+  }
+}
+
+static void uplink_close(uplink_publisher *ps_pub)
+{
+  uint8_t *puch_batch = ps_pub->auch_batch;
+  const uint16_t uw_len = ps_pub->uw_fill;
+
+  if (ps_pub->uw_records == 0)
+    return;
+  puch_batch[0] = UPLINK_VERSION;
+  uplink_put16(puch_batch + 2, ps_pub->s_config.uw_device_id);
+  if (ps_pub->un_next_sequence == ps_pub->un_sequence_limit) {
+    // a restart continues above the limit, so numbers are never reused
+    ps_pub->un_sequence_limit += UPLINK_SEQUENCE_RESERVE;
+    uplink_ring_commit(ps_pub);
+  }
+  uplink_put32(puch_batch + 4, ps_pub->un_next_sequence++);
+  ps_pub->s_stats.un_batches++;
+  ps_pub->s_stats.ul_batch_bytes += uw_len;
+  ps_pub->uw_fill = UPLINK_BATCH_HEADER;
+  ps_pub->uw_records = 0;
+
+  // nothing may overtake the backlog or the batch in flight
+  uplink_receive_acks(ps_pub);
+  if (ps_pub->un_count == 0 && ps_pub->uw_inflight == 0 && uplink_link_up(ps_pub) && uplink_send(ps_pub, puch_batch, uw_len, 0, 0)) {
+    ps_pub->s_stats.un_sent_live++;
+    uplink_await_ack(ps_pub, puch_batch, uw_len, false);
+    return;
+  }
+  uplink_store_inflight(ps_pub);
+  uplink_ring_push(ps_pub, puch_batch, uw_len);
+  uplink_ring_commit(ps_pub);
+}
+
+static bool uplink_append(void *p_context, const uint8_t *puch_data, size_t un_len)
+// telemetry_sink: frames are never split over batches
+{
+  uplink_publisher *ps_pub = (uplink_publisher *)p_context;
+  if (un_len > UPLINK_BATCH_BYTES - UPLINK_BATCH_HEADER)
+    return false;
+  if (ps_pub->uw_fill + un_len > UPLINK_BATCH_BYTES)
+    uplink_close(ps_pub);
+  if (ps_pub->uw_records == 0)
+    ps_pub->un_opened_ms = ps_pub->un_now_ms;
+  memcpy(ps_pub->auch_batch + ps_pub->uw_fill, puch_data, un_len);
+  ps_pub->uw_fill += (uint16_t)un_len;
+  ps_pub->uw_records++;
+  ps_pub->s_stats.un_records++;
+  return true;
+}
+
+void uplink_default_config(uplink_config *ps_config)
+{
+  ps_config->uw_device_id = 0;
+  ps_config->un_max_age_ms = 5000;
+  ps_config->un_drain_bytes_per_s = 4096;
+  ps_config->un_drain_burst_bytes = 2 * UPLINK_BATCH_BYTES;
+  ps_config->un_ack_timeout_ms = 2000;
+  ps_config->b_raw = false;
+}
+
+bool uplink_init(uplink_publisher *ps_pub, const uplink_config *ps_config, const uplink_link *ps_link, const uplink_store *ps_store,
+    uint32_t un_now_ms)
+/**
+* \brief        Set up the publisher and pick up the backlog already in the store
+* \par          Details
+*               The store must hold at least one full batch besides the header. A store
+*               without a valid header (first boot, other firmware) starts out empty.
+*
+* \retval       false if the store is too small or its header cannot be read
+*/
+{
+  memset(ps_pub, 0, sizeof(*ps_pub));
+  ps_pub->s_config = *ps_config;
+  if (ps_pub->s_config.un_drain_burst_bytes < UPLINK_BATCH_BYTES)
+    ps_pub->s_config.un_drain_burst_bytes = UPLINK_BATCH_BYTES;
+  ps_pub->s_link = *ps_link;
+  ps_pub->s_store = *ps_store;
+  ps_pub->uw_fill = UPLINK_BATCH_HEADER;
+  ps_pub->un_now_ms = ps_pub->un_refill_ms = un_now_ms;
+  ps_pub->ul_credit = ps_pub->s_config.un_drain_burst_bytes * 1000ull;
+  telemetry_writer_init(&ps_pub->s_writer, uplink_append, ps_pub);
+  if (ps_store->un_size < UPLINK_RING_HEADER + UPLINK_RING_RECORD + UPLINK_BATCH_BYTES)
+    return false;
+  if (!uplink_ring_load(ps_pub)) {
+    ps_pub->s_stats.un_store_errors++;
+    return false;
+  }
+  ps_pub->s_stats.un_peak_depth = ps_pub->un_count;
+  ps_pub->s_stats.un_peak_depth_bytes = ps_pub->un_used;
+  return true;
+}
+
+bool uplink_publish_config(uplink_publisher *ps_pub, const capture_config *ps_config, uint32_t un_now_ms)
+/**
+* \brief        Describe the raw samples that follow; only sent with b_raw
+*/
+{
+  if (!ps_pub->s_config.b_raw)
+    return true;
+  ps_pub->un_now_ms = un_now_ms;
+  return telemetry_write_config(&ps_pub->s_writer, ps_config);
+}
+
+bool uplink_publish_result(uplink_publisher *ps_pub, const telemetry_result *ps_result, uint32_t un_now_ms)
+/**
+* \brief        Add one estimate to the open batch; never waits for the link
+*/
+{
+  ps_pub->un_now_ms = un_now_ms;
+  return telemetry_write_result(&ps_pub->s_writer, ps_result);
+}
+
+bool uplink_publish_quality(uplink_publisher *ps_pub, const telemetry_quality *ps_quality, uint32_t un_now_ms)
+{
+  ps_pub->un_now_ms = un_now_ms;
+  return telemetry_write_quality(&ps_pub->s_writer, ps_quality);
+}
+
+bool uplink_publish_temperature(uplink_publisher *ps_pub, int8_t ch_integer, uint8_t uch_fraction, uint32_t un_now_ms)
+{
+  ps_pub->un_now_ms = un_now_ms;
+  return telemetry_write_temperature(&ps_pub->s_writer, un_now_ms, ch_integer, uch_fraction);
+}
+
+bool uplink_publish_sample(uplink_publisher *ps_pub, uint32_t un_red_led, uint32_t un_ir_led, uint32_t un_now_ms)
+/**
+* \brief        Add one raw red/IR pair if b_raw is configured
+* \par          Details
+*               Samples are packed TELEMETRY_BLOCK_SAMPLES to a frame, as on the UART.
+*
+* \retval       false if a frame could not be added
+*/
+{
+  if (!ps_pub->s_config.b_raw)
+    return true;
+  ps_pub->un_now_ms = un_now_ms;
+  return telemetry_write_sample(&ps_pub->s_writer, un_red_led, un_ir_led, un_now_ms);
+}
+
+void uplink_flush(uplink_publisher *ps_pub, uint32_t un_now_ms)
+/**
+* \brief        Close the open batch now, with any partial sample block; e.g. before a planned restart
+* \par          Details
+*               A live batch still waiting for its ack is stored too, so the restart sends it again.
+*/
+{
+  ps_pub->un_now_ms = un_now_ms;
+  telemetry_flush_samples(&ps_pub->s_writer);
+  uplink_close(ps_pub);
+  if (uplink_store_inflight(ps_pub))
+    uplink_ring_commit(ps_pub);
+}
+
+void uplink_service(uplink_publisher *ps_pub, uint32_t un_now_ms)
+/**
+* \brief        Take in acks, close an old batch and send at most one stored batch; call from loop()
+* \par          Details
+*               Stored batches go out oldest first, paced by a token bucket of
+*               un_drain_burst_bytes refilled at un_drain_bytes_per_s. A failed send
+*               leaves the batch stored for the next call. On a link with acks the next
+*               one waits until the batch in flight is acknowledged, or un_ack_timeout_ms
+*               has passed and it is sent again from the ring.
+*/
+{
+  const uint64_t ul_burst = ps_pub->s_config.un_drain_burst_bytes * 1000ull;
+  uint16_t uw_len;
+
+  ps_pub->un_now_ms = un_now_ms;
+  uplink_receive_acks(ps_pub);
+  if (ps_pub->uw_records > 0 && un_now_ms - ps_pub->un_opened_ms >= ps_pub->s_config.un_max_age_ms)
+    uplink_close(ps_pub);
+
+  // bytes/s times ms: credit in 1/1000 byte, no rounding loss between calls
+  ps_pub->ul_credit += (uint64_t)(un_now_ms - ps_pub->un_refill_ms) * ps_pub->s_config.un_drain_bytes_per_s;
+  ps_pub->un_refill_ms = un_now_ms;
+  if (ps_pub->ul_credit > ul_burst)
+    ps_pub->ul_credit = ul_burst;
+
+  if (ps_pub->uw_inflight > 0) {
+    if (un_now_ms - ps_pub->un_inflight_ms < ps_pub->s_config.un_ack_timeout_ms)
+      return;
+    ps_pub->s_stats.un_ack_timeouts++;
+    if (uplink_store_inflight(ps_pub))
+      uplink_ring_commit(ps_pub);
+    ps_pub->uw_inflight = 0;
+    ps_pub->b_inflight_stored = false;
+  }
+  if (ps_pub->un_count == 0 || !uplink_link_up(ps_pub))
+    return;
+  uw_len = uplink_ring_front(ps_pub);
+  if (uw_len == 0) {
+    uplink_ring_pop(ps_pub, 0);
+    uplink_ring_commit(ps_pub);
+    return;
+  }
+  if (ps_pub->ul_credit < uw_len * 1000ull)
+    return;
+  if (!uplink_ring_io(ps_pub, (ps_pub->un_tail + UPLINK_RING_RECORD) % uplink_ring_size(ps_pub), ps_pub->auch_drain, uw_len, false)) {
+    uplink_ring_pop(ps_pub, uw_len);
+    ps_pub->s_stats.un_dropped++;
+    uplink_ring_commit(ps_pub);
+    return;
+  }
+  if (!uplink_send(ps_pub, ps_pub->auch_drain, uw_len, UPLINK_BATCH_STORED, ps_pub->un_count - 1))
+    return;
+  ps_pub->ul_credit -= uw_len * 1000ull;
+  ps_pub->s_stats.un_drained++;
+  uplink_await_ack(ps_pub, ps_pub->auch_drain, uw_len, true);
+  if (ps_pub->uw_inflight > 0)
+    return;
+  uplink_ring_pop(ps_pub, uw_len);
+  uplink_ring_commit(ps_pub);
+}
+
+uint32_t uplink_queue_depth(const uplink_publisher *ps_pub, uint32_t *pun_bytes)
+/**
+* \retval       Batches not yet delivered: stored, or sent live and waiting for their ack;
+*               *pun_bytes (if not NULL) the size of those stored
+*/
+{
+  if (pun_bytes != NULL)
+    *pun_bytes = ps_pub->un_used;
+  return ps_pub->un_count + (ps_pub->uw_inflight > 0 && !ps_pub->b_inflight_stored);
+}
+
+bool uplink_parse_batch(const uint8_t *puch_data, size_t un_len, uplink_batch *ps_batch)
+/**
+* \brief        Receiver side: check the batch header and locate the frames
+*
+* \retval       false if this is not a batch of this version
+*/
+{
+  if (un_len <= UPLINK_BATCH_HEADER || un_len > UPLINK_BATCH_BYTES || puch_data[0] != UPLINK_VERSION)
+    return false;
+  ps_batch->uch_flags = puch_data[1];
+  ps_batch->uw_device_id = uplink_get16(puch_data + 2);
+  ps_batch->un_sequence = uplink_get32(puch_data + 4);
+  ps_batch->uw_depth = uplink_get16(puch_data + 8);
+  ps_batch->puch_frames = puch_data + UPLINK_BATCH_HEADER;
+  ps_batch->uw_frames_len = (uint16_t)(un_len - UPLINK_BATCH_HEADER);
+  return true;
+}
+
+uint16_t uplink_make_ack(const uplink_batch *ps_batch, uint8_t *puch_ack)
+/**
+* \brief        Receiver side: the ack for a batch, to send back to its source address and port
+* \par          Details
+*               Ack every batch, also one seen before: its earlier ack was lost.
+*
+* \retval       UPLINK_ACK_BYTES, written to puch_ack
+*/
+{
+  puch_ack[0] = UPLINK_VERSION;
+  puch_ack[1] = UPLINK_BATCH_ACK;
+  uplink_put16(puch_ack + 2, ps_batch->uw_device_id);
+  uplink_put32(puch_ack + 4, ps_batch->un_sequence);
+  return UPLINK_ACK_BYTES;
+}
+
+static bool uplink_ram_read(void *p_context, uint32_t un_offset, uint8_t *puch_data, uint16_t uw_len)
+{
+  memcpy(puch_data, (const uint8_t *)p_context + un_offset, uw_len);
+  return true;
+}
+
+static bool uplink_ram_write(void *p_context, uint32_t un_offset, const uint8_t *puch_data, uint16_t uw_len)
+{
+  memcpy((uint8_t *)p_context + un_offset, puch_data, uw_len);
+  return true;
+}
+
+static bool uplink_ram_sync(void *)
+{
+  return true;
+}
+
+void uplink_store_ram(uplink_store *ps_store, uint8_t *puch_buffer, uint32_t un_size)
+/**
+* \brief        A store in a caller's buffer; survives uplink_init() again, not a reset
+*/
+{
+  ps_store->p_context = puch_buffer;
+  ps_store->un_size = un_size;
+  ps_store->read = uplink_ram_read;
+  ps_store->write = uplink_ram_write;
+  ps_store->sync = uplink_ram_sync;
+}
@@ -0,0 +1,160 @@
+/** \file uplink.h ******************************************************
+*
+* Description: Store-and-forward batched uplink
+*
+* Results, temperature, quality and (optionally) raw sample blocks are
+* coalesced into batches of at most UPLINK_BATCH_BYTES, one UDP datagram or
+* MQTT publish each, instead of a packet per estimate:
+*
+*   offset  size  field
+*   0       1     UPLINK_VERSION
+*   1       1     flags, UPLINK_BATCH_STORED: sent from the backlog
+*   2       2     device id
+*   4       4     batch sequence number, jumps ahead after a restart
+*   8       2     queue depth: batches still stored behind this one
+*   10      n     telemetry frames (lib/telemetry), each ending in 0x00
+*
+* All fields little endian. The receiver feeds the frames of consecutive
+* batches to one telemetry_decoder per device.
+*
+* The receiver acknowledges every batch with its first UPLINK_ACK_BYTES,
+* flags UPLINK_BATCH_ACK (uplink_make_ack()), sent back to where the batch
+* came from. On a link that can receive, a batch is delivered once its ack
+* is in, not once it is sent: one batch is in flight at a time, and without
+* an ack within un_ack_timeout_ms it is stored, if it was not already, and
+* sent again from the ring. So a receiver that is down while the link is up
+* loses nothing either. A lost ack makes a duplicate: the receiver acks a
+* sequence number it has seen again and skips its frames. A link without
+* receive() takes a successful send() as delivery.
+*
+* A finished batch is sent at once while the link is up and nothing is
+* stored or in flight. Otherwise it is appended to a ring in an uplink_store (a LittleFS
+* file on the ESP8266, RAM on the host), so order is kept. When the ring is
+* full the oldest batches are dropped and counted. uplink_service(), called
+* from loop(), drains the ring once the link is back, at most one batch per
+* call and un_drain_bytes_per_s on average, so neither the radio nor loop()
+* is swamped.
+*
+* The ring header is written after the batch data, so a power cut loses at
+* most the batch being written. The open batch itself is in RAM.
+*
+* ------------------------------------------------------------------------- */
+
+#ifndef UPLINK_H_
+#define UPLINK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <telemetry.h>
+
+#define UPLINK_VERSION 2              // 2: batches are acknowledged
+#define UPLINK_BATCH_BYTES 1024        // below a 1500 byte MTU with IP/UDP headers
+#define UPLINK_BATCH_HEADER 10
+#define UPLINK_BATCH_STORED 0x01
+#define UPLINK_BATCH_ACK 0x80          // flags of an acknowledgement: version, flags, device id, sequence number
+#define UPLINK_ACK_BYTES 8
+#define UPLINK_RING_HEADER 32          // bytes at the start of the store
+#define UPLINK_RING_RECORD 2           // u16 length before each stored batch
+
+// Persistent byte region: a file of fixed size, flash or RAM
+typedef struct {
+  void *p_context;
+  uint32_t un_size;                    // bytes, including UPLINK_RING_HEADER
+  bool (*read)(void *p_context, uint32_t un_offset, uint8_t *puch_data, uint16_t uw_len);
+  bool (*write)(void *p_context, uint32_t un_offset, const uint8_t *puch_data, uint16_t uw_len);
+  bool (*sync)(void *p_context);       // make the writes so far durable
+} uplink_store;
+
+typedef struct {
+  void *p_context;
+  bool (*up)(void *p_context);         // cheap check, e.g. WiFi.status() == WL_CONNECTED
+  bool (*send)(void *p_context, const uint8_t *puch_data, uint16_t uw_len); // false: not sent
+  uint16_t (*receive)(void *p_context, uint8_t *puch_data, uint16_t uw_size); // a waiting datagram, at most uw_size bytes of it, 0 if none; NULL: no acks
+} uplink_link;
+
+typedef struct {
+  uint16_t uw_device_id;
+  uint32_t un_max_age_ms;              // a batch goes out this long after its first record at the latest
+  uint32_t un_drain_bytes_per_s;       // backlog rate limit
+  uint32_t un_drain_burst_bytes;       // limiter bucket, at least UPLINK_BATCH_BYTES
+  uint32_t un_ack_timeout_ms;          // a batch not acknowledged in this time is sent again
+  bool b_raw;                          // uplink_publish_sample() forwards raw blocks
+} uplink_config;
+
+typedef struct {
+  uint32_t un_records;                 // telemetry frames published
+  uint32_t un_batches;                 // closed
+  uint32_t un_sent_live;
+  uint32_t un_stored;
+  uint32_t un_drained;                 // sent from the ring
+  uint32_t un_dropped;                 // oldest stored batches given up for room
+  uint32_t un_send_failures;
+  uint32_t un_acked;
+  uint32_t un_ack_timeouts;            // batches sent again for want of an ack
+  uint32_t un_store_errors;
+  uint64_t ul_bytes_sent;
+  uint64_t ul_batch_bytes;             // sum of closed batch sizes, for the mean fill
+  uint32_t un_peak_depth;              // stored batches
+  uint32_t un_peak_depth_bytes;
+} uplink_stats;
+
+typedef struct {
+  uplink_config s_config;
+  uplink_link s_link;
+  uplink_store s_store;
+  telemetry_writer s_writer;           // frames go into the open batch
+  // ring, as persisted in the header
+  uint32_t un_head;                    // data offset of the next write
+  uint32_t un_tail;                    // data offset of the oldest batch
+  uint32_t un_used;                    // bytes stored
+  uint32_t un_count;                   // batches stored
+  uint32_t un_next_sequence;
+  uint32_t un_sequence_limit;          // persisted; reserved up to here
+  // open batch
+  uint32_t un_now_ms;
+  uint32_t un_opened_ms;
+  uint16_t uw_fill;
+  uint16_t uw_records;
+  uint8_t auch_batch[UPLINK_BATCH_BYTES];
+  uint8_t auch_drain[UPLINK_BATCH_BYTES];
+  // batch in flight, its copy in auch_drain
+  uint16_t uw_inflight;                // length, 0 if none
+  bool b_inflight_stored;              // it is the oldest stored batch
+  uint32_t un_inflight_sequence;
+  uint32_t un_inflight_ms;             // sent
+  // drain limiter
+  uint64_t ul_credit;                  // 1/1000 byte
+  uint32_t un_refill_ms;
+  uplink_stats s_stats;
+} uplink_publisher;
+
+typedef struct {
+  uint8_t uch_flags;
+  uint16_t uw_device_id;
+  uint32_t un_sequence;
+  uint16_t uw_depth;
+  const uint8_t *puch_frames;
+  uint16_t uw_frames_len;
+} uplink_batch;
+
+void uplink_default_config(uplink_config *ps_config);
+bool uplink_init(uplink_publisher *ps_pub, const uplink_config *ps_config, const uplink_link *ps_link, const uplink_store *ps_store,
+    uint32_t un_now_ms);
+bool uplink_publish_config(uplink_publisher *ps_pub, const capture_config *ps_config, uint32_t un_now_ms);
+bool uplink_publish_result(uplink_publisher *ps_pub, const telemetry_result *ps_result, uint32_t un_now_ms);
+bool uplink_publish_quality(uplink_publisher *ps_pub, const telemetry_quality *ps_quality, uint32_t un_now_ms);
+bool uplink_publish_temperature(uplink_publisher *ps_pub, int8_t ch_integer, uint8_t uch_fraction, uint32_t un_now_ms);
+bool uplink_publish_sample(uplink_publisher *ps_pub, uint32_t un_red_led, uint32_t un_ir_led, uint32_t un_now_ms);
+void uplink_flush(uplink_publisher *ps_pub, uint32_t un_now_ms);
+void uplink_service(uplink_publisher *ps_pub, uint32_t un_now_ms);
+uint32_t uplink_queue_depth(const uplink_publisher *ps_pub, uint32_t *pun_bytes);
+bool uplink_parse_batch(const uint8_t *puch_data, size_t un_len, uplink_batch *ps_batch);
+uint16_t uplink_make_ack(const uplink_batch *ps_batch, uint8_t *puch_ack);
+
+void uplink_store_ram(uplink_store *ps_store, uint8_t *puch_buffer, uint32_t un_size);
+#if defined(ARDUINO_ARCH_ESP8266)
+bool uplink_store_littlefs(uplink_store *ps_store, const char *s_path, uint32_t un_size);
+bool uplink_link_udp(uplink_link *ps_link, const char *s_host, uint16_t uw_port);
+#endif
+
+#endif /* UPLINK_H_ */
@@ -0,0 +1,117 @@
+/** \file uplink_esp8266.cpp ******************************************************
+*
+* Description: Uplink store on LittleFS and link over WiFiUDP, ESP8266 only
+*
+* The store is one file of fixed size; LittleFS does the wear levelling. The
+* link is up while the station is associated; the receiver is a host address
+* and UDP port, e.g. a small UDP-to-MQTT bridge, and acks each batch to the
+* same local port (uplink.h), so a receiver that is down loses nothing.
+*
+* ------------------------------------------------------------------------- */
+
+#if defined(ARDUINO_ARCH_ESP8266)
+
+#include "uplink.h"
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include <WiFiUdp.h>
+
+static File s_uplink_file;
+static WiFiUDP s_uplink_udp;
+static IPAddress s_uplink_host;
+static uint16_t uw_uplink_port;
+
+static bool uplink_fs_read(void *, uint32_t un_offset, uint8_t *puch_data, uint16_t uw_len)
+{
+  return s_uplink_file.seek(un_offset, SeekSet) && s_uplink_file.read(puch_data, uw_len) == uw_len;
+}
+
+static bool uplink_fs_write(void *, uint32_t un_offset, const uint8_t *puch_data, uint16_t uw_len)
+{
+  return s_uplink_file.seek(un_offset, SeekSet) && s_uplink_file.write(puch_data, uw_len) == uw_len;
+}
+
+static bool uplink_fs_sync(void *)
+{
+  s_uplink_file.flush();
+  return true;
+}
+
+bool uplink_store_littlefs(uplink_store *ps_store, const char *s_path, uint32_t un_size)
+/**
+* \brief        Open (or create and size) the queue file
+* \par          Details
+*               Mounts LittleFS if needed. The file is grown with zeros to un_size once,
+*               so later writes never allocate.
+*
+* \retval       false if the file system or the file is not available
+*/
+{
+  uint8_t auch_zero[64] = { 0 };
+  uint32_t un_size_now;
+
+  if (!LittleFS.begin())
+    return false;
+  s_uplink_file = LittleFS.open(s_path, LittleFS.exists(s_path) ? "r+" : "w+");
+  if (!s_uplink_file)
+    return false;
+  un_size_now = s_uplink_file.size();
+  if (un_size_now < un_size) {
+    s_uplink_file.seek(un_size_now, SeekSet);
+    while (un_size_now < un_size) {
+      uint16_t uw_part = un_size - un_size_now < sizeof(auch_zero) ? (uint16_t)(un_size - un_size_now) : (uint16_t)sizeof(auch_zero);
+      if (s_uplink_file.write(auch_zero, uw_part) != uw_part)
+        return false;
+      un_size_now += uw_part;
+    }
+    s_uplink_file.flush();
+  }
+  ps_store->p_context = NULL;
+  ps_store->un_size = un_size;
+  ps_store->read = uplink_fs_read;
+  ps_store->write = uplink_fs_write;
+  ps_store->sync = uplink_fs_sync;
+  return true;
+}
+
+static bool uplink_udp_up(void *)
+{
+  return WiFi.status() == WL_CONNECTED;
+}
+
+static bool uplink_udp_send(void *, const uint8_t *puch_data, uint16_t uw_len)
+{
+  return s_uplink_udp.beginPacket(s_uplink_host, uw_uplink_port) && s_uplink_udp.write(puch_data, uw_len) == uw_len
+      && s_uplink_udp.endPacket();
+}
+
+static uint16_t uplink_udp_receive(void *, uint8_t *puch_data, uint16_t uw_size)
+{
+  int n_len;
+  if (s_uplink_udp.parsePacket() <= 0)
+    return 0;
+  n_len = s_uplink_udp.read(puch_data, uw_size);
+  return n_len > 0 ? (uint16_t)n_len : 0;
+}
+
+bool uplink_link_udp(uplink_link *ps_link, const char *s_host, uint16_t uw_port)
+/**
+* \brief        Send batches as UDP datagrams to s_host (dotted quad) : uw_port, acks come back to uw_port
+* \par          Details
+*               Joining the network is up to the caller (WiFi.begin()); until then the
+*               link reports down and batches are stored.
+*
+* \retval       false if s_host is not an IPv4 address or uw_port cannot be bound
+*/
+{
+  if (!s_uplink_host.fromString(s_host) || !s_uplink_udp.begin(uw_port))
+    return false;
+  uw_uplink_port = uw_port;
+  ps_link->p_context = NULL;
+  ps_link->up = uplink_udp_up;
+  ps_link->send = uplink_udp_send;
+  ps_link->receive = uplink_udp_receive;
+  return true;
+}
+
+#endif /* ARDUINO_ARCH_ESP8266 */
@@ -26,6 +26,29 @@
 
   * NOTE: if reading are not consistent, some calibration may be required
           see maxim_max30102_init() in /lib/max30102/max30102.cpp
+  * Build with -DRF_LOW_RAM to run the estimator in place on a packed window
+    (rf_packed_push(), same estimates in about half the RAM)
+  * Build with -DLED_AGC to let max30102_agc retune LED current, ADC range and
+    pulse width after every estimate, to the lowest LED current that still
+    gives valid estimates
+  * Build with -DHR_ONLY to convert the IR LED alone (one multi-LED slot): half
+    the I2C bytes per sample and no red channel maths, heart rate only
+  * Build with -DTELEMETRY (env esp01_telemetry) to replace the text output with
+    framed binary telemetry (lib/telemetry) at TELEMETRY_BAUD: raw samples,
+    estimates, LED/acquisition quality and die temperature on one port, decoded
+    on the host by tools/teldump
+  * Build with -DUPLINK (env esp01_uplink) to also send estimates, quality and
+    die temperature over Wi-Fi (lib/uplink): batched UDP datagrams to
+    UPLINK_HOST:UPLINK_PORT, kept in a LittleFS queue of UPLINK_QUEUE_BYTES
+    until the receiver acknowledges them. Needs -DUPLINK_SSID, -DUPLINK_PASSWORD and
+    -DUPLINK_HOST; add -DUPLINK_RAW to forward the raw samples as well
+  * Build with -DPROFILE to time every stage of the estimate and every sensor
+    bus call in CPU cycles (lib/profile); p50/p99/max per stage are reported
+    every PROFILE_REPORT_EVERY estimates
+  * Build with -DDUTY_CYCLE to light-sleep between FIFO almost full interrupts
+    (lib/duty): FIFO_A_FULL follows the measured wake, drain and estimate times
+    so the FIFO never overflows; wakeups/s and the awake fraction are reported
+    every DUTY_REPORT_EVERY estimates. The radio stays off
 */
 
 //#include <Wire.h>
@@ -36,15 +59,236 @@
 #include <max30102.h>
 #include <SPI.h>
 #include <algorithmRF.h>
+#include <acquisition.h>
+#include <max30102_temp.h>
+#ifdef RAW_CAPTURE
+#include <capture.h>
+#endif
+#ifdef TELEMETRY
+#include <telemetry.h>
+#include <stdio.h>
+#endif
+#ifdef LED_AGC
+#include <max30102_agc.h>
+#endif
+#ifdef UPLINK
+#include <ESP8266WiFi.h>
+#include <uplink.h>
+#endif
+#ifdef PROFILE
+#include <profile.h>
+#include <stdio.h>
+#endif
+#ifdef DUTY_CYCLE
+#include <duty.h>
+#include <stdio.h>
+#endif
+
+#if defined(HR_ONLY) && defined(LED_AGC)
+#error "LED_AGC balances the red LED against IR and needs both channels"
+#endif
+#if defined(TELEMETRY) && defined(RAW_CAPTURE)
+#error "TELEMETRY carries the raw samples itself, RAW_CAPTURE chunks would break its frames"
+#endif
+#ifndef TELEMETRY_BAUD
+#define TELEMETRY_BAUD 921600 // 400 sps raw plus estimates need ~2.1 kB/s, 18 % of 115200
+#endif
+#if defined(UPLINK) && !(defined(UPLINK_SSID) && defined(UPLINK_PASSWORD) && defined(UPLINK_HOST))
+#error "UPLINK needs -DUPLINK_SSID, -DUPLINK_PASSWORD and -DUPLINK_HOST, each a quoted string"
+#endif
+#ifndef UPLINK_PORT
+#define UPLINK_PORT 4210
+#endif
+#ifndef UPLINK_QUEUE_BYTES
+#define UPLINK_QUEUE_BYTES 262144 // ~2.3 h of estimates, ~27 min with UPLINK_RAW at 25 sps (bench uplink)
+#endif
+#define UPLINK_QUALITY_EVERY 10 // estimates per quality record over the air
+#if defined(DUTY_CYCLE) && defined(UPLINK)
+#error "DUTY_CYCLE turns the radio off to light-sleep, UPLINK needs it on"
+#endif
+#ifndef DUTY_REPORT_EVERY
+#define DUTY_REPORT_EVERY 60 // estimates
+#endif
+#ifndef PROFILE_REPORT_EVERY
+#define PROFILE_REPORT_EVERY 60 // estimates, one per second
+#endif
 
 long samplesTaken = 0; //Counter for calculating the Hz or read rate
 //
 uint32_t elapsedTime,timeStart;
 
-uint32_t aun_ir_buffer[BUFFER_SIZE]; //infrared LED sensor data
-uint32_t aun_red_buffer[BUFFER_SIZE];  //red LED sensor data
+#define RF_HOP FS // new estimate every second, each over the last ST seconds of samples
+#ifdef RF_LOW_RAM
+rf_packed_state rf_stream; // packed sliding window, estimated in place without scratch arrays
+#define RF_STREAM_INIT rf_packed_init
+#define RF_STREAM_PUSH rf_packed_push
+#else
+rf_stream_state rf_stream; // sliding window of IR/red samples and running sums
+#define RF_STREAM_INIT rf_stream_init
+#define RF_STREAM_PUSH rf_stream_push
+#endif
 float old_n_spo2;  // Previous SPO2 value
+#define TEMP_REFRESH_MS 30000 // the die warms up over minutes
+max30102_temp die_temp; // converted in the background on DIE_TEMP_RDY, read from the cache
+#ifdef LED_AGC
+max30102_agc agc; // LED current, ADC range and pulse width follow the finger
+
+void agc_begin()
+{
+  max30102_agc_config s_cfg;
+  max30102_agc_default_config(&s_cfg);
+  s_cfg.f_min_correl = min_pearson_correlation; // the estimator's own quality gates
+  s_cfg.f_min_ratio = min_autocorrelation_ratio;
+  max30102_agc_init(&agc, &s_cfg);
+}
+#endif
 uint8_t uch_dummy,k;
+#ifdef HR_ONLY
+const uint8_t auch_hr_slots[MAX30102_MAX_SLOTS] = { MAX30102_SLOT_IR, MAX30102_SLOT_NONE }; // red reads 0
+#endif
+#ifdef RAW_CAPTURE
+capture_writer capture; // raw samples as binary chunks between the text lines, see tools/replay
+#endif
+#ifdef TELEMETRY
+telemetry_writer telemetry; // every output as COBS frames, nothing else may be printed
+#endif
+
+#if defined(TELEMETRY) || defined(UPLINK)
+bool sensor_quality(telemetry_quality *ps_quality)
+{
+  uint8_t auch_regs[REG_LED2_PULSE_AMPLITUDE - REG_SPO2_CONFIG + 1];
+  if (!maxim_max30102_read_regs(REG_SPO2_CONFIG, auch_regs, sizeof(auch_regs)))
+    return false;
+  ps_quality->un_time_ms = millis();
+  ps_quality->uch_spo2_config = auch_regs[0];
+  ps_quality->uch_led_red = auch_regs[REG_LED1_PULSE_AMPLITUDE - REG_SPO2_CONFIG];
+  ps_quality->uch_led_ir = auch_regs[REG_LED2_PULSE_AMPLITUDE - REG_SPO2_CONFIG];
+  ps_quality->uch_mode = maxim_max30102_mode();
+  ps_quality->un_missed_interrupts = acq_missed_interrupts();
+  ps_quality->un_overruns = acq_overruns();
+  return true;
+}
+#endif
+
+// Status messages: a text line, or a text frame with TELEMETRY
+void report(const char *s_text)
+{
+#ifdef TELEMETRY
+  telemetry_write_text(&telemetry, s_text);
+#else
+  Serial.println(s_text);
+#endif
+}
+
+#ifdef PROFILE
+uint32_t un_profile_estimates = 0;
+
+// Stage timing since the last report, one line per stage, then start over
+void profile_print()
+{
+  char s_line[96];
+  snprintf(s_line, sizeof(s_line), "profile: stage count mean p50 p99 max (%s, lags per window)", profile_unit());
+  report(s_line);
+  for (int k = 0; k < PROFILE_STAGES; k++)
+    if (profile_format((profile_stage)k, s_line, sizeof(s_line)) > 0)
+      report(s_line);
+  profile_reset();
+}
+#endif
+
+#ifdef DUTY_CYCLE
+duty_scheduler duty; // FIFO_A_FULL from the measured wake, drain and estimate times
+uint32_t un_duty_wake_us, un_duty_drain_us, un_duty_estimates = 0;
+
+// A wake starts: time it with micros(), which stands still while asleep
+void duty_start_wake(bool b_slept)
+{
+  duty_wake(&duty, acq_clock_us(), b_slept);
+  un_duty_wake_us = micros();
+  un_duty_drain_us = 0;
+}
+
+void duty_begin()
+{
+  duty_config s_cfg;
+  duty_default_config(&s_cfg, 1000000UL / FS);
+  maxim_max30102_set_fifo_a_full(duty_init(&duty, &s_cfg));
+  duty_start_wake(false);
+}
+
+// The ring is empty: retune the threshold while the FIFO is nearly empty too, then
+// sleep until it fills. An interrupt that is already pending counts as a new wake.
+void duty_sleep()
+{
+  uint8_t uch_a_full;
+  if (duty_done(&duty, micros() - un_duty_wake_us - un_duty_drain_us, &uch_a_full))
+    maxim_max30102_set_fifo_a_full(uch_a_full);
+  Serial.flush(); // the UART stops in light sleep
+  duty_start_wake(acq_sleep(ACQ_POLL_TIMEOUT_MS));
+}
+
+void duty_print()
+{
+  char s_line[112];
+  snprintf(s_line, sizeof(s_line), "duty: %.2f wakeups/s, awake %.1f%%, FIFO_A_FULL %u, full drains %lu, compute max %lu us",
+      duty_wakeups_per_s(&duty), 100.0f * duty_awake_fraction(&duty), duty.uch_a_full,
+      (unsigned long)duty.s_stats.un_full_drains, (unsigned long)duty.s_stats.un_compute_max_us);
+  report(s_line);
+}
+#endif
+
+#ifdef UPLINK
+uplink_publisher uplink; // batches in RAM, backlog in LittleFS; loop() never waits for the network
+bool b_uplink = false;
+uint32_t un_uplink_estimates = 0;
+
+void uplink_begin()
+{
+  uplink_config s_cfg;
+  uplink_store s_store;
+  uplink_link s_link;
+  uplink_default_config(&s_cfg);
+  s_cfg.uw_device_id = (uint16_t)ESP.getChipId();
+#ifdef UPLINK_RAW
+  s_cfg.b_raw = true;
+#endif
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(UPLINK_SSID, UPLINK_PASSWORD); // joins in the background, batches are stored until then
+  b_uplink = uplink_store_littlefs(&s_store, "/uplink.q", UPLINK_QUEUE_BYTES) && uplink_link_udp(&s_link, UPLINK_HOST, UPLINK_PORT)
+      && uplink_init(&uplink, &s_cfg, &s_link, &s_store, millis());
+  if (!b_uplink)
+    report("uplink disabled: no LittleFS queue or bad UPLINK_HOST");
+}
+#endif
+
+#if defined(RAW_CAPTURE) || defined(TELEMETRY)
+bool capture_to_serial(void *p_context, const uint8_t *puch_data, size_t un_len)
+{
+  return Serial.write(puch_data, un_len) == un_len;
+}
+#endif
+
+#if defined(RAW_CAPTURE) || defined(TELEMETRY) || defined(UPLINK)
+void capture_sensor_config()
+{
+  uint8_t auch_regs[REG_LED2_PULSE_AMPLITUDE - REG_FIFO_CONFIG + 1], uch_multi_led1, uch_multi_led2;
+  capture_config s_config;
+  maxim_max30102_read_regs(REG_FIFO_CONFIG, auch_regs, sizeof(auch_regs));
+  maxim_max30102_read_reg(REG_MULTI_LED_CONTROL1, &uch_multi_led1);
+  maxim_max30102_read_reg(REG_MULTI_LED_CONTROL2, &uch_multi_led2);
+  capture_config_from_regs(&s_config, auch_regs, uch_multi_led1, uch_multi_led2);
+#ifdef RAW_CAPTURE
+  capture_write_config(&capture, &s_config);
+#endif
+#ifdef TELEMETRY
+  telemetry_write_config(&telemetry, &s_config);
+#endif
+#ifdef UPLINK
+  if (b_uplink)
+    uplink_publish_config(&uplink, &s_config, millis());
+#endif
+}
+#endif
 
 //
 void millis_to_hours(uint32_t ms, char* hr_str)
@@ -68,22 +312,37 @@ void millis_to_hours(uint32_t ms, char* hr_str)
 void setup()
 {
   //Wire.begin(SDA_PIN, SCL_PIN);
-  pinMode(int_pin, INPUT);
 
+#ifdef TELEMETRY
+  Serial.begin(TELEMETRY_BAUD);
+  telemetry_writer_init(&telemetry, capture_to_serial, NULL);
+#else
   Serial.begin(115200);
-  Serial.println("Initializing...");
+#endif
+  report("Initializing...");
 
 
   // Initialize sensor
-  if (!maxim_max30102_init()) // I2C port defined in max30102.cpp init(), 400kHz speed
+  max30102_status e_sensor = maxim_max30102_configure(); // I2C port defined in max30102_hal.cpp, 400kHz speed
+  if (e_sensor != MAX30102_OK)
   {
-    Serial.println("MAX30105 was not found. Please check wiring/power. ");
+    report("MAX30105 was not found. Please check wiring/power. ");
+    report(maxim_max30102_status_name(e_sensor));
     while (1);
   }
+#ifdef HR_ONLY
+  maxim_max30102_set_mode(MAX30102_MODE_MULTI_LED, auch_hr_slots);
+#endif
   uint8_t uch_dummy;
   maxim_max30102_read_reg(REG_REV_ID, &uch_dummy);
+#ifdef TELEMETRY
+  char s_text[48];
+  snprintf(s_text, sizeof(s_text), "Rev ID: %u, estimator RAM: %u", uch_dummy, (unsigned)sizeof(rf_stream));
+  report(s_text);
+#else
   Serial.print("Rev ID: "); // sensor revision, code is targeted at Rev 2+
   Serial.println(uch_dummy);
+#endif
 
   old_n_spo2=0.0;
   /*
@@ -94,9 +353,32 @@ void setup()
   }
   uch_dummy=Serial.read();
   */
+#ifndef TELEMETRY
+  Serial.print(F("Estimator RAM: ")); // static; its peak stack is measured by the host benchmark (bench lowram)
+  Serial.println(sizeof(rf_stream));
   Serial.print(F("Time[s]\tSpO2\tHR\tClock\tTemp[C]"));
+#endif
+
 
 
+  RF_STREAM_INIT(&rf_stream, RF_HOP);
+  max30102_temp_init(&die_temp, TEMP_REFRESH_MS, true);
+#ifdef LED_AGC
+  agc_begin();
+#endif
+#ifdef RAW_CAPTURE
+  capture_writer_init(&capture, capture_to_serial, NULL);
+#endif
+#ifdef UPLINK
+  uplink_begin();
+#endif
+#if defined(RAW_CAPTURE) || defined(TELEMETRY) || defined(UPLINK)
+  capture_sensor_config();
+#endif
+  acq_begin(int_pin); // INT pin ISR, samples are collected in loop() without blocking
+#ifdef DUTY_CYCLE
+  duty_begin();
+#endif
 
   //startTime = millis();
   timeStart=millis();
@@ -108,36 +390,135 @@ void loop()
   int8_t ch_spo2_valid;  //indicator to show if the SPO2 calculation is valid
   int32_t n_heart_rate; //heart rate value
   int8_t  ch_hr_valid;  //indicator to show if the heart rate calculation is valid
-  int32_t i;
   char hr_str[10];
      
-  //buffer length of BUFFER_SIZE stores ST seconds of samples running at FS sps
-  //read BUFFER_SIZE samples, and determine the signal range
-  for(i=0;i<BUFFER_SIZE;i++)
+  uint32_t un_red,un_ir;
+  bool b_new_estimate=false;
+
+  //the stream keeps the last BUFFER_SIZE samples (ST seconds at FS sps) and produces
+  //a new estimate using Robert's method every RF_HOP samples
+#ifdef DUTY_CYCLE
+  uint32_t un_drain_us = micros();
+  uint8_t uch_drained = acq_service(); // move samples from the sensor FIFO into the ring if INT fired
+  un_drain_us = micros() - un_drain_us;
+  if (uch_drained > 0)
+  {
+    duty_drained(&duty, un_drain_us, uch_drained);
+    un_duty_drain_us += un_drain_us;
+  }
+#else
+  acq_service(); // move samples from the sensor FIFO into the ring if INT fired
+#endif
+#if defined(TELEMETRY) || defined(UPLINK)
+  if (max30102_temp_service(&die_temp)) // picks up DIE_TEMP_RDY from the FIFO read above
+  {
+#ifdef TELEMETRY
+    telemetry_write_temperature(&telemetry, millis(), die_temp.ch_integer, die_temp.uch_fraction);
+#endif
+#ifdef UPLINK
+    if (b_uplink)
+      uplink_publish_temperature(&uplink, die_temp.ch_integer, die_temp.uch_fraction, millis());
+#endif
+  }
+#else
+  max30102_temp_service(&die_temp); // picks up DIE_TEMP_RDY from the FIFO read above
+#endif
+#ifdef UPLINK
+  if (b_uplink)
+    uplink_service(&uplink, millis()); // at most one stored batch per pass, rate limited
+#endif
+  while(!b_new_estimate && acq_read(&un_red, &un_ir))
+  {
+#ifdef RAW_CAPTURE
+    capture_write_sample(&capture, un_red, un_ir, millis());
+#endif
+    samplesTaken++;
+#ifdef TELEMETRY
+    telemetry_write_sample(&telemetry, un_red, un_ir, millis());
+#endif
+#ifdef UPLINK
+    if (b_uplink)
+      uplink_publish_sample(&uplink, un_red, un_ir, millis());
+#endif
+#ifdef LED_AGC
+    max30102_agc_sample(&agc, un_red, un_ir);
+#endif
+    b_new_estimate=RF_STREAM_PUSH(&rf_stream, un_ir, un_red, &n_spo2, &ch_spo2_valid, &n_heart_rate, &ch_hr_valid, &ratio, &correl);
+  }
+  if(acq_stalled())
+  {
+    report("MAX30102 stopped delivering samples, reinitializing");
+    maxim_max30102_init();
+#ifdef HR_ONLY
+    maxim_max30102_set_mode(MAX30102_MODE_MULTI_LED, auch_hr_slots);
+#endif
+    max30102_temp_init(&die_temp, TEMP_REFRESH_MS, true);
+#ifdef LED_AGC
+    agc_begin();
+#endif
+#if defined(RAW_CAPTURE) || defined(TELEMETRY) || defined(UPLINK)
+    capture_sensor_config();
+#endif
+    acq_begin(int_pin);
+#ifdef DUTY_CYCLE
+    duty_begin();
+#endif
+    RF_STREAM_INIT(&rf_stream, RF_HOP);
+    return;
+  }
+  if(!b_new_estimate)
+  {
+#ifdef DUTY_CYCLE
+    duty_sleep();
+#endif
+    return; // give the CPU back to the Wi-Fi stack and watchdog
+  }
+#ifdef LED_AGC
+  bool b_agc_changed;
+  if(max30102_agc_update(&agc, ch_hr_valid, ratio, correl, &b_agc_changed) && b_agc_changed)
+  {
+    RF_STREAM_INIT(&rf_stream, RF_HOP); // samples before and after the change do not mix
+#if defined(RAW_CAPTURE) || defined(TELEMETRY) || defined(UPLINK)
+    capture_sensor_config();
+#endif
+  }
+#endif
+#ifdef DUTY_CYCLE
+  if (++un_duty_estimates % DUTY_REPORT_EVERY == 0)
+    duty_print();
+#endif
+#ifdef PROFILE
+  if (++un_profile_estimates % PROFILE_REPORT_EVERY == 0)
+    profile_print();
+#endif
+#if defined(TELEMETRY) || defined(UPLINK)
+  telemetry_result s_result;
+  telemetry_quality s_quality;
+  bool b_quality = sensor_quality(&s_quality);
+  telemetry_result_from_estimate(&s_result, millis(), samplesTaken - 1, n_spo2, ch_spo2_valid, n_heart_rate, ch_hr_valid, ratio, correl);
+#ifdef UPLINK
+  if (b_uplink)
   {
-    while(digitalRead(int_pin)==1);  //wait until the interrupt pin asserts
-    maxim_max30102_read_fifo((aun_red_buffer+i), (aun_ir_buffer+i));  //read from MAX30102 FIFO
-    delay(2); // need time for int pin to reset
-    // Serial.print("");
-    // Serial.print(i, DEC);
-    //  Serial.print(F("\t"));
-    //  Serial.print(aun_red_buffer[i], DEC);
-    //  Serial.print(F("\t"));
-    //  Serial.print(aun_ir_buffer[i], DEC);
-    //  Serial.println("");
+    uplink_publish_result(&uplink, &s_result, millis());
+    if (b_quality && un_uplink_estimates++ % UPLINK_QUALITY_EVERY == 0)
+      uplink_publish_quality(&uplink, &s_quality, millis());
   }
+#endif
+#ifdef TELEMETRY
+  telemetry_write_result(&telemetry, &s_result);
+  if (b_quality)
+    telemetry_write_quality(&telemetry, &s_quality);
+  return;
+#endif
+#endif
 
-  //calculate heart rate and SpO2 after BUFFER_SIZE samples (ST seconds of samples) using Robert's method
-  rf_heart_rate_and_oxygen_saturation(aun_ir_buffer, BUFFER_SIZE, aun_red_buffer, &n_spo2, &ch_spo2_valid, &n_heart_rate, &ch_hr_valid, &ratio, &correl); 
   elapsedTime=millis()-timeStart;
   millis_to_hours(elapsedTime,hr_str); // Time in hh:mm:ss format
   elapsedTime/=1000; // Time in seconds
 
-  // Read the _chip_ temperature in degrees Celsius
-  int8_t integer_temperature;
-  uint8_t fractional_temperature;
-  maxim_max30102_read_temperature(&integer_temperature, &fractional_temperature);
-  float temperature_C = integer_temperature + (((float)fractional_temperature)/16.0);
+  // The _chip_ temperature in degrees Celsius, cached: no bus traffic here
+  float temperature_C = 0.0;
+  max30102_temp_read(&die_temp, &temperature_C);
   float temperature_F = (temperature_C * 1.8) + 32; // convert to F
   //
 
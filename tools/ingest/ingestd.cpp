@@ -0,0 +1,194 @@
+/*
+ * Ingest daemon: framed telemetry from many devices, RF estimates per device
+ * Usage: ingestd [--tcp [ADDRESS:]PORT] [--baud N] [--workers N] [--quiet]
+ *                [--stats SECONDS] [--fleet N [--fleet-tcp N] [--speed X] [--seconds S]]
+ *                [DEVICE...]
+ *   DEVICE       serial ports (or PTYs) of nodes built with -DTELEMETRY
+ *   --tcp        also accept nodes on this TCP port (default address 0.0.0.0)
+ *   --baud       serial port speed (default 921600)
+ *   --workers    estimator threads (default: one per hardware thread)
+ *   --quiet      no per-estimate output, statistics only
+ *   --stats      print a summary line to stderr this often (default 10 s)
+ *   --fleet      demo and self-test: N simulated nodes on PTYs, plus --fleet-tcp
+ *                nodes connecting to --tcp, sending --seconds of data each at
+ *                --speed times real time (0: as fast as possible)
+ * Prints every estimate as a tab separated line: stream, sample, time_ms, hr,
+ * hr_valid, spo2, spo2_valid, latency_us. On exit (Ctrl-C, or the fleet has
+ * finished) one line of statistics per stream goes to stderr.
+ * Exit code: 0 done, 1 usage, 2 a device or the port could not be opened
+ */
+#include <ingest.h>
+#include <ingest_fleet.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+static volatile sig_atomic_t b_ingestd_stop = 0;
+static std::mutex s_ingestd_output;
+static bool b_ingestd_quiet = false;
+
+static void ingestd_signal(int)
+{
+  b_ingestd_stop = 1;
+}
+
+static double ingestd_seconds()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void ingestd_result(void*, const ingest_result* ps_result)
+{
+  if (b_ingestd_quiet)
+    return;
+  std::lock_guard<std::mutex> s_guard(s_ingestd_output);
+  printf("%s\t%u\t%u\t%d\t%d\t%.2f\t%d\t%llu\n", ps_result->s_name, ps_result->un_sample_index, ps_result->un_time_ms, (int)ps_result->n_heart_rate,
+      ps_result->ch_hr_valid, ps_result->f_spo2, ps_result->ch_spo2_valid, (unsigned long long)(ps_result->ul_latency_ns / 1000));
+}
+
+static void ingestd_summary(ingest_server* ps_server, uint32_t* pun_windows, double* pf_last)
+{
+  ingest_stream_stats s_stats;
+  uint32_t un_windows = 0, un_lost = 0;
+  uint64_t ul_p99 = 0;
+  double f_now = ingestd_seconds();
+  for (int32_t i = 0; ingest_stream_stats_get(ps_server, i, &s_stats); i++) {
+    un_windows += s_stats.un_windows;
+    un_lost += s_stats.un_lost_frames;
+    if (ingest_latency_percentile_us(&s_stats, 0.99f) > ul_p99)
+      ul_p99 = ingest_latency_percentile_us(&s_stats, 0.99f);
+  }
+  std::lock_guard<std::mutex> s_guard(s_ingestd_output);
+  fprintf(stderr, "%d/%d streams open\t%u estimates, %.0f/s\tworst p99 latency <%.2f ms\t%u frames lost\n", ingest_open_streams(ps_server),
+      ingest_stream_count(ps_server), un_windows, (un_windows - *pun_windows) / (f_now - *pf_last), ul_p99 / 1e3, un_lost);
+  *pun_windows = un_windows;
+  *pf_last = f_now;
+}
+
+static void ingestd_report(ingest_server* ps_server)
+{
+  ingest_stream_stats s_stats;
+  std::lock_guard<std::mutex> s_guard(s_ingestd_output);
+  fflush(stdout);
+  fprintf(stderr, "# stream\tstate\tsps\tsamples\testimates\thr_valid\tlatency_mean_ms\tp50_ms\tp99_ms\tmax_ms\tlost_frames\tmissing_samples\t"
+                  "errors\trestarts\tpauses\tdropped\n");
+  for (int32_t i = 0; ingest_stream_stats_get(ps_server, i, &s_stats); i++)
+    fprintf(stderr, "%s\t%s\t%.1f\t%llu\t%u\t%u\t%.2f\t%.2f\t%.2f\t%.2f\t%u\t%u\t%u\t%u\t%u\t%u\n", s_stats.s_name, s_stats.b_open ? "open" : "closed",
+        s_stats.f_sample_rate, (unsigned long long)s_stats.ul_samples, s_stats.un_windows, s_stats.un_hr_valid,
+        s_stats.un_windows ? s_stats.ul_latency_sum_ns / 1e6 / s_stats.un_windows : 0.0, ingest_latency_percentile_us(&s_stats, 0.5f) / 1e3,
+        ingest_latency_percentile_us(&s_stats, 0.99f) / 1e3, s_stats.ul_latency_max_ns / 1e6, s_stats.un_lost_frames, s_stats.un_missing_samples,
+        s_stats.un_crc_errors, s_stats.un_restarts, s_stats.un_pauses, s_stats.un_dropped_windows);
+}
+
+int main(int argc, char** argv)
+{
+  static ingest_server s_server;
+  static ingest_fleet s_fleet;
+  ingest_config s_config;
+  ingest_fleet_config s_fleet_config;
+  std::vector<const char*> as_devices;
+  std::string s_address = "0.0.0.0";
+  const char* s_colon;
+  int32_t n_baud = 921600, n_port = -1;
+  double f_stats_s = 10.0, f_last;
+  uint32_t un_windows = 0;
+  bool b_usage = false, b_fleet = false;
+  int n_exit = 0, i;
+
+  ingest_default_config(&s_config);
+  ingest_fleet_default_config(&s_fleet_config);
+  s_fleet_config.n_pty_devices = 0;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--tcp") == 0 && i + 1 < argc) {
+      s_colon = strrchr(argv[++i], ':');
+      if (s_colon != NULL)
+        s_address.assign(argv[i], s_colon - argv[i]);
+      n_port = atoi(s_colon != NULL ? s_colon + 1 : argv[i]);
+    } else if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+      n_baud = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+      s_config.n_workers = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--quiet") == 0)
+      b_ingestd_quiet = true;
+    else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+      f_stats_s = atof(argv[++i]);
+    else if (strcmp(argv[i], "--fleet") == 0 && i + 1 < argc)
+      s_fleet_config.n_pty_devices = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--fleet-tcp") == 0 && i + 1 < argc)
+      s_fleet_config.n_tcp_devices = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+      s_fleet_config.f_speed = (float)atof(argv[++i]);
+    else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+      s_fleet_config.un_seconds = (uint32_t)atoi(argv[++i]);
+    else if (argv[i][0] != '-')
+      as_devices.push_back(argv[i]);
+    else
+      b_usage = true;
+  }
+  b_fleet = s_fleet_config.n_pty_devices + s_fleet_config.n_tcp_devices > 0;
+  b_usage |= (as_devices.empty() && n_port < 0 && !b_fleet) || (s_fleet_config.n_tcp_devices > 0 && n_port < 0) || n_port > 65535;
+  if (b_usage) {
+    fprintf(stderr, "usage: ingestd [--tcp [ADDRESS:]PORT] [--baud N] [--workers N] [--quiet] [--stats SECONDS]\n"
+                    "               [--fleet N [--fleet-tcp N] [--speed X] [--seconds S]] [DEVICE...]\n");
+    return 1;
+  }
+
+  s_config.handler = ingestd_result;
+  if (!ingest_init(&s_server, &s_config)) {
+    fprintf(stderr, "cannot create the epoll set\n");
+    return 2;
+  }
+  if (n_port >= 0 && !ingest_listen_tcp(&s_server, s_address.c_str(), (uint16_t)n_port)) {
+    fprintf(stderr, "cannot listen on %s:%d\n", s_address.c_str(), n_port);
+    ingest_shutdown(&s_server);
+    return 2;
+  }
+  for (const char* s_device : as_devices) {
+    if (ingest_add_serial(&s_server, s_device, n_baud) < 0) {
+      fprintf(stderr, "cannot open %s at %d baud\n", s_device, (int)n_baud);
+      n_exit = 2;
+    }
+  }
+  if (b_fleet) {
+    s_fleet_config.uw_tcp_port = ingest_tcp_port(&s_server);
+    if (!ingest_fleet_open(&s_fleet, &s_fleet_config)) {
+      fprintf(stderr, "cannot open the fleet\n");
+      ingest_fleet_close(&s_fleet);
+      ingest_shutdown(&s_server);
+      return 2;
+    }
+    for (i = 0; i < ingest_fleet_size(&s_fleet); i++)
+      if (ingest_fleet_is_pty(&s_fleet, i))
+        ingest_add_serial(&s_server, ingest_fleet_name(&s_fleet, i), n_baud);
+    ingest_fleet_start(&s_fleet);
+  }
+  signal(SIGINT, ingestd_signal);
+  signal(SIGTERM, ingestd_signal);
+
+  f_last = ingestd_seconds();
+  while (!b_ingestd_stop) {
+    if (ingest_poll(&s_server, 100) < 0)
+      break;
+    if (b_fleet && ingest_fleet_done(&s_fleet) && s_fleet.aps_devices.size() > 0) {
+      // let the last bytes in before hanging up
+      for (int32_t n_idle = 0; n_idle < 5 && !b_ingestd_stop; )
+        n_idle = ingest_poll(&s_server, 100) == 0 ? n_idle + 1 : 0;
+      ingest_fleet_close(&s_fleet);
+    }
+    if (b_fleet && s_fleet.aps_devices.empty() && ingest_open_streams(&s_server) == 0)
+      break;
+    if (f_stats_s > 0.0 && ingestd_seconds() - f_last >= f_stats_s)
+      ingestd_summary(&s_server, &un_windows, &f_last);
+  }
+  ingest_drain(&s_server);
+  ingestd_report(&s_server);
+  if (b_fleet)
+    ingest_fleet_close(&s_fleet);
+  ingest_shutdown(&s_server);
+  return n_exit;
+}
@@ -0,0 +1,181 @@
+/*
+ * Offline replay of raw captures
+ * Usage: replay [--algo rf|maxim|cascade|both|all] [--csv FILE] CAPTURE...
+ *   --algo   estimator(s) to run (default: both, rf and maxim); the cascade
+ *            also reports its escalation rate and cycles per window
+ *   --csv    write every estimate as: file, algo, sample, time_ms, hr, hr_valid,
+ *            spo2, spo2_valid
+ * Each capture is read whole and fed through the estimators as fast as the host
+ * allows. Estimators restart wherever samples are missing. A capture is what a
+ * device built with -DRAW_CAPTURE (env:esp01_capture) writes to its serial port,
+ * e.g. saved with `pio device monitor -f log2file` or `cat /dev/ttyUSB0 > day.bin`.
+ * Exit code: 0 done, 1 usage, 2 a capture could not be read
+ */
+#include "replay.h"
+#include <capture.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#define REPLAY_ALGOS 3
+
+struct replay_algo {
+  const char* s_name;
+  void (*reset)();
+  bool (*push)(uint32_t, uint32_t, replay_estimate*);
+  uint32_t un_estimates, un_hr_valid, un_spo2_valid;
+  double f_hr_sum, f_spo2_sum;
+};
+
+static replay_algo as_algos[] = {
+  { "rf", replay_rf_reset, replay_rf_push, 0, 0, 0, 0.0, 0.0 },
+  { "maxim", replay_maxim_reset, replay_maxim_push, 0, 0, 0, 0.0, 0.0 },
+  { "cascade", replay_cascade_reset, replay_cascade_push, 0, 0, 0, 0.0, 0.0 },
+};
+
+static uint64_t replay_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool replay_load(const char* s_path, std::vector<uint8_t>& auch_bytes)
+{
+  uint8_t auch_block[65536];
+  size_t un_read;
+  FILE* p_file = fopen(s_path, "rb");
+  if (p_file == NULL)
+    return false;
+  auch_bytes.clear();
+  while ((un_read = fread(auch_block, 1, sizeof(auch_block), p_file)) > 0)
+    auch_bytes.insert(auch_bytes.end(), auch_block, auch_block + un_read);
+  fclose(p_file);
+  return true;
+}
+
+static void replay_file(const char* s_path, const std::vector<uint8_t>& auch_bytes, bool* ab_run, FILE* p_csv)
+{
+  capture_reader s_reader;
+  static capture_record s_record;
+  capture_config s_config = { 0, { 0 } };
+  replay_estimate s_estimate;
+  uint64_t ul_samples = 0, ul_start;
+  uint32_t un_missing = 0, un_restarts = 0, un_time_ms, i, a;
+  double f_seconds = 0.0, f_wall;
+  float f_escalation_rate, f_cycles;
+
+  for (a = 0; a < REPLAY_ALGOS; a++)
+    if (ab_run[a])
+      as_algos[a].reset();
+  ul_start = replay_ns();
+  capture_reader_init(&s_reader, auch_bytes.data(), auch_bytes.size());
+  while (capture_read(&s_reader, &s_record)) {
+    if (s_record.uch_type == CAPTURE_CHUNK_CONFIG) {
+      s_config = s_record.s_config;
+      if (s_config.un_sample_period_us != 0 && (int32_t)(capture_sample_rate(&s_config) + 0.5f) != replay_fs)
+        fprintf(stderr, "%s: captured at %.1f sps, the estimators assume %d\n", s_path, capture_sample_rate(&s_config), (int)replay_fs);
+      continue;
+    }
+    if (s_reader.un_missing_samples != un_missing) { // gap: windows would straddle it
+      un_missing = s_reader.un_missing_samples;
+      un_restarts++;
+      for (a = 0; a < REPLAY_ALGOS; a++)
+        if (ab_run[a])
+          as_algos[a].reset();
+    }
+    for (i = 0; i < s_record.uw_count; i++) {
+      for (a = 0; a < REPLAY_ALGOS; a++) {
+        replay_algo* ps_algo = &as_algos[a];
+        if (!ab_run[a] || !ps_algo->push(s_record.aun_red[i], s_record.aun_ir[i], &s_estimate))
+          continue;
+        ps_algo->un_estimates++;
+        if (s_estimate.ch_hr_valid) {
+          ps_algo->un_hr_valid++;
+          ps_algo->f_hr_sum += s_estimate.n_heart_rate;
+        }
+        if (s_estimate.ch_spo2_valid) {
+          ps_algo->un_spo2_valid++;
+          ps_algo->f_spo2_sum += s_estimate.f_spo2;
+        }
+        if (p_csv != NULL) {
+          un_time_ms = s_record.un_time_ms + (uint32_t)((uint64_t)i * s_config.un_sample_period_us / 1000);
+          fprintf(p_csv, "%s,%s,%u,%u,%d,%d,%.2f,%d\n", s_path, ps_algo->s_name, s_record.un_index + i, un_time_ms,
+              (int)s_estimate.n_heart_rate, s_estimate.ch_hr_valid, s_estimate.f_spo2, s_estimate.ch_spo2_valid);
+        }
+      }
+    }
+    ul_samples += s_record.uw_count;
+    f_seconds += s_record.uw_count * (s_config.un_sample_period_us ? s_config.un_sample_period_us * 1e-6 : 1.0 / replay_fs);
+  }
+  f_wall = (replay_ns() - ul_start) / 1e9;
+
+  printf("%s\t%llu samples, %.1f h\t%u missing, %u restarts, %u CRC errors, %u bytes skipped\t%.3f s, %.0fx real time\n", s_path,
+      (unsigned long long)ul_samples, f_seconds / 3600.0, s_reader.un_missing_samples, un_restarts, s_reader.un_crc_errors,
+      s_reader.un_skipped_bytes, f_wall, f_wall > 0.0 ? f_seconds / f_wall : 0.0);
+  for (a = 0; a < REPLAY_ALGOS; a++) {
+    replay_algo* ps_algo = &as_algos[a];
+    if (!ab_run[a])
+      continue;
+    printf("  %s\t%u estimates\tHR valid %.1f%% mean %.1f bpm\tSpO2 valid %.1f%% mean %.1f %%\n", ps_algo->s_name, ps_algo->un_estimates,
+        ps_algo->un_estimates ? 100.0 * ps_algo->un_hr_valid / ps_algo->un_estimates : 0.0,
+        ps_algo->un_hr_valid ? ps_algo->f_hr_sum / ps_algo->un_hr_valid : 0.0,
+        ps_algo->un_estimates ? 100.0 * ps_algo->un_spo2_valid / ps_algo->un_estimates : 0.0,
+        ps_algo->un_spo2_valid ? ps_algo->f_spo2_sum / ps_algo->un_spo2_valid : 0.0);
+    if (ps_algo->push == replay_cascade_push) {
+      replay_cascade_stats(&f_escalation_rate, &f_cycles);
+      printf("  %s\tescalated to rf %.1f%%\t%.0f cycles/window\n", ps_algo->s_name, 100.0f * f_escalation_rate, f_cycles);
+    }
+    ps_algo->un_estimates = ps_algo->un_hr_valid = ps_algo->un_spo2_valid = 0;
+    ps_algo->f_hr_sum = ps_algo->f_spo2_sum = 0.0;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  bool ab_run[REPLAY_ALGOS] = { true, true, false };
+  const char* s_csv = NULL;
+  std::vector<const char*> as_files;
+  std::vector<uint8_t> auch_bytes;
+  FILE* p_csv = NULL;
+  bool b_usage = false;
+  int n_exit = 0, i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--algo") == 0 && i + 1 < argc) {
+      i++;
+      ab_run[0] = strcmp(argv[i], "rf") == 0 || strcmp(argv[i], "both") == 0 || strcmp(argv[i], "all") == 0;
+      ab_run[1] = strcmp(argv[i], "maxim") == 0 || strcmp(argv[i], "both") == 0 || strcmp(argv[i], "all") == 0;
+      ab_run[2] = strcmp(argv[i], "cascade") == 0 || strcmp(argv[i], "all") == 0;
+      b_usage |= !ab_run[0] && !ab_run[1] && !ab_run[2];
+    } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+      s_csv = argv[++i];
+    else if (argv[i][0] != '-')
+      as_files.push_back(argv[i]);
+    else
+      b_usage = true;
+  }
+  if (b_usage || as_files.empty()) {
+    fprintf(stderr, "usage: replay [--algo rf|maxim|cascade|both|all] [--csv FILE] CAPTURE...\n");
+    return 1;
+  }
+  if (s_csv != NULL) {
+    p_csv = fopen(s_csv, "w");
+    if (p_csv == NULL) {
+      fprintf(stderr, "cannot write %s\n", s_csv);
+      return 1;
+    }
+    fprintf(p_csv, "file,algo,sample,time_ms,hr,hr_valid,spo2,spo2_valid\n");
+  }
+  for (const char* s_path : as_files) {
+    if (!replay_load(s_path, auch_bytes)) {
+      fprintf(stderr, "cannot read %s\n", s_path);
+      n_exit = 2;
+      continue;
+    }
+    replay_file(s_path, auch_bytes, ab_run, p_csv);
+  }
+  if (p_csv != NULL)
+    fclose(p_csv);
+  return n_exit;
+}
@@ -0,0 +1,30 @@
+/*
+ * Offline replay of raw captures (lib/capture)
+ * One translation unit per estimator: replay_rf.cpp, replay_maxim.cpp and
+ * replay_cascade.cpp. Each keeps one channel; reset it whenever the sample
+ * stream is not contiguous.
+ */
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <stdint.h>
+
+struct replay_estimate {
+  float f_spo2;
+  int32_t n_heart_rate;
+  int8_t ch_spo2_valid;
+  int8_t ch_hr_valid;
+};
+
+// Window and hop in samples, and the sample rate the estimator assumes
+extern const int32_t replay_rf_window, replay_maxim_window, replay_hop, replay_fs;
+
+void replay_rf_reset();
+bool replay_rf_push(uint32_t un_red, uint32_t un_ir, replay_estimate* ps_estimate);
+void replay_maxim_reset();
+bool replay_maxim_push(uint32_t un_red, uint32_t un_ir, replay_estimate* ps_estimate);
+void replay_cascade_reset();
+bool replay_cascade_push(uint32_t un_red, uint32_t un_ir, replay_estimate* ps_estimate);
+void replay_cascade_stats(float* pf_escalation_rate, float* pf_cycles_per_window); // since the last call
+
+#endif /* REPLAY_H_ */
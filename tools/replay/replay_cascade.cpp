@@ -0,0 +1,53 @@
+/*
+ * Cascade estimator for the replay tool (lib/estimator): Maxim first, RF when
+ * the window does not back Maxim's answer; fed like replay_maxim.cpp
+ */
+#include "replay.h"
+#include <string.h>
+#include <estimator.h>
+
+static estimator_state s_replay_cascade;
+static uint32_t aun_replay_red[BUFFER_SIZE], aun_replay_ir[BUFFER_SIZE];
+static int32_t n_replay_count, n_replay_since;
+
+void replay_cascade_reset()
+{
+  // the counters run across restarts, only the channels start over
+  uint32_t un_windows = s_replay_cascade.un_windows, un_escalations = s_replay_cascade.un_escalations;
+  uint64_t ul_cycles = s_replay_cascade.ul_cycles;
+  estimator_init(&s_replay_cascade, ESTIMATOR_CASCADE);
+  s_replay_cascade.un_windows = un_windows;
+  s_replay_cascade.un_escalations = un_escalations;
+  s_replay_cascade.ul_cycles = ul_cycles;
+  n_replay_count = n_replay_since = 0;
+}
+
+bool replay_cascade_push(uint32_t un_red, uint32_t un_ir, replay_estimate* ps_estimate)
+{
+  estimator_result s_result;
+  if (n_replay_count == BUFFER_SIZE) {
+    memmove(aun_replay_red, aun_replay_red + 1, (BUFFER_SIZE - 1) * sizeof(uint32_t));
+    memmove(aun_replay_ir, aun_replay_ir + 1, (BUFFER_SIZE - 1) * sizeof(uint32_t));
+    n_replay_count--;
+  }
+  aun_replay_red[n_replay_count] = un_red;
+  aun_replay_ir[n_replay_count] = un_ir;
+  n_replay_count++;
+  if (n_replay_count < BUFFER_SIZE || n_replay_since-- > 0)
+    return false;
+  n_replay_since = FS - 1;
+  estimator_run(&s_replay_cascade, aun_replay_ir, aun_replay_red, &s_result);
+  ps_estimate->f_spo2 = s_result.f_spo2;
+  ps_estimate->n_heart_rate = s_result.n_heart_rate;
+  ps_estimate->ch_spo2_valid = s_result.ch_spo2_valid;
+  ps_estimate->ch_hr_valid = s_result.ch_hr_valid;
+  return true;
+}
+
+void replay_cascade_stats(float* pf_escalation_rate, float* pf_cycles_per_window)
+{
+  *pf_escalation_rate = estimator_escalation_rate(&s_replay_cascade);
+  *pf_cycles_per_window = estimator_cycles_per_window(&s_replay_cascade);
+  s_replay_cascade.un_windows = s_replay_cascade.un_escalations = 0;
+  s_replay_cascade.ul_cycles = 0;
+}
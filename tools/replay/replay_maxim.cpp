@@ -0,0 +1,37 @@
+/*
+ * Maxim estimator for the replay tool: a window of MAXIM_BUFFER_SIZE samples that
+ * slides by MAXIM_FS, the way the original Maxim example feeds it
+ */
+#include "replay.h"
+#include <string.h>
+#include <algorithm.h>
+
+const int32_t replay_maxim_window = MAXIM_BUFFER_SIZE;
+
+static maxim_channel_state s_replay_maxim;
+static uint32_t aun_replay_red[MAXIM_BUFFER_SIZE], aun_replay_ir[MAXIM_BUFFER_SIZE];
+static int32_t n_replay_count, n_replay_since;
+
+void replay_maxim_reset()
+{
+  maxim_channel_init(&s_replay_maxim);
+  n_replay_count = n_replay_since = 0;
+}
+
+bool replay_maxim_push(uint32_t un_red, uint32_t un_ir, replay_estimate* ps_estimate)
+{
+  if (n_replay_count == MAXIM_BUFFER_SIZE) {
+    memmove(aun_replay_red, aun_replay_red + 1, (MAXIM_BUFFER_SIZE - 1) * sizeof(uint32_t));
+    memmove(aun_replay_ir, aun_replay_ir + 1, (MAXIM_BUFFER_SIZE - 1) * sizeof(uint32_t));
+    n_replay_count--;
+  }
+  aun_replay_red[n_replay_count] = un_red;
+  aun_replay_ir[n_replay_count] = un_ir;
+  n_replay_count++;
+  if (n_replay_count < MAXIM_BUFFER_SIZE || n_replay_since-- > 0)
+    return false;
+  n_replay_since = MAXIM_FS - 1;
+  maxim_heart_rate_and_oxygen_saturation_r(&s_replay_maxim, aun_replay_ir, MAXIM_BUFFER_SIZE, aun_replay_red, &ps_estimate->f_spo2,
+      &ps_estimate->ch_spo2_valid, &ps_estimate->n_heart_rate, &ps_estimate->ch_hr_valid);
+  return true;
+}
@@ -0,0 +1,22 @@
+/*
+ * RF estimator for the replay tool: the streaming path main.cpp runs, a new
+ * estimate every FS samples over the last BUFFER_SIZE
+ */
+#include "replay.h"
+#include <algorithmRF.h>
+
+const int32_t replay_rf_window = BUFFER_SIZE, replay_hop = FS, replay_fs = FS;
+
+static rf_stream_state s_replay_rf;
+
+void replay_rf_reset()
+{
+  rf_stream_init(&s_replay_rf, FS);
+}
+
+bool replay_rf_push(uint32_t un_red, uint32_t un_ir, replay_estimate* ps_estimate)
+{
+  float f_ratio, f_correl;
+  return rf_stream_push(&s_replay_rf, un_ir, un_red, &ps_estimate->f_spo2, &ps_estimate->ch_spo2_valid, &ps_estimate->n_heart_rate,
+      &ps_estimate->ch_hr_valid, &f_ratio, &f_correl);
+}
@@ -0,0 +1,315 @@
+/*
+ * Decoder for framed telemetry (lib/telemetry)
+ * Usage: teldump [--baud N] [--samples] [--capture FILE] [--quiet] SOURCE | --udp PORT
+ *   SOURCE      a serial port, a file saved from one, or - for stdin
+ *   --udp       receive uplink batches (lib/uplink) on this UDP port instead,
+ *               from one device built with -DUPLINK (env:esp01_uplink)
+ *   --baud      serial port speed (default 921600); ignored for files
+ *   --samples   also print every raw sample
+ *   --capture   write the raw samples and configuration as a capture file
+ *               (lib/capture) for tools/replay
+ *   --quiet     statistics only
+ * Prints one tab separated line per frame: stream, sequence, device time, fields.
+ * Lost frames and missing samples are reported as they are found, and the
+ * totals plus the decode throughput on exit (end of file, or Ctrl-C on a port).
+ * The stream is what a device built with -DTELEMETRY (env:esp01_telemetry) sends.
+ * With --udp a line per batch also shows its sequence number and the backlog
+ * still queued on the device; gaps in the batch sequence are reported. Every
+ * batch is acked to its source, and one seen before (its ack was lost) is
+ * acked again but not decoded twice.
+ * Exit code: 0 done, 1 usage, 2 the source could not be opened or read
+ */
+#include <capture.h>
+#include <telemetry.h>
+#include <uplink.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+
+struct teldump_state {
+  bool b_samples;
+  bool b_quiet;
+  capture_writer s_capture;
+  bool b_capture;
+  uint32_t un_lost_frames, un_missing_samples, un_restarts; // last reported
+  const telemetry_decoder* ps_decoder;
+  capture_record s_record;
+  bool b_batches;              // --udp: a batch was seen, un_next_batch is valid
+  uint32_t un_next_batch;
+  uint32_t un_batches;
+  uint32_t un_duplicates;
+  uint32_t un_bad_batches;
+};
+
+static volatile sig_atomic_t b_teldump_stop = 0;
+
+static void teldump_signal(int)
+{
+  b_teldump_stop = 1;
+}
+
+static uint64_t teldump_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool teldump_to_file(void* p_context, const uint8_t* puch_data, size_t un_len)
+{
+  return fwrite(puch_data, 1, un_len, (FILE*)p_context) == un_len;
+}
+
+static speed_t teldump_speed(long n_baud)
+{
+  switch (n_baud) {
+  case 115200: return B115200;
+  case 230400: return B230400;
+  case 460800: return B460800;
+  case 921600: return B921600;
+  case 1000000: return B1000000;
+  case 2000000: return B2000000;
+  default: return B0;
+  }
+}
+
+// Raw mode, no flow control, reads return whatever has arrived
+static bool teldump_open_port(int n_fd, long n_baud)
+{
+  struct termios s_tio;
+  speed_t e_speed = teldump_speed(n_baud);
+  if (e_speed == B0 || tcgetattr(n_fd, &s_tio) != 0)
+    return false;
+  cfmakeraw(&s_tio);
+  s_tio.c_cflag |= CLOCAL | CREAD;
+  s_tio.c_cflag &= ~CRTSCTS;
+  s_tio.c_cc[VMIN] = 1;
+  s_tio.c_cc[VTIME] = 0;
+  cfsetispeed(&s_tio, e_speed);
+  cfsetospeed(&s_tio, e_speed);
+  return tcsetattr(n_fd, TCSANOW, &s_tio) == 0 && tcflush(n_fd, TCIFLUSH) == 0;
+}
+
+static int teldump_open_udp(long n_port)
+{
+  struct sockaddr_in s_addr;
+  int n_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (n_fd < 0)
+    return -1;
+  memset(&s_addr, 0, sizeof(s_addr));
+  s_addr.sin_family = AF_INET;
+  s_addr.sin_port = htons((uint16_t)n_port);
+  s_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(n_fd, (struct sockaddr*)&s_addr, sizeof(s_addr)) != 0) {
+    close(n_fd);
+    return -1;
+  }
+  return n_fd;
+}
+
+static void teldump_frame(void* p_context, const telemetry_frame* ps_frame)
+{
+  teldump_state* ps_state = (teldump_state*)p_context;
+  const telemetry_decoder* ps_decoder = ps_state->ps_decoder;
+  telemetry_result s_result;
+  telemetry_quality s_quality;
+  capture_config s_config;
+  uint32_t un_time_ms, i;
+  float f_celsius;
+
+  if (ps_decoder->un_restarts != ps_state->un_restarts)
+    fprintf(stderr, "device restarted\n");
+  if (ps_decoder->un_lost_frames != ps_state->un_lost_frames)
+    fprintf(stderr, "%u frames lost\n", ps_decoder->un_lost_frames - ps_state->un_lost_frames);
+  if (ps_decoder->un_missing_samples != ps_state->un_missing_samples)
+    fprintf(stderr, "%u samples missing\n", ps_decoder->un_missing_samples - ps_state->un_missing_samples);
+  ps_state->un_restarts = ps_decoder->un_restarts;
+  ps_state->un_lost_frames = ps_decoder->un_lost_frames;
+  ps_state->un_missing_samples = ps_decoder->un_missing_samples;
+
+  switch (ps_frame->uch_stream) {
+  case TELEMETRY_STREAM_SAMPLES:
+    if (!telemetry_parse_samples(ps_frame, &ps_state->s_record))
+      break;
+    for (i = 0; i < ps_state->s_record.uw_count; i++) {
+      if (ps_state->b_capture)
+        capture_write_sample(&ps_state->s_capture, ps_state->s_record.aun_red[i], ps_state->s_record.aun_ir[i], ps_state->s_record.un_time_ms);
+      if (ps_state->b_samples && !ps_state->b_quiet)
+        printf("sample\t%u\t%u\t%u\t%u\n", ps_frame->uw_sequence, ps_state->s_record.un_index + i, ps_state->s_record.aun_red[i],
+            ps_state->s_record.aun_ir[i]);
+    }
+    break;
+  case TELEMETRY_STREAM_CONFIG:
+    if (!telemetry_parse_config(ps_frame, &s_config))
+      break;
+    if (ps_state->b_capture)
+      capture_write_config(&ps_state->s_capture, &s_config);
+    if (!ps_state->b_quiet)
+      printf("config\t%u\t-\t%.1f sps\tregs %02x %02x %02x %02x %02x %02x %02x %02x\n", ps_frame->uw_sequence, capture_sample_rate(&s_config),
+          s_config.auch_regs[0], s_config.auch_regs[1], s_config.auch_regs[2], s_config.auch_regs[3], s_config.auch_regs[4],
+          s_config.auch_regs[5], s_config.auch_regs[6], s_config.auch_regs[7]);
+    break;
+  case TELEMETRY_STREAM_RESULT:
+    if (telemetry_parse_result(ps_frame, &s_result) && !ps_state->b_quiet)
+      printf("result\t%u\t%u\tsample %u\tHR %d%s\tSpO2 %.2f%s\tratio %.4f\tcorrel %.4f\n", ps_frame->uw_sequence, s_result.un_time_ms,
+          s_result.un_sample_index, s_result.w_heart_rate, s_result.uch_flags & TELEMETRY_RESULT_HR_VALID ? "" : " (invalid)",
+          s_result.w_spo2_centi / 100.0, s_result.uch_flags & TELEMETRY_RESULT_SPO2_VALID ? "" : " (invalid)", s_result.w_ratio_q15 / 32768.0,
+          s_result.w_correl_q15 / 32768.0);
+    break;
+  case TELEMETRY_STREAM_QUALITY:
+    if (telemetry_parse_quality(ps_frame, &s_quality) && !ps_state->b_quiet)
+      printf("quality\t%u\t%u\tLED red %u ir %u\tSpO2 config %02x\tmode %u\t%u missed interrupts\t%u overruns\n", ps_frame->uw_sequence,
+          s_quality.un_time_ms, s_quality.uch_led_red, s_quality.uch_led_ir, s_quality.uch_spo2_config, s_quality.uch_mode,
+          s_quality.un_missed_interrupts, s_quality.un_overruns);
+    break;
+  case TELEMETRY_STREAM_TEMPERATURE:
+    if (telemetry_parse_temperature(ps_frame, &un_time_ms, &f_celsius) && !ps_state->b_quiet)
+      printf("temp\t%u\t%u\t%.4f C\n", ps_frame->uw_sequence, un_time_ms, f_celsius);
+    break;
+  case TELEMETRY_STREAM_TEXT:
+    if (!ps_state->b_quiet)
+      printf("text\t%u\t-\t%.*s\n", ps_frame->uw_sequence, (int)ps_frame->uw_len, (const char*)ps_frame->puch_payload);
+    break;
+  default:
+    if (!ps_state->b_quiet)
+      printf("stream%u\t%u\t-\t%u bytes\n", ps_frame->uch_stream, ps_frame->uw_sequence, ps_frame->uw_len);
+  }
+}
+
+// One datagram: check the batch header, ack it, then decode its frames as if they came from a port
+static bool teldump_batch(teldump_state* ps_state, telemetry_decoder* ps_decoder, const uint8_t* puch_data, size_t un_len, int n_fd,
+    const struct sockaddr_in* ps_from)
+{
+  uplink_batch s_batch;
+  uint8_t auch_ack[UPLINK_ACK_BYTES];
+  if (!uplink_parse_batch(puch_data, un_len, &s_batch))
+    return false;
+  sendto(n_fd, auch_ack, uplink_make_ack(&s_batch, auch_ack), 0, (const struct sockaddr*)ps_from, sizeof(*ps_from));
+  if (ps_state->b_batches && s_batch.un_sequence < ps_state->un_next_batch) {
+    ps_state->un_duplicates++; // sequence numbers only grow, also over a restart
+    return true;
+  }
+  if (ps_state->b_batches && s_batch.un_sequence != ps_state->un_next_batch)
+    fprintf(stderr, "%u batches lost or device restarted\n", s_batch.un_sequence - ps_state->un_next_batch);
+  ps_state->b_batches = true;
+  ps_state->un_next_batch = s_batch.un_sequence + 1;
+  ps_state->un_batches++;
+  if (!ps_state->b_quiet)
+    printf("batch\t%u\t-\tdevice %04x\t%u bytes\tbacklog %u%s\n", s_batch.un_sequence, s_batch.uw_device_id, (unsigned)un_len, s_batch.uw_depth,
+        s_batch.uch_flags & UPLINK_BATCH_STORED ? "\tstored" : "");
+  telemetry_decoder_push(ps_decoder, s_batch.puch_frames, s_batch.uw_frames_len, teldump_frame, ps_state);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  static telemetry_decoder s_decoder;
+  static teldump_state s_state;
+  uint8_t auch_block[65536];
+  const char* s_source = NULL;
+  const char* s_capture = NULL;
+  FILE* p_capture = NULL;
+  struct sigaction s_action;
+  char s_udp[16];
+  struct sockaddr_in s_from;
+  socklen_t un_from_len;
+  long n_baud = 921600, n_udp_port = -1;
+  uint64_t ul_decode_ns = 0, ul_start;
+  ssize_t n_read;
+  bool b_usage = false;
+  int n_fd, n_exit = 0, i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+      n_baud = strtol(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--samples") == 0)
+      s_state.b_samples = true;
+    else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+      s_capture = argv[++i];
+    else if (strcmp(argv[i], "--quiet") == 0)
+      s_state.b_quiet = true;
+    else if (strcmp(argv[i], "--udp") == 0 && i + 1 < argc)
+      n_udp_port = strtol(argv[++i], NULL, 10);
+    else if ((argv[i][0] != '-' || argv[i][1] == 0) && s_source == NULL)
+      s_source = argv[i];
+    else
+      b_usage = true;
+  }
+  if (b_usage || (s_source == NULL) == (n_udp_port < 0) || n_udp_port > 65535) {
+    fprintf(stderr, "usage: teldump [--baud N] [--samples] [--capture FILE] [--quiet] SOURCE | --udp PORT\n");
+    return 1;
+  }
+
+  if (n_udp_port >= 0) {
+    snprintf(s_udp, sizeof(s_udp), "udp:%ld", n_udp_port);
+    s_source = s_udp;
+    n_fd = teldump_open_udp(n_udp_port);
+  } else
+    n_fd = strcmp(s_source, "-") == 0 ? STDIN_FILENO : open(s_source, O_RDONLY | O_NOCTTY);
+  if (n_fd < 0) {
+    fprintf(stderr, "cannot open %s: %s\n", s_source, strerror(errno));
+    return 2;
+  }
+  if (isatty(n_fd) && !teldump_open_port(n_fd, n_baud)) {
+    fprintf(stderr, "cannot set %s to %ld baud\n", s_source, n_baud);
+    return 2;
+  }
+  if (s_capture != NULL) {
+    p_capture = fopen(s_capture, "wb");
+    if (p_capture == NULL) {
+      fprintf(stderr, "cannot write %s\n", s_capture);
+      return 1;
+    }
+    capture_writer_init(&s_state.s_capture, teldump_to_file, p_capture);
+    s_state.b_capture = true;
+  }
+  // no SA_RESTART: a read waiting on a quiet port or socket returns EINTR
+  memset(&s_action, 0, sizeof(s_action));
+  s_action.sa_handler = teldump_signal;
+  sigaction(SIGINT, &s_action, NULL);
+  sigaction(SIGTERM, &s_action, NULL);
+
+  telemetry_decoder_init(&s_decoder);
+  s_state.ps_decoder = &s_decoder;
+  while (!b_teldump_stop) {
+    un_from_len = sizeof(s_from);
+    n_read = n_udp_port < 0 ? read(n_fd, auch_block, sizeof(auch_block))
+                            : recvfrom(n_fd, auch_block, sizeof(auch_block), 0, (struct sockaddr*)&s_from, &un_from_len);
+    if (n_read < 0 && errno == EINTR)
+      continue;
+    if (n_read < 0) {
+      fprintf(stderr, "cannot read %s: %s\n", s_source, strerror(errno));
+      n_exit = 2;
+    }
+    if (n_read <= 0)
+      break;
+    ul_start = teldump_ns();
+    if (n_udp_port < 0)
+      telemetry_decoder_push(&s_decoder, auch_block, (size_t)n_read, teldump_frame, &s_state);
+    else if (!teldump_batch(&s_state, &s_decoder, auch_block, (size_t)n_read, n_fd, &s_from))
+      s_state.un_bad_batches++;
+    ul_decode_ns += teldump_ns() - ul_start;
+  }
+  fflush(stdout);
+  if (p_capture != NULL) {
+    capture_flush(&s_state.s_capture);
+    fclose(p_capture);
+  }
+  if (n_fd != STDIN_FILENO)
+    close(n_fd);
+
+  fprintf(stderr, "%s\t%llu bytes, %u frames\t%u lost frames, %u missing samples, %u restarts\t%u CRC errors, %u framing errors\t"
+                  "decode %.1f MB/s\n",
+      s_source, (unsigned long long)s_decoder.ul_bytes, s_decoder.un_frames, s_decoder.un_lost_frames, s_decoder.un_missing_samples,
+      s_decoder.un_restarts, s_decoder.un_crc_errors, s_decoder.un_framing_errors,
+      ul_decode_ns ? s_decoder.ul_bytes * 1e3 / ul_decode_ns : 0.0);
+  if (n_udp_port >= 0)
+    fprintf(stderr, "%s\t%u batches, %u duplicates, %u not batches\n", s_source, s_state.un_batches, s_state.un_duplicates, s_state.un_bad_batches);
+  return n_exit;
+}